@@ -0,0 +1,831 @@
+#include "btree.hpp"
+#include "btree_blink.hpp"
+#include "btree_buffered.hpp"
+#include "btree_cow.hpp"
+#include "btree_string.hpp"
+#include "btree_wal.hpp"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+// number of keys inserted into every tree
+static const int NUM_KEYS = 1 << 20;
+// number of point lookups measured
+static const int NUM_LOOKUPS = 1 << 21;
+
+// build the random keys and lookup probes once, so every
+// configuration searches exactly the same keys
+struct workload {
+    vector<int> keys;
+    vector<int> probes;
+    workload() {
+        mt19937 rng(42);
+        for(int i = 0; i < NUM_KEYS; ++i)
+            keys.push_back(i * 2);
+        shuffle(keys.begin(), keys.end(), rng);
+        uniform_int_distribution<int> dist(0, NUM_KEYS * 2);
+        for(int i = 0; i < NUM_LOOKUPS; ++i)
+            probes.push_back(dist(rng));
+    }
+};
+
+template<int N, typename Search>
+double bench_find(const workload &w) {
+    BPlusTree<int, int, N, N, Search> b;
+    for(auto k : w.keys)
+        b.insert(k, k);
+
+    std::size_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for(auto p : w.probes)
+        found += b.find(p).first;
+    auto end = chrono::steady_clock::now();
+    // half of the probes hit
+    assert( found > 0 );
+    double sec = chrono::duration<double>(end - start).count();
+    return w.probes.size() / sec;
+}
+
+template<int N>
+void bench_node_size(const workload &w) {
+    cout << setw(6) << N
+         << setw(14) << static_cast<long>(bench_find<N, btree_linear_search>(w))
+         << setw(14) << static_cast<long>(bench_find<N, btree_binary_search>(w))
+         << setw(14) << static_cast<long>(bench_find<N, btree_simd_search>(w))
+         << setw(14) << static_cast<long>(bench_find<N, btree_default_search>(w))
+         << endl;
+}
+
+// lookups/sec of a tree with nodes of _NodeBytes, the tree is bulk loaded
+// at the fill of a tree built by random inserts
+template<typename _key, typename _data, std::size_t _NodeBytes>
+void bench_geometry_row(const vector<pair<_key, _data> > &pairs, const vector<_key> &probes, double &best, std::size_t &bestBytes) {
+    typedef btree_layout<_key, _data, _NodeBytes> layout;
+    BPlusTree_sized<_key, _data, _NodeBytes> b;
+    b.bulk_load(pairs.begin(), pairs.end(), 0.7);
+    std::size_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for(auto &p : probes)
+        found += b.find(p).first;
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    assert( found > 0 );
+    double rate = probes.size() / sec;
+    if( rate > best ) {
+        best = rate;
+        bestBytes = _NodeBytes;
+    }
+    cout << setw(10) << _NodeBytes << setw(10) << layout::INNER_MAX << setw(10) << layout::LEAF_MAX
+         << setw(14) << static_cast<long>(rate) << endl;
+}
+
+// sweep the candidate node sizes for one key/data type
+template<typename _key, typename _data>
+void bench_geometry(const char* name) {
+    vector<pair<_key, _data> > pairs;
+    for(int i = 0; i < NUM_KEYS; ++i)
+        pairs.push_back(make_pair(static_cast<_key>(i * 2), static_cast<_data>(i)));
+    mt19937 rng(6);
+    uniform_int_distribution<int> dist(0, NUM_KEYS * 2);
+    vector<_key> probes;
+    for(int i = 0; i < NUM_LOOKUPS; ++i)
+        probes.push_back(static_cast<_key>(dist(rng)));
+
+    double best = 0;
+    std::size_t bestBytes = 0;
+    cout << "BPlusTree<" << name << "> node geometry, lookups/sec" << endl;
+    cout << setw(10) << "bytes" << setw(10) << "inner" << setw(10) << "leaf" << setw(14) << "find" << endl;
+    bench_geometry_row<_key, _data, 128>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, 256>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, 512>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, 1024>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, 2048>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, PAGE_SIZE_4K>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, 4 * PAGE_SIZE_4K>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, 16 * PAGE_SIZE_4K>(pairs, probes, best, bestBytes);
+    bench_geometry_row<_key, _data, PAGE_SIZE_2M>(pairs, probes, best, bestBytes);
+    cout << "best node size " << bestBytes << " bytes : BPlusTree_sized<" << name << ", " << bestBytes << ">" << endl;
+}
+
+// sorted load : one insert per key against bulk_load
+void bench_bulk_load() {
+    vector<pair<int, int> > input;
+    for(int i = 0; i < NUM_KEYS * 4; ++i)
+        input.push_back(make_pair(i, i));
+
+    auto start = chrono::steady_clock::now();
+    {
+        BPlusTree<int, int> b;
+        for(auto &p : input)
+            b.insert(p.first, p.second);
+    }
+    double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    {
+        BPlusTree<int, int> b;
+        b.bulk_load(input.begin(), input.end());
+    }
+    double loadSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "BPlusTree<int,int> sorted load of " << input.size() << " pairs, pairs/sec" << endl;
+    cout << setw(14) << "insert" << setw(14) << static_cast<long>(input.size() / insertSec) << endl;
+    cout << setw(14) << "bulk_load" << setw(14) << static_cast<long>(input.size() / loadSec) << endl;
+}
+
+// split heavy random inserts, then erase and refill half of the keys
+template<typename Alloc>
+double bench_alloc(const workload &w) {
+    auto start = chrono::steady_clock::now();
+    {
+        BPlusTree<int, int, 32, 32, btree_default_search, Alloc> b;
+        for(auto k : w.keys)
+            b.insert(k, k);
+        for(std::size_t i = 0; i < w.keys.size(); i += 2)
+            b.erase(w.keys[i]);
+        for(std::size_t i = 0; i < w.keys.size(); i += 2)
+            b.insert(w.keys[i], w.keys[i]);
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return w.keys.size() * 2 / sec;
+}
+
+void bench_allocator(const workload &w) {
+    cout << "BPlusTree<int,int,32,32> node allocation, ops/sec" << endl;
+    cout << setw(14) << "new/delete" << setw(14) << static_cast<long>(bench_alloc<allocator<char> >(w)) << endl;
+    cout << setw(14) << "slab" << setw(14) << static_cast<long>(bench_alloc<btree_slab_allocator<char> >(w)) << endl;
+    cout << setw(14) << "slab huge" << setw(14) << static_cast<long>(bench_alloc<btree_slab_allocator<char, true> >(w)) << endl;
+}
+
+// batches of 10k keys clustered around a random base, applied one key
+// at a time and as insert_many / erase_many
+void bench_batch() {
+    const int BATCH = 10000;
+    mt19937 rng(3);
+    vector<vector<pair<int, int> > > batches;
+    for(int i = 0; i < NUM_KEYS / BATCH * 2; ++i) {
+        int base = rng() % (NUM_KEYS * 8);
+        vector<pair<int, int> > batch;
+        for(int j = 0; j < BATCH; ++j) {
+            int k = base + rng() % (BATCH * 4);
+            batch.push_back(make_pair(k, k));
+        }
+        batches.push_back(batch);
+    }
+
+    double single[2] = {0, 0}, batched[2] = {0, 0};
+    for(int mode = 0; mode < 2; ++mode) {
+        BPlusTree<int, int> b;
+        auto start = chrono::steady_clock::now();
+        for(auto &batch : batches) {
+            if( mode == 0 ) {
+                for(auto &p : batch)
+                    b.insert(p.first, p.second);
+            } else {
+                b.insert_many(batch.begin(), batch.end());
+            }
+        }
+        double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for(auto &batch : batches) {
+            vector<int> keys;
+            for(auto &p : batch)
+                keys.push_back(p.first);
+            if( mode == 0 ) {
+                for(auto k : keys)
+                    b.erase(k);
+            } else {
+                b.erase_many(keys.begin(), keys.end());
+            }
+        }
+        double eraseSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        assert( b.empty() );
+        double ops = static_cast<double>(batches.size()) * BATCH;
+        (mode ? batched : single)[0] = ops / insertSec;
+        (mode ? batched : single)[1] = ops / eraseSec;
+    }
+    cout << "BPlusTree<int,int> batches of " << BATCH << " clustered keys, keys/sec" << endl;
+    cout << setw(14) << "" << setw(14) << "insert" << setw(14) << "erase" << endl;
+    cout << setw(14) << "one by one" << setw(14) << static_cast<long>(single[0]) << setw(14) << static_cast<long>(single[1]) << endl;
+    cout << setw(14) << "batched" << setw(14) << static_cast<long>(batched[0]) << setw(14) << static_cast<long>(batched[1]) << endl;
+}
+
+template<typename tree>
+void bench_random_inserts(const char* name, const vector<int> &keys) {
+    tree b;
+    auto start = chrono::steady_clock::now();
+    for(auto k : keys)
+        b.insert(k, k);
+    double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    std::size_t found = 0;
+    start = chrono::steady_clock::now();
+    for(std::size_t i = 0; i < keys.size(); i += 4)
+        found += b.find(keys[i]).first;
+    double findSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    assert( found == (keys.size() + 3) / 4 );
+    cout << setw(14) << name << setw(14) << static_cast<long>(keys.size() / insertSec)
+         << setw(14) << static_cast<long>((keys.size() + 3) / 4 / findSec) << endl;
+}
+
+// random inserts into a tree much larger than the caches, the buffered
+// tree rewrites each leaf once for many inserts
+void bench_buffered() {
+    const int KEYS = NUM_KEYS * 4;
+    vector<int> keys;
+    for(int i = 0; i < KEYS; ++i)
+        keys.push_back(i);
+    mt19937 rng(8);
+    shuffle(keys.begin(), keys.end(), rng);
+    cout << "BPlusTree<int,int> " << KEYS << " random inserts, ops/sec" << endl;
+    cout << setw(14) << "" << setw(14) << "insert" << setw(14) << "find" << endl;
+    bench_random_inserts<BPlusTree<int, int> >("plain", keys);
+    bench_random_inserts<BPlusTree_buffered<int, int> >("buffered", keys);
+}
+
+// expire the oldest quarter of the keys, one erase per key, as a batch
+// and as one range
+void bench_erase_range() {
+    vector<pair<int, int> > input;
+    for(int i = 0; i < NUM_KEYS * 4; ++i)
+        input.push_back(make_pair(i, i));
+    const int expired = NUM_KEYS;
+    double sec[3];
+    for(int mode = 0; mode < 3; ++mode) {
+        BPlusTree<int, int> b;
+        b.bulk_load(input.begin(), input.end(), 0.7);
+        auto start = chrono::steady_clock::now();
+        if( mode == 0 ) {
+            for(int k = 0; k < expired; ++k)
+                b.erase(k);
+        } else if( mode == 1 ) {
+            vector<int> keys;
+            for(int k = 0; k < expired; ++k)
+                keys.push_back(k);
+            b.erase_many(keys.begin(), keys.end());
+        } else {
+            b.erase_range(0, expired);
+        }
+        sec[mode] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        assert( b.size() == input.size() - expired );
+    }
+    cout << "BPlusTree<int,int> expire " << expired << " of " << input.size() << " keys, ms" << endl;
+    cout << setw(14) << "erase" << setw(14) << sec[0] * 1000 << endl;
+    cout << setw(14) << "erase_many" << setw(14) << sec[1] * 1000 << endl;
+    cout << setw(14) << "erase_range" << setw(14) << sec[2] * 1000 << endl;
+}
+
+// erase latency of random erases and inserts on a tree with half full
+// leaves, eager rebalancing against relaxed erase with one compact() step
+// every 256 updates, the compact steps count into the total time
+void bench_relaxed_row(const char* name, double minFill, const vector<pair<int, int> > &input, const vector<int> &churn) {
+    BPlusTree<int, int> b;
+    b.bulk_load(input.begin(), input.end(), 0.5);
+    b.set_min_fill(minFill);
+
+    vector<double> lat;
+    lat.reserve(churn.size());
+    auto start = chrono::steady_clock::now();
+    for(std::size_t i = 0; i < churn.size(); ++i) {
+        auto t = chrono::steady_clock::now();
+        b.erase(churn[i]);
+        lat.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t).count());
+        // odd keys are new, the even ones were erased before
+        b.insert(churn[churn.size() - 1 - i] + 1, 0);
+        if( minFill < 0.5 && i % 256 == 0 )
+            b.compact(1);
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    sort(lat.begin(), lat.end());
+    cout << setw(14) << name << setw(10) << static_cast<long>(lat[lat.size() / 2])
+         << setw(10) << static_cast<long>(lat[lat.size() * 99 / 100])
+         << setw(10) << static_cast<long>(lat[lat.size() * 999 / 1000])
+         << setw(14) << static_cast<long>(churn.size() / sec)
+         << setw(10) << b.leaf_count() << endl;
+}
+
+void bench_relaxed() {
+    vector<pair<int, int> > input;
+    for(int i = 0; i < NUM_KEYS * 2; i += 2)
+        input.push_back(make_pair(i, i));
+    vector<int> churn;
+    for(auto &p : input)
+        churn.push_back(p.first);
+    mt19937 rng(12);
+    shuffle(churn.begin(), churn.end(), rng);
+    churn.resize(NUM_KEYS / 2);
+    cout << "BPlusTree<int,int> " << churn.size() << " erase/insert pairs on half full leaves" << endl;
+    cout << setw(14) << "" << setw(10) << "p50 ns" << setw(10) << "p99 ns" << setw(10) << "p99.9 ns"
+         << setw(14) << "pairs/sec" << setw(10) << "leaves" << endl;
+    bench_relaxed_row("eager", 0.5, input, churn);
+    bench_relaxed_row("relaxed 0.25", 0.25, input, churn);
+    bench_relaxed_row("relaxed 0", 0, input, churn);
+}
+
+// lookups of 64-bit ids which come in dense runs, descending the tree
+// against the learned index for a few error bounds
+void bench_learned() {
+    mt19937 rng(13);
+    vector<pair<long, long> > input;
+    long id = 1L << 40;
+    for(int i = 0; i < NUM_KEYS * 4; ++i) {
+        id += rng() % 64 ? 1 + rng() % 4 : 1 + rng() % 100000;
+        input.push_back(make_pair(id, i));
+    }
+    vector<long> probes;
+    for(int i = 0; i < NUM_LOOKUPS; ++i)
+        probes.push_back(input[rng() % input.size()].first);
+
+    BPlusTree<long, long> b;
+    b.bulk_load(input.begin(), input.end());
+    cout << "BPlusTree<long,long> " << input.size() << " ids, lookups/sec" << endl;
+    cout << setw(14) << "epsilon" << setw(10) << "models" << setw(14) << "find" << endl;
+    for(std::size_t eps = 0; eps <= 32; eps = eps ? eps * 4 : 2) {
+        if( eps )
+            b.learn(eps);
+        std::size_t found = 0;
+        auto start = chrono::steady_clock::now();
+        for(auto p : probes)
+            found += b.find(p).first;
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        assert( found == probes.size() );
+        cout << setw(14) << (eps ? to_string(eps) : string("descent")) << setw(10) << b.learned_models()
+             << setw(14) << static_cast<long>(probes.size() / sec) << endl;
+    }
+}
+
+// 200 byte payloads, copied in and out by insert/find against built in
+// place by emplace, read in place by find_ptr and updated by upsert
+struct payload200 {
+    long value;
+    char bytes[192];
+    payload200() : value(0) {}
+    explicit payload200(long v) : value(v) {}
+};
+
+void bench_payload() {
+    vector<int> keys;
+    for(int i = 0; i < NUM_KEYS / 4; ++i)
+        keys.push_back(i);
+    shuffle(keys.begin(), keys.end(), mt19937(19));
+    cout << "BPlusTree<int,payload200> " << keys.size() << " keys, ops/sec" << endl;
+    cout << setw(14) << "api" << setw(14) << "insert" << setw(14) << "find" << setw(14) << "update" << endl;
+    long sum = 0;
+    {
+        BPlusTree<int, payload200> b;
+        auto start = chrono::steady_clock::now();
+        for(auto k : keys)
+            b.insert(k, payload200(k));
+        double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for(auto k : keys)
+            sum += b.find(k).second.second.value;
+        double findSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for(auto k : keys) {
+            payload200 p = b.find(k).second.second;
+            ++p.value;
+            b.erase(k);
+            b.insert(k, p);
+        }
+        double updateSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << setw(14) << "copy" << setw(14) << static_cast<long>(keys.size() / insertSec)
+             << setw(14) << static_cast<long>(keys.size() / findSec)
+             << setw(14) << static_cast<long>(keys.size() / updateSec) << endl;
+    }
+    {
+        BPlusTree<int, payload200> b;
+        auto start = chrono::steady_clock::now();
+        for(auto k : keys)
+            b.emplace(k, k);
+        double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for(auto k : keys)
+            sum += b.find_ptr(k)->value;
+        double findSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        for(auto k : keys)
+            b.upsert(k, [](payload200 &p) { ++p.value; });
+        double updateSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << setw(14) << "in place" << setw(14) << static_cast<long>(keys.size() / insertSec)
+             << setw(14) << static_cast<long>(keys.size() / findSec)
+             << setw(14) << static_cast<long>(keys.size() / updateSec) << endl;
+    }
+    // both finds sum every key once, the check must survive NDEBUG builds
+    const long n = static_cast<long>(keys.size());
+    if( sum != n * (n - 1) )
+        cerr << "bench_payload: find sum " << sum << ", expected " << n * (n - 1) << endl;
+}
+
+// cold start of 4M long/long pairs : replaying the inserts against
+// loading a checkpoint written by save
+void bench_checkpoint() {
+    const char* file = "bench_btree.tree";
+    vector<pair<long, long> > input;
+    for(long i = 0; i < NUM_KEYS * 4; ++i)
+        input.push_back(make_pair(i * 3, i));
+    shuffle(input.begin(), input.end(), mt19937(23));
+    cout << "BPlusTree<long,long> " << input.size() << " pairs, cold start ms" << endl;
+
+    BPlusTree<long, long> b;
+    auto start = chrono::steady_clock::now();
+    for(auto &p : input)
+        b.insert(p.first, p.second);
+    double replayMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    b.save(file);
+    double saveMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    BPlusTree<long, long> c;
+    start = chrono::steady_clock::now();
+    c.load(file);
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    assert( c.size() == b.size() );
+    std::remove(file);
+    cout << setw(14) << "replay" << setw(14) << "save" << setw(14) << "load" << endl;
+    cout << setw(14) << replayMs << setw(14) << saveMs << setw(14) << loadMs << endl;
+}
+
+// sum of the data of 4M pairs, a scan on one thread against the parallel
+// reduce on growing thread counts
+void bench_parallel_scan() {
+    vector<pair<long, long> > input;
+    for(long i = 0; i < NUM_KEYS * 4; ++i)
+        input.push_back(make_pair(i, i % 1000));
+    BPlusTree<long, long> b;
+    b.bulk_load(input.begin(), input.end());
+    cout << "BPlusTree<long,long> " << input.size() << " pairs, sum of data ms, "
+         << thread::hardware_concurrency() << " cores" << endl;
+
+    long expect = 0;
+    auto start = chrono::steady_clock::now();
+    b.scan(0, input.size(), [&](const long &, const long &d) { expect += d; });
+    double scanMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << setw(14) << "scan" << setw(14) << scanMs << endl;
+    for(unsigned int threads = 1; threads <= 32; threads *= 2) {
+        start = chrono::steady_clock::now();
+        long sum = b.parallel_reduce(0L, [](long &acc, const long &, const long &d) { acc += d; },
+                                     [](long a, long b) { return a + b; }, threads);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        assert( sum == expect );
+        cout << setw(11) << threads << " th" << setw(14) << ms << endl;
+    }
+}
+
+// the inner capacity is derived with the child counts, so the counted
+// inner node is smaller by fanout rather than larger than a block
+typedef BPlusTree<int, int, 0, 0, btree_default_search, btree_slab_allocator<char>, btree_counted_traits> counted_tree;
+
+// range counts of 1% of the keys, scanning the range against the subtree
+// counts of a counted tree, and what the counts cost random inserts
+void bench_order_statistics() {
+    const int QUERIES = 2000;
+    vector<int> keys;
+    for(int i = 0; i < NUM_KEYS; ++i)
+        keys.push_back(i);
+    mt19937 rng(11);
+    shuffle(keys.begin(), keys.end(), rng);
+    vector<int> lows;
+    for(int i = 0; i < QUERIES; ++i)
+        lows.push_back(rng() % NUM_KEYS);
+    const int width = NUM_KEYS / 100;
+
+    BPlusTree<int, int> plain;
+    counted_tree counted;
+    auto start = chrono::steady_clock::now();
+    for(auto k : keys)
+        plain.insert(k, k);
+    double plainInsertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for(auto k : keys)
+        counted.insert(k, k);
+    double countedInsertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    std::size_t scanned = 0, counts = 0;
+    start = chrono::steady_clock::now();
+    for(auto lo : lows)
+        scanned += plain.scan(lo, lo + width, [](const int &, const int &) {});
+    double scanSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for(auto lo : lows)
+        counts += counted.count_range(lo, lo + width);
+    double countSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    assert( scanned == counts );
+
+    cout << "BPlusTree<int,int> " << NUM_KEYS << " keys, counts of " << width << " keys" << endl;
+    cout << setw(14) << "" << setw(14) << "insert/sec" << setw(14) << "count/sec" << endl;
+    cout << setw(14) << "scan" << setw(14) << static_cast<long>(NUM_KEYS / plainInsertSec)
+         << setw(14) << static_cast<long>(QUERIES / scanSec) << endl;
+    cout << setw(14) << "count_range" << setw(14) << static_cast<long>(NUM_KEYS / countedInsertSec)
+         << setw(14) << static_cast<long>(QUERIES / countSec) << endl;
+}
+
+// durable inserts from concurrent writers, every insert waits for its
+// log record to be synced, group commit shares one sync between writers
+void bench_durable() {
+    const int NUM_PER_THREAD = 2000;
+    cout << "BPlusTree_durable<int,int> synced inserts" << endl;
+    cout << setw(8) << "threads" << setw(14) << "ops/sec" << setw(14) << "writes/sync" << endl;
+    for(int t = 1; t <= 16; t *= 4) {
+        std::remove("bench_btree.db.wal");
+        std::remove("bench_btree.db.ckpt");
+        wal_stats st;
+        double sec;
+        {
+            BPlusTree_durable<int, int> b("bench_btree.db");
+            vector<thread> threads;
+            auto start = chrono::steady_clock::now();
+            for(int i = 0; i < t; ++i) {
+                threads.push_back(thread([&b, i]() {
+                    for(int j = 0; j < NUM_PER_THREAD; ++j)
+                        b.insert(i * NUM_PER_THREAD + j, j);
+                }));
+            }
+            for(auto &th : threads)
+                th.join();
+            sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            st = b.stats();
+        }
+        cout << setw(8) << t << setw(14) << static_cast<long>(t * NUM_PER_THREAD / sec)
+             << setw(14) << st.records_ / static_cast<double>(st.syncs_) << endl;
+    }
+    std::remove("bench_btree.db.wal");
+    std::remove("bench_btree.db.ckpt");
+}
+
+// url keys : a few hosts followed by random paths
+vector<string> urlKeys(std::size_t n) {
+    static const char* hosts[] = { "https://www.example.com/", "https://docs.example.com/api/", "http://shop.example.org/item/" };
+    mt19937 rng(7);
+    vector<string> keys;
+    for(std::size_t i = 0; i < n; ++i) {
+        string k = hosts[rng() % 3];
+        for(int j = 0; j < 3; ++j)
+            k += to_string(rng() % 1000) + "/";
+        keys.push_back(k);
+    }
+    return keys;
+}
+
+// random url inserts and lookups, std::string keys in BPlusTree
+// against the prefix compressed BPlusTree_string
+void bench_string_keys() {
+    vector<string> keys = urlKeys(NUM_KEYS / 2);
+    cout << "url keys, " << keys.size() << " inserts then lookups, ops/sec" << endl;
+    {
+        BPlusTree<string, int> b;
+        auto start = chrono::steady_clock::now();
+        for(std::size_t i = 0; i < keys.size(); ++i)
+            b.insert(keys[i], i);
+        double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        std::size_t found = 0;
+        start = chrono::steady_clock::now();
+        for(auto &k : keys)
+            found += b.find(k).first;
+        double findSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        assert( found == keys.size() );
+        cout << setw(18) << "BPlusTree" << setw(14) << static_cast<long>(keys.size() / insertSec)
+             << setw(14) << static_cast<long>(keys.size() / findSec) << endl;
+    }
+    {
+        BPlusTree_string<int> b;
+        auto start = chrono::steady_clock::now();
+        for(std::size_t i = 0; i < keys.size(); ++i)
+            b.insert(keys[i], i);
+        double insertSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        std::size_t found = 0;
+        start = chrono::steady_clock::now();
+        for(auto &k : keys)
+            found += b.find(k).first;
+        double findSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        BPlusTree_string<int>::tree_stats st = b.stats();
+        cout << setw(18) << "BPlusTree_string" << setw(14) << static_cast<long>(keys.size() / insertSec)
+             << setw(14) << static_cast<long>(keys.size() / findSec)
+             << "   " << st.itemCount_ / st.leaves_ << " keys per 4KiB leaf" << endl;
+    }
+}
+
+// lookups of url keys which hit and which miss, the fingerprinted leaves
+// compare the strings of the matching fingerprints only
+template<typename tree>
+void bench_fingerprint_row(const char* name, const vector<string>& keys, const vector<string>& misses) {
+    tree b;
+    for(std::size_t i = 0; i < keys.size(); ++i)
+        b.insert(keys[i], i);
+    std::size_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for(auto &k : keys)
+        found += b.find(k).first;
+    double hitSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for(auto &k : misses)
+        found += b.find(k).first;
+    double missSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    assert( found == keys.size() );
+    cout << setw(14) << name << setw(14) << static_cast<long>(keys.size() / hitSec)
+         << setw(14) << static_cast<long>(misses.size() / missSec) << endl;
+}
+
+void bench_fingerprint() {
+    vector<string> keys = urlKeys(NUM_KEYS / 2);
+    vector<string> misses;
+    for(auto &k : keys)
+        misses.push_back(k + "/");
+    shuffle(keys.begin(), keys.end(), mt19937(17));
+    cout << "BPlusTree<string,int> url keys, " << keys.size() << " lookups/sec" << endl;
+    cout << setw(14) << "leaf" << setw(14) << "hit" << setw(14) << "miss" << endl;
+    bench_fingerprint_row<BPlusTree<string, int> >("search", keys, misses);
+    bench_fingerprint_row<BPlusTree<string, int, 0, 0, btree_default_search, btree_slab_allocator<char>,
+                                    btree_fingerprint_traits> >("fingerprint", keys, misses);
+}
+
+// BPlusTree behind one global mutex, the baseline for concurrent trees
+template<typename _key, typename _data>
+class BPlusTree_glock {
+public:
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+        lock_guard<mutex> lock(mutex_);
+        return tree_.find(key);
+    }
+    bool insert(const _key& key, const _data& data) {
+        lock_guard<mutex> lock(mutex_);
+        std::size_t n = tree_.size();
+        tree_.insert(key, data);
+        return tree_.size() != n;
+    }
+    bool erase(const _key& key) {
+        lock_guard<mutex> lock(mutex_);
+        std::size_t n = tree_.size();
+        tree_.erase(key);
+        return tree_.size() != n;
+    }
+    template<typename Function>
+    std::size_t scan(const _key& lo, const _key& hi, Function f) const {
+        lock_guard<mutex> lock(mutex_);
+        return tree_.scan(lo, hi, f);
+    }
+private:
+    BPlusTree<_key, _data> tree_;
+    mutable mutex mutex_;
+};
+
+// every thread runs ops operations, updatePercent of them are
+// insert/erase pairs on its own keys, the rest are lookups
+template<typename tree>
+void tree_ops(tree &b, atomic<bool> &f, int tid, int ops, int updatePercent) {
+    mt19937 rng(tid);
+    while( !f.load() )
+        btree_cpu_relax();
+    std::size_t found = 0;
+    for(int i = 0; i < ops; ++i) {
+        int k = rng() % (NUM_KEYS * 2);
+        if( static_cast<int>(rng() % 100) < updatePercent ) {
+            // odd keys are never preloaded, so updates do not disturb lookups
+            int u = (tid * ops + i) * 2 + 1;
+            b.insert(u, u);
+            b.erase(u);
+        } else {
+            found += b.find(k).first;
+        }
+    }
+    assert( found <= static_cast<std::size_t>(ops) );
+}
+
+template<typename tree>
+double bench_threads(int numThreads, int updatePercent) {
+    const int OPS_PER_THREAD = 1 << 18;
+    tree b;
+    for(int i = 0; i < NUM_KEYS; ++i)
+        b.insert(i * 2, i * 2);
+
+    vector<thread> threads;
+    atomic<bool> start_flag(false);
+    for(int i = 0; i < numThreads; ++i)
+        threads.push_back(thread(tree_ops<tree>, ref(b), ref(start_flag), i, OPS_PER_THREAD, updatePercent));
+    auto start = chrono::steady_clock::now();
+    start_flag.store(true);
+    for(auto &t : threads)
+        t.join();
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return static_cast<double>(numThreads) * OPS_PER_THREAD / sec;
+}
+
+// concurrent find/insert/erase throughput from 1 to N threads
+void bench_concurrent(int updatePercent) {
+    int maxThreads = max(4u, thread::hardware_concurrency());
+    cout << "concurrent BPlusTree<int,int>, " << updatePercent << "% updates, ops/sec" << endl;
+    cout << setw(8) << "threads" << setw(14) << "glock" << setw(14) << "olc" << setw(14) << "blink" << endl;
+    for(int t = 1; t <= maxThreads; t *= 2) {
+        cout << setw(8) << t
+             << setw(14) << static_cast<long>(bench_threads<BPlusTree_glock<int, int> >(t, updatePercent))
+             << setw(14) << static_cast<long>(bench_threads<BPlusTree_olc<int, int> >(t, updatePercent))
+             << setw(14) << static_cast<long>(bench_threads<BPlusTree_blink<int, int> >(t, updatePercent))
+             << endl;
+    }
+}
+
+// one writer updates while readers run full scans, return the writer's
+// updates/sec and count the finished scans
+template<typename tree>
+double bench_scan_writer(int numReaders, std::size_t &scans) {
+    const int KEYS = NUM_KEYS / 4;
+    const int UPDATES = 1 << 18;
+    tree b;
+    for(int i = 0; i < KEYS; ++i)
+        b.insert(i * 2, i * 2);
+
+    atomic<bool> done(false);
+    atomic<std::size_t> cnt(0);
+    vector<thread> readers;
+    for(int i = 0; i < numReaders; ++i) {
+        readers.push_back(thread([&]() {
+            while( !done.load() ) {
+                long sum = 0;
+                b.scan(0, KEYS * 2, [&](const int&, const int &d) { sum += d; });
+                assert( sum > 0 );
+                ++cnt;
+            }
+        }));
+    }
+    mt19937 rng(3);
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < UPDATES; ++i) {
+        int u = (rng() % KEYS) * 2 + 1;
+        if( i & 1 )
+            b.erase(u);
+        else
+            b.insert(u, u);
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    done.store(true);
+    for(auto &t : readers)
+        t.join();
+    scans = cnt.load();
+    return UPDATES / sec;
+}
+
+// writer throughput under long running scans, the global lock makes the
+// writer wait for every scan, snapshots let both run side by side
+void bench_snapshot_scan() {
+    cout << "writer under full scans, " << NUM_KEYS / 4 << " keys, updates/sec (scans)" << endl;
+    cout << setw(8) << "readers" << setw(24) << "glock" << setw(24) << "cow" << endl;
+    for(int r = 0; r <= 2; ++r) {
+        std::size_t glockScans = 0, cowScans = 0;
+        long glock = static_cast<long>(bench_scan_writer<BPlusTree_glock<int, int> >(r, glockScans));
+        long cow = static_cast<long>(bench_scan_writer<BPlusTree_cow<int, int> >(r, cowScans));
+        cout << setw(8) << r
+             << setw(14) << glock << " (" << setw(6) << glockScans << ")"
+             << setw(14) << cow << " (" << setw(6) << cowScans << ")" << endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    // bench_btree geometry : only sweep the node sizes
+    if( argc > 1 && string(argv[1]) == "geometry" ) {
+        bench_geometry<int, int>("int,int");
+        bench_geometry<long, long>("long,long");
+        bench_geometry<double, int>("double,int");
+        return 0;
+    }
+
+    bench_concurrent(0);
+    bench_concurrent(10);
+    bench_concurrent(50);
+    bench_snapshot_scan();
+
+    bench_bulk_load();
+    bench_string_keys();
+    bench_batch();
+    bench_buffered();
+    bench_order_statistics();
+    bench_erase_range();
+    bench_relaxed();
+    bench_learned();
+    bench_fingerprint();
+    bench_payload();
+    bench_checkpoint();
+    bench_parallel_scan();
+    bench_geometry<int, int>("int,int");
+    bench_durable();
+
+    workload w;
+    bench_allocator(w);
+
+    cout << "BPlusTree<int,int> find, lookups/sec" << endl;
+    cout << setw(6) << "node" << setw(14) << "linear" << setw(14) << "binary"
+         << setw(14) << "simd" << setw(14) << "default" << endl;
+    bench_node_size<8>(w);
+    bench_node_size<16>(w);
+    bench_node_size<32>(w);
+    bench_node_size<64>(w);
+    bench_node_size<128>(w);
+    bench_node_size<256>(w);
+    return 0;
+}
@@ -2,40 +2,743 @@
 #define _BPlusTree_HPP_
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+// POSIX, the slab allocator maps its slabs and save/load use files
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * node search strategies
+ * every strategy returns the index of the first key in the sorted
+ * array [keys, keys + n) which is not less than key
+ */
+
+// plain linear scan, the cheapest choice for small nodes
+struct btree_linear_search {
+    template<typename _key>
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        unsigned int i;
+        for(i = 0; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+
+// branchless binary search, the loop only depends on n so the
+// compiler can turn the comparison into a conditional move
+struct btree_binary_search {
+    template<typename _key>
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        if( n == 0 )
+            return 0;
+        const _key* base = keys;
+        while( n > 1 ) {
+            unsigned int half = n / 2;
+            base = (base[half] < key) ? base + half : base;
+            n -= half;
+        }
+        return (base - keys) + (*base < key);
+    }
+};
+
+// simd helpers : count the keys less than key by comparing a whole
+// vector of keys at once and popcount the result mask. As the keys are
+// sorted, the count is the lower bound, and we can stop at the first
+// vector which is not all less than key.
+// The generic version is disabled and falls back to binary search.
+template<typename _key, typename Enable = void>
+struct btree_simd {
+    static const bool enabled = false;
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        return btree_binary_search::lower_bound(keys, n, key);
+    }
+};
+
+#if defined(__AVX2__)
+// 32 bit integers, unsigned keys are biased so the signed compare works
+template<typename _key>
+struct btree_simd<_key, typename std::enable_if<std::is_integral<_key>::value && sizeof(_key) == 4>::type> {
+    static const bool enabled = true;
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        const int32_t bias = std::is_signed<_key>::value ? 0 : INT32_MIN;
+        const __m256i vbias = _mm256_set1_epi32(bias);
+        const __m256i vkey = _mm256_set1_epi32(static_cast<int32_t>(key) ^ bias);
+        unsigned int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), vbias);
+            unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(vkey, v)));
+            if( mask != 0xff )
+                return i + __builtin_popcount(mask);
+        }
+        for(; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+
+// 64 bit integers
+template<typename _key>
+struct btree_simd<_key, typename std::enable_if<std::is_integral<_key>::value && sizeof(_key) == 8>::type> {
+    static const bool enabled = true;
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        const int64_t bias = std::is_signed<_key>::value ? 0 : INT64_MIN;
+        const __m256i vbias = _mm256_set1_epi64x(bias);
+        const __m256i vkey = _mm256_set1_epi64x(static_cast<int64_t>(key) ^ bias);
+        unsigned int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), vbias);
+            unsigned int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vkey, v)));
+            if( mask != 0xf )
+                return i + __builtin_popcount(mask);
+        }
+        for(; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+
+template<>
+struct btree_simd<float> {
+    static const bool enabled = true;
+    static inline unsigned int lower_bound(const float* keys, unsigned int n, const float& key) {
+        const __m256 vkey = _mm256_set1_ps(key);
+        unsigned int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            unsigned int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), vkey, _CMP_LT_OQ));
+            if( mask != 0xff )
+                return i + __builtin_popcount(mask);
+        }
+        for(; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+
+template<>
+struct btree_simd<double> {
+    static const bool enabled = true;
+    static inline unsigned int lower_bound(const double* keys, unsigned int n, const double& key) {
+        const __m256d vkey = _mm256_set1_pd(key);
+        unsigned int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            unsigned int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), vkey, _CMP_LT_OQ));
+            if( mask != 0xf )
+                return i + __builtin_popcount(mask);
+        }
+        for(; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+#elif defined(__SSE2__)
+// without avx2 only 32 bit keys are handled by sse2, others use binary search
+template<typename _key>
+struct btree_simd<_key, typename std::enable_if<std::is_integral<_key>::value && sizeof(_key) == 4>::type> {
+    static const bool enabled = true;
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        const int32_t bias = std::is_signed<_key>::value ? 0 : INT32_MIN;
+        const __m128i vbias = _mm_set1_epi32(bias);
+        const __m128i vkey = _mm_set1_epi32(static_cast<int32_t>(key) ^ bias);
+        unsigned int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), vbias);
+            unsigned int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(vkey, v)));
+            if( mask != 0xf )
+                return i + __builtin_popcount(mask);
+        }
+        for(; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+
+template<>
+struct btree_simd<float> {
+    static const bool enabled = true;
+    static inline unsigned int lower_bound(const float* keys, unsigned int n, const float& key) {
+        const __m128 vkey = _mm_set1_ps(key);
+        unsigned int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            unsigned int mask = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), vkey));
+            if( mask != 0xf )
+                return i + __builtin_popcount(mask);
+        }
+        for(; i < n && keys[i] < key; ++i);
+        return i;
+    }
+};
+#endif
+
+// compare-and-popcount search for arithmetic keys, binary search otherwise
+struct btree_simd_search {
+    template<typename _key>
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        return btree_simd<_key>::lower_bound(keys, n, key);
+    }
+};
+
+// default strategy : linear scan for small nodes, simd search when the key
+// type supports it and branchless binary search for anything else
+struct btree_default_search {
+    // nodes with no more keys than this are scanned linearly
+    static const unsigned int LINEAR_MAX = 16;
+
+    template<typename _key>
+    static inline unsigned int lower_bound(const _key* keys, unsigned int n, const _key& key) {
+        if( n <= LINEAR_MAX )
+            return btree_linear_search::lower_bound(keys, n, key);
+        if( btree_simd<_key>::enabled )
+            return btree_simd<_key>::lower_bound(keys, n, key);
+        return btree_binary_search::lower_bound(keys, n, key);
+    }
+};
+
+/*
+ * node allocation
+ * slab allocator following the std allocator interface, the tree rebinds
+ * it to its leaf and inner node types. Nodes are carved out of large
+ * slabs at cache line boundaries and released nodes are kept on a free
+ * list for reuse, so split heavy bursts don't go to malloc and erase
+ * heavy phases don't fragment the heap. Copies and rebound copies share
+ * the slabs, so they compare equal and free each other's nodes. Slabs are
+ * returned to the system only when the last of them is destroyed.
+ * Nodes of one size come from their own pool. Like the tree, the
+ * allocators sharing the slabs must not be used concurrently.
+ */
+static const std::size_t CACHE_LINE_SIZE = 64;
+
+// the slabs shared by an allocator and its copies, one pool per node stride
+template<bool _HugePages>
+struct btree_slab_pools {
+    static const std::size_t SLAB_SIZE = _HugePages ? (2 << 20) : (64 << 10);
+
+    // a released node is reused as the link of the free list
+    struct freeItem {
+        freeItem* next_;
+    };
+
+    struct pool {
+        // distance between two nodes, a multiple of the cache line
+        const std::size_t stride_;
+        // released nodes
+        freeItem* free_;
+        // unused part of the last slab
+        char* cur_;
+        char* end_;
+        std::vector<char*> slabs_;
+
+        explicit pool(std::size_t stride) : stride_(stride), free_(nullptr), cur_(nullptr), end_(nullptr) {}
+
+        // a slab holds at least 8 nodes
+        inline std::size_t slabBytes() const {
+            return (8 * stride_ + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+        }
+
+        // map a new slab, mmap returns page aligned memory so every
+        // node starts on a cache line
+        void grow() {
+            std::size_t bytes = slabBytes();
+            void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+            if( _HugePages )
+                p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+            if( p == MAP_FAILED ) {
+                p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if( p == MAP_FAILED )
+                    throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+                // fall back to transparent huge pages
+                if( _HugePages )
+                    ::madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+            }
+            slabs_.push_back(static_cast<char*>(p));
+            cur_ = static_cast<char*>(p);
+            end_ = cur_ + bytes / stride_ * stride_;
+        }
+    };
+
+    btree_slab_pools() = default;
+    // non-copyable, shared through shared_ptr
+    btree_slab_pools(const btree_slab_pools&) = delete;
+    btree_slab_pools& operator=(const btree_slab_pools&) = delete;
+
+    ~btree_slab_pools() {
+        for(auto &p : pools_)
+            for(char* slab : p->slabs_)
+                ::munmap(slab, p->slabBytes());
+    }
+
+    // the pool of a stride, the pools stay where they are
+    pool* find(std::size_t stride) {
+        for(auto &p : pools_)
+            if( p->stride_ == stride )
+                return p.get();
+        pools_.push_back(std::unique_ptr<pool>(new pool(stride)));
+        return pools_.back().get();
+    }
+
+    std::vector<std::unique_ptr<pool> > pools_;
+};
+
+// @param :
+// _HugePages : use 2MiB slabs backed by huge pages when available
+template<typename T, bool _HugePages = false>
+class btree_slab_allocator {
+    template<typename U, bool H>
+    friend class btree_slab_allocator;
+    typedef btree_slab_pools<_HugePages> pools_type;
+    typedef typename pools_type::freeItem freeItem;
+
+public:
+    typedef T value_type;
+    template<typename U>
+    struct rebind {
+        typedef btree_slab_allocator<U, _HugePages> other;
+    };
+
+    static const std::size_t SLAB_SIZE = pools_type::SLAB_SIZE;
+
+    btree_slab_allocator() : pools_(std::make_shared<pools_type>()), pool_(pools_->find(stride())) {}
+    btree_slab_allocator(const btree_slab_allocator&) = default;
+    btree_slab_allocator& operator=(const btree_slab_allocator&) = default;
+    template<typename U>
+    btree_slab_allocator(const btree_slab_allocator<U, _HugePages>& other) : pools_(other.pools_), pool_(pools_->find(stride())) {}
+
+    T* allocate(std::size_t n) {
+        // only single nodes come from the slabs
+        if( n != 1 )
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        typename pools_type::pool* p = pool_;
+        if( p->free_ ) {
+            freeItem* f = p->free_;
+            p->free_ = f->next_;
+            return reinterpret_cast<T*>(f);
+        }
+        if( p->cur_ == p->end_ )
+            p->grow();
+        T* t = reinterpret_cast<T*>(p->cur_);
+        p->cur_ += p->stride_;
+        return t;
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        if( n != 1 ) {
+            ::operator delete(p);
+            return;
+        }
+        freeItem* f = reinterpret_cast<freeItem*>(p);
+        f->next_ = pool_->free_;
+        pool_->free_ = f;
+    }
+
+    template<typename U>
+    bool operator==(const btree_slab_allocator<U, _HugePages>& other) const {
+        return pools_ == other.pools_;
+    }
+    template<typename U>
+    bool operator!=(const btree_slab_allocator<U, _HugePages>& other) const {
+        return !(*this == other);
+    }
+
+private:
+    // distance between two nodes, a multiple of the cache line
+    static inline std::size_t stride() {
+        std::size_t size = std::max(sizeof(T), sizeof(freeItem));
+        return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+    std::shared_ptr<pools_type> pools_;
+    // the pool of this node size inside pools_
+    typename pools_type::pool* pool_;
+};
+
+/*
+ * optional tree features
+ * COUNTED : inner nodes keep the number of elements below every child,
+ *           which gives rank, select and count_range in O(log n)
+ * FINGERPRINT : leaves keep a 1 byte hash of every key, find compares the
+ *           key only where the hash matches. Pays off for keys which are
+ *           expensive to compare, like strings and composite keys
+ */
+struct btree_default_traits {
+    static const bool COUNTED = false;
+    static const bool FINGERPRINT = false;
+};
+
+struct btree_counted_traits : btree_default_traits {
+    static const bool COUNTED = true;
+};
+
+struct btree_fingerprint_traits : btree_default_traits {
+    static const bool FINGERPRINT = true;
+};
+
+// per child element counts of an inner node, empty unless counted
+template<int N, bool _Counted>
+struct btree_child_counts {
+    std::size_t count_[N];
+
+    inline std::size_t childCount(unsigned int i) const {
+        return count_[i];
+    }
+    inline void setChildCount(unsigned int i, std::size_t c) {
+        count_[i] = c;
+    }
+    inline void addChildCount(unsigned int i, std::ptrdiff_t d) {
+        count_[i] += d;
+    }
+};
+
+template<int N>
+struct btree_child_counts<N, false> {
+    inline std::size_t childCount(unsigned int) const {
+        return 0;
+    }
+    inline void setChildCount(unsigned int, std::size_t) {}
+    inline void addChildCount(unsigned int, std::ptrdiff_t) {}
+};
+
+// 1 byte fingerprints of the leaf keys, a point lookup compares the
+// fingerprints of a whole leaf at once and the keys of the matches only.
+// The hashes follow MurmurHash3 (MurmurHash3.cpp): the 64 bit finalizer
+// for numbers and the 32 bit variant for byte strings, which mixes four
+// bytes per step so long keys such as URLs stay cheap
+inline uint64_t btree_fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3_x86_32 with seed 0
+inline uint64_t btree_hash_bytes(const void* key, std::size_t len) {
+    const unsigned char* data = static_cast<const unsigned char*>(key);
+    const std::size_t nblocks = len / 4;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h1 = 0;
+
+    for(std::size_t i = 0; i < nblocks; ++i) {
+        uint32_t k1;
+        std::memcpy(&k1, data + i * 4, 4);
+        k1 *= c1;
+        k1 = (k1 << 15) | (k1 >> 17);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = (h1 << 13) | (h1 >> 19);
+        h1 = h1 * 5 + 0xe6546b64;
+    }
+
+    const unsigned char* tail = data + nblocks * 4;
+    uint32_t k1 = 0;
+    switch( len & 3 ) {
+    case 3: k1 ^= static_cast<uint32_t>(tail[2]) << 16; // fall through
+    case 2: k1 ^= static_cast<uint32_t>(tail[1]) << 8;  // fall through
+    case 1: k1 ^= tail[0];
+            k1 *= c1; k1 = (k1 << 15) | (k1 >> 17); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= static_cast<uint32_t>(len);
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+    return h1;
+}
+
+// hash of a key, equal keys must hash equally. Other key types add
+// their own specialization
+template<typename _key, typename Enable = void>
+struct btree_hash;
+
+template<typename _key>
+struct btree_hash<_key, typename std::enable_if<std::is_integral<_key>::value>::type> {
+    static inline uint64_t hash(const _key& key) {
+        return btree_fmix64(static_cast<uint64_t>(key));
+    }
+};
+
+template<typename _key>
+struct btree_hash<_key, typename std::enable_if<std::is_floating_point<_key>::value>::type> {
+    static inline uint64_t hash(const _key& key) {
+        // adding 0 turns -0 into 0
+        double d = static_cast<double>(key) + 0.0;
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        return btree_fmix64(bits);
+    }
+};
+
+template<typename _char, typename _chartraits, typename _alloc>
+struct btree_hash<std::basic_string<_char, _chartraits, _alloc> > {
+    static inline uint64_t hash(const std::basic_string<_char, _chartraits, _alloc>& key) {
+        return btree_hash_bytes(key.data(), key.size() * sizeof(_char));
+    }
+};
+
+template<typename _first, typename _second>
+struct btree_hash<std::pair<_first, _second> > {
+    static inline uint64_t hash(const std::pair<_first, _second>& key) {
+        return btree_fmix64(btree_hash<_first>::hash(key.first) * 31 + btree_hash<_second>::hash(key.second));
+    }
+};
+
+// fingerprints of a leaf with N keys, empty unless fingerprinted
+// the array is padded to whole vectors, the padding never matches
+template<typename _key, int N, bool _Fingerprinted>
+struct btree_leaf_fingerprints {
+    static const int PADDED = (N + 31) / 32 * 32;
+    unsigned char fp_[PADDED];
+
+    static inline unsigned char fingerprint(const _key& key) {
+        return static_cast<unsigned char>(btree_hash<_key>::hash(key));
+    }
+    // fingerprints of keys [first, last) to the same slots
+    inline void hashFingerprints(const _key* keys, unsigned int first, unsigned int last) {
+        for(; first < last; ++first)
+            fp_[first] = fingerprint(keys[first]);
+    }
+    inline void setFingerprint(unsigned int i, const _key& key) {
+        fp_[i] = fingerprint(key);
+    }
+    // same as std::copy and std::copy_backward on the keys, src may be
+    // this leaf
+    inline void copyFingerprints(const btree_leaf_fingerprints& src, unsigned int first, unsigned int last, unsigned int dst) {
+        std::copy(src.fp_ + first, src.fp_ + last, fp_ + dst);
+    }
+    inline void copyFingerprintsBackward(const btree_leaf_fingerprints& src, unsigned int first, unsigned int last, unsigned int dstLast) {
+        std::copy_backward(src.fp_ + first, src.fp_ + last, fp_ + dstLast);
+    }
+    // index of key in keys[0, n), n if it is not there
+    inline unsigned int matchFingerprint(const _key* keys, unsigned int n, const _key& key) const {
+        const unsigned char fp = fingerprint(key);
+#if defined(__AVX2__)
+        const __m256i v = _mm256_set1_epi8(static_cast<char>(fp));
+        for(unsigned int i = 0; i < n; i += 32) {
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(fp_ + i)), v)));
+            if( n - i < 32 )
+                mask &= (1u << (n - i)) - 1;
+            for(; mask; mask &= mask - 1) {
+                unsigned int j = i + __builtin_ctz(mask);
+                if( keys[j] == key )
+                    return j;
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128i v = _mm_set1_epi8(static_cast<char>(fp));
+        for(unsigned int i = 0; i < n; i += 16) {
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(fp_ + i)), v)));
+            if( n - i < 16 )
+                mask &= (1u << (n - i)) - 1;
+            for(; mask; mask &= mask - 1) {
+                unsigned int j = i + __builtin_ctz(mask);
+                if( keys[j] == key )
+                    return j;
+            }
+        }
+#else
+        for(unsigned int j = 0; j < n; ++j)
+            if( fp_[j] == fp && keys[j] == key )
+                return j;
+#endif
+        return n;
+    }
+};
+
+template<typename _key, int N>
+struct btree_leaf_fingerprints<_key, N, false> {
+    inline void hashFingerprints(const _key*, unsigned int, unsigned int) {}
+    inline void setFingerprint(unsigned int, const _key&) {}
+    inline void copyFingerprints(const btree_leaf_fingerprints&, unsigned int, unsigned int, unsigned int) {}
+    inline void copyFingerprintsBackward(const btree_leaf_fingerprints&, unsigned int, unsigned int, unsigned int) {}
+    inline unsigned int matchFingerprint(const _key*, unsigned int n, const _key&) const {
+        return n;
+    }
+};
+
 // BPlus Tree declaration
 // the size of disk block
 // default is 1024kb on linux
 static const int BLOCK_SIZE = 1024;
+
+/*
+ * node geometry
+ * the key and data counts are derived from a target node size in bytes,
+ * a node never exceeds the target. Both node types start with the 8 byte
+ * header (level and size) followed directly by the key array, so a search
+ * finds the size and the first keys in the node's first cache line. The
+ * leaf links are only needed by scans and come last.
+ * The optional per-node arrays of the traits sit between the header and
+ * the keys and count against the target: the child counts of a counted
+ * inner node and the padded fingerprints of a fingerprinted leaf.
+ * Nodes from btree_slab_allocator start on a cache line.
+ */
+static const std::size_t PAGE_SIZE_4K = 4096;
+static const std::size_t PAGE_SIZE_2M = 2 << 20;
+
+constexpr std::size_t btree_align_up(std::size_t n, std::size_t a) {
+    return (n + a - 1) / a * a;
+}
+
+// exact byte size of the node classes of BPlusTree for m or l keys
+// the other trees pass the size of their own node header, for them the
+// size is an upper bound as their leaves may do without the two links
+template<typename _key, typename _data, typename _Traits = btree_default_traits,
+         std::size_t _Header = 2 * sizeof(unsigned int)>
+struct btree_node_bytes {
+    static const std::size_t HEADER = _Header;
+
+    static constexpr std::size_t innerAlign() {
+        return alignof(_key) > alignof(void*) ? alignof(_key) : alignof(void*);
+    }
+    static constexpr std::size_t leafAlign() {
+        return alignof(_data) > innerAlign() ? alignof(_data) : innerAlign();
+    }
+    // the header and the child counts of a counted node
+    static constexpr std::size_t innerPrefix(std::size_t m) {
+        return _Traits::COUNTED ? btree_align_up(HEADER, alignof(std::size_t)) + (m + 1) * sizeof(std::size_t) : HEADER;
+    }
+    // the header and the fingerprints, padded to whole 32 byte vectors
+    static constexpr std::size_t leafPrefix(std::size_t l) {
+        return _Traits::FINGERPRINT ? HEADER + (l + 31) / 32 * 32 : HEADER;
+    }
+    static constexpr std::size_t inner(std::size_t m) {
+        return btree_align_up(btree_align_up(btree_align_up(innerPrefix(m), alignof(_key)) + m * sizeof(_key), alignof(void*))
+                              + (m + 1) * sizeof(void*), innerAlign());
+    }
+    static constexpr std::size_t leaf(std::size_t l) {
+        return btree_align_up(btree_align_up(btree_align_up(btree_align_up(leafPrefix(l), alignof(_key)) + l * sizeof(_key), alignof(_data))
+                                             + l * sizeof(_data), alignof(void*)) + 2 * sizeof(void*), leafAlign());
+    }
+    // grow a count whose node fits until the next one would not
+    static constexpr std::size_t fitInner(std::size_t m, std::size_t bytes) {
+        return inner(m + 1) <= bytes ? fitInner(m + 1, bytes) : m;
+    }
+    static constexpr std::size_t fitLeaf(std::size_t l, std::size_t bytes) {
+        return leaf(l + 1) <= bytes ? fitLeaf(l + 1, bytes) : l;
+    }
+};
+
 // @param :
-// _M : denote the maximum number key of innernode
-// _L : denote the maximum number key of leafnode
+// _NodeBytes : target node size, a multiple of the cache line, PAGE_SIZE_4K
+//              or PAGE_SIZE_2M (the latter with huge page slabs)
+// _Traits : the optional features of the tree, their arrays take room
+// _Header : bytes in front of the keys of a node without the traits
+template<typename _key, typename _data, std::size_t _NodeBytes = BLOCK_SIZE, typename _Traits = btree_default_traits,
+         std::size_t _Header = 2 * sizeof(unsigned int)>
+struct btree_layout {
+    static_assert(_NodeBytes % CACHE_LINE_SIZE == 0, "btree_layout: node size must be a multiple of the cache line");
+    static_assert(_NodeBytes >= 2 * CACHE_LINE_SIZE, "btree_layout: node size must be at least two cache lines");
+    typedef btree_node_bytes<_key, _data, _Traits, _Header> bytes;
+
+    static const std::size_t NODE_BYTES = _NodeBytes;
+    // bytes per key and fixed bytes of a node, with the optional arrays
+    static const std::size_t INNER_PER_KEY = sizeof(_key) + sizeof(void*) + (_Traits::COUNTED ? sizeof(std::size_t) : 0);
+    static const std::size_t INNER_FIXED = bytes::HEADER + sizeof(void*) + (_Traits::COUNTED ? sizeof(std::size_t) : 0);
+    static const std::size_t LEAF_PER_KEY = sizeof(_key) + sizeof(_data) + (_Traits::FINGERPRINT ? 1 : 0);
+    static const std::size_t LEAF_FIXED = bytes::HEADER + 2 * sizeof(void*) + (_Traits::FINGERPRINT ? 31 : 0);
+    // the lower bounds leave room for the worst case padding, fitting
+    // then adds the few keys the padding did not need
+    static const int INNER_MAX = static_cast<int>(bytes::fitInner(
+        (_NodeBytes - INNER_FIXED - alignof(_key) - 2 * bytes::innerAlign()) / INNER_PER_KEY, _NodeBytes));
+    static const int LEAF_MAX = static_cast<int>(bytes::fitLeaf(
+        (_NodeBytes - LEAF_FIXED - alignof(_key) - alignof(_data) - 2 * bytes::leafAlign()) / LEAF_PER_KEY, _NodeBytes));
+
+    static_assert(INNER_MAX >= 4 && LEAF_MAX >= 4, "btree_layout: node size too small for the key/data type");
+    static_assert(bytes::inner(INNER_MAX) <= _NodeBytes && bytes::leaf(LEAF_MAX) <= _NodeBytes,
+                  "btree_layout: nodes exceed the node size");
+};
+
+// the inner and leaf capacity a tree uses, a count of 0 is derived from
+// the layout of the default node size for the traits
+template<typename _key, typename _data, int _M, int _L, typename _Traits>
+struct btree_geometry {
+    static const int INNER_MAX = _M ? _M : btree_layout<_key, _data, BLOCK_SIZE, _Traits>::INNER_MAX;
+    static const int LEAF_MAX = _L ? _L : btree_layout<_key, _data, BLOCK_SIZE, _Traits>::LEAF_MAX;
+};
+
+// @param :
+// _M : denote the maximum number key of innernode, 0 fits it into
+//      BLOCK_SIZE with the traits
+// _L : denote the maximum number key of leafnode, 0 fits it into
+//      BLOCK_SIZE with the traits
+// _Search : strategy used to search the keys inside one node
+// _Alloc : allocator rebound to the node types, std::allocator<char>
+//          gives plain new/delete
+// _Traits : optional features, btree_counted_traits adds order statistics
 template<typename _key,
          typename _data,
-         // let innernode and leafnode contains allocated in a block default
-         int _M = ( BLOCK_SIZE - sizeof(void*) ) / ( sizeof(_key) + sizeof(void*) ),
-         int _L = BLOCK_SIZE / ( sizeof(_key) + sizeof(_data) )>
+         // let innernode and leafnode fit into one block by default
+         int _M = 0,
+         int _L = 0,
+         typename _Search = btree_default_search,
+         typename _Alloc = btree_slab_allocator<char>,
+         typename _Traits = btree_default_traits>
 class BPlusTree {
+    class node;
+    class innerNode;
+    class leafNode;
+
 public:
     // default constructor
     explicit BPlusTree();
     // no assignment constructor & copy constructor
     BPlusTree(const BPlusTree &other) = delete;
     BPlusTree(BPlusTree &&) = delete;
-    const BPlusTree<_key,_data,_M,_L>& operator=(const BPlusTree &other) = delete;
+    const BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>& operator=(const BPlusTree &other) = delete;
     // destructor
     ~BPlusTree();
 
     // insert an element into BPlusTree
     // current we don't support identical key
     void insert(const _key &key, const _data &data);
+    void insert(_key &&key, _data &&data);
+
+    // construct the data from args in place if key is not there yet
+    // return true if inserted, args are left alone otherwise
+    template<typename... Args>
+    bool emplace(const _key &key, Args&&... args);
+    template<typename... Args>
+    bool emplace(_key &&key, Args&&... args);
+
+    // call f(data) on the data of key, a missing key is inserted with
+    // value initialized data first. Return true if inserted
+    template<typename Function>
+    bool upsert(const _key &key, Function f);
 
     // find an element, if true return key/data pair
     // else return false pair
     std::pair<bool, std::pair<_key, _data> > find(const _key& key) const;
 
+    // pointer to the data of key in place, nullptr if not found
+    // the pointer is invalidated by any insert or erase
+    _data* find_ptr(const _key& key);
+    const _data* find_ptr(const _key& key) const;
+
     // remove one element
     void erase(const _key& val);
 
@@ -45,6 +748,75 @@ public:
     // check whether the BPlusTree is nullptr
     const bool empty() const;
 
+    // remove all elements
+    void clear();
+
+    // replace the contents with the key/data pairs in [first, last)
+    // the input must be sorted by strictly increasing key
+    // fill_factor in (0, 1] is the fraction of each node to fill
+    template<typename ForwardIterator>
+    void bulk_load(ForwardIterator first, ForwardIterator last, double fill_factor = 1.0);
+
+    // checkpoint of the contents, only for trivially copyable keys and data
+    // the file holds a header, all keys and then all data, each array
+    // cache line aligned, so a mapped file can be read in place.
+    // save writes path.tmp and renames it over path once it is on disk,
+    // load maps the file and builds the tree bottom-up like bulk_load.
+    // Errors throw std::system_error, bad files std::runtime_error
+    void save(const std::string& path) const;
+    void load(const std::string& path, double fill_factor = 1.0);
+
+    // insert the key/data pairs in [first, last) as one batch, the batch
+    // is sorted and routed down the tree together, every touched leaf is
+    // rewritten once and split only after all its pairs are in.
+    // identical keys are ignored, in the batch the first one wins
+    // return the number of inserted elements
+    template<typename InputIterator>
+    std::size_t insert_many(InputIterator first, InputIterator last);
+
+    // remove the keys in [first, last) as one batch, underflowing nodes
+    // are merged or rebalanced only after all their keys are removed
+    // return the number of removed elements
+    template<typename InputIterator>
+    std::size_t erase_many(InputIterator first, InputIterator last);
+
+    // remove every element in [lo, hi), leaves and subtrees which lie
+    // inside the range are freed without visiting their elements, only
+    // the paths to lo and hi are rebalanced
+    // return the number of removed elements
+    std::size_t erase_range(const _key& lo, const _key& hi);
+
+    // relaxed erase : erase rebalances a node only when it holds less
+    // than min_fill of its capacity, 0.5 is the eager default, a lower
+    // fill leaves underfull nodes behind for compact()
+    void set_min_fill(double min_fill);
+
+    // incremental maintenance of the relaxed mode, merge or rebalance the
+    // underfull nodes below at most budget level 1 inner nodes, a call
+    // resumes where the previous one stopped, nodes left of that point
+    // wait for the next pass
+    // return true when the pass has reached the end of the tree
+    bool compact(std::size_t budget = static_cast<std::size_t>(-1));
+
+    // learned index for arithmetic keys : piecewise linear models over the
+    // leaf chain predict the leaf of a key and its position in the leaf
+    // within epsilon slots, find() then reads one leaf instead of
+    // descending. Allocating or freeing a leaf makes the models stale and
+    // find() descends again until the write which brings the writes since
+    // the last build to rebuild_writes builds them anew
+    void learn(std::size_t epsilon = 8, std::size_t rebuild_writes = 1024);
+    // drop the learned index
+    void unlearn();
+    // number of linear models, 0 without learned index
+    std::size_t learned_models() const {
+        return learnModel_.size();
+    }
+
+    // number of leaf nodes
+    std::size_t leaf_count() const {
+        return stats_.leaves_;
+    }
+
     // debug usage
     // output leaf items
     std::vector<std::pair<_key, _data> > dumpTree() const {
@@ -59,11 +831,76 @@ public:
         return res;
     }
 
-private:
+    // bidirectional cursor over the leaf chain, it reads key/data in place
+    // the cursor is invalidated by any insert or erase
+    class cursor {
+    public:
+        friend class BPlusTree;
+        explicit cursor();
+        // check whether the cursor points to an element
+        bool valid() const {
+            return leaf_ != nullptr;
+        }
+        const _key& key() const {
+            return leaf_->key_[idx_];
+        }
+        const _data& data() const {
+            return leaf_->data_[idx_];
+        }
+        cursor& operator++(); // move to the next element
+        cursor& operator--(); // move to the previous element
+        bool operator==(const cursor &other) const;
+        bool operator!=(const cursor &other) const;
+    private:
+        cursor(const BPlusTree* tree, leafNode* leaf, unsigned int idx);
+        const BPlusTree* tree_;
+        leafNode* leaf_;
+        unsigned int idx_;
+    };
 
-    class node;
-    class innerNode;
-    class leafNode;
+    // cursor to the first element, end() is an invalid cursor
+    // decrementing end() moves to the last element
+    cursor begin() const;
+    cursor end() const;
+
+    // cursor to the first element which is not less than key
+    cursor lower_bound(const _key& key) const;
+    // cursor to the first element which is greater than key
+    cursor upper_bound(const _key& key) const;
+
+    // call f(key, data) on every element in [lo, hi) in order
+    // return the number of visited elements
+    template<typename Function>
+    std::size_t scan(const _key& lo, const _key& hi, Function f) const;
+
+    // parallel scans, the key range is cut at the separators of the upper
+    // inner levels into a few parts per thread. A pool of up to threads
+    // threads, 0 for one per core, takes the parts one by one and scans
+    // each in key order. The tree must not change meanwhile
+    // call f(key, data) on every element in [lo, hi) or in the whole tree,
+    // f is called concurrently from the threads
+    // return the number of visited elements
+    template<typename Function>
+    std::size_t parallel_scan(const _key& lo, const _key& hi, Function f, unsigned int threads = 0) const;
+    template<typename Function>
+    std::size_t parallel_scan(Function f, unsigned int threads = 0) const;
+    // fold the elements of every part into a copy of init with
+    // f(acc, key, data), then combine the parts in key order with
+    // result = merge(result, part). init must be neutral for merge
+    template<typename T, typename Function, typename Merge>
+    T parallel_reduce(const _key& lo, const _key& hi, T init, Function f, Merge merge, unsigned int threads = 0) const;
+    template<typename T, typename Function, typename Merge>
+    T parallel_reduce(T init, Function f, Merge merge, unsigned int threads = 0) const;
+
+    // order statistics, only with btree_counted_traits
+    // number of elements which are less than key
+    std::size_t rank(const _key& key) const;
+    // cursor to the element with rank k, end() if k >= size()
+    cursor select(std::size_t k) const;
+    // number of elements in [lo, hi)
+    std::size_t count_range(const _key& lo, const _key& hi) const;
+
+private:
 
     /*
      * template find function to search the key which is not less
@@ -71,9 +908,27 @@ private:
      */
     template<typename nodeType>
     inline int find(nodeType *n, const _key& key) const {
-        unsigned int i;
-        for(i = 0; i < n->size_ && n->key_[i] < key; ++i);
-        return i;
+        return _Search::lower_bound(n->key_, n->size_, key);
+    }
+
+    // descend down to the leaf node which may contain key
+    inline leafNode* findLeaf(const _key& key) const {
+        node* n = root_;
+        if( !n )
+            return nullptr;
+        while( !n->isLeafNode() ) {
+            innerNode* tmp = static_cast<innerNode*>(n);
+            n = tmp->child_[find(tmp, key)];
+        }
+        return static_cast<leafNode*>(n);
+    }
+
+    // hint the cpu to fetch the leaf while the current one is processed
+    static inline void prefetchLeaf(const leafNode* n) {
+        if( n ) {
+            __builtin_prefetch(n);
+            __builtin_prefetch(n->key_);
+        }
     }
 
     /*
@@ -81,26 +936,94 @@ private:
      */
     // the number of inner node which may be different with the
     // number of leaf node
-    static const int INNER_MAX_ = _M;
+    static const int INNER_MAX_ = btree_geometry<_key, _data, _M, _L, _Traits>::INNER_MAX;
     // the minimum number of inner node
     static const int INNER_MIN_ = INNER_MAX_ / 2;
     // the number of leaf node
-    static const int LEAF_MAX_ = _L;
+    static const int LEAF_MAX_ = btree_geometry<_key, _data, _M, _L, _Traits>::LEAF_MAX;
     // the minimum number of leaf node
     static const int LEAF_MIN_ = LEAF_MAX_ / 2;
 
     inline leafNode* newLeaf() {
-        leafNode* n = new leafNode();
+        leafNode* n = new (leafAlloc_.allocate(1)) leafNode();
         ++stats_.leaves_;
+        ++leafEpoch_;
         return n;
     }
 
     inline innerNode* newInner(unsigned int l) {
-        innerNode* n = new innerNode(l);
+        innerNode* n = new (innerAlloc_.allocate(1)) innerNode(l);
         ++stats_.inners_;
         return n;
     }
 
+    // release one node which has been unlinked from the tree
+    inline void freeNode(node* n) {
+        if( n->isLeafNode() ) {
+            leafNode* leaf = static_cast<leafNode*>(n);
+            leaf->~leafNode();
+            leafAlloc_.deallocate(leaf, 1);
+            --stats_.leaves_;
+            ++leafEpoch_;
+        } else {
+            innerNode* inner = static_cast<innerNode*>(n);
+            inner->~innerNode();
+            innerAlloc_.deallocate(inner, 1);
+            --stats_.inners_;
+        }
+    }
+
+    // split n items into groups of about per items where every group
+    // keeps at least lo and at most hi items, return the number of groups
+    static inline std::size_t groupCount(std::size_t n, std::size_t per, std::size_t lo, std::size_t hi) {
+        per = std::max<std::size_t>(1, std::min(per, hi));
+        std::size_t k = (n + per - 1) / per;
+        while( k > 1 && n / k < lo )
+            --k;
+        return k;
+    }
+
+    // number of slots filled per node for a given fill factor
+    static inline std::size_t fillCount(std::size_t max, double fill_factor) {
+        return static_cast<std::size_t>(max * fill_factor + 0.5);
+    }
+
+    // release the whole subtree rooted at n
+    // return the number of elements it held
+    std::size_t clear(node* n) {
+        std::size_t cnt = n->size_;
+        if( !n->isLeafNode() ) {
+            innerNode* inner = static_cast<innerNode*>(n);
+            cnt = 0;
+            for(unsigned int i = 0; i <= inner->size_; ++i)
+                cnt += clear(inner->child_[i]);
+        }
+        freeNode(n);
+        return cnt;
+    }
+
+    // number of elements below n in a counted tree
+    static std::size_t subtreeCount(const node* n) {
+        if( n->isLeafNode() )
+            return n->size_;
+        const innerNode* inner = static_cast<const innerNode*>(n);
+        std::size_t cnt = 0;
+        for(unsigned int i = 0; i <= inner->size_; ++i)
+            cnt += inner->childCount(i);
+        return cnt;
+    }
+
+    // recompute the counts of children [lo, hi] of n, clipped to its
+    // children, from the children themselves
+    static void recount(innerNode* n, int lo = 0, int hi = INNER_MAX_) {
+        if( !_Traits::COUNTED )
+            return;
+        lo = std::max(lo, 0);
+        hi = std::min(hi, static_cast<int>(n->size_));
+        for(int i = lo; i <= hi; ++i)
+            n->setChildCount(i, subtreeCount(n->child_[i]));
+    }
+
     struct tree_stats {
         std::size_t itemCount_; // number of items in btree
         std::size_t leaves_;    // number of leaf nodes
@@ -153,6 +1076,33 @@ private:
     leafNode* tail_;
     // record the statistical information of tree
     tree_stats stats_;
+    // erase rebalances leaves and inner nodes smaller than these
+    int leafMin_;
+    int innerMin_;
+    // compact() continues behind this separator if compacting_ is set
+    _key compactKey_;
+    bool compacting_;
+    // learned index, leaf i covers the slots [i * LEAF_MAX_, (i+1) * LEAF_MAX_)
+    // and spreads its elements evenly over them. A model maps the keys
+    // from its first one on to slots, the radix table splits the key
+    // space into equal parts and keeps the first model of each part
+    struct learned_model {
+        _key key_;
+        double slot_;
+        double slope_;
+    };
+    std::vector<learned_model> learnModel_;
+    std::vector<unsigned int> learnRadix_;
+    double learnScale_;
+    std::vector<leafNode*> learnLeaf_;
+    std::size_t learnEps_;      // 0 without learned index
+    std::size_t learnRebuild_;
+    std::size_t learnWrites_;
+    std::size_t leafEpoch_;     // counts the leaf allocations and frees
+    std::size_t learnEpoch_;    // leafEpoch_ at the last build
+    // node allocators, destroyed after the destructor released the nodes
+    typename std::allocator_traits<_Alloc>::template rebind_alloc<leafNode> leafAlloc_;
+    typename std::allocator_traits<_Alloc>::template rebind_alloc<innerNode> innerAlloc_;
 
     // private insert helper function
 
@@ -169,143 +1119,1469 @@ private:
         // record current node's size
         unsigned int size_;
 
-        // method to check whether it's leaf or inner node
-        inline bool isLeafNode() const {
-            return level_ == 0;
+        // method to check whether it's leaf or inner node
+        inline bool isLeafNode() const {
+            return level_ == 0;
+        }
+
+    };
+
+    // innernode can only store the key and pointer to child node
+    // a counted tree keeps the element count of every child in front of
+    // the keys
+    class innerNode : public node, public btree_child_counts<INNER_MAX_ + 1, _Traits::COUNTED> {
+    public:
+        // no argument constructor
+        innerNode() {};
+        // one argument constructor
+        innerNode(unsigned int l) : node(l) {}
+
+        // innernode only store keys and pointers to children
+        _key key_[INNER_MAX_];
+        node* child_[INNER_MAX_+1]; // child is one more than the key
+
+        inline bool isFull() const {
+            return node::size_ == INNER_MAX_;
+        }
+        inline bool isUnderflow() const {
+            return node::size_ < INNER_MIN_;
+        }
+        inline bool isFew() const {
+            return node::size_ <= INNER_MIN_;
+        }
+    };
+
+    // leaf node can store key/data pair
+    // a fingerprinted leaf keeps the fingerprints in front of the keys
+    class leafNode : public node, public btree_leaf_fingerprints<_key, LEAF_MAX_, _Traits::FINGERPRINT> {
+    public:
+        // no argument constructor
+        leafNode() : prev_(nullptr), next_(nullptr) {};
+
+        // leafnode must store keys and data, the keys right after the
+        // header as searches read them first
+        _key key_[LEAF_MAX_];
+        _data data_[LEAF_MAX_];
+        // pointer to previous leafnode
+        leafNode* prev_;
+        // pointer to next leafnode
+        leafNode* next_;
+
+        inline bool isFull() const {
+            return node::size_ == LEAF_MAX_;
+        }
+        inline bool isUnderflow() const {
+            return node::size_ < LEAF_MIN_;
+        }
+        inline bool isFew() const {
+            return node::size_ <= LEAF_MIN_;
+        }
+        inline void setData(unsigned int idx, std::pair<_key, _data> val) {
+            assert( idx < LEAF_MAX_ );
+            key_[idx] = val.first;
+            key_[idx] = val.second;
+        }
+    };
+
+    // the layout models the node classes byte for byte, derived counts
+    // therefore keep both nodes within BLOCK_SIZE
+    typedef btree_node_bytes<_key, _data, _Traits> node_bytes;
+    static_assert(sizeof(innerNode) == node_bytes::inner(INNER_MAX_), "BPlusTree: inner node layout differs from btree_node_bytes");
+    static_assert(sizeof(leafNode) == node_bytes::leaf(LEAF_MAX_), "BPlusTree: leaf node layout differs from btree_node_bytes");
+    static_assert(_M || sizeof(innerNode) <= BLOCK_SIZE, "BPlusTree: derived inner node exceeds BLOCK_SIZE");
+    static_assert(_L || sizeof(leafNode) <= BLOCK_SIZE, "BPlusTree: derived leaf node exceeds BLOCK_SIZE");
+
+    void split_innernode(innerNode* n, node* &splitNode, _key& splitKey, unsigned int idx);
+    void split_leafnode(leafNode* n, node* &splitNode, _key& splitKey);
+
+    // place key into the tree, return its leaf and index, inserted tells
+    // whether it is new. The data of a new key is left for the caller
+    template<typename K>
+    std::pair<leafNode*, unsigned int> place(K&& key, bool& inserted);
+    template<typename K>
+    bool insert(node* node_, K&& key, node* &splitNode, _key& splitKey, leafNode* &leaf, unsigned int &slot);
+    // build the data of a new slot from args, in place when that cannot throw
+    template<typename... Args>
+    static inline void construct(_data& slot, std::true_type, Args&&... args) {
+        slot.~_data();
+        new (&slot) _data(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static inline void construct(_data& slot, std::false_type, Args&&... args) {
+        slot = _data(std::forward<Args>(args)...);
+    }
+    leafNode* findSlot(const _key& key, unsigned int& idx) const;
+
+    result_t erase(const _key& val,node* n,node* left,node* right,innerNode* leftParent,innerNode* rightParent,innerNode* parent,unsigned int idxParent);
+    result_t shift_left_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent);
+    void shift_left_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent);
+    void shift_right_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent);
+    void shift_right_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent);
+    result_t merge_inner(innerNode* left, innerNode* right, innerNode* parent, unsigned int idxParent);
+    result_t merge_leaves(leafNode* left, leafNode* right, innerNode* parent);
+
+    // batch helpers
+    typedef std::pair<_key, _data> value_type;
+    // new right sibling of a node and the separator in front of it
+    typedef std::pair<_key, node*> split_type;
+    void insert_many(node* n, const value_type* first, const value_type* last,
+                     std::vector<split_type>& splits, std::vector<value_type>& scratch);
+    // spread sorted pairs over leaf and new leaves linked behind it
+    void fillLeaves(leafNode* leaf, const std::vector<value_type>& items, std::vector<split_type>& splits);
+    // spread children and the keys between them over inner and new inner nodes
+    void fillInner(innerNode* inner, const std::vector<_key>& keys, const std::vector<node*>& children,
+                   std::vector<split_type>& splits);
+    // checkpoint file layout, the arrays start at multiples of CACHE_LINE_SIZE
+    static const uint64_t FILE_MAGIC = 0x4250545245453031ull; // "BPTREE01"
+    static const uint32_t FILE_VERSION = 1;
+    struct file_header {
+        uint64_t magic_;
+        uint32_t version_;
+        uint32_t keySize_;
+        uint32_t dataSize_;
+        uint32_t pad_;
+        uint64_t count_;
+        uint64_t keyOffset_;
+        uint64_t dataOffset_;
+    };
+    static inline uint64_t fileAlign(uint64_t n) {
+        return btree_align_up(n, CACHE_LINE_SIZE);
+    }
+    // write [p, p + n) at offset, closes fd on error
+    static void writeAt(int fd, const char* p, std::size_t n, uint64_t offset, const std::string& file);
+    // build the inner levels of bulk_load and load above the leaves
+    void buildInner(std::vector<node*>& level, std::vector<_key>& lastKey, double fill_factor);
+    void erase_many(node* n, const _key* first, const _key* last);
+    void erase_range(node* n, const _key& lo, const _key& hi, bool loPath, bool hiPath);
+    // drop roots with a single child and an empty root leaf
+    void shrinkRoot();
+    // compact the subtree of n, bound is the separator right of n
+    bool compact(innerNode* n, const _key* bound, std::size_t& budget);
+
+    // learned index helpers, no-ops for keys which are not arithmetic
+    typedef std::integral_constant<bool, std::is_arithmetic<_key>::value> learnable;
+    inline void learnWrite(std::size_t n = 1) {
+        if( learnEps_ && (learnWrites_ += n) >= learnRebuild_ )
+            buildLearned(learnable());
+    }
+    void buildLearned(std::true_type);
+    void buildLearned(std::false_type) {}
+    // part of the key space key falls into, key is not below the first model
+    // distance from a up to b, not below a. Integral keys subtract in
+    // their unsigned type, the difference of signed keys may not fit _key
+    typedef std::integral_constant<bool, std::is_integral<_key>::value && !std::is_same<_key, bool>::value> learnIntegral;
+    static inline double keySpan(const _key& a, const _key& b) {
+        return keySpan(a, b, learnIntegral());
+    }
+    static inline double keySpan(const _key& a, const _key& b, std::true_type) {
+        typedef typename std::make_unsigned<_key>::type ukey;
+        return static_cast<double>(static_cast<ukey>(static_cast<ukey>(b) - static_cast<ukey>(a)));
+    }
+    static inline double keySpan(const _key& a, const _key& b, std::false_type) {
+        return static_cast<double>(b) - static_cast<double>(a);
+    }
+    // part of the radix table for key, clamped to the table
+    inline std::size_t learnPart(const _key& key) const {
+        const double part = keySpan(learnModel_[0].key_, key) * learnScale_;
+        return static_cast<std::size_t>(std::min(std::max(part, 0.0), static_cast<double>(learnRadix_.size() - 1)));
+    }
+    bool learnedFind(const _key& key, leafNode*& leaf, unsigned int& idx, std::true_type) const;
+    bool learnedFind(const _key&, leafNode*&, unsigned int&, std::false_type) const {
+        return false;
+    }
+    // merge or rebalance the underflowing children of inner
+    void fixChildren(innerNode* inner);
+    // merge children idx and idx+1 of inner if they fit into one node,
+    // otherwise even them out, return true if merged
+    bool fixPair(innerNode* inner, unsigned int idx);
+
+    // parallel scan helpers, a null bound leaves its side open
+    // separators strictly inside the range of the depth levels from n down
+    void splitRange(const node* n, const _key* lo, const _key* hi, unsigned int depth, std::vector<_key>& bounds) const;
+    template<typename T, typename Function>
+    void scanPart(const _key* lo, const _key* hi, T& acc, Function& f) const;
+    template<typename T, typename Function, typename Merge>
+    T reduceParts(const _key* lo, const _key* hi, T init, Function f, Merge merge, unsigned int threads) const;
+};
+
+// BPlusTree with the node geometry fitted to _NodeBytes, 2MiB nodes are
+// allocated from huge page slabs
+template<typename _key,
+         typename _data,
+         std::size_t _NodeBytes,
+         typename _Search = btree_default_search,
+         typename _Alloc = btree_slab_allocator<char, (_NodeBytes >= PAGE_SIZE_2M)>,
+         typename _Traits = btree_default_traits>
+using BPlusTree_sized = BPlusTree<_key, _data,
+                                  btree_layout<_key, _data, _NodeBytes, _Traits>::INNER_MAX,
+                                  btree_layout<_key, _data, _NodeBytes, _Traits>::LEAF_MAX,
+                                  _Search, _Alloc, _Traits>;
+
+
+// default constructor -- only initialize the private variable
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::BPlusTree() {
+    root_ = nullptr;
+    head_ = nullptr;
+    tail_ = nullptr;
+    leafMin_ = LEAF_MIN_;
+    innerMin_ = INNER_MIN_;
+    compacting_ = false;
+    learnEps_ = learnRebuild_ = learnWrites_ = 0;
+    learnScale_ = 0;
+    leafEpoch_ = learnEpoch_ = 0;
+}
+
+// return the number of key/data pairs in BPlusTree
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+const std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::size() const {
+    return stats_.itemCount_;
+}
+
+// check whether the BPlusTree contains at least one key/data pair
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+const bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::empty() const {
+    return size() == 0;
+}
+
+// destructor
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::~BPlusTree() {
+    if( root_ )
+        clear(root_);
+}
+
+
+// remove all elements
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::clear() {
+    if( root_ )
+        clear(root_);
+    root_ = nullptr;
+    head_ = tail_ = nullptr;
+    stats_ = tree_stats();
+    compacting_ = false;
+}
+
+// build the tree bottom-up from sorted input
+// first pack the leaves and link them, then build every inner level from
+// the level below in one pass, the separator of a child is its last key
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename ForwardIterator>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::bulk_load(ForwardIterator first, ForwardIterator last, double fill_factor) {
+    assert( fill_factor > 0 && fill_factor <= 1 );
+    clear();
+    const std::size_t n = std::distance(first, last);
+    if( n == 0 )
+        return;
+
+    // nodes of the level being built and the last key of each of them
+    std::vector<node*> level;
+    std::vector<_key> lastKey;
+
+    // leaf level
+    std::size_t k = groupCount(n, fillCount(LEAF_MAX_, fill_factor), LEAF_MIN_, LEAF_MAX_);
+    level.reserve(k);
+    lastKey.reserve(k);
+    leafNode* prev = nullptr;
+    for(std::size_t i = 0; i < k; ++i) {
+        leafNode* leaf = newLeaf();
+        // spread the remainder over the first leaves
+        leaf->size_ = n / k + (i < n % k ? 1 : 0);
+        for(unsigned int j = 0; j < leaf->size_; ++j, ++first) {
+            leaf->key_[j] = first->first;
+            leaf->data_[j] = first->second;
+            assert( j == 0 || leaf->key_[j-1] < leaf->key_[j] );
+        }
+        leaf->hashFingerprints(leaf->key_, 0, leaf->size_);
+        assert( !prev || prev->key_[prev->size_-1] < leaf->key_[0] );
+        leaf->prev_ = prev;
+        if( prev )
+            prev->next_ = leaf;
+        else
+            head_ = leaf;
+        prev = leaf;
+        level.push_back(leaf);
+        lastKey.push_back(leaf->key_[leaf->size_-1]);
+    }
+    tail_ = prev;
+    stats_.itemCount_ = n;
+
+    buildInner(level, lastKey, fill_factor);
+    if( learnEps_ )
+        buildLearned(learnable());
+}
+
+// inner levels above the nodes of level, an inner node holds one more
+// child than keys. The top node becomes the root
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::buildInner(std::vector<node*>& level, std::vector<_key>& lastKey,
+                                                                    double fill_factor) {
+    unsigned int height = 0;
+    while( level.size() > 1 ) {
+        ++height;
+        const std::size_t m = level.size();
+        const std::size_t k = groupCount(m, fillCount(INNER_MAX_ + 1, fill_factor), INNER_MIN_ + 1, INNER_MAX_ + 1);
+        std::vector<node*> upper;
+        std::vector<_key> upperKey;
+        upper.reserve(k);
+        upperKey.reserve(k);
+        std::size_t c = 0;
+        // on failure level still holds the complete level below
+        try {
+            for(std::size_t i = 0; i < k; ++i) {
+                innerNode* inner = newInner(height);
+                upper.push_back(inner);
+                unsigned int children = m / k + (i < m % k ? 1 : 0);
+                for(unsigned int j = 0; j < children; ++j, ++c) {
+                    inner->child_[j] = level[c];
+                    if( j + 1 < children )
+                        inner->key_[j] = lastKey[c];
+                }
+                inner->size_ = children - 1;
+                recount(inner);
+                upperKey.push_back(lastKey[c-1]);
+            }
+        } catch(...) {
+            for(auto u : upper)
+                freeNode(u);
+            throw;
+        }
+        level.swap(upper);
+        lastKey.swap(upperKey);
+    }
+    root_ = level[0];
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::writeAt(int fd, const char* p, std::size_t n, uint64_t offset,
+                                                                 const std::string& file) {
+    while( n > 0 ) {
+        ssize_t w = ::pwrite(fd, p, n, static_cast<off_t>(offset));
+        if( w < 0 && errno == EINTR )
+            continue;
+        if( w < 0 ) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "write " + file);
+        }
+        p += w;
+        n -= w;
+        offset += w;
+    }
+}
+
+// the leaves are streamed out twice, first their keys then their data,
+// through a buffer of whole leaf arrays
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::save(const std::string& path) const {
+    static_assert(std::is_trivially_copyable<_key>::value, "save needs trivially copyable keys");
+    static_assert(std::is_trivially_copyable<_data>::value, "save needs trivially copyable data");
+    const std::string tmp = path + ".tmp";
+
+    file_header h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic_ = FILE_MAGIC;
+    h.version_ = FILE_VERSION;
+    h.keySize_ = sizeof(_key);
+    h.dataSize_ = sizeof(_data);
+    h.count_ = stats_.itemCount_;
+    h.keyOffset_ = fileAlign(sizeof(h));
+    h.dataOffset_ = fileAlign(h.keyOffset_ + h.count_ * sizeof(_key));
+    const uint64_t end = h.dataOffset_ + h.count_ * sizeof(_data);
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if( fd < 0 )
+        throw std::system_error(errno, std::generic_category(), "open " + tmp);
+    // the file gets its final size up front, the padding reads as zeros
+    if( ::ftruncate(fd, static_cast<off_t>(end)) != 0 ) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "ftruncate " + tmp);
+    }
+    writeAt(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0, tmp);
+
+    std::vector<char> buf;
+    buf.reserve(std::size_t(1) << 20);
+    for(int column = 0; column < 2; ++column) {
+        uint64_t offset = column == 0 ? h.keyOffset_ : h.dataOffset_;
+        for(const leafNode* n = head_; n; n = n->next_) {
+            const char* p = column == 0 ? reinterpret_cast<const char*>(n->key_) : reinterpret_cast<const char*>(n->data_);
+            buf.insert(buf.end(), p, p + n->size_ * (column == 0 ? sizeof(_key) : sizeof(_data)));
+            if( buf.size() >= (std::size_t(1) << 20) || !n->next_ ) {
+                writeAt(fd, buf.data(), buf.size(), offset, tmp);
+                offset += buf.size();
+                buf.clear();
+            }
+        }
+    }
+
+    if( ::fsync(fd) != 0 ) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "fsync " + tmp);
+    }
+    ::close(fd);
+    if( ::rename(tmp.c_str(), path.c_str()) != 0 )
+        throw std::system_error(errno, std::generic_category(), "rename " + tmp);
+
+    // make the rename durable
+    std::string::size_type slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    fd = ::open(dir.c_str(), O_RDONLY);
+    if( fd >= 0 ) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+// the leaves are filled straight from the mapped key and data arrays, the
+// keys are checked to be increasing on the way
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::load(const std::string& path, double fill_factor) {
+    static_assert(std::is_trivially_copyable<_key>::value, "load needs trivially copyable keys");
+    static_assert(std::is_trivially_copyable<_data>::value, "load needs trivially copyable data");
+    assert( fill_factor > 0 && fill_factor <= 1 );
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if( fd < 0 )
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    struct stat st;
+    if( ::fstat(fd, &st) != 0 ) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "fstat " + path);
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    if( size < sizeof(file_header) ) {
+        ::close(fd);
+        throw std::runtime_error("BPlusTree: " + path + " is truncated");
+    }
+    void* base = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if( base == MAP_FAILED )
+        throw std::system_error(err, std::generic_category(), "mmap " + path);
+    // unmapped on every way out
+    struct mapping {
+        void* base_;
+        std::size_t size_;
+        ~mapping() {
+            ::munmap(base_, size_);
+        }
+    } guard = { base, size };
+    ::madvise(base, size, MADV_SEQUENTIAL);
+    const char* file = static_cast<const char*>(base);
+
+    file_header h;
+    std::memcpy(&h, file, sizeof(h));
+    const char* bad = nullptr;
+    if( h.magic_ != FILE_MAGIC || h.version_ != FILE_VERSION )
+        bad = " is not a BPlusTree file";
+    else if( h.keySize_ != sizeof(_key) || h.dataSize_ != sizeof(_data) )
+        bad = " has a different key/data layout";
+    else if( h.count_ > size || h.keyOffset_ != fileAlign(sizeof(h)) || h.dataOffset_ != fileAlign(h.keyOffset_ + h.count_ * sizeof(_key)) ||
+             size != h.dataOffset_ + h.count_ * sizeof(_data) )
+        bad = " is truncated";
+    if( bad )
+        throw std::runtime_error("BPlusTree: " + path + bad);
+
+    clear();
+    const std::size_t n = h.count_;
+    // the roots of everything built so far, the tree is left empty if
+    // anything throws
+    std::vector<node*> level;
+    try {
+        const _key* keys = reinterpret_cast<const _key*>(file + h.keyOffset_);
+        const _data* data = reinterpret_cast<const _data*>(file + h.dataOffset_);
+        std::vector<_key> lastKey;
+        const std::size_t k = groupCount(n, fillCount(LEAF_MAX_, fill_factor), LEAF_MIN_, LEAF_MAX_);
+        level.reserve(k);
+        lastKey.reserve(k);
+        leafNode* prev = nullptr;
+        std::size_t c = 0;
+        for(std::size_t i = 0; i < k; ++i) {
+            leafNode* leaf = newLeaf();
+            leaf->size_ = n / k + (i < n % k ? 1 : 0);
+            std::memcpy(leaf->key_, keys + c, leaf->size_ * sizeof(_key));
+            std::memcpy(leaf->data_, data + c, leaf->size_ * sizeof(_data));
+            c += leaf->size_;
+            bool sorted = !prev || prev->key_[prev->size_-1] < leaf->key_[0];
+            for(unsigned int j = 1; j < leaf->size_; ++j)
+                sorted &= leaf->key_[j-1] < leaf->key_[j];
+            level.push_back(leaf);
+            if( !sorted )
+                throw std::runtime_error("BPlusTree: " + path + " is corrupted");
+            leaf->prev_ = prev;
+            if( prev )
+                prev->next_ = leaf;
+            else
+                head_ = leaf;
+            prev = leaf;
+            leaf->hashFingerprints(leaf->key_, 0, leaf->size_);
+            lastKey.push_back(leaf->key_[leaf->size_-1]);
+        }
+        tail_ = prev;
+        stats_.itemCount_ = n;
+        if( n > 0 )
+            buildInner(level, lastKey, fill_factor);
+        if( learnEps_ )
+            buildLearned(learnable());
+    } catch(...) {
+        if( root_ == nullptr ) {
+            for(auto l : level)
+                clear(l);
+        }
+        clear();
+        throw;
+    }
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename InputIterator>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::insert_many(InputIterator first, InputIterator last) {
+    std::vector<value_type> batch(first, last);
+    if( batch.empty() )
+        return 0;
+    std::stable_sort(batch.begin(), batch.end(), [](const value_type& a, const value_type& b) {
+        return a.first < b.first;
+    });
+    batch.erase(std::unique(batch.begin(), batch.end(), [](const value_type& a, const value_type& b) {
+        return a.first == b.first;
+    }), batch.end());
+
+    if( root_ == nullptr )
+        root_ = head_ = tail_ = newLeaf();
+    const std::size_t before = stats_.itemCount_;
+    std::vector<split_type> splits;
+    std::vector<value_type> scratch;
+    insert_many(root_, batch.data(), batch.data() + batch.size(), splits, scratch);
+
+    // the root has been split, grow the tree until one root is left
+    while( !splits.empty() ) {
+        std::vector<_key> keys;
+        std::vector<node*> children(1, root_);
+        for(auto& s : splits) {
+            keys.push_back(s.first);
+            children.push_back(s.second);
+        }
+        splits.clear();
+        innerNode* newRoot = newInner(root_->level_ + 1);
+        fillInner(newRoot, keys, children, splits);
+        root_ = newRoot;
+    }
+    learnWrite(batch.size());
+    return stats_.itemCount_ - before;
+}
+
+// route the sorted pairs [first, last) down to the leaves
+// a leaf merges its pairs with the batch and is rewritten once, an inner
+// node collects the splits of all its children before taking them in
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::insert_many(node* n, const value_type* first, const value_type* last,
+                                                             std::vector<split_type>& splits, std::vector<value_type>& scratch) {
+    if( n->isLeafNode() ) {
+        leafNode* leaf = static_cast<leafNode*>(n);
+        scratch.clear();
+        unsigned int i = 0;
+        while( i < leaf->size_ || first != last ) {
+            if( first == last || (i < leaf->size_ && leaf->key_[i] < first->first) ) {
+                scratch.push_back(std::make_pair(leaf->key_[i], leaf->data_[i]));
+                ++i;
+            } else if( i < leaf->size_ && !(first->first < leaf->key_[i]) ) {
+                // the key has already existed
+                scratch.push_back(std::make_pair(leaf->key_[i], leaf->data_[i]));
+                ++i;
+                ++first;
+            } else {
+                scratch.push_back(*first);
+                ++first;
+                ++stats_.itemCount_;
+            }
+        }
+        fillLeaves(leaf, scratch, splits);
+        return;
+    }
+
+    innerNode* inner = static_cast<innerNode*>(n);
+    // children with splits and where they go
+    std::vector<std::pair<unsigned int, split_type> > childSplits;
+    std::vector<split_type> tmp;
+    for(unsigned int i = 0; i <= inner->size_ && first != last; ++i) {
+        // the child takes the keys which are not greater than its separator
+        const value_type* end = last;
+        if( i < inner->size_ )
+            end = std::upper_bound(first, last, inner->key_[i], [](const _key& k, const value_type& v) {
+                return k < v.first;
+            });
+        if( end == first )
+            continue;
+        insert_many(inner->child_[i], first, end, tmp, scratch);
+        for(auto& s : tmp)
+            childSplits.push_back(std::make_pair(i, s));
+        tmp.clear();
+        first = end;
+    }
+    if( childSplits.empty() ) {
+        recount(inner);
+        return;
+    }
+
+    std::vector<_key> keys;
+    std::vector<node*> children;
+    std::size_t c = 0;
+    for(unsigned int i = 0; i <= inner->size_; ++i) {
+        children.push_back(inner->child_[i]);
+        for(; c < childSplits.size() && childSplits[c].first == i; ++c) {
+            keys.push_back(childSplits[c].second.first);
+            children.push_back(childSplits[c].second.second);
+        }
+        if( i < inner->size_ )
+            keys.push_back(inner->key_[i]);
+    }
+    fillInner(inner, keys, children, splits);
+}
+
+// as in bulk_load, the pairs are spread evenly so every leaf keeps at
+// least LEAF_MIN_ pairs
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::fillLeaves(leafNode* leaf, const std::vector<value_type>& items,
+                                                            std::vector<split_type>& splits) {
+    const std::size_t n = items.size();
+    const std::size_t k = n <= static_cast<std::size_t>(LEAF_MAX_) ? 1 : groupCount(n, LEAF_MAX_, LEAF_MIN_, LEAF_MAX_);
+    std::size_t c = 0;
+    for(std::size_t i = 0; i < k; ++i) {
+        if( i > 0 ) {
+            leafNode* next = newLeaf();
+            next->next_ = leaf->next_;
+            if( next->next_ == nullptr )
+                tail_ = next;
+            else
+                next->next_->prev_ = next;
+            next->prev_ = leaf;
+            leaf->next_ = next;
+            splits.push_back(std::make_pair(leaf->key_[leaf->size_-1], next));
+            leaf = next;
+        }
+        leaf->size_ = n / k + (i < n % k ? 1 : 0);
+        for(unsigned int j = 0; j < leaf->size_; ++j, ++c) {
+            leaf->key_[j] = items[c].first;
+            leaf->data_[j] = items[c].second;
+        }
+        leaf->hashFingerprints(leaf->key_, 0, leaf->size_);
+    }
+}
+
+// children has one more element than keys, a key is the separator
+// between its two neighbouring children
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::fillInner(innerNode* inner, const std::vector<_key>& keys,
+                                                           const std::vector<node*>& children,
+                                                           std::vector<split_type>& splits) {
+    const std::size_t m = children.size();
+    const std::size_t k = m <= static_cast<std::size_t>(INNER_MAX_ + 1) ? 1 : groupCount(m, INNER_MAX_ + 1, INNER_MIN_ + 1, INNER_MAX_ + 1);
+    std::size_t c = 0;
+    for(std::size_t i = 0; i < k; ++i) {
+        if( i > 0 ) {
+            // the key between the two groups moves up
+            inner = newInner(inner->level_);
+            splits.push_back(std::make_pair(keys[c-1], static_cast<node*>(inner)));
+        }
+        unsigned int cnt = m / k + (i < m % k ? 1 : 0);
+        for(unsigned int j = 0; j < cnt; ++j, ++c) {
+            inner->child_[j] = children[c];
+            if( j + 1 < cnt )
+                inner->key_[j] = keys[c];
+        }
+        inner->size_ = cnt - 1;
+        recount(inner);
+    }
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename InputIterator>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::erase_many(InputIterator first, InputIterator last) {
+    std::vector<_key> batch(first, last);
+    if( batch.empty() || root_ == nullptr )
+        return 0;
+    std::sort(batch.begin(), batch.end());
+    batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+
+    const std::size_t before = stats_.itemCount_;
+    erase_many(root_, batch.data(), batch.data() + batch.size());
+    shrinkRoot();
+    learnWrite(batch.size());
+    return before - stats_.itemCount_;
+}
+
+// remove the sorted keys [first, last) below n, the children of an inner
+// node are fixed once all of them have been visited
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::erase_many(node* n, const _key* first, const _key* last) {
+    if( n->isLeafNode() ) {
+        leafNode* leaf = static_cast<leafNode*>(n);
+        unsigned int j = 0;
+        for(unsigned int i = 0; i < leaf->size_; ++i) {
+            while( first != last && *first < leaf->key_[i] )
+                ++first;
+            if( first != last && *first == leaf->key_[i] ) {
+                ++first;
+                continue;
+            }
+            if( i != j ) {
+                leaf->key_[j] = std::move(leaf->key_[i]);
+                leaf->data_[j] = std::move(leaf->data_[i]);
+                leaf->copyFingerprints(*leaf, i, i + 1, j);
+            }
+            ++j;
+        }
+        stats_.itemCount_ -= leaf->size_ - j;
+        leaf->size_ = j;
+        return;
+    }
+
+    innerNode* inner = static_cast<innerNode*>(n);
+    bool changed = false;
+    for(unsigned int i = 0; i <= inner->size_ && first != last; ++i) {
+        const _key* end = last;
+        if( i < inner->size_ )
+            end = std::upper_bound(first, last, inner->key_[i]);
+        if( end == first )
+            continue;
+        erase_many(inner->child_[i], first, end);
+        changed = true;
+        first = end;
+    }
+    if( changed ) {
+        fixChildren(inner);
+        recount(inner);
+    }
+}
+
+// the leaves between the leaf of lo and the leaf of hi hold only keys
+// inside the range, they are unlinked at once and freed with the
+// subtrees which contain them
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::erase_range(const _key& lo, const _key& hi) {
+    if( root_ == nullptr || !(lo < hi) )
+        return 0;
+    leafNode* first = findLeaf(lo);
+    leafNode* last = findLeaf(hi);
+    if( first != last ) {
+        first->next_ = last;
+        last->prev_ = first;
+    }
+
+    const std::size_t before = stats_.itemCount_;
+    erase_range(root_, lo, hi, true, true);
+    shrinkRoot();
+    learnWrite(before - stats_.itemCount_);
+    return before - stats_.itemCount_;
+}
+
+// n lies on the path to lo, to hi or both, the children strictly between
+// the two paths are freed, the children on them trimmed and fixed once
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::erase_range(node* n, const _key& lo, const _key& hi,
+                                                                      bool loPath, bool hiPath) {
+    if( n->isLeafNode() ) {
+        leafNode* leaf = static_cast<leafNode*>(n);
+        const unsigned int i = find(leaf, lo);
+        unsigned int j = i;
+        while( j < leaf->size_ && leaf->key_[j] < hi )
+            ++j;
+        if( j == i )
+            return;
+        std::move(leaf->key_ + j, leaf->key_ + leaf->size_, leaf->key_ + i);
+        std::move(leaf->data_ + j, leaf->data_ + leaf->size_, leaf->data_ + i);
+        leaf->copyFingerprints(*leaf, j, leaf->size_, i);
+        stats_.itemCount_ -= j - i;
+        leaf->size_ -= j - i;
+        return;
+    }
+
+    // off a path the range runs over the end of the node
+    innerNode* inner = static_cast<innerNode*>(n);
+    const int a = loPath ? find(inner, lo) : -1;
+    const int b = hiPath ? find(inner, hi) : inner->size_ + 1;
+    if( b > a + 1 ) {
+        // child a keeps its separator, the keys of child b are larger
+        for(int i = a + 1; i < b; ++i)
+            stats_.itemCount_ -= clear(inner->child_[i]);
+        if( b <= static_cast<int>(inner->size_) ) {
+            std::move(inner->key_ + b, inner->key_ + inner->size_, inner->key_ + a + 1);
+            std::copy(inner->child_ + b, inner->child_ + inner->size_ + 1, inner->child_ + a + 1);
+        }
+        inner->size_ -= b - a - 1;
+    }
+    if( loPath )
+        erase_range(inner->child_[a], lo, hi, true, a == b);
+    if( hiPath && b != a )
+        erase_range(inner->child_[a + 1], lo, hi, false, true);
+    fixChildren(inner);
+    recount(inner);
+}
+
+// a node keeps at least one element or two children, so erase never
+// leaves an empty leaf or a childless inner node behind
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::set_min_fill(double min_fill) {
+    assert( min_fill >= 0 && min_fill <= 0.5 );
+    leafMin_ = std::min(static_cast<int>(LEAF_MIN_), std::max(1, static_cast<int>(LEAF_MAX_ * min_fill)));
+    innerMin_ = std::min(static_cast<int>(INNER_MIN_), std::max(1, static_cast<int>(INNER_MAX_ * min_fill)));
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::compact(std::size_t budget) {
+    if( root_ == nullptr || root_->isLeafNode() ) {
+        compacting_ = false;
+        return true;
+    }
+    bool done = compact(static_cast<innerNode*>(root_), nullptr, budget);
+    compacting_ = !done;
+    shrinkRoot();
+    learnWrite();
+    return done;
+}
+
+// the children of a level 1 node are fixed with the same pass as after
+// erase_many, an upper node is fixed after its visited children
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::compact(innerNode* n, const _key* bound, std::size_t& budget) {
+    bool done = true;
+    if( n->level_ == 1 ) {
+        fixChildren(n);
+        --budget;
+        if( bound )
+            compactKey_ = *bound;
+    } else {
+        // skip the children left of the resume point
+        unsigned int i = 0;
+        if( compacting_ ) {
+            i = find(n, compactKey_);
+            if( i < n->size_ && !(compactKey_ < n->key_[i]) )
+                ++i;
+        }
+        for(; i <= n->size_; ++i) {
+            if( budget == 0 ) {
+                done = false;
+                break;
+            }
+            if( !compact(static_cast<innerNode*>(n->child_[i]), i < n->size_ ? &n->key_[i] : bound, budget) ) {
+                done = false;
+                break;
+            }
+        }
+        fixChildren(n);
+    }
+    recount(n);
+    return done;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::learn(std::size_t epsilon, std::size_t rebuild_writes) {
+    static_assert(std::is_arithmetic<_key>::value, "learn needs arithmetic keys");
+    assert( epsilon > 0 && rebuild_writes > 0 );
+    learnEps_ = epsilon;
+    learnRebuild_ = rebuild_writes;
+    buildLearned(learnable());
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::unlearn() {
+    learnEps_ = 0;
+    std::vector<learned_model>().swap(learnModel_);
+    std::vector<unsigned int>().swap(learnRadix_);
+    std::vector<leafNode*>().swap(learnLeaf_);
+}
+
+// one pass over the leaf chain, a model grows while one line keeps every
+// element within epsilon slots, the cone of slopes which still does so
+// shrinks with every element and the model ends when the cone is empty
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::buildLearned(std::true_type) {
+    learnModel_.clear();
+    learnRadix_.clear();
+    learnLeaf_.clear();
+    learnWrites_ = 0;
+    learnEpoch_ = leafEpoch_;
+    const double eps = static_cast<double>(learnEps_);
+    const double inf = std::numeric_limits<double>::infinity();
+    double lo = 0, hi = inf;
+    for(leafNode* n = head_; n; n = n->next_) {
+        const double base = static_cast<double>(learnLeaf_.size()) * LEAF_MAX_;
+        const double step = static_cast<double>(LEAF_MAX_) / std::max(1u, static_cast<unsigned int>(n->size_));
+        learnLeaf_.push_back(n);
+        for(unsigned int j = 0; j < n->size_; ++j) {
+            const double y = base + j * step;
+            if( !learnModel_.empty() ) {
+                learned_model& last = learnModel_.back();
+                const double dx = keySpan(last.key_, n->key_[j]);
+                const double smin = (y - eps - last.slot_) / dx;
+                const double smax = (y + eps - last.slot_) / dx;
+                if( smin <= hi && smax >= lo ) {
+                    lo = std::max(lo, smin);
+                    hi = std::min(hi, smax);
+                    continue;
+                }
+                last.slope_ = hi == inf ? 0 : (lo + hi) / 2;
+            }
+            learned_model model = { n->key_[j], y, 0 };
+            learnModel_.push_back(model);
+            lo = 0;
+            hi = inf;
+        }
+    }
+    if( learnModel_.empty() )
+        return;
+    learnModel_.back().slope_ = hi == inf ? 0 : (lo + hi) / 2;
+
+    // about one model per part of the key space
+    const std::size_t parts = learnModel_.size();
+    learnScale_ = parts / (keySpan(learnModel_[0].key_, tail_->key_[tail_->size_-1]) + 1);
+    learnRadix_.resize(parts + 1);
+    std::size_t m = 0;
+    for(std::size_t b = 0; b <= parts; ++b) {
+        while( m < learnModel_.size() && learnPart(learnModel_[m].key_) < b )
+            ++m;
+        learnRadix_[b] = m;
+    }
+}
+
+// the leaf is checked against the key, writes since the build may have
+// moved the key to a neighbour, a key between two leaves is absent
+// return false if the models cannot tell
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::learnedFind(const _key& key, leafNode*& leaf, unsigned int& idx,
+                                                                      std::true_type) const {
+    if( !learnEps_ || learnEpoch_ != leafEpoch_ || learnLeaf_.empty() )
+        return false;
+    // the model of key is the last one which starts at or before key
+    double slot = 0;
+    if( !(key < learnModel_[0].key_) ) {
+        const std::size_t b = std::min(learnPart(key), learnRadix_.size() - 2);
+        const learned_model* m = learnModel_.data() + learnRadix_[b];
+        const learned_model* end = learnModel_.data() + learnRadix_[b+1];
+        while( m != end && !(key < m->key_) )
+            ++m;
+        --m;
+        slot = m->slot_ + m->slope_ * keySpan(m->key_, key);
+    }
+    slot = std::min(std::max(slot, 0.0), static_cast<double>(learnLeaf_.size()) * LEAF_MAX_ - 1);
+    const std::size_t li = static_cast<std::size_t>(slot) / LEAF_MAX_;
+
+    leafNode* n = learnLeaf_[li];
+    for(int step = 0; ; ++step) {
+        if( n->size_ == 0 || step > 2 )
+            return false;
+        leafNode* side = nullptr;
+        if( key < n->key_[0] ) {
+            side = n->prev_;
+            if( !side || (side->size_ && side->key_[side->size_-1] < key) ) {
+                leaf = nullptr;
+                return true;
+            }
+        } else if( n->key_[n->size_-1] < key ) {
+            side = n->next_;
+            if( !side || (side->size_ && key < side->key_[0]) ) {
+                leaf = nullptr;
+                return true;
+            }
+        } else {
+            break;
+        }
+        n = side;
+    }
+
+    // search the predicted window if it brackets key, else the whole leaf
+    unsigned int a = 0, b = n->size_;
+    if( n == learnLeaf_[li] ) {
+        const double pos = (slot - static_cast<double>(li) * LEAF_MAX_) * n->size_ / LEAF_MAX_;
+        const double r = static_cast<double>(learnEps_) * n->size_ / LEAF_MAX_ + 2;
+        a = static_cast<unsigned int>(std::max(pos - r, 0.0));
+        b = static_cast<unsigned int>(std::min(pos + r + 1, static_cast<double>(n->size_)));
+        if( a >= b || (a > 0 && !(n->key_[a-1] < key)) || (b < n->size_ && n->key_[b-1] < key) ) {
+            a = 0;
+            b = n->size_;
+        }
+    }
+    leaf = n;
+    idx = a + _Search::lower_bound(n->key_ + a, b - a, key);
+    return true;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::shrinkRoot() {
+    // the root has one child left, the child becomes the root
+    while( !root_->isLeafNode() && root_->size_ == 0 ) {
+        innerNode* inner = static_cast<innerNode*>(root_);
+        root_ = inner->child_[0];
+        freeNode(inner);
+    }
+    // the last element is gone
+    if( root_->size_ == 0 ) {
+        freeNode(root_);
+        root_ = nullptr;
+        head_ = tail_ = nullptr;
+    }
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::fixChildren(innerNode* inner) {
+    unsigned int i = 0;
+    while( inner->size_ > 0 && i <= inner->size_ ) {
+        node* child = inner->child_[i];
+        bool underflow = child->isLeafNode() ? static_cast<leafNode*>(child)->isUnderflow()
+                                             : static_cast<innerNode*>(child)->isUnderflow();
+        if( !underflow ) {
+            ++i;
+            continue;
+        }
+        // pair the child with its right sibling, the last child with its left one
+        unsigned int idx = i < inner->size_ ? i : i - 1;
+        if( fixPair(inner, idx) )
+            i = idx;
+        else
+            ++i;
+    }
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::fixPair(innerNode* inner, unsigned int idx) {
+    bool merged;
+    if( inner->child_[idx]->isLeafNode() ) {
+        leafNode* left = static_cast<leafNode*>(inner->child_[idx]);
+        leafNode* right = static_cast<leafNode*>(inner->child_[idx+1]);
+        const unsigned int total = left->size_ + right->size_;
+        merged = total <= static_cast<unsigned int>(LEAF_MAX_);
+        if( merged ) {
+            std::move(right->key_, right->key_ + right->size_, left->key_ + left->size_);
+            std::move(right->data_, right->data_ + right->size_, left->data_ + left->size_);
+            left->copyFingerprints(*right, 0, right->size_, left->size_);
+            left->size_ = total;
+            left->next_ = right->next_;
+            if( left->next_ == nullptr )
+                tail_ = left;
+            else
+                left->next_->prev_ = left;
+            freeNode(right);
+        } else if( left->size_ < right->size_ ) {
+            unsigned int cnt = total / 2 - left->size_;
+            std::move(right->key_, right->key_ + cnt, left->key_ + left->size_);
+            std::move(right->data_, right->data_ + cnt, left->data_ + left->size_);
+            std::move(right->key_ + cnt, right->key_ + right->size_, right->key_);
+            std::move(right->data_ + cnt, right->data_ + right->size_, right->data_);
+            left->copyFingerprints(*right, 0, cnt, left->size_);
+            right->copyFingerprints(*right, cnt, right->size_, 0);
+            left->size_ += cnt;
+            right->size_ -= cnt;
+        } else {
+            unsigned int cnt = left->size_ - total / 2;
+            std::move_backward(right->key_, right->key_ + right->size_, right->key_ + right->size_ + cnt);
+            std::move_backward(right->data_, right->data_ + right->size_, right->data_ + right->size_ + cnt);
+            std::move(left->key_ + left->size_ - cnt, left->key_ + left->size_, right->key_);
+            std::move(left->data_ + left->size_ - cnt, left->data_ + left->size_, right->data_);
+            right->copyFingerprintsBackward(*right, 0, right->size_, right->size_ + cnt);
+            right->copyFingerprints(*left, left->size_ - cnt, left->size_, 0);
+            left->size_ -= cnt;
+            right->size_ += cnt;
+        }
+        if( !merged )
+            inner->key_[idx] = left->key_[left->size_-1];
+    } else {
+        innerNode* left = static_cast<innerNode*>(inner->child_[idx]);
+        innerNode* right = static_cast<innerNode*>(inner->child_[idx+1]);
+        // the separator comes down between the two key arrays
+        std::vector<_key> keys(left->key_, left->key_ + left->size_);
+        keys.push_back(inner->key_[idx]);
+        keys.insert(keys.end(), right->key_, right->key_ + right->size_);
+        std::vector<node*> children(left->child_, left->child_ + left->size_ + 1);
+        children.insert(children.end(), right->child_, right->child_ + right->size_ + 1);
+
+        merged = children.size() <= static_cast<std::size_t>(INNER_MAX_ + 1);
+        unsigned int cnt = merged ? children.size() : children.size() / 2;
+        std::copy(children.begin(), children.begin() + cnt, left->child_);
+        std::copy(keys.begin(), keys.begin() + cnt - 1, left->key_);
+        left->size_ = cnt - 1;
+        if( merged ) {
+            freeNode(right);
+        } else {
+            std::copy(children.begin() + cnt, children.end(), right->child_);
+            std::copy(keys.begin() + cnt, keys.end(), right->key_);
+            right->size_ = children.size() - cnt - 1;
+            inner->key_[idx] = keys[cnt-1];
+        }
+        // an underflowing grandchild may now have a sibling to merge with
+        fixChildren(left);
+        recount(left);
+        if( !merged ) {
+            fixChildren(right);
+            recount(right);
+        }
+    }
+
+    if( merged ) {
+        // drop the right child and the separator in front of it, the
+        // merged node keeps the right child's separator
+        std::move(inner->key_ + idx + 1, inner->key_ + inner->size_, inner->key_ + idx);
+        std::copy(inner->child_ + idx + 2, inner->child_ + inner->size_ + 1, inner->child_ + idx + 1);
+        --inner->size_;
+    }
+    return merged;
+}
+
+// find an element, if true return key/data pair
+// else return false pair, a fingerprinted leaf only compares the keys
+// whose fingerprint matches
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+std::pair<bool, std::pair<_key, _data> >
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::find(const _key& key) const {
+    unsigned int idx;
+    leafNode* leaf = findSlot(key, idx);
+    if( leaf )
+        return std::make_pair(true, std::make_pair(leaf->key_[idx], leaf->data_[idx]) );
+
+    return std::make_pair(false, std::make_pair(_key(), _data()) );
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+_data* BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::find_ptr(const _key& key) {
+    unsigned int idx;
+    leafNode* leaf = findSlot(key, idx);
+    return leaf ? leaf->data_ + idx : nullptr;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+const _data* BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::find_ptr(const _key& key) const {
+    unsigned int idx;
+    leafNode* leaf = findSlot(key, idx);
+    return leaf ? leaf->data_ + idx : nullptr;
+}
+
+// the leaf which holds key and its index there, nullptr if not found
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::leafNode*
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::findSlot(const _key& key, unsigned int& idx) const {
+    leafNode* leaf;
+    if( !learnedFind(key, leaf, idx, learnable()) ) {
+        leaf = findLeaf(key);
+        if( leaf )
+            idx = _Traits::FINGERPRINT ? leaf->matchFingerprint(leaf->key_, leaf->size_, key) : find(leaf, key);
+    }
+    if( leaf && idx < leaf->size_ && leaf->key_[idx] == key )
+        return leaf;
+    return nullptr;
+}
+
+// BPlusTree::cursor
+// default constructor
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor::cursor() : tree_(nullptr), leaf_(nullptr), idx_(0) {
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor::cursor(const BPlusTree* tree, leafNode* leaf, unsigned int idx)
+    : tree_(tree), leaf_(leaf), idx_(idx) {
+    // normalize the position past the end of a leaf to the next leaf
+    if( leaf_ && idx_ >= leaf_->size_ ) {
+        leaf_ = leaf_->next_;
+        idx_ = 0;
+    }
+    if( leaf_ )
+        prefetchLeaf(leaf_->next_);
+}
+
+// move to the next element, walk to the next leaf at the end of current one
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor& BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor::operator++() {
+    assert( leaf_ );
+    if( ++idx_ >= leaf_->size_ ) {
+        leaf_ = leaf_->next_;
+        idx_ = 0;
+        if( leaf_ )
+            prefetchLeaf(leaf_->next_);
+    }
+    return *this;
+}
+
+// move to the previous element, decrement end() moves to the last element
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor& BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor::operator--() {
+    if( !leaf_ ) {
+        leaf_ = tree_ ? tree_->tail_ : nullptr;
+        idx_ = leaf_ ? leaf_->size_ - 1 : 0;
+    } else if( idx_ == 0 ) {
+        leaf_ = leaf_->prev_;
+        if( leaf_ ) {
+            idx_ = leaf_->size_ - 1;
+            prefetchLeaf(leaf_->prev_);
         }
+    } else {
+        --idx_;
+    }
+    return *this;
+}
 
-    };
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor::operator==(const cursor &other) const {
+    return leaf_ == other.leaf_ && idx_ == other.idx_;
+}
 
-    // innernode can only store the key and pointer to child node
-    class innerNode : public node {
-    public:
-        // no argument constructor
-        innerNode() {};
-        // one argument constructor
-        innerNode(unsigned int l) : node(l) {}
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor::operator!=(const cursor &other) const {
+    return !(*this == other);
+}
 
-        // innernode only store keys and pointers to children
-        _key key_[INNER_MAX_];
-        node* child_[INNER_MAX_+1]; // child is one more than the key
+// cursor to the first element
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::begin() const {
+    return cursor(this, head_, 0);
+}
 
-        inline bool isFull() const {
-            return node::size_ == INNER_MAX_;
-        }
-        inline bool isUnderflow() const {
-            return node::size_ < INNER_MIN_;
-        }
-        inline bool isFew() const {
-            return node::size_ >= INNER_MIN_;
-        }
-    };
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::end() const {
+    return cursor(this, nullptr, 0);
+}
 
-    // leaf node can store key/data pair
-    class leafNode : public node {
-    public:
-        // no argument constructor
-        leafNode() : prev_(nullptr), next_(nullptr) {};
+// cursor to the first element which is not less than key
+// the separator may be larger than the leaf's last key after erase, so
+// the leaf found may hold only smaller keys, cursor moves to next leaf then
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::lower_bound(const _key& key) const {
+    leafNode* leaf = findLeaf(key);
+    if( !leaf )
+        return end();
+    return cursor(this, leaf, find(leaf, key));
+}
 
-        // pointer to previous leafnode
-        leafNode* prev_;
-        // pointer to next leafnode
-        leafNode* next_;
-        // leafnode must store keys and data
-        _key key_[LEAF_MAX_];
-        _data data_[LEAF_MAX_];
+// cursor to the first element which is greater than key
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::upper_bound(const _key& key) const {
+    cursor c = lower_bound(key);
+    // keys are unique, so skip at most one equal key
+    if( c.valid() && !(key < c.key()) )
+        ++c;
+    return c;
+}
 
-        inline bool isFull() const {
-            return node::size_ == LEAF_MAX_;
-        }
-        inline bool isUnderflow() const {
-            return node::size_ < LEAF_MIN_;
+// visit every element in [lo, hi) leaf by leaf
+// the next leaf is prefetched before the current one is processed
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename Function>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::scan(const _key& lo, const _key& hi, Function f) const {
+    std::size_t cnt = 0;
+    leafNode* leaf = findLeaf(lo);
+    if( !leaf || !(lo < hi) )
+        return cnt;
+    unsigned int idx = find(leaf, lo);
+    while( leaf ) {
+        prefetchLeaf(leaf->next_);
+        for(; idx < leaf->size_; ++idx) {
+            if( !(leaf->key_[idx] < hi) )
+                return cnt;
+            f(leaf->key_[idx], leaf->data_[idx]);
+            ++cnt;
         }
-        inline bool isFew() const {
-            return node::size_ >= LEAF_MIN_;
-        }
-        inline void setData(unsigned int idx, std::pair<_key, _data> val) {
-            assert( idx < LEAF_MAX_ );
-            key_[idx] = val.first;
-            key_[idx] = val.second;
-        }
-    };
-
-    void split_innernode(innerNode* n, node* &splitNode, _key& splitKey, unsigned int idx);
-    void split_leafnode(leafNode* n, node* &splitNode, _key& splitKey);
-
-    bool insert(node* node_, const _key& key, const _data& data, node* &splitNode, _key& splitKey);
+        leaf = leaf->next_;
+        idx = 0;
+    }
+    return cnt;
+}
 
-    result_t erase(const _key& val,node* n,node* left,node* right,innerNode* leftParent,innerNode* rightParent,innerNode* parent,unsigned int idxParent);
-    result_t shift_left_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent);
-    void shift_left_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent);
-    void shift_right_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent);
-    void shift_right_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent);
-    result_t merge_inner(innerNode* left, innerNode* right, innerNode* parent, unsigned int idxParent);
-    result_t merge_leaves(leafNode* left, leafNode* right, innerNode* parent);
-};
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename Function>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::parallel_scan(const _key& lo, const _key& hi, Function f,
+                                                                               unsigned int threads) const {
+    if( !(lo < hi) )
+        return 0;
+    return reduceParts(&lo, &hi, std::size_t(0), [&f](std::size_t& cnt, const _key& key, const _data& data) {
+        f(key, data);
+        ++cnt;
+    }, [](std::size_t a, std::size_t b) { return a + b; }, threads);
+}
 
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename Function>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::parallel_scan(Function f, unsigned int threads) const {
+    return reduceParts(nullptr, nullptr, std::size_t(0), [&f](std::size_t& cnt, const _key& key, const _data& data) {
+        f(key, data);
+        ++cnt;
+    }, [](std::size_t a, std::size_t b) { return a + b; }, threads);
+}
 
-// default constructor -- only initialize the private variable
-template<typename _key, typename _data, int _M, int _L>
-BPlusTree<_key,_data,_M,_L>::BPlusTree() {
-    root_ = nullptr;
-    head_ = nullptr;
-    tail_ = nullptr;
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename T, typename Function, typename Merge>
+T BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::parallel_reduce(const _key& lo, const _key& hi, T init, Function f, Merge merge,
+                                                                      unsigned int threads) const {
+    if( !(lo < hi) )
+        return init;
+    return reduceParts(&lo, &hi, init, f, merge, threads);
 }
 
-// return the number of key/data pairs in BPlusTree
-template<typename _key, typename _data, int _M, int _L>
-const std::size_t BPlusTree<_key,_data,_M,_L>::size() const {
-    return stats_.itemCount_;
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename T, typename Function, typename Merge>
+T BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::parallel_reduce(T init, Function f, Merge merge, unsigned int threads) const {
+    return reduceParts(nullptr, nullptr, init, f, merge, threads);
 }
 
-// check whether the BPlusTree contains at least one key/data pair
-template<typename _key, typename _data, int _M, int _L>
-const bool BPlusTree<_key,_data,_M,_L>::empty() const {
-    return size() == 0;
+// in key order : the separators below child i, then the separator right of
+// it. Only the children between the paths to lo and hi overlap the range
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::splitRange(const node* n, const _key* lo, const _key* hi,
+                                                                    unsigned int depth, std::vector<_key>& bounds) const {
+    if( depth == 0 || n->isLeafNode() )
+        return;
+    const innerNode* inner = static_cast<const innerNode*>(n);
+    const unsigned int a = lo ? find(inner, *lo) : 0;
+    const unsigned int b = hi ? find(inner, *hi) : inner->size_;
+    for(unsigned int i = a; i <= b; ++i) {
+        splitRange(inner->child_[i], lo, hi, depth - 1, bounds);
+        if( i < b && (!lo || *lo < inner->key_[i]) )
+            bounds.push_back(inner->key_[i]);
+    }
 }
 
-// destructor
-template<typename _key, typename _data, int _M, int _L>
-BPlusTree<_key,_data,_M,_L>::~BPlusTree() {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename T, typename Function>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::scanPart(const _key* lo, const _key* hi, T& acc, Function& f) const {
+    leafNode* leaf = lo ? findLeaf(*lo) : head_;
+    if( !leaf )
+        return;
+    unsigned int idx = lo ? find(leaf, *lo) : 0;
+    // fold into a local, acc shares cache lines with the other parts
+    T local(std::move(acc));
+    for(; leaf; leaf = leaf->next_, idx = 0) {
+        prefetchLeaf(leaf->next_);
+        // only the last leaf of the part needs the bound check
+        unsigned int end = leaf->size_;
+        if( hi && end > 0 && !(leaf->key_[end-1] < *hi) )
+            end = find(leaf, *hi);
+        for(; idx < end; ++idx)
+            f(local, leaf->key_[idx], leaf->data_[idx]);
+        if( end < leaf->size_ )
+            break;
+    }
+    acc = std::move(local);
 }
 
+// the range is cut at the separators of the shallowest inner levels which
+// give a few parts per thread, the calling thread works in the pool too.
+// The first exception thrown by f stops the pool and is rethrown
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename T, typename Function, typename Merge>
+T BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::reduceParts(const _key* lo, const _key* hi, T init, Function f, Merge merge,
+                                                                  unsigned int threads) const {
+    if( threads == 0 )
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t want = threads > 1 ? threads * 4 : 1;
+    std::vector<_key> bounds;
+    if( root_ && want > 1 ) {
+        for(unsigned int depth = 1; depth <= root_->level_; ++depth) {
+            bounds.clear();
+            splitRange(root_, lo, hi, depth, bounds);
+            if( bounds.size() + 1 >= want )
+                break;
+        }
+    }
+    // stale separators left by erase may repeat or step back, any
+    // increasing subsequence cuts the range into disjoint parts
+    std::size_t m = 0;
+    for(std::size_t i = 0; i < bounds.size(); ++i)
+        if( m == 0 || bounds[m-1] < bounds[i] )
+            bounds[m++] = bounds[i];
+    bounds.resize(m);
+    const std::size_t parts = bounds.size() + 1;
+
+    std::vector<T> results(parts, init);
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        try {
+            for(std::size_t i = next++; i < parts; i = next++)
+                scanPart(i > 0 ? &bounds[i-1] : lo, i + 1 < parts ? &bounds[i] : hi, results[i], f);
+        } catch(...) {
+            std::lock_guard<std::mutex> lk(errorMutex);
+            if( !error )
+                error = std::current_exception();
+            next = parts;
+        }
+    };
+    std::vector<std::thread> pool;
+    for(std::size_t t = 1; t < std::min<std::size_t>(threads, parts); ++t)
+        pool.push_back(std::thread(worker));
+    worker();
+    for(auto& t : pool)
+        t.join();
+    if( error )
+        std::rethrow_exception(error);
+
+    T result = results[0];
+    for(std::size_t i = 1; i < parts; ++i)
+        result = merge(result, results[i]);
+    return result;
+}
 
-// find an element, if true return key/data pair
-// else return false pair
-template<typename _key, typename _data, int _M, int _L>
-std::pair<bool, std::pair<_key, _data> >
-BPlusTree<_key,_data,_M,_L>::find(const _key& key) const {
+// add up the counts of the children left of the path to key
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::rank(const _key& key) const {
+    static_assert(_Traits::COUNTED, "rank needs btree_counted_traits");
+    std::size_t r = 0;
     node* n = root_;
     if( !n )
-        return std::make_pair(false, std::make_pair(_key(), _data()) );
+        return r;
     while( !n->isLeafNode() ) {
-        innerNode* tmp = static_cast<innerNode*>(n);
-        int idx = find(tmp, key);
-        n = tmp->child_[idx];
+        innerNode* inner = static_cast<innerNode*>(n);
+        unsigned int idx = find(inner, key);
+        for(unsigned int i = 0; i < idx; ++i)
+            r += inner->childCount(i);
+        n = inner->child_[idx];
     }
+    return r + find(static_cast<leafNode*>(n), key);
+}
 
-    leafNode* leaf = static_cast<leafNode*>(n);
-    const unsigned int idx = find(leaf, key);
-    if( idx < leaf->size_ && leaf->key_[idx] == key )
-        return std::make_pair(true, std::make_pair(leaf->key_[idx], leaf->data_[idx]) );
+// descend into the child which holds rank k, skipping the counts of the
+// children left of it
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::cursor BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::select(std::size_t k) const {
+    static_assert(_Traits::COUNTED, "select needs btree_counted_traits");
+    if( k >= size() )
+        return end();
+    node* n = root_;
+    while( !n->isLeafNode() ) {
+        innerNode* inner = static_cast<innerNode*>(n);
+        unsigned int i = 0;
+        while( i < inner->size_ && k >= inner->childCount(i) ) {
+            k -= inner->childCount(i);
+            ++i;
+        }
+        n = inner->child_[i];
+    }
+    return cursor(this, static_cast<leafNode*>(n), k);
+}
 
-    return std::make_pair(false, std::make_pair(_key(), _data()) );
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+std::size_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::count_range(const _key& lo, const _key& hi) const {
+    if( !(lo < hi) )
+        return 0;
+    return rank(hi) - rank(lo);
 }
 
 // remove one element
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::erase(const _key& val) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::erase(const _key& val) {
     if( !root_ )
         return;
     result_t res = erase(val, root_, nullptr, nullptr,nullptr,nullptr,nullptr, 0);
-    if( !res.has(btree_not_found) )
+    if( !res.has(btree_not_found) ) {
         --stats_.itemCount_;
+        learnWrite();
+    }
 }
 
 // descends down the tree for searching the key
 // and remove it after found
-template<typename _key, typename _data, int _M, int _L>
-typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::erase(const _key& val,
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::result_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::erase(const _key& val,
                                         node* n,
                                         node* left,
                                         node* right,
@@ -325,13 +2601,14 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
         if( idx >= leaf->size_ || leaf->key_[idx] != val )
             return btree_not_found;
         // if found , then erase the key
-        std::copy(leaf->key_ + idx + 1, leaf->key_ + leaf->size_, leaf->key_ + idx);
-        std::copy(leaf->data_ + idx + 1, leaf->data_ + leaf->size_, leaf->data_ + idx);
+        std::move(leaf->key_ + idx + 1, leaf->key_ + leaf->size_, leaf->key_ + idx);
+        std::move(leaf->data_ + idx + 1, leaf->data_ + leaf->size_, leaf->data_ + idx);
+        leaf->copyFingerprints(*leaf, idx + 1, leaf->size_, idx);
         --leaf->size_;
 
         result_t res = btree_ok;
         // if the key is the last one
-        if( idx == leaf->size_ ) {
+        if( idx == leaf->size_ && leaf->size_ >= 1 ) {
             if( parent && idxParent < parent->size_ )
                 parent->key_[idxParent] = leaf->key_[leaf->size_ - 1];
             else {
@@ -341,9 +2618,10 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
             }
         }
 
-        if( leaf->isUnderflow() && !( leaf == root_ && leaf->size_ >= 1 ) ) {
+        if( leaf->size_ < leafMin_ && !( leaf == root_ && leaf->size_ >= 1 ) ) {
             // case1 : if leaf == root, then reset to null
             if( leftLeaf == nullptr && rightLeaf == nullptr ) {
+                freeNode(leaf);
                 root_ = nullptr;
                 leaf = nullptr;
                 head_ = tail_ = nullptr;
@@ -399,7 +2677,7 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
 
         int idx = find(inner, val);
         if( idx == 0 ) {
-            myleft = left ? (static_cast<innerNode*>(left))->child_[left->size_-1] : nullptr;
+            myleft = left ? (static_cast<innerNode*>(left))->child_[left->size_] : nullptr;
             myleftParent = leftParent;
         } else {
             myleft = inner->child_[idx-1];
@@ -418,6 +2696,8 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
         result_t myRes = btree_ok;
         if( res.has(btree_not_found) )
             return res;
+        // the child may have shifted with or merged into a neighbour
+        const int idxChild = idx;
         if( res.has(btree_update_lastkey) ) {
             if( parent && idxParent < parent->size_ )
                 parent->key_[idxParent] = res.lastKey_;
@@ -429,7 +2709,8 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
             // either current node or the next is empty and should be removed
             if( inner->child_[idx]->size_ != 0 )
                 ++idx;
-            std::copy(inner->key_+idx, inner->key_+inner->size_, inner->key_+idx-1);
+            freeNode(inner->child_[idx]);
+            std::move(inner->key_+idx, inner->key_+inner->size_, inner->key_+idx-1);
             std::copy(inner->child_ +idx+1, inner->child_ +inner->size_+1, inner->child_+idx);
             --inner->size_;
 
@@ -439,13 +2720,15 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
                 inner->key_[idx] = child->key_[child->size_-1];
             }
         }
+        // a merge shifts the children behind it
+        recount(inner, idxChild - 1, res.has(btree_fixmerge) ? INNER_MAX_ : idxChild + 1);
 
-        if( inner->isUnderflow() && !(inner == root_ && inner->size_ >= 1) ) {
+        if( inner->size_ < innerMin_ && !(inner == root_ && inner->size_ >= 1) ) {
             // case1 : the inner node is the root and has just one child, the
             // child becomes the new root
             if( leftInner == nullptr && rightInner == nullptr ) {
                 root_ = inner->child_[0];
-                inner->size_ = 0;
+                freeNode(inner);
                 return btree_ok;
             }
             // case2 : if both left and right leaves would underflow if shift,
@@ -489,13 +2772,14 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::eras
 }
 
 // merge two leaf nodes
-template<typename _key, typename _data, int _M, int _L>
-typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::merge_leaves(leafNode* left, leafNode* right, innerNode* parent) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::result_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::merge_leaves(leafNode* left, leafNode* right, innerNode* parent) {
 
-    std::copy(right->key_, right->key_ + right->size_,
+    std::move(right->key_, right->key_ + right->size_,
               left->key_ + left->size_);
-    std::copy(right->data_, right->data_ + right->size_,
+    std::move(right->data_, right->data_ + right->size_,
               left->data_ + left->size_);
+    left->copyFingerprints(*right, 0, right->size_, left->size_);
 
     left->size_ += right->size_;
 
@@ -511,20 +2795,21 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::merg
 }
 
 // Merge two inner nodes.
-template<typename _key, typename _data, int _M, int _L>
-typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::merge_inner(innerNode* left, innerNode* right, innerNode* parent, unsigned int idxParent) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::result_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::merge_inner(innerNode* left, innerNode* right, innerNode* parent, unsigned int idxParent) {
     // retrieve the decision key from parent
     left->key_[left->size_] = parent->key_[idxParent];
     ++left->size_;
 
     // copy over keys and children from right
-    std::copy(right->key_, right->key_ + right->size_,
+    std::move(right->key_, right->key_ + right->size_,
               left->key_ + left->size_);
     std::copy(right->child_, right->child_ + right->size_+1,
               left->child_ + left->size_);
 
     left->size_ += right->size_;
     right->size_ = 0;
+    recount(left);
 
     return btree_fixmerge;
 }
@@ -532,26 +2817,28 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::merg
 /// Balance two leaf nodes. The function moves key/data pairs from right to
 /// left so that both nodes are equally filled. The parent node is updated
 /// if possible.
-template<typename _key, typename _data, int _M, int _L>
-typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::shift_left_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::result_t BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::shift_left_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent) {
     unsigned int shiftnum = (right->size_ - left->size_) >> 1;
 
 
     // copy the first items from the right node to the last slot in the left node.
 
-    std::copy(right->key_, right->key_ + shiftnum,
+    std::move(right->key_, right->key_ + shiftnum,
               left->key_ + left->size_);
-    std::copy(right->data_, right->data_ + shiftnum,
+    std::move(right->data_, right->data_ + shiftnum,
               left->data_ + left->size_);
+    left->copyFingerprints(*right, 0, shiftnum, left->size_);
 
     left->size_ += shiftnum;
 
     // shift all slots in the right node to the left
 
-    std::copy(right->key_ + shiftnum, right->key_ + right->size_,
+    std::move(right->key_ + shiftnum, right->key_ + right->size_,
               right->key_);
-    std::copy(right->data_ + shiftnum, right->data_ + right->size_,
+    std::move(right->data_ + shiftnum, right->data_ + right->size_,
               right->data_);
+    right->copyFingerprints(*right, shiftnum, right->size_, 0);
 
     right->size_ -= shiftnum;
 
@@ -568,8 +2855,8 @@ typename BPlusTree<_key,_data,_M,_L>::result_t BPlusTree<_key,_data,_M,_L>::shif
 /// Balance two inner nodes. The function moves key/data pairs from right
 /// to left so that both nodes are equally filled. The parent node is
 /// updated if possible.
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::shift_left_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::shift_left_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent) {
     unsigned int shiftnum = (right->size_ - left->size_) >> 1;
 
 
@@ -579,7 +2866,7 @@ void BPlusTree<_key,_data,_M,_L>::shift_left_inner(innerNode *left, innerNode *r
 
     // copy the other items from the right node to the last slots in the left node.
 
-    std::copy(right->key_, right->key_ + shiftnum-1,
+    std::move(right->key_, right->key_ + shiftnum-1,
               left->key_ + left->size_);
     std::copy(right->child_, right->child_ + shiftnum,
               left->child_ + left->size_);
@@ -591,35 +2878,39 @@ void BPlusTree<_key,_data,_M,_L>::shift_left_inner(innerNode *left, innerNode *r
 
     // shift all slots in the right node
 
-    std::copy(right->key_ + shiftnum, right->key_ + right->size_,
+    std::move(right->key_ + shiftnum, right->key_ + right->size_,
               right->key_);
     std::copy(right->child_ + shiftnum, right->child_ + right->size_+1,
               right->child_);
 
     right->size_ -= shiftnum;
+    recount(left);
+    recount(right);
 }
 
 /// Balance two leaf nodes. The function moves key/data pairs from left to
 /// right so that both nodes are equally filled. The parent node is updated
 /// if possible.
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::shift_right_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::shift_right_leaf(leafNode *left, leafNode *right, innerNode *parent, unsigned int idxParent) {
 
     unsigned int shiftnum = (left->size_ - right->size_) >> 1;
 
 
-    std::copy_backward(right->key_, right->key_ + right->size_,
+    std::move_backward(right->key_, right->key_ + right->size_,
                        right->key_ + right->size_ + shiftnum);
-    std::copy_backward(right->data_, right->data_ + right->size_,
+    std::move_backward(right->data_, right->data_ + right->size_,
                        right->data_ + right->size_ + shiftnum);
+    right->copyFingerprintsBackward(*right, 0, right->size_, right->size_ + shiftnum);
 
     right->size_ += shiftnum;
 
     // copy the last items from the left node to the first slot in the right node.
-    std::copy(left->key_ + left->size_ - shiftnum, left->key_ + left->size_,
+    std::move(left->key_ + left->size_ - shiftnum, left->key_ + left->size_,
               right->key_);
-    std::copy(left->data_ + left->size_ - shiftnum, left->data_ + left->size_,
+    std::move(left->data_ + left->size_ - shiftnum, left->data_ + left->size_,
               right->data_);
+    right->copyFingerprints(*left, left->size_ - shiftnum, left->size_, 0);
 
     left->size_ -= shiftnum;
 
@@ -629,13 +2920,13 @@ void BPlusTree<_key,_data,_M,_L>::shift_right_leaf(leafNode *left, leafNode *rig
 /// Balance two inner nodes. The function moves key/data pairs from left to
 /// right so that both nodes are equally filled. The parent node is updated
 /// if possible.
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::shift_right_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::shift_right_inner(innerNode *left, innerNode *right, innerNode *parent, unsigned int idxParent) {
 
     unsigned int shiftnum = (left->size_ - right->size_) >> 1;
 
 
-    std::copy_backward(right->key_, right->key_ + right->size_,
+    std::move_backward(right->key_, right->key_ + right->size_,
                        right->key_ + right->size_ + shiftnum);
     std::copy_backward(right->child_, right->child_ + right->size_+1,
                        right->child_ + right->size_+1 + shiftnum);
@@ -646,7 +2937,7 @@ void BPlusTree<_key,_data,_M,_L>::shift_right_inner(innerNode *left, innerNode *
     right->key_[shiftnum - 1] = parent->key_[idxParent];
 
     // copy the remaining last items from the left node to the first slot in the right node.
-    std::copy(left->key_ + left->size_ - shiftnum+1, left->key_ + left->size_,
+    std::move(left->key_ + left->size_ - shiftnum+1, left->key_ + left->size_,
               right->key_);
     std::copy(left->child_ + left->size_ - shiftnum+1, left->child_ + left->size_+1,
               right->child_);
@@ -655,12 +2946,66 @@ void BPlusTree<_key,_data,_M,_L>::shift_right_inner(innerNode *left, innerNode *
     parent->key_[idxParent] = left->key_[left->size_ - shiftnum];
 
     left->size_ -= shiftnum;
+    recount(left);
+    recount(right);
 }
 
 // insert an element into BPlusTree
 // current we don't support identical key
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::insert(const _key& key, const _data& data) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::insert(const _key& key, const _data& data) {
+    bool inserted;
+    std::pair<leafNode*, unsigned int> s = place(key, inserted);
+    if( inserted )
+        s.first->data_[s.second] = data;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::insert(_key&& key, _data&& data) {
+    bool inserted;
+    std::pair<leafNode*, unsigned int> s = place(std::move(key), inserted);
+    if( inserted )
+        s.first->data_[s.second] = std::move(data);
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename... Args>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::emplace(const _key& key, Args&&... args) {
+    bool inserted;
+    std::pair<leafNode*, unsigned int> s = place(key, inserted);
+    if( inserted )
+        construct(s.first->data_[s.second], std::integral_constant<bool, std::is_nothrow_constructible<_data, Args&&...>::value>(),
+                  std::forward<Args>(args)...);
+    return inserted;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename... Args>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::emplace(_key&& key, Args&&... args) {
+    bool inserted;
+    std::pair<leafNode*, unsigned int> s = place(std::move(key), inserted);
+    if( inserted )
+        construct(s.first->data_[s.second], std::integral_constant<bool, std::is_nothrow_constructible<_data, Args&&...>::value>(),
+                  std::forward<Args>(args)...);
+    return inserted;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename Function>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::upsert(const _key& key, Function f) {
+    bool inserted;
+    std::pair<leafNode*, unsigned int> s = place(key, inserted);
+    _data& data = s.first->data_[s.second];
+    if( inserted )
+        construct(data, std::integral_constant<bool, std::is_nothrow_default_constructible<_data>::value>());
+    f(data);
+    return inserted;
+}
+
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename K>
+std::pair<typename BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::leafNode*, unsigned int>
+BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::place(K&& key, bool& inserted) {
     // if root_ is nullptr, first create the root node
     if( root_ == nullptr )
         root_ = head_ = tail_ = newLeaf();
@@ -669,7 +3014,9 @@ void BPlusTree<_key,_data,_M,_L>::insert(const _key& key, const _data& data) {
     // if inner node has been split, we must handle if split propagates to root
     node* newChild = nullptr;
     _key newKey;
-    bool res = insert(root_, key, data, newChild, newKey);
+    leafNode* leaf;
+    unsigned int slot;
+    inserted = insert(root_, std::forward<K>(key), newChild, newKey, leaf, slot);
 
     // if newChild is not null, we must put the shiftup key into root
     if( newChild ) {
@@ -681,27 +3028,36 @@ void BPlusTree<_key,_data,_M,_L>::insert(const _key& key, const _data& data) {
         newRoot->child_[1] = newChild;
 
         newRoot->size_ = 1;
+        recount(newRoot);
         root_ = newRoot;
     }
 
     // after insertion, update the item count
-    if( res )
+    if( inserted ) {
         ++stats_.itemCount_;
+        learnWrite();
+    }
+    return std::make_pair(leaf, slot);
 }
 
 // insert helper function
-// descent down to leaf and insert key/pair
+// descent down to leaf and insert key, the new slot or the one which
+// already holds key is returned in leaf/slot
 // if the node overflows, then split the node and shiftup until root
-template<typename _key, typename _data, int _M, int _L>
-bool BPlusTree<_key,_data,_M,_L>::insert(node* node_, const _key& key,
-    const _data& data, node* &splitNode, _key& splitKey) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+template<typename K>
+bool BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::insert(node* node_, K&& key, node* &splitNode, _key& splitKey,
+                                                                 leafNode* &leaf, unsigned int &slot) {
 
     if( node_->isLeafNode() ) {
         leafNode* n = static_cast<leafNode*>(node_);
         int idx = find(n, key);
         // if key has already existed, just return
-        if( idx < n->size_ && n->key_[idx] == key )
+        if( idx < n->size_ && n->key_[idx] == key ) {
+            leaf = n;
+            slot = idx;
             return false;
+        }
         if( n->isFull() ) {
             split_leafnode(n, splitNode, splitKey);
 
@@ -711,20 +3067,18 @@ bool BPlusTree<_key,_data,_M,_L>::insert(node* node_, const _key& key,
                 n = static_cast<leafNode*>(splitNode);
             }
         }
-        // insert key/data into node
-        std::copy_backward(n->key_ + idx, n->key_ + n->size_,
+        // insert key into node, the data slot is filled by the caller
+        std::move_backward(n->key_ + idx, n->key_ + n->size_,
                            n->key_ + n->size_ + 1);
-        std::copy_backward(n->data_ + idx, n->data_ + n->size_,
+        std::move_backward(n->data_ + idx, n->data_ + n->size_,
                            n->data_ + n->size_ + 1);
-        n->key_[idx] = key;
-        n->data_[idx] = data;
+        n->copyFingerprintsBackward(*n, idx, n->size_, n->size_ + 1);
+        n->key_[idx] = std::forward<K>(key);
+        n->setFingerprint(idx, n->key_[idx]);
         ++n->size_;
 
-        // if the inserted key/data is the first of leafnode
-        // we should update splitKey
-        if( splitNode && n == splitNode && idx == 0 )
-            splitKey = key;
-
+        leaf = n;
+        slot = idx;
         return true;
 
     } else {
@@ -734,7 +3088,9 @@ bool BPlusTree<_key,_data,_M,_L>::insert(node* node_, const _key& key,
         // then descent down to child node
         node* newChild = nullptr;
         _key newKey;
-        bool res = insert(n->child_[idx], key, data, newChild, newKey);
+        bool res = insert(n->child_[idx], std::forward<K>(key), newChild, newKey, leaf, slot);
+        if( res && !newChild )
+            n->addChildCount(idx, 1);
 
         // if newChild is not null, we must put the shiftup key into root
         if( newChild ) {
@@ -754,12 +3110,14 @@ bool BPlusTree<_key,_data,_M,_L>::insert(node* node_, const _key& key,
                     tmp->child_[0] = newChild;
                     splitKey = newKey;
 
+                    recount(n);
+                    recount(tmp);
                     return res;
 
                 }
             }
 
-            std::copy_backward(n->key_ + idx, n->key_ + n->size_,
+            std::move_backward(n->key_ + idx, n->key_ + n->size_,
                                n->key_ + n->size_ + 1);
             std::copy_backward(n->child_ + idx, n->child_ + n->size_ + 1,
                                n->child_ + n->size_ + 2);
@@ -767,14 +3125,23 @@ bool BPlusTree<_key,_data,_M,_L>::insert(node* node_, const _key& key,
             n->key_[idx] = newKey;
             n->child_[idx+1] = newChild;
             ++n->size_;
+
+            // the children right of the split child moved up by one, all
+            // of them moved if this node has been split
+            if( splitNode ) {
+                recount(static_cast<innerNode*>(node_));
+                recount(static_cast<innerNode*>(splitNode));
+            } else {
+                recount(n, idx);
+            }
         }
         return res;
     }
 }
 
 // splits a leaf node into two equal size leaves
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::split_leafnode(leafNode* n, node* &splitNode, _key& splitKey) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::split_leafnode(leafNode* n, node* &splitNode, _key& splitKey) {
     unsigned int m = n->size_ / 2;
 
     leafNode* leaf = newLeaf();
@@ -788,8 +3155,9 @@ void BPlusTree<_key,_data,_M,_L>::split_leafnode(leafNode* n, node* &splitNode,
         leaf->next_->prev_ = leaf;
 
     // move the half key/data to new leaf node
-    std::copy(n->key_ + m, n->key_ + n->size_, leaf->key_);
-    std::copy(n->data_ + m, n->data_ + n->size_, leaf->data_);
+    std::move(n->key_ + m, n->key_ + n->size_, leaf->key_);
+    std::move(n->data_ + m, n->data_ + n->size_, leaf->data_);
+    leaf->copyFingerprints(*n, m, n->size_, 0);
 
     // set the original leafnode chain to new leaf node
     n->size_ = m;
@@ -802,15 +3170,15 @@ void BPlusTree<_key,_data,_M,_L>::split_leafnode(leafNode* n, node* &splitNode,
 }
 
 // splits a inner node into two equal size leaves
-template<typename _key, typename _data, int _M, int _L>
-void BPlusTree<_key,_data,_M,_L>::split_innernode(innerNode* n, node* &splitNode, _key& splitKey, unsigned int idx) {
+template<typename _key, typename _data, int _M, int _L, typename _Search, typename _Alloc, typename _Traits>
+void BPlusTree<_key,_data,_M,_L,_Search,_Alloc,_Traits>::split_innernode(innerNode* n, node* &splitNode, _key& splitKey, unsigned int idx) {
     unsigned int m = n->size_ / 2;
 
     // TODO
     innerNode* inner = newInner(n->level_);
 
     inner->size_ = n->size_ - m - 1;
-    std::copy(n->key_ + m + 1, n->key_ + n->size_, inner->key_);
+    std::move(n->key_ + m + 1, n->key_ + n->size_, inner->key_);
     std::copy(n->child_ + m + 1, n->child_ + n->size_ + 1, inner->child_);
 
     n->size_ = m;
@@ -819,4 +3187,572 @@ void BPlusTree<_key,_data,_M,_L>::split_innernode(innerNode* n, node* &splitNode
     splitNode = inner;
 }
 
+// pause inside a spin loop, it lets the core know another thread holds
+// the cache line. Without a known pause instruction it only keeps the
+// compiler from folding the loop
+inline void btree_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// concurrent BPlusTree with optimistic lock coupling
+// every node carries a version counter, readers never write shared
+// memory : they remember the version before reading a node and validate
+// it afterwards, restarting from the root if the node has changed.
+// Writers lock only the nodes they modify, full nodes are split eagerly
+// on the way down so a split never propagates upwards. An erase which
+// underflows a leaf merges it with a sibling under the same parent,
+// inner nodes are never merged.
+// Nodes unlinked by a merge may still be read by concurrent readers, so
+// they are retired with the current epoch. Every operation announces the
+// epoch it started in, a retired node is released by a later merge once
+// no announced epoch is as old as its tag.
+// keys and data are read optimistically, so both must be trivially copyable
+// The default node sizes fit BLOCK_SIZE with the version in the header
+template<typename _key,
+         typename _data,
+         int _M = btree_layout<_key, _data, BLOCK_SIZE, btree_default_traits, sizeof(uint64_t) + 2 * sizeof(unsigned int)>::INNER_MAX,
+         int _L = btree_layout<_key, _data, BLOCK_SIZE, btree_default_traits, sizeof(uint64_t) + 2 * sizeof(unsigned int)>::LEAF_MAX,
+         typename _Search = btree_default_search>
+class BPlusTree_olc {
+    static_assert(std::is_trivially_copyable<_key>::value, "BPlusTree_olc needs trivially copyable keys");
+    static_assert(std::is_trivially_copyable<_data>::value, "BPlusTree_olc needs trivially copyable data");
+public:
+    // default constructor
+    explicit BPlusTree_olc() : root_(new leafNode()), count_(0), epoch_(1) { }
+    // non-copyable
+    BPlusTree_olc(const BPlusTree_olc &other) = delete;
+    BPlusTree_olc(BPlusTree_olc &&) = delete;
+    BPlusTree_olc& operator=(const BPlusTree_olc &other) = delete;
+    // destructor
+    ~BPlusTree_olc() {
+        clear(root_.load());
+        for(auto &r : retired_)
+            freeNode(r.node_);
+    }
+
+    // return the size of tree
+    std::size_t size() const {
+        return count_.load();
+    }
+
+    // check whether the tree is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // number of retired nodes not released yet
+    std::size_t pending() const {
+        std::lock_guard<std::mutex> lock(retiredMutex_);
+        return retired_.size();
+    }
+
+    // find an element, if true return key/data pair
+    // else return false pair
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+        epochGuard guard(this);
+        int restartCount = 0;
+    restart:
+        if( restartCount++ )
+            backoff(restartCount);
+        bool needRestart = false;
+
+        node* n = root_.load();
+        uint64_t v = n->readLockOrRestart(needRestart);
+        if( needRestart || n != root_.load() )
+            goto restart;
+
+        while( !n->isLeafNode() ) {
+            innerNode* inner = static_cast<innerNode*>(n);
+            node* child = inner->child_[inner->lowerBound(key)];
+            inner->checkOrRestart(v, needRestart);
+            if( needRestart )
+                goto restart;
+            uint64_t vChild = child->readLockOrRestart(needRestart);
+            if( needRestart )
+                goto restart;
+            // the child is reached from a valid parent, release the parent
+            inner->readUnlockOrRestart(v, needRestart);
+            if( needRestart )
+                goto restart;
+            n = child;
+            v = vChild;
+        }
+
+        leafNode* leaf = static_cast<leafNode*>(n);
+        unsigned int idx = leaf->lowerBound(key);
+        bool found = idx < leaf->size_ && leaf->key_[idx] == key;
+        _data data = found ? leaf->data_[idx] : _data();
+        leaf->readUnlockOrRestart(v, needRestart);
+        if( needRestart )
+            goto restart;
+        return std::make_pair(found, std::make_pair(found ? key : _key(), data));
+    }
+
+    // insert an element, identical key is ignored
+    // return whether the key is inserted
+    bool insert(const _key& key, const _data& data) {
+        epochGuard guard(this);
+        int restartCount = 0;
+    restart:
+        if( restartCount++ )
+            backoff(restartCount);
+        bool needRestart = false;
+
+        node* n = root_.load();
+        uint64_t v = n->readLockOrRestart(needRestart);
+        if( needRestart || n != root_.load() )
+            goto restart;
+
+        innerNode* parent = nullptr;
+        uint64_t vParent = 0;
+
+        while( true ) {
+            // split a full node before descending through it
+            if( n->isFull() ) {
+                if( parent ) {
+                    parent->upgradeToWriteLockOrRestart(vParent, needRestart);
+                    if( needRestart )
+                        goto restart;
+                }
+                n->upgradeToWriteLockOrRestart(v, needRestart);
+                if( needRestart ) {
+                    if( parent )
+                        parent->writeUnlock();
+                    goto restart;
+                }
+                // a new root has been installed meanwhile
+                if( !parent && n != root_.load() ) {
+                    n->writeUnlock();
+                    goto restart;
+                }
+                _key splitKey;
+                node* splitNode = n->isLeafNode() ?
+                    static_cast<node*>(static_cast<leafNode*>(n)->split(splitKey)) :
+                    static_cast<node*>(static_cast<innerNode*>(n)->split(splitKey));
+                if( parent ) {
+                    parent->insert(splitKey, splitNode);
+                } else {
+                    innerNode* newRoot = new innerNode(n->level_ + 1);
+                    newRoot->key_[0] = splitKey;
+                    newRoot->child_[0] = n;
+                    newRoot->child_[1] = splitNode;
+                    newRoot->size_ = 1;
+                    root_.store(newRoot);
+                }
+                n->writeUnlock();
+                if( parent )
+                    parent->writeUnlock();
+                goto restart;
+            }
+
+            if( n->isLeafNode() )
+                break;
+
+            if( parent ) {
+                parent->readUnlockOrRestart(vParent, needRestart);
+                if( needRestart )
+                    goto restart;
+            }
+            innerNode* inner = static_cast<innerNode*>(n);
+            parent = inner;
+            vParent = v;
+
+            n = inner->child_[inner->lowerBound(key)];
+            inner->checkOrRestart(v, needRestart);
+            if( needRestart )
+                goto restart;
+            v = n->readLockOrRestart(needRestart);
+            if( needRestart )
+                goto restart;
+        }
+
+        // the leaf has room, lock only the leaf
+        leafNode* leaf = static_cast<leafNode*>(n);
+        leaf->upgradeToWriteLockOrRestart(v, needRestart);
+        if( needRestart )
+            goto restart;
+        if( parent ) {
+            parent->readUnlockOrRestart(vParent, needRestart);
+            if( needRestart ) {
+                leaf->writeUnlock();
+                goto restart;
+            }
+        }
+        bool res = leaf->insert(key, data);
+        leaf->writeUnlock();
+        if( res )
+            ++count_;
+        return res;
+    }
+
+    // remove one element, return whether the key is removed
+    bool erase(const _key& key) {
+        epochGuard guard(this);
+        int restartCount = 0;
+    restart:
+        if( restartCount++ )
+            backoff(restartCount);
+        bool needRestart = false;
+
+        node* n = root_.load();
+        uint64_t v = n->readLockOrRestart(needRestart);
+        if( needRestart || n != root_.load() )
+            goto restart;
+
+        innerNode* parent = nullptr;
+        uint64_t vParent = 0;
+        unsigned int pos = 0;
+
+        while( !n->isLeafNode() ) {
+            if( parent ) {
+                parent->readUnlockOrRestart(vParent, needRestart);
+                if( needRestart )
+                    goto restart;
+            }
+            innerNode* inner = static_cast<innerNode*>(n);
+            parent = inner;
+            vParent = v;
+
+            pos = inner->lowerBound(key);
+            n = inner->child_[pos];
+            inner->checkOrRestart(v, needRestart);
+            if( needRestart )
+                goto restart;
+            v = n->readLockOrRestart(needRestart);
+            if( needRestart )
+                goto restart;
+        }
+
+        leafNode* leaf = static_cast<leafNode*>(n);
+        // merge with a sibling if the leaf would underflow, lock the parent
+        // before the leaf and the sibling just like the split path
+        if( parent && parent->size_ > 0 && leaf->size_ <= LEAF_MIN_ ) {
+            unsigned int idx = pos < parent->size_ ? pos : pos - 1;
+            parent->upgradeToWriteLockOrRestart(vParent, needRestart);
+            if( needRestart )
+                goto restart;
+            leafNode* left = static_cast<leafNode*>(parent->child_[idx]);
+            leafNode* right = static_cast<leafNode*>(parent->child_[idx+1]);
+            leafNode* sibling = left == leaf ? right : left;
+            leaf->upgradeToWriteLockOrRestart(v, needRestart);
+            if( needRestart ) {
+                parent->writeUnlock();
+                goto restart;
+            }
+            uint64_t vSibling = sibling->readLockOrRestart(needRestart);
+            if( !needRestart )
+                sibling->upgradeToWriteLockOrRestart(vSibling, needRestart);
+            if( needRestart ) {
+                leaf->writeUnlock();
+                parent->writeUnlock();
+                goto restart;
+            }
+
+            bool res = leaf->erase(key);
+            if( left->size_ + right->size_ <= LEAF_MAX_ ) {
+                left->merge(right);
+                parent->remove(idx);
+                left->writeUnlock();
+                right->writeUnlockObsolete();
+                retire(right);
+            } else {
+                leaf->writeUnlock();
+                sibling->writeUnlock();
+            }
+            parent->writeUnlock();
+            if( res )
+                --count_;
+            return res;
+        }
+
+        leaf->upgradeToWriteLockOrRestart(v, needRestart);
+        if( needRestart )
+            goto restart;
+        if( parent ) {
+            parent->readUnlockOrRestart(vParent, needRestart);
+            if( needRestart ) {
+                leaf->writeUnlock();
+                goto restart;
+            }
+        }
+        bool res = leaf->erase(key);
+        leaf->writeUnlock();
+        if( res )
+            --count_;
+        return res;
+    }
+
+private:
+    static const int INNER_MAX_ = _M;
+    static const int LEAF_MAX_ = _L;
+    static const int LEAF_MIN_ = LEAF_MAX_ / 2;
+    // operations running at once beyond this wait for a free slot
+    static const std::size_t EPOCH_SLOTS_ = 64;
+
+    // spin for a while before restarting, yield if contention persists
+    static inline void backoff(int restartCount) {
+        if( restartCount < 32 ) {
+            for(int i = 0; i < restartCount; ++i)
+                btree_cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    // base class of node, holds the optimistic lock
+    // bit 0 of version marks the node obsolete, bit 1 marks it locked
+    class node {
+    public:
+        node(unsigned int l) : version_(0x4), level_(l), size_(0) {}
+        std::atomic<uint64_t> version_;
+        // 0 for leaf node, never changes after construction
+        const unsigned int level_;
+        unsigned int size_;
+
+        inline bool isLeafNode() const {
+            return level_ == 0;
+        }
+        inline bool isFull() const {
+            return size_ == static_cast<unsigned int>(isLeafNode() ? LEAF_MAX_ : INNER_MAX_);
+        }
+
+        static inline bool isLocked(uint64_t v) {
+            return (v & 0x2) == 0x2;
+        }
+        static inline bool isObsolete(uint64_t v) {
+            return (v & 0x1) == 0x1;
+        }
+        // wait until the node is unlocked and return the version
+        uint64_t readLockOrRestart(bool &needRestart) const {
+            uint64_t v = version_.load();
+            while( isLocked(v) ) {
+                btree_cpu_relax();
+                v = version_.load();
+            }
+            if( isObsolete(v) )
+                needRestart = true;
+            return v;
+        }
+        // validate that nothing has changed since v was read
+        void readUnlockOrRestart(uint64_t v, bool &needRestart) const {
+            needRestart = v != version_.load();
+        }
+        void checkOrRestart(uint64_t v, bool &needRestart) const {
+            readUnlockOrRestart(v, needRestart);
+        }
+        // lock the node if it has not changed since v was read
+        void upgradeToWriteLockOrRestart(uint64_t &v, bool &needRestart) {
+            if( version_.compare_exchange_strong(v, v + 0x2) )
+                v += 0x2;
+            else
+                needRestart = true;
+        }
+        // unlock and bump the version
+        void writeUnlock() {
+            version_.fetch_add(0x2);
+        }
+        void writeUnlockObsolete() {
+            version_.fetch_add(0x3);
+        }
+    };
+
+    class innerNode : public node {
+    public:
+        innerNode(unsigned int l) : node(l) {}
+        _key key_[INNER_MAX_];
+        node* child_[INNER_MAX_+1];
+
+        inline unsigned int lowerBound(const _key& key) const {
+            // the size may be read while a writer changes it
+            unsigned int n = std::min<unsigned int>(node::size_, INNER_MAX_);
+            return _Search::lower_bound(key_, n, key);
+        }
+        // insert a separator and the right child created by a split
+        void insert(const _key& key, node* child) {
+            unsigned int idx = lowerBound(key);
+            std::copy_backward(key_ + idx, key_ + node::size_, key_ + node::size_ + 1);
+            std::copy_backward(child_ + idx + 1, child_ + node::size_ + 1, child_ + node::size_ + 2);
+            key_[idx] = key;
+            child_[idx+1] = child;
+            ++node::size_;
+        }
+        // remove key idx and child idx + 1 after they are merged
+        void remove(unsigned int idx) {
+            std::copy(key_ + idx + 1, key_ + node::size_, key_ + idx);
+            std::copy(child_ + idx + 2, child_ + node::size_ + 1, child_ + idx + 1);
+            --node::size_;
+        }
+        innerNode* split(_key& splitKey) {
+            unsigned int m = node::size_ / 2;
+            innerNode* inner = new innerNode(node::level_);
+            inner->size_ = node::size_ - m - 1;
+            std::copy(key_ + m + 1, key_ + node::size_, inner->key_);
+            std::copy(child_ + m + 1, child_ + node::size_ + 1, inner->child_);
+            splitKey = key_[m];
+            node::size_ = m;
+            return inner;
+        }
+    };
+
+    class leafNode : public node {
+    public:
+        leafNode() : node(0) {}
+        _key key_[LEAF_MAX_];
+        _data data_[LEAF_MAX_];
+
+        inline unsigned int lowerBound(const _key& key) const {
+            unsigned int n = std::min<unsigned int>(node::size_, LEAF_MAX_);
+            return _Search::lower_bound(key_, n, key);
+        }
+        bool insert(const _key& key, const _data& data) {
+            unsigned int idx = lowerBound(key);
+            if( idx < node::size_ && key_[idx] == key )
+                return false;
+            std::copy_backward(key_ + idx, key_ + node::size_, key_ + node::size_ + 1);
+            std::copy_backward(data_ + idx, data_ + node::size_, data_ + node::size_ + 1);
+            key_[idx] = key;
+            data_[idx] = data;
+            ++node::size_;
+            return true;
+        }
+        bool erase(const _key& key) {
+            unsigned int idx = lowerBound(key);
+            if( idx >= node::size_ || key_[idx] != key )
+                return false;
+            std::copy(key_ + idx + 1, key_ + node::size_, key_ + idx);
+            std::copy(data_ + idx + 1, data_ + node::size_, data_ + idx);
+            --node::size_;
+            return true;
+        }
+        // move all pairs of the right sibling into this leaf
+        void merge(leafNode* right) {
+            std::copy(right->key_, right->key_ + right->size_, key_ + node::size_);
+            std::copy(right->data_, right->data_ + right->size_, data_ + node::size_);
+            node::size_ += right->size_;
+        }
+        leafNode* split(_key& splitKey) {
+            unsigned int m = node::size_ / 2;
+            leafNode* leaf = new leafNode();
+            leaf->size_ = node::size_ - m;
+            std::copy(key_ + m, key_ + node::size_, leaf->key_);
+            std::copy(data_ + m, data_ + node::size_, leaf->data_);
+            node::size_ = m;
+            splitKey = key_[m-1];
+            return leaf;
+        }
+    };
+
+    // the layout bounds both nodes, so the default sizes fit BLOCK_SIZE
+    typedef btree_node_bytes<_key, _data, btree_default_traits, sizeof(uint64_t) + 2 * sizeof(unsigned int)> node_bytes;
+    static_assert(sizeof(innerNode) <= node_bytes::inner(INNER_MAX_) && sizeof(leafNode) <= node_bytes::leaf(LEAF_MAX_),
+                  "BPlusTree_olc: node layout exceeds btree_node_bytes");
+
+    static void freeNode(node* n) {
+        if( n->isLeafNode() )
+            delete static_cast<leafNode*>(n);
+        else
+            delete static_cast<innerNode*>(n);
+    }
+
+    static void clear(node* n) {
+        if( !n->isLeafNode() ) {
+            innerNode* inner = static_cast<innerNode*>(n);
+            for(unsigned int i = 0; i <= inner->size_; ++i)
+                clear(inner->child_[i]);
+        }
+        freeNode(n);
+    }
+
+    // one announced epoch per running operation, 0 marks a free slot.
+    // Slots are padded to a cache line so announcing does not bounce the
+    // lines of other threads
+    struct epochSlot {
+        std::atomic<uint64_t> epoch_;
+        char pad_[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+
+        epochSlot() : epoch_(0) {}
+    };
+
+    // a node unlinked while the epoch was tag_
+    struct retiredNode {
+        uint64_t tag_;
+        node* node_;
+    };
+
+    // announce the current epoch in a free slot for one operation
+    class epochGuard {
+    public:
+        explicit epochGuard(const BPlusTree_olc* tree) : slot_(tree->enter()) {}
+        ~epochGuard() {
+            slot_->store(0);
+        }
+    private:
+        std::atomic<uint64_t>* slot_;
+    };
+
+    // a thread starts probing at the slot it took last time, so without
+    // contention every thread keeps its own slot
+    std::atomic<uint64_t>* enter() const {
+        static thread_local std::size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id()) % EPOCH_SLOTS_;
+        for(std::size_t i = 0; ; ++i) {
+            std::size_t idx = (hint + i) % EPOCH_SLOTS_;
+            std::atomic<uint64_t>& slot = active_[idx].epoch_;
+            uint64_t free = 0;
+            if( slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(free, epoch_.load()) ) {
+                hint = idx;
+                return &slot;
+            }
+            if( i % EPOCH_SLOTS_ == EPOCH_SLOTS_ - 1 )
+                std::this_thread::yield();
+        }
+    }
+
+    // keep an unlinked node until no operation can reach it. An operation
+    // which announced an epoch after the tag started below the unlink, one
+    // which has not announced yet when the slots are read starts later
+    void retire(node* n) {
+        std::vector<node*> dead;
+        {
+            std::lock_guard<std::mutex> lock(retiredMutex_);
+            retiredNode r;
+            r.tag_ = epoch_.fetch_add(1);
+            r.node_ = n;
+            retired_.push_back(r);
+            reclaim(dead);
+        }
+        for(auto d : dead)
+            freeNode(d);
+    }
+
+    // collect the retired nodes older than every announced epoch,
+    // retiredMutex_ is held
+    void reclaim(std::vector<node*> &dead) {
+        uint64_t oldest = epoch_.load();
+        for(std::size_t i = 0; i < EPOCH_SLOTS_; ++i) {
+            uint64_t e = active_[i].epoch_.load();
+            if( e != 0 && e < oldest )
+                oldest = e;
+        }
+        while( !retired_.empty() && retired_.front().tag_ < oldest ) {
+            dead.push_back(retired_.front().node_);
+            retired_.pop_front();
+        }
+    }
+
+    std::atomic<node*> root_;
+    std::atomic<std::size_t> count_;
+    // bumped by every retire, starts at 1 as 0 marks a free slot
+    std::atomic<uint64_t> epoch_;
+    mutable epochSlot active_[EPOCH_SLOTS_];
+    // guards retired_, tags are increasing from front to back
+    mutable std::mutex retiredMutex_;
+    std::deque<retiredNode> retired_;
+};
+
 #endif
\ No newline at end of file
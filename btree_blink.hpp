@@ -0,0 +1,438 @@
+#ifndef _BPlusTree_BLINK_HPP_
+#define _BPlusTree_BLINK_HPP_
+
+#include "btree.hpp"
+
+// bytes in front of the keys of a B-link node
+template<typename _key>
+struct btree_blink_header {
+    // version, level, size, right link and high key
+    static const std::size_t BYTES = btree_align_up(sizeof(uint64_t) + 2 * sizeof(unsigned int) + sizeof(void*), alignof(_key)) + sizeof(_key);
+};
+
+// concurrent BPlusTree after Lehman and Yao (B-link tree)
+// every node keeps a high key, the largest key it may hold, and a link to
+// its right sibling on the same level. The rightmost node of a level has
+// no link and no bound. A split moves the upper half into a new right
+// sibling and publishes it by linking it behind the old node, under the
+// lock of the old node only. The separator goes into the parent
+// afterwards, under the lock of the parent alone. Whoever reaches a node
+// whose high key is below the key, during a split or after it, follows
+// the right link. So nobody restarts from the root and a writer never
+// holds more than one lock while it waits for another.
+// Readers take no locks : like BPlusTree_olc they read a node
+// optimistically and validate its version, a failed read retries the
+// same node.
+// erase only removes the pair from its leaf. Nodes are never merged and
+// only released when the tree is destroyed, so no reader can reach freed
+// memory.
+// keys and data are read optimistically, so both must be trivially copyable
+// The default node sizes fit BLOCK_SIZE with the B-link header
+template<typename _key,
+         typename _data,
+         int _M = btree_layout<_key, _data, BLOCK_SIZE, btree_default_traits, btree_blink_header<_key>::BYTES>::INNER_MAX,
+         int _L = btree_layout<_key, _data, BLOCK_SIZE, btree_default_traits, btree_blink_header<_key>::BYTES>::LEAF_MAX,
+         typename _Search = btree_default_search>
+class BPlusTree_blink {
+    static_assert(std::is_trivially_copyable<_key>::value, "BPlusTree_blink needs trivially copyable keys");
+    static_assert(std::is_trivially_copyable<_data>::value, "BPlusTree_blink needs trivially copyable data");
+    static_assert(_M >= 3 && _L >= 2, "BPlusTree_blink nodes too small");
+    class node;
+    class innerNode;
+    class leafNode;
+
+public:
+    // default constructor
+    explicit BPlusTree_blink() : root_(new leafNode()), count_(0) { }
+    // non-copyable
+    BPlusTree_blink(const BPlusTree_blink &other) = delete;
+    BPlusTree_blink(BPlusTree_blink &&) = delete;
+    BPlusTree_blink& operator=(const BPlusTree_blink &other) = delete;
+    // destructor
+    // every level is a chain of right links from its leftmost node, and
+    // the leftmost node of a level is the first child of the one above
+    ~BPlusTree_blink() {
+        node* first = root_.load();
+        while( first ) {
+            node* below = first->isLeafNode() ? nullptr : static_cast<innerNode*>(first)->child_[0];
+            for(node* n = first; n; ) {
+                node* next = n->right_;
+                freeNode(n);
+                n = next;
+            }
+            first = below;
+        }
+    }
+
+    // return the size of tree
+    std::size_t size() const {
+        return count_.load();
+    }
+
+    // check whether the tree is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // find an element, if true return key/data pair
+    // else return false pair
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+        unsigned int top;
+        node* n = descend(key, 0, nullptr, top);
+        while( true ) {
+            uint64_t v = n->readLock();
+            node* next = n->moveRight(key);
+            if( next ) {
+                if( n->validate(v) )
+                    n = next;
+                continue;
+            }
+            const leafNode* leaf = static_cast<const leafNode*>(n);
+            unsigned int idx = leaf->lowerBound(key);
+            bool found = idx < leaf->count() && leaf->key_[idx] == key;
+            _data data = found ? leaf->data_[idx] : _data();
+            if( n->validate(v) )
+                return std::make_pair(found, std::make_pair(found ? key : _key(), data));
+        }
+    }
+
+    // insert an element, identical key is ignored
+    // return whether the key is inserted
+    bool insert(const _key& key, const _data& data) {
+        innerNode* path[MAX_HEIGHT];
+        unsigned int top;
+        leafNode* leaf = static_cast<leafNode*>(lockCovering(descend(key, 0, path, top), key));
+        unsigned int idx = leaf->lowerBound(key);
+        if( idx < leaf->size_ && leaf->key_[idx] == key ) {
+            leaf->writeUnlock();
+            return false;
+        }
+        if( !leaf->isFull() ) {
+            leaf->insert(idx, key, data);
+            leaf->writeUnlock();
+            ++count_;
+            return true;
+        }
+        // the new right half is complete before the unlock publishes it
+        _key splitKey;
+        leafNode* right = leaf->split(splitKey);
+        if( key < splitKey || key == splitKey )
+            leaf->insert(leaf->lowerBound(key), key, data);
+        else
+            right->insert(right->lowerBound(key), key, data);
+        leaf->writeUnlock();
+        ++count_;
+        insertParent(leaf, splitKey, right, path, top);
+        return true;
+    }
+
+    // remove one element, return whether the key is removed
+    bool erase(const _key& key) {
+        unsigned int top;
+        leafNode* leaf = static_cast<leafNode*>(lockCovering(descend(key, 0, nullptr, top), key));
+        bool res = leaf->erase(key);
+        leaf->writeUnlock();
+        if( res )
+            --count_;
+        return res;
+    }
+
+    // call f(key, data) on every element in [lo, hi) in order
+    // every leaf is read consistently, the scan as a whole is not a
+    // snapshot of the tree. return the number of visited elements
+    template<typename Function>
+    std::size_t scan(const _key& lo, const _key& hi, Function f) const {
+        std::size_t cnt = 0;
+        if( !(lo < hi) )
+            return cnt;
+        unsigned int top;
+        node* n = descend(lo, 0, nullptr, top);
+        // the pairs of one leaf, copied while its version is valid
+        std::pair<_key, _data> buf[LEAF_MAX_];
+        // keys up to the high key of the last visited leaf are done
+        _key from = lo;
+        while( true ) {
+            uint64_t v = n->readLock();
+            node* next = n->moveRight(from);
+            if( next ) {
+                if( n->validate(v) )
+                    n = next;
+                continue;
+            }
+            const leafNode* leaf = static_cast<const leafNode*>(n);
+            unsigned int m = 0;
+            for(unsigned int i = leaf->lowerBound(from); i < leaf->count() && leaf->key_[i] < hi; ++i)
+                buf[m++] = std::make_pair(leaf->key_[i], leaf->data_[i]);
+            next = leaf->right_;
+            const bool more = next && leaf->highKey_ < hi;
+            const _key high = leaf->highKey_;
+            if( !n->validate(v) )
+                continue;
+            for(unsigned int i = 0; i < m; ++i)
+                f(buf[i].first, buf[i].second);
+            cnt += m;
+            if( !more )
+                return cnt;
+            // the right sibling holds only keys above high
+            from = high;
+            n = next;
+        }
+    }
+
+private:
+    static const int INNER_MAX_ = _M;
+    static const int LEAF_MAX_ = _L;
+    // nodes never merge, so a split node keeps at least half of its
+    // fanout and the tree stays far below this height
+    static const unsigned int MAX_HEIGHT = 48;
+
+    // spin for a while, yield if the lock holder does not finish
+    static inline void backoff(int &spins) {
+        if( ++spins < 64 )
+            btree_cpu_relax();
+        else
+            std::this_thread::yield();
+    }
+
+    // base class of node, holds the version lock and the B-link fields
+    // an odd version means the node is locked
+    class node {
+    public:
+        node(unsigned int l) : version_(0), level_(l), size_(0), right_(nullptr), highKey_() {}
+        std::atomic<uint64_t> version_;
+        // 0 for leaf node, never changes after construction
+        const unsigned int level_;
+        unsigned int size_;
+        // right sibling and the largest key of this node, the high key
+        // only counts if there is a right sibling
+        node* right_;
+        _key highKey_;
+
+        inline bool isLeafNode() const {
+            return level_ == 0;
+        }
+        inline bool isFull() const {
+            return size_ == static_cast<unsigned int>(isLeafNode() ? LEAF_MAX_ : INNER_MAX_);
+        }
+        // the right sibling if key lies beyond this node
+        inline node* moveRight(const _key& key) const {
+            return right_ && highKey_ < key ? right_ : nullptr;
+        }
+
+        // wait until the node is unlocked and return the version
+        uint64_t readLock() const {
+            int spins = 0;
+            uint64_t v = version_.load();
+            while( v & 1 ) {
+                backoff(spins);
+                v = version_.load();
+            }
+            return v;
+        }
+        // check that nothing has changed since v was read
+        bool validate(uint64_t v) const {
+            return v == version_.load();
+        }
+        void writeLock() {
+            int spins = 0;
+            uint64_t v = version_.load();
+            while( (v & 1) || !version_.compare_exchange_weak(v, v + 1) ) {
+                backoff(spins);
+                v = version_.load();
+            }
+        }
+        // unlock and bump the version
+        void writeUnlock() {
+            version_.fetch_add(1);
+        }
+    };
+
+    class innerNode : public node {
+    public:
+        innerNode(unsigned int l) : node(l) {}
+        _key key_[INNER_MAX_];
+        node* child_[INNER_MAX_+1];
+
+        // the size may be read while a writer changes it
+        inline unsigned int count() const {
+            return std::min<unsigned int>(node::size_, INNER_MAX_);
+        }
+        inline unsigned int lowerBound(const _key& key) const {
+            return _Search::lower_bound(key_, count(), key);
+        }
+        // insert the separator and the right child of a split child, the
+        // position follows from the key even if the child has split again
+        void insert(const _key& key, node* child) {
+            unsigned int idx = lowerBound(key);
+            std::copy_backward(key_ + idx, key_ + node::size_, key_ + node::size_ + 1);
+            std::copy_backward(child_ + idx + 1, child_ + node::size_ + 1, child_ + node::size_ + 2);
+            key_[idx] = key;
+            child_[idx+1] = child;
+            ++node::size_;
+        }
+        // move the upper half into a new right sibling, the middle key
+        // becomes the high key of this node
+        innerNode* split(_key& splitKey) {
+            unsigned int m = node::size_ / 2;
+            innerNode* inner = new innerNode(node::level_);
+            inner->size_ = node::size_ - m - 1;
+            std::copy(key_ + m + 1, key_ + node::size_, inner->key_);
+            std::copy(child_ + m + 1, child_ + node::size_ + 1, inner->child_);
+            inner->right_ = node::right_;
+            inner->highKey_ = node::highKey_;
+            splitKey = key_[m];
+            node::size_ = m;
+            node::highKey_ = splitKey;
+            node::right_ = inner;
+            return inner;
+        }
+    };
+
+    class leafNode : public node {
+    public:
+        leafNode() : node(0) {}
+        _key key_[LEAF_MAX_];
+        _data data_[LEAF_MAX_];
+
+        inline unsigned int count() const {
+            return std::min<unsigned int>(node::size_, LEAF_MAX_);
+        }
+        inline unsigned int lowerBound(const _key& key) const {
+            return _Search::lower_bound(key_, count(), key);
+        }
+        void insert(unsigned int idx, const _key& key, const _data& data) {
+            std::copy_backward(key_ + idx, key_ + node::size_, key_ + node::size_ + 1);
+            std::copy_backward(data_ + idx, data_ + node::size_, data_ + node::size_ + 1);
+            key_[idx] = key;
+            data_[idx] = data;
+            ++node::size_;
+        }
+        bool erase(const _key& key) {
+            unsigned int idx = lowerBound(key);
+            if( idx >= node::size_ || key_[idx] != key )
+                return false;
+            std::copy(key_ + idx + 1, key_ + node::size_, key_ + idx);
+            std::copy(data_ + idx + 1, data_ + node::size_, data_ + idx);
+            --node::size_;
+            return true;
+        }
+        // move the upper half into a new right sibling, the last key
+        // left behind becomes the high key of this leaf
+        leafNode* split(_key& splitKey) {
+            unsigned int m = node::size_ / 2;
+            leafNode* leaf = new leafNode();
+            leaf->size_ = node::size_ - m;
+            std::copy(key_ + m, key_ + node::size_, leaf->key_);
+            std::copy(data_ + m, data_ + node::size_, leaf->data_);
+            leaf->right_ = node::right_;
+            leaf->highKey_ = node::highKey_;
+            node::size_ = m;
+            splitKey = key_[m-1];
+            node::highKey_ = splitKey;
+            node::right_ = leaf;
+            return leaf;
+        }
+    };
+
+    // the layout bounds both nodes, so the default sizes fit BLOCK_SIZE
+    typedef btree_node_bytes<_key, _data, btree_default_traits, btree_blink_header<_key>::BYTES> node_bytes;
+    static_assert(sizeof(innerNode) <= node_bytes::inner(INNER_MAX_) && sizeof(leafNode) <= node_bytes::leaf(LEAF_MAX_),
+                  "BPlusTree_blink: node layout exceeds btree_node_bytes");
+
+    static void freeNode(node* n) {
+        if( n->isLeafNode() )
+            delete static_cast<leafNode*>(n);
+        else
+            delete static_cast<innerNode*>(n);
+    }
+
+    // optimistic descent to the node on level which may cover key, the
+    // caller locks it and moves right if it has split meanwhile.
+    // path, if given, receives the node left on every level above, top
+    // the level of the root the descent started from
+    node* descend(const _key& key, unsigned int level, innerNode** path, unsigned int& top) const {
+        node* n = root_.load();
+        top = n->level_;
+        while( n->level_ > level ) {
+            uint64_t v = n->readLock();
+            node* next = n->moveRight(key);
+            const bool down = next == nullptr;
+            if( down )
+                next = static_cast<innerNode*>(n)->child_[static_cast<innerNode*>(n)->lowerBound(key)];
+            if( !n->validate(v) )
+                continue;
+            if( down && path )
+                path[n->level_] = static_cast<innerNode*>(n);
+            n = next;
+        }
+        return n;
+    }
+
+    // lock the node which covers key, starting from n on the same level
+    // locks are taken left to right, one more only while moving right
+    static node* lockCovering(node* n, const _key& key) {
+        n->writeLock();
+        while( node* next = n->moveRight(key) ) {
+            next->writeLock();
+            n->writeUnlock();
+            n = next;
+        }
+        return n;
+    }
+
+    // post the separator of a split to the level above, splitting up the
+    // tree as long as the parents are full. No lock is held on entry
+    void insertParent(node* left, _key splitKey, node* right, innerNode** path, unsigned int top) {
+        while( true ) {
+            const unsigned int level = left->level_ + 1;
+            node* parent;
+            if( level <= top ) {
+                parent = path[level];
+            } else {
+                // left was the root when the descent started
+                std::unique_lock<std::mutex> lock(rootMutex_);
+                node* root = root_.load();
+                if( root == left ) {
+                    assert( level < MAX_HEIGHT );
+                    innerNode* newRoot = new innerNode(level);
+                    newRoot->key_[0] = splitKey;
+                    newRoot->child_[0] = left;
+                    newRoot->child_[1] = right;
+                    newRoot->size_ = 1;
+                    root_.store(newRoot);
+                    return;
+                }
+                lock.unlock();
+                // left is right of the old root, whose split has not
+                // installed the new root yet
+                if( root->level_ < level ) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                parent = descend(splitKey, level, nullptr, top);
+                top = level;
+            }
+
+            innerNode* inner = static_cast<innerNode*>(lockCovering(parent, splitKey));
+            if( !inner->isFull() ) {
+                inner->insert(splitKey, right);
+                inner->writeUnlock();
+                return;
+            }
+            _key upKey;
+            innerNode* sibling = inner->split(upKey);
+            (splitKey < upKey ? inner : sibling)->insert(splitKey, right);
+            inner->writeUnlock();
+            left = inner;
+            splitKey = upKey;
+            right = sibling;
+        }
+    }
+
+    std::atomic<node*> root_;
+    std::atomic<std::size_t> count_;
+    // serializes the installation of a new root
+    std::mutex rootMutex_;
+};
+
+#endif
@@ -0,0 +1,549 @@
+#ifndef _BPlusTree_BUFFERED_HPP_
+#define _BPlusTree_BUFFERED_HPP_
+
+#include "btree.hpp"
+
+// write-optimized BPlusTree (B-epsilon tree)
+// every inner node keeps a buffer of pending insert/erase messages sorted
+// by key. An update only adds a message to the root buffer, a full buffer
+// moves the messages of its busiest child one level down in one batch,
+// so a leaf is rewritten once for many updates. find checks the messages
+// on the path from the root, the newest message of a key wins.
+// The element count only covers messages which reached the leaves, flush()
+// pushes everything down. Underflowing leaves are merged with a sibling,
+// inner nodes are never merged.
+// The default leaf fits BLOCK_SIZE, inner nodes keep their arrays in
+// vectors and take the fanout of a BPlusTree inner node
+// @param :
+// _B : maximum number of messages buffered in one inner node, by
+//      default as many as 16 leaves hold
+template<typename _key,
+         typename _data,
+         int _M = btree_layout<_key, _data>::INNER_MAX,
+         int _L = btree_layout<_key, _data>::LEAF_MAX,
+         int _B = 16 * btree_layout<_key, _data>::LEAF_MAX,
+         typename _Search = btree_default_search>
+class BPlusTree_buffered {
+    class node;
+    class innerNode;
+    class leafNode;
+
+public:
+    // default constructor
+    explicit BPlusTree_buffered() : root_(nullptr), count_(0), pending_(0) {}
+    // non-copyable
+    BPlusTree_buffered(const BPlusTree_buffered &other) = delete;
+    BPlusTree_buffered(BPlusTree_buffered &&) = delete;
+    BPlusTree_buffered& operator=(const BPlusTree_buffered &other) = delete;
+    // destructor
+    ~BPlusTree_buffered() {
+        clear();
+    }
+
+    // insert an element, identical key is ignored once the message
+    // reaches the element
+    void insert(const _key& key, const _data& data) {
+        put(message(key, data, msg_insert));
+    }
+
+    // remove one element
+    void erase(const _key& key) {
+        put(message(key, _data(), msg_erase));
+    }
+
+    // find an element, if true return key/data pair
+    // else return false pair
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+        // inserts only apply if the key is absent below them, the oldest
+        // one of them decides the data
+        bool inserted = false;
+        _data insertData = _data();
+        const node* n = root_;
+        while( n && !n->isLeafNode() ) {
+            const innerNode* inner = static_cast<const innerNode*>(n);
+            const message* m = inner->findMessage(key);
+            if( m ) {
+                if( m->op_ == msg_put )
+                    return std::make_pair(true, std::make_pair(key, m->data_));
+                if( m->op_ == msg_erase )
+                    break;
+                inserted = true;
+                insertData = m->data_;
+            }
+            n = inner->child_[lowerBound(inner, key)];
+        }
+        if( n && n->isLeafNode() ) {
+            const leafNode* leaf = static_cast<const leafNode*>(n);
+            unsigned int idx = lowerBound(leaf, key);
+            if( idx < leaf->size_ && leaf->key_[idx] == key )
+                return std::make_pair(true, std::make_pair(key, leaf->data_[idx]));
+        }
+        if( inserted )
+            return std::make_pair(true, std::make_pair(key, insertData));
+        return std::make_pair(false, std::make_pair(_key(), _data()));
+    }
+
+    // apply every buffered message to the leaves
+    void flush() {
+        if( !root_ || root_->isLeafNode() )
+            return;
+        std::vector<split_type> splits;
+        flushAll(static_cast<innerNode*>(root_), splits);
+        growRoot(splits);
+        shrinkRoot();
+    }
+
+    // call f(key, data) on every element in [lo, hi) in order
+    // the buffered messages are flushed first
+    // return the number of visited elements
+    template<typename Function>
+    std::size_t scan(const _key& lo, const _key& hi, Function f) {
+        flush();
+        std::size_t cnt = 0;
+        if( !root_ || !(lo < hi) )
+            return cnt;
+        node* n = root_;
+        while( !n->isLeafNode() ) {
+            innerNode* inner = static_cast<innerNode*>(n);
+            n = inner->child_[lowerBound(inner, lo)];
+        }
+        leafNode* leaf = static_cast<leafNode*>(n);
+        unsigned int idx = lowerBound(leaf, lo);
+        while( leaf ) {
+            for(; idx < leaf->size_; ++idx) {
+                if( !(leaf->key_[idx] < hi) )
+                    return cnt;
+                f(leaf->key_[idx], leaf->data_[idx]);
+                ++cnt;
+            }
+            leaf = leaf->next_;
+            idx = 0;
+        }
+        return cnt;
+    }
+
+    // number of elements in the leaves, exact after flush()
+    std::size_t size() const {
+        return count_;
+    }
+
+    // check whether the tree is empty, exact after flush()
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    // number of messages buffered in inner nodes
+    std::size_t pending() const {
+        return pending_;
+    }
+
+    // remove all elements and messages
+    void clear() {
+        clear(root_);
+        root_ = nullptr;
+        count_ = 0;
+        pending_ = 0;
+    }
+
+private:
+    static const int INNER_MAX_ = _M;
+    static const int LEAF_MAX_ = _L;
+    static const int LEAF_MIN_ = LEAF_MAX_ / 2;
+    static const int BUFFER_MAX_ = _B;
+
+    // msg_insert adds the pair if the key is absent, msg_put adds or
+    // replaces it, msg_put only results from an insert after an erase
+    enum { msg_insert, msg_put, msg_erase };
+
+    struct message {
+        message() {}
+        message(const _key& key, const _data& data, int op) : key_(key), data_(data), op_(op) {}
+        _key key_;
+        _data data_;
+        int op_;
+
+        bool operator<(const message &other) const {
+            return key_ < other.key_;
+        }
+        // the net effect of this message followed by newer one
+        message then(const message &newer) const {
+            if( newer.op_ != msg_insert )
+                return newer;
+            if( op_ != msg_erase )
+                return *this;
+            return message(key_, newer.data_, msg_put);
+        }
+    };
+
+    // separator and node created right of it by a split
+    typedef std::pair<_key, node*> split_type;
+    typedef std::pair<_key, _data> value_type;
+
+    class node {
+    public:
+        explicit node(unsigned int l) : level_(l) {}
+        // 0 for leaf node
+        const unsigned int level_;
+
+        inline bool isLeafNode() const {
+            return level_ == 0;
+        }
+    };
+
+    // child i holds the keys in (key_[i-1], key_[i]], the buffer holds
+    // at most one message per key
+    class innerNode : public node {
+    public:
+        explicit innerNode(unsigned int l) : node(l) {}
+        std::vector<_key> key_;
+        std::vector<node*> child_;
+        std::vector<message> buffer_;
+
+        unsigned int size() const {
+            return key_.size();
+        }
+        const message* findMessage(const _key& key) const {
+            auto itr = std::lower_bound(buffer_.begin(), buffer_.end(), message(key, _data(), msg_insert));
+            if( itr != buffer_.end() && itr->key_ == key )
+                return &*itr;
+            return nullptr;
+        }
+    };
+
+    class leafNode : public node {
+    public:
+        leafNode() : node(0), size_(0), prev_(nullptr), next_(nullptr) {}
+        unsigned int size_;
+        leafNode* prev_;
+        leafNode* next_;
+        _key key_[LEAF_MAX_];
+        _data data_[LEAF_MAX_];
+    };
+
+    // the layout bounds the leaf, so the default size fits BLOCK_SIZE
+    static_assert(sizeof(leafNode) <= btree_node_bytes<_key, _data>::leaf(LEAF_MAX_),
+                  "BPlusTree_buffered: leaf layout exceeds btree_node_bytes");
+
+    static inline unsigned int lowerBound(const innerNode* n, const _key& key) {
+        return _Search::lower_bound(n->key_.data(), n->size(), key);
+    }
+    static inline unsigned int lowerBound(const leafNode* n, const _key& key) {
+        return _Search::lower_bound(n->key_, n->size_, key);
+    }
+
+    static void clear(node* n) {
+        if( !n )
+            return;
+        if( n->isLeafNode() ) {
+            delete static_cast<leafNode*>(n);
+            return;
+        }
+        innerNode* inner = static_cast<innerNode*>(n);
+        for(auto c : inner->child_)
+            clear(c);
+        delete inner;
+    }
+
+    // add one message at the root
+    void put(const message &m) {
+        if( !root_ )
+            root_ = new leafNode();
+        std::vector<split_type> splits;
+        if( root_->isLeafNode() ) {
+            // nothing to buffer in, apply the message right away
+            applyLeaf(static_cast<leafNode*>(root_), &m, &m + 1, splits);
+            growRoot(splits);
+            shrinkRoot();
+            return;
+        }
+        innerNode* root = static_cast<innerNode*>(root_);
+        auto itr = std::lower_bound(root->buffer_.begin(), root->buffer_.end(), m);
+        if( itr != root->buffer_.end() && itr->key_ == m.key_ ) {
+            *itr = itr->then(m);
+        } else {
+            root->buffer_.insert(itr, m);
+            ++pending_;
+        }
+        if( root->buffer_.size() > static_cast<std::size_t>(BUFFER_MAX_) ) {
+            flush(root, splits);
+            growRoot(splits);
+            shrinkRoot();
+        }
+    }
+
+    // put new roots on top of the root until it stops splitting
+    void growRoot(std::vector<split_type> &splits) {
+        while( !splits.empty() ) {
+            innerNode* root = new innerNode(root_->level_ + 1);
+            root->child_.push_back(root_);
+            for(auto &s : splits) {
+                root->key_.push_back(s.first);
+                root->child_.push_back(s.second);
+            }
+            root_ = root;
+            splits.clear();
+            splitInner(root, splits);
+        }
+    }
+
+    // remove roots with a single child, drop an empty leaf root
+    void shrinkRoot() {
+        while( !root_->isLeafNode() ) {
+            innerNode* root = static_cast<innerNode*>(root_);
+            if( root->size() > 0 )
+                return;
+            if( !root->buffer_.empty() ) {
+                // every message belongs to the only child
+                flushChild(root, 0);
+                std::vector<split_type> splits;
+                splitInner(root, splits);
+                growRoot(splits);
+                continue;
+            }
+            root_ = root->child_[0];
+            delete root;
+        }
+        if( static_cast<leafNode*>(root_)->size_ == 0 ) {
+            delete static_cast<leafNode*>(root_);
+            root_ = nullptr;
+        }
+    }
+
+    // move messages down until the buffer of n fits, a split of n is
+    // returned in splits
+    void flush(innerNode* n, std::vector<split_type> &splits) {
+        while( n->buffer_.size() > static_cast<std::size_t>(BUFFER_MAX_) )
+            flushChild(n, busiestChild(n));
+        splitInner(n, splits);
+    }
+
+    // move every message of the subtree of n down to the leaves
+    void flushAll(innerNode* n, std::vector<split_type> &splits) {
+        while( !n->buffer_.empty() )
+            flushChild(n, busiestChild(n));
+        if( n->level_ > 1 ) {
+            for(std::size_t i = 0; i < n->child_.size(); ++i) {
+                std::vector<split_type> childSplits;
+                flushAll(static_cast<innerNode*>(n->child_[i]), childSplits);
+                addSplits(n, i, childSplits);
+                i += childSplits.size();
+            }
+        }
+        splitInner(n, splits);
+    }
+
+    // index of the child with the most buffered messages
+    static unsigned int busiestChild(const innerNode* n) {
+        unsigned int best = 0, bestCnt = 0, i = 0, cnt = 0;
+        for(auto &m : n->buffer_) {
+            while( i < n->size() && n->key_[i] < m.key_ ) {
+                if( cnt > bestCnt ) {
+                    best = i;
+                    bestCnt = cnt;
+                }
+                ++i;
+                cnt = 0;
+            }
+            ++cnt;
+        }
+        return cnt > bestCnt ? i : best;
+    }
+
+    // move the messages for child i of n down in one batch
+    void flushChild(innerNode* n, unsigned int i) {
+        auto first = n->buffer_.begin();
+        auto last = n->buffer_.end();
+        message bound;
+        if( i > 0 ) {
+            bound.key_ = n->key_[i-1];
+            first = std::upper_bound(first, last, bound);
+        }
+        if( i < n->size() ) {
+            bound.key_ = n->key_[i];
+            last = std::upper_bound(first, last, bound);
+        }
+        if( first == last )
+            return;
+
+        std::vector<split_type> splits;
+        node* child = n->child_[i];
+        if( child->isLeafNode() ) {
+            applyLeaf(static_cast<leafNode*>(child), &*first, &*first + (last - first), splits);
+        } else {
+            mergeMessages(static_cast<innerNode*>(child), &*first, &*first + (last - first));
+            flush(static_cast<innerNode*>(child), splits);
+        }
+        pending_ -= last - first;
+        n->buffer_.erase(first, last);
+        addSplits(n, i, splits);
+        if( child->isLeafNode() && static_cast<leafNode*>(child)->size_ < static_cast<unsigned int>(LEAF_MIN_) )
+            fixLeaf(n, i);
+    }
+
+    // add the nodes split off child i right after it
+    static void addSplits(innerNode* n, unsigned int i, const std::vector<split_type> &splits) {
+        if( splits.empty() )
+            return;
+        // child i keeps the lowest keys, its old separator moves behind
+        // the last new node
+        std::vector<_key> keys;
+        std::vector<node*> nodes;
+        for(auto &s : splits) {
+            keys.push_back(s.first);
+            nodes.push_back(s.second);
+        }
+        n->key_.insert(n->key_.begin() + i, keys.begin(), keys.end());
+        n->child_.insert(n->child_.begin() + i + 1, nodes.begin(), nodes.end());
+    }
+
+    // merge the sorted messages [first, last) into the buffer of n, they
+    // are newer than the messages already there
+    void mergeMessages(innerNode* n, const message* first, const message* last) {
+        std::vector<message> &out = scratchMessages_;
+        out.clear();
+        out.reserve(n->buffer_.size() + (last - first));
+        pending_ += last - first;
+        auto itr = n->buffer_.begin();
+        for(; first != last; ++first) {
+            while( itr != n->buffer_.end() && itr->key_ < first->key_ )
+                out.push_back(*itr++);
+            if( itr != n->buffer_.end() && itr->key_ == first->key_ ) {
+                out.push_back(itr->then(*first));
+                ++itr;
+                --pending_;
+            } else {
+                out.push_back(*first);
+            }
+        }
+        out.insert(out.end(), itr, n->buffer_.end());
+        n->buffer_.swap(out);
+    }
+
+    // apply the sorted messages [first, last) to the leaf, a leaf which
+    // overflows is cut into several leaves returned in splits
+    void applyLeaf(leafNode* leaf, const message* first, const message* last, std::vector<split_type> &splits) {
+        std::vector<value_type> &out = scratchPairs_;
+        out.clear();
+        unsigned int i = 0;
+        for(; first != last; ++first) {
+            while( i < leaf->size_ && leaf->key_[i] < first->key_ ) {
+                out.push_back(value_type(leaf->key_[i], leaf->data_[i]));
+                ++i;
+            }
+            bool found = i < leaf->size_ && leaf->key_[i] == first->key_;
+            if( first->op_ == msg_erase ) {
+                if( found ) {
+                    ++i;
+                    --count_;
+                }
+            } else if( found ) {
+                out.push_back(value_type(leaf->key_[i], first->op_ == msg_put ? first->data_ : leaf->data_[i]));
+                ++i;
+            } else {
+                out.push_back(value_type(first->key_, first->data_));
+                ++count_;
+            }
+        }
+        for(; i < leaf->size_; ++i)
+            out.push_back(value_type(leaf->key_[i], leaf->data_[i]));
+
+        // spread the pairs evenly over as few leaves as possible
+        const std::size_t total = out.size();
+        const std::size_t groups = std::max<std::size_t>(1, (total + LEAF_MAX_ - 1) / LEAF_MAX_);
+        std::size_t pos = 0;
+        leafNode* n = leaf;
+        for(std::size_t g = 0; g < groups; ++g) {
+            std::size_t cnt = total / groups + (g < total % groups ? 1 : 0);
+            if( g > 0 ) {
+                leafNode* right = new leafNode();
+                right->prev_ = n;
+                right->next_ = n->next_;
+                if( n->next_ )
+                    n->next_->prev_ = right;
+                n->next_ = right;
+                splits.push_back(split_type(out[pos-1].first, right));
+                n = right;
+            }
+            for(std::size_t k = 0; k < cnt; ++k, ++pos) {
+                n->key_[k] = out[pos].first;
+                n->data_[k] = out[pos].second;
+            }
+            n->size_ = cnt;
+        }
+    }
+
+    // cut an overflowing inner node into nodes of at most INNER_MAX_ keys
+    // the key between two of them moves up, the buffer is cut along
+    void splitInner(innerNode* n, std::vector<split_type> &splits) {
+        if( n->size() <= static_cast<unsigned int>(INNER_MAX_) )
+            return;
+        const std::size_t children = n->child_.size();
+        const std::size_t groups = (children + INNER_MAX_) / (INNER_MAX_ + 1);
+        std::vector<_key> keys;
+        std::vector<node*> nodes;
+        std::vector<message> buffer;
+        keys.swap(n->key_);
+        nodes.swap(n->child_);
+        buffer.swap(n->buffer_);
+
+        std::size_t pos = 0;
+        auto msg = buffer.begin();
+        innerNode* cur = n;
+        for(std::size_t g = 0; g < groups; ++g) {
+            std::size_t cnt = children / groups + (g < children % groups ? 1 : 0);
+            if( g > 0 ) {
+                cur = new innerNode(n->level_);
+                splits.push_back(split_type(keys[pos-1], cur));
+            }
+            cur->child_.assign(nodes.begin() + pos, nodes.begin() + pos + cnt);
+            cur->key_.assign(keys.begin() + pos, keys.begin() + pos + cnt - 1);
+            pos += cnt;
+            auto end = buffer.end();
+            if( pos < children ) {
+                message bound;
+                bound.key_ = keys[pos-1];
+                end = std::upper_bound(msg, buffer.end(), bound);
+            }
+            cur->buffer_.assign(msg, end);
+            msg = end;
+        }
+    }
+
+    // child i of n is an underflowing leaf, merge it with a sibling if
+    // both fit into one leaf
+    void fixLeaf(innerNode* n, unsigned int i) {
+        leafNode* leaf = static_cast<leafNode*>(n->child_[i]);
+        leafNode* left = nullptr;
+        leafNode* right = nullptr;
+        if( i + 1 < n->child_.size() && leaf->size_ + static_cast<leafNode*>(n->child_[i+1])->size_ <= static_cast<unsigned int>(LEAF_MAX_) ) {
+            left = leaf;
+            right = static_cast<leafNode*>(n->child_[i+1]);
+        } else if( i > 0 && leaf->size_ + static_cast<leafNode*>(n->child_[i-1])->size_ <= static_cast<unsigned int>(LEAF_MAX_) ) {
+            left = static_cast<leafNode*>(n->child_[i-1]);
+            right = leaf;
+            --i;
+        } else {
+            return;
+        }
+        // merge the right leaf into the left, messages for either of them
+        // are routed to the left once the separator between them is gone
+        std::copy(right->key_, right->key_ + right->size_, left->key_ + left->size_);
+        std::copy(right->data_, right->data_ + right->size_, left->data_ + left->size_);
+        left->size_ += right->size_;
+        left->next_ = right->next_;
+        if( right->next_ )
+            right->next_->prev_ = left;
+        delete right;
+        n->key_.erase(n->key_.begin() + i);
+        n->child_.erase(n->child_.begin() + i + 1);
+    }
+
+    node* root_;
+    std::size_t count_;
+    std::size_t pending_;
+    // reused merge space
+    std::vector<message> scratchMessages_;
+    std::vector<value_type> scratchPairs_;
+};
+
+#endif
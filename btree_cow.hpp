@@ -0,0 +1,660 @@
+#ifndef _BPlusTree_COW_HPP_
+#define _BPlusTree_COW_HPP_
+
+#include "btree.hpp"
+
+#include <deque>
+#include <map>
+
+// copy-on-write BPlusTree with snapshot readers
+// a node reachable from a published root is never modified : a writer
+// copies the root-to-leaf path it changes (plus the sibling it borrows
+// from or merges with) and publishes the new root as the next version.
+// A snapshot pins one version in O(1) and reads it without any lock while
+// writers go on, writers are serialized by a mutex.
+// Nodes replaced by version v + 1 are retired with tag v, they are
+// released as soon as no snapshot of version v or older is alive.
+// The default node sizes fit BLOCK_SIZE with the birth version in the header
+template<typename _key,
+         typename _data,
+         int _M = btree_layout<_key, _data, BLOCK_SIZE, btree_default_traits, sizeof(uint64_t) + 2 * sizeof(unsigned int)>::INNER_MAX,
+         int _L = btree_layout<_key, _data, BLOCK_SIZE, btree_default_traits, sizeof(uint64_t) + 2 * sizeof(unsigned int)>::LEAF_MAX,
+         typename _Search = btree_default_search>
+class BPlusTree_cow {
+    class node;
+    class innerNode;
+    class leafNode;
+
+public:
+    // consistent read-only view of one version of the tree
+    // the snapshot must be released before the tree is destroyed
+    class snapshot {
+    public:
+        friend class BPlusTree_cow;
+        snapshot(snapshot&& other)
+            : tree_(other.tree_), root_(other.root_), size_(other.size_), version_(other.version_) {
+            other.tree_ = nullptr;
+        }
+        snapshot(const snapshot &other) = delete;
+        snapshot& operator=(const snapshot &other) = delete;
+        ~snapshot() {
+            release();
+        }
+
+        // drop the snapshot early, nothing may be read afterwards
+        void release() {
+            if( tree_ ) {
+                tree_->unpin(version_);
+                tree_ = nullptr;
+            }
+        }
+
+        // version of the tree the snapshot sees
+        uint64_t version() const {
+            return version_;
+        }
+        std::size_t size() const {
+            return size_;
+        }
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        // find an element, if true return key/data pair
+        // else return false pair
+        std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+            const node* n = root_;
+            if( !n )
+                return std::make_pair(false, std::make_pair(_key(), _data()));
+            while( !n->isLeafNode() ) {
+                const innerNode* inner = static_cast<const innerNode*>(n);
+                n = inner->child_[lowerBound(inner, key)];
+            }
+            const leafNode* leaf = static_cast<const leafNode*>(n);
+            unsigned int idx = lowerBound(leaf, key);
+            if( idx < leaf->size_ && leaf->key_[idx] == key )
+                return std::make_pair(true, std::make_pair(key, leaf->data_[idx]));
+            return std::make_pair(false, std::make_pair(_key(), _data()));
+        }
+
+        // call f(key, data) on every element in [lo, hi) in order
+        // return the number of visited elements
+        template<typename Function>
+        std::size_t scan(const _key& lo, const _key& hi, Function f) const {
+            std::size_t cnt = 0;
+            if( root_ && lo < hi )
+                scan(root_, lo, hi, f, cnt);
+            return cnt;
+        }
+
+    private:
+        snapshot(const BPlusTree_cow* tree, const node* root, std::size_t size, uint64_t version)
+            : tree_(tree), root_(root), size_(size), version_(version) {}
+
+        // there is no leaf chain in a copy-on-write tree, so the range is
+        // walked down the subtrees, return false once hi is reached
+        template<typename Function>
+        static bool scan(const node* n, const _key& lo, const _key& hi, Function &f, std::size_t &cnt) {
+            if( n->isLeafNode() ) {
+                const leafNode* leaf = static_cast<const leafNode*>(n);
+                for(unsigned int i = lowerBound(leaf, lo); i < leaf->size_; ++i) {
+                    if( !(leaf->key_[i] < hi) )
+                        return false;
+                    f(leaf->key_[i], leaf->data_[i]);
+                    ++cnt;
+                }
+                return true;
+            }
+            const innerNode* inner = static_cast<const innerNode*>(n);
+            for(unsigned int i = lowerBound(inner, lo); i <= inner->size_; ++i) {
+                if( !scan(inner->child_[i], lo, hi, f, cnt) )
+                    return false;
+            }
+            return true;
+        }
+
+        const BPlusTree_cow* tree_;
+        const node* root_;
+        std::size_t size_;
+        uint64_t version_;
+    };
+
+    // default constructor
+    explicit BPlusTree_cow() : root_(nullptr), size_(0), version_(0), update_(nullptr), pending_(0) {}
+    // non-copyable
+    BPlusTree_cow(const BPlusTree_cow &other) = delete;
+    BPlusTree_cow(BPlusTree_cow &&) = delete;
+    BPlusTree_cow& operator=(const BPlusTree_cow &other) = delete;
+    // destructor, every snapshot must have been released
+    ~BPlusTree_cow() {
+        assert( active_.empty() );
+        for(auto &r : retired_) {
+            for(auto n : r.nodes_)
+                freeNode(n);
+        }
+        clear(root_);
+    }
+
+    // pin the current version, O(1) and independent of the tree size
+    snapshot take_snapshot() const {
+        std::lock_guard<std::mutex> lock(epochMutex_);
+        ++active_[version_];
+        return snapshot(this, root_, size_, version_);
+    }
+
+    // find an element in the current version
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+        return take_snapshot().find(key);
+    }
+
+    // call f(key, data) on every element in [lo, hi) of the current
+    // version, writers are not blocked while the scan runs
+    template<typename Function>
+    std::size_t scan(const _key& lo, const _key& hi, Function f) const {
+        return take_snapshot().scan(lo, hi, f);
+    }
+
+    // return the size of the current version
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(epochMutex_);
+        return size_;
+    }
+
+    // check whether the current version is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // number of the current version, every successful update adds one
+    uint64_t version() const {
+        std::lock_guard<std::mutex> lock(epochMutex_);
+        return version_;
+    }
+
+    // number of retired nodes still kept alive by snapshots
+    std::size_t pending() const {
+        std::lock_guard<std::mutex> lock(epochMutex_);
+        return pending_;
+    }
+
+    // insert an element, identical key is ignored
+    // return whether the key is inserted
+    bool insert(const _key& key, const _data& data) {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        update u(this);
+        if( !root_ ) {
+            leafNode* leaf = newLeaf();
+            leaf->key_[0] = key;
+            leaf->data_[0] = data;
+            leaf->size_ = 1;
+            publish(leaf, 1);
+            return true;
+        }
+        bool inserted = false;
+        node* splitNode = nullptr;
+        _key splitKey;
+        node* root = insert(root_, key, data, inserted, splitNode, splitKey);
+        if( !inserted )
+            return false;
+        if( splitNode ) {
+            innerNode* inner = newInner(root->level_ + 1);
+            inner->key_[0] = splitKey;
+            inner->child_[0] = root;
+            inner->child_[1] = splitNode;
+            inner->size_ = 1;
+            root = inner;
+        }
+        publish(root, size_ + 1);
+        return true;
+    }
+
+    // remove one element, return whether the key is removed
+    bool erase(const _key& key) {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        if( !root_ )
+            return false;
+        update u(this);
+        bool erased = false;
+        node* root = erase(root_, key, erased);
+        if( !erased )
+            return false;
+        if( root->size_ == 0 ) {
+            // the last element is gone or the root has one child left
+            node* child = root->isLeafNode() ? nullptr : static_cast<innerNode*>(root)->child_[0];
+            discard(root);
+            root = child;
+        }
+        publish(root, size_ - 1);
+        return true;
+    }
+
+private:
+    static const int INNER_MAX_ = _M;
+    static const int LEAF_MAX_ = _L;
+    static const int INNER_MIN_ = INNER_MAX_ / 2;
+    static const int LEAF_MIN_ = LEAF_MAX_ / 2;
+
+    // nodes remember the version which created them, a node created by
+    // the version under construction is private to the writer and may
+    // be changed in place
+    class node {
+    public:
+        node(unsigned int l, uint64_t birth) : level_(l), size_(0), birth_(birth) {}
+        // 0 for leaf node
+        const unsigned int level_;
+        unsigned int size_;
+        const uint64_t birth_;
+
+        inline bool isLeafNode() const {
+            return level_ == 0;
+        }
+    };
+
+    class innerNode : public node {
+    public:
+        innerNode(unsigned int l, uint64_t birth) : node(l, birth) {}
+        _key key_[INNER_MAX_];
+        node* child_[INNER_MAX_+1];
+    };
+
+    class leafNode : public node {
+    public:
+        explicit leafNode(uint64_t birth) : node(0, birth) {}
+        _key key_[LEAF_MAX_];
+        _data data_[LEAF_MAX_];
+    };
+
+    // the layout bounds both nodes, so the default sizes fit BLOCK_SIZE
+    typedef btree_node_bytes<_key, _data, btree_default_traits, sizeof(uint64_t) + 2 * sizeof(unsigned int)> node_bytes;
+    static_assert(sizeof(innerNode) <= node_bytes::inner(INNER_MAX_) && sizeof(leafNode) <= node_bytes::leaf(LEAF_MAX_),
+                  "BPlusTree_cow: node layout exceeds btree_node_bytes");
+
+    // nodes retired by the update which published version tag_ + 1
+    struct retiredList {
+        uint64_t tag_;
+        std::vector<node*> nodes_;
+    };
+
+    template<typename nodeType>
+    static inline unsigned int lowerBound(const nodeType* n, const _key& key) {
+        return _Search::lower_bound(n->key_, n->size_, key);
+    }
+
+    static void freeNode(node* n) {
+        if( n->isLeafNode() )
+            delete static_cast<leafNode*>(n);
+        else
+            delete static_cast<innerNode*>(n);
+    }
+
+    static void clear(node* n) {
+        if( !n )
+            return;
+        if( !n->isLeafNode() ) {
+            innerNode* inner = static_cast<innerNode*>(n);
+            for(unsigned int i = 0; i <= inner->size_; ++i)
+                clear(inner->child_[i]);
+        }
+        freeNode(n);
+    }
+
+    // version under construction, only valid while writeMutex_ is held
+    uint64_t next() const {
+        return version_ + 1;
+    }
+
+    // the update under construction, one per writer call
+    // it collects the published nodes it replaces and the nodes it
+    // creates. The replaced ones are retired only once the new root is
+    // published; an update which fails before, e.g. on a throwing new,
+    // retires nothing and frees what it created, leaving the published
+    // tree as it was
+    struct update {
+        BPlusTree_cow* tree_;
+        std::vector<node*> retired_;
+        std::vector<node*> created_;
+        bool published_;
+
+        explicit update(BPlusTree_cow* tree) : tree_(tree), published_(false) {
+            tree_->update_ = this;
+        }
+        ~update() {
+            tree_->update_ = nullptr;
+            if( published_ )
+                return;
+            for(auto n : created_) {
+                if( n )
+                    freeNode(n);
+            }
+        }
+    };
+
+    // nodes of the next version, recorded before they exist so a failing
+    // record cannot leak them
+    leafNode* newLeaf() {
+        update_->created_.push_back(nullptr);
+        leafNode* leaf = new leafNode(next());
+        update_->created_.back() = leaf;
+        return leaf;
+    }
+    innerNode* newInner(unsigned int level) {
+        update_->created_.push_back(nullptr);
+        innerNode* inner = new innerNode(level, next());
+        update_->created_.back() = inner;
+        return inner;
+    }
+
+    // return a node of the next version with the content of n
+    // a published n is copied and retired, a private n is returned as is
+    leafNode* writable(leafNode* n) {
+        if( n->birth_ == next() )
+            return n;
+        leafNode* leaf = newLeaf();
+        leaf->size_ = n->size_;
+        std::copy(n->key_, n->key_ + n->size_, leaf->key_);
+        std::copy(n->data_, n->data_ + n->size_, leaf->data_);
+        update_->retired_.push_back(n);
+        return leaf;
+    }
+    innerNode* writable(innerNode* n) {
+        if( n->birth_ == next() )
+            return n;
+        innerNode* inner = newInner(n->level_);
+        inner->size_ = n->size_;
+        std::copy(n->key_, n->key_ + n->size_, inner->key_);
+        std::copy(n->child_, n->child_ + n->size_ + 1, inner->child_);
+        update_->retired_.push_back(n);
+        return inner;
+    }
+
+    // n is unlinked by the update under construction
+    void discard(node* n) {
+        if( n->birth_ == next() ) {
+            std::vector<node*> &created = update_->created_;
+            created.erase(std::find(created.begin(), created.end(), n));
+            freeNode(n);
+        } else {
+            update_->retired_.push_back(n);
+        }
+    }
+
+    // install the next version, the retired nodes of this update are
+    // tagged with the version they were last visible in
+    void publish(node* root, std::size_t size) {
+        std::vector<node*> dead;
+        {
+            std::lock_guard<std::mutex> lock(epochMutex_);
+            if( !update_->retired_.empty() ) {
+                retired_.push_back(retiredList());
+                retired_.back().tag_ = version_;
+                retired_.back().nodes_.swap(update_->retired_);
+                pending_ += retired_.back().nodes_.size();
+            }
+            root_ = root;
+            size_ = size;
+            ++version_;
+            update_->published_ = true;
+            reclaim(dead);
+        }
+        for(auto n : dead)
+            freeNode(n);
+    }
+
+    // a snapshot of version v is released
+    void unpin(uint64_t v) const {
+        std::vector<node*> dead;
+        {
+            std::lock_guard<std::mutex> lock(epochMutex_);
+            auto itr = active_.find(v);
+            if( --itr->second == 0 )
+                active_.erase(itr);
+            reclaim(dead);
+        }
+        for(auto n : dead)
+            freeNode(n);
+    }
+
+    // collect the retired nodes no live snapshot can reach, epochMutex_
+    // is held. A node tagged v is visible to snapshots of version <= v
+    void reclaim(std::vector<node*> &dead) const {
+        uint64_t oldest = active_.empty() ? version_ : active_.begin()->first;
+        while( !retired_.empty() && retired_.front().tag_ < oldest ) {
+            std::vector<node*> &nodes = retired_.front().nodes_;
+            dead.insert(dead.end(), nodes.begin(), nodes.end());
+            pending_ -= nodes.size();
+            retired_.pop_front();
+        }
+    }
+
+    // descend down to the leaf and insert the pair into a copy of the
+    // path, return the node which replaces n in its parent
+    node* insert(node* n, const _key& key, const _data& data, bool &inserted, node* &splitNode, _key &splitKey) {
+        if( n->isLeafNode() ) {
+            leafNode* leaf = static_cast<leafNode*>(n);
+            unsigned int idx = lowerBound(leaf, key);
+            if( idx < leaf->size_ && leaf->key_[idx] == key )
+                return n;
+            leaf = writable(leaf);
+            leafNode* target = leaf;
+            if( leaf->size_ == static_cast<unsigned int>(LEAF_MAX_) ) {
+                leafNode* right = newLeaf();
+                unsigned int m = leaf->size_ / 2;
+                right->size_ = leaf->size_ - m;
+                std::copy(leaf->key_ + m, leaf->key_ + leaf->size_, right->key_);
+                std::copy(leaf->data_ + m, leaf->data_ + leaf->size_, right->data_);
+                leaf->size_ = m;
+                splitKey = leaf->key_[m-1];
+                splitNode = right;
+                if( idx >= m ) {
+                    idx -= m;
+                    target = right;
+                }
+            }
+            std::copy_backward(target->key_ + idx, target->key_ + target->size_, target->key_ + target->size_ + 1);
+            std::copy_backward(target->data_ + idx, target->data_ + target->size_, target->data_ + target->size_ + 1);
+            target->key_[idx] = key;
+            target->data_[idx] = data;
+            ++target->size_;
+            inserted = true;
+            return leaf;
+        }
+
+        innerNode* inner = static_cast<innerNode*>(n);
+        unsigned int idx = lowerBound(inner, key);
+        node* newChild = nullptr;
+        _key newKey;
+        node* child = insert(inner->child_[idx], key, data, inserted, newChild, newKey);
+        if( !inserted )
+            return n;
+        inner = writable(inner);
+        inner->child_[idx] = child;
+        if( !newChild )
+            return inner;
+
+        innerNode* target = inner;
+        if( inner->size_ == static_cast<unsigned int>(INNER_MAX_) ) {
+            innerNode* right = newInner(inner->level_);
+            unsigned int m = inner->size_ / 2;
+            right->size_ = inner->size_ - m - 1;
+            std::copy(inner->key_ + m + 1, inner->key_ + inner->size_, right->key_);
+            std::copy(inner->child_ + m + 1, inner->child_ + inner->size_ + 1, right->child_);
+            inner->size_ = m;
+            splitKey = inner->key_[m];
+            splitNode = right;
+            // the split child is kept on the left if it is at most the
+            // left's last child, otherwise it moved to the right node
+            if( idx > m ) {
+                idx -= m + 1;
+                target = right;
+            }
+        }
+        std::copy_backward(target->key_ + idx, target->key_ + target->size_, target->key_ + target->size_ + 1);
+        std::copy_backward(target->child_ + idx + 1, target->child_ + target->size_ + 1, target->child_ + target->size_ + 2);
+        target->key_[idx] = newKey;
+        target->child_[idx+1] = newChild;
+        ++target->size_;
+        return inner;
+    }
+
+    // descend down to the leaf and remove the key from a copy of the
+    // path, on the way back up every underflowing child borrows from or
+    // is merged with a sibling. Return the node which replaces n
+    node* erase(node* n, const _key& key, bool &erased) {
+        if( n->isLeafNode() ) {
+            leafNode* leaf = static_cast<leafNode*>(n);
+            unsigned int idx = lowerBound(leaf, key);
+            if( idx >= leaf->size_ || leaf->key_[idx] != key )
+                return n;
+            leaf = writable(leaf);
+            std::copy(leaf->key_ + idx + 1, leaf->key_ + leaf->size_, leaf->key_ + idx);
+            std::copy(leaf->data_ + idx + 1, leaf->data_ + leaf->size_, leaf->data_ + idx);
+            --leaf->size_;
+            erased = true;
+            return leaf;
+        }
+
+        innerNode* inner = static_cast<innerNode*>(n);
+        unsigned int idx = lowerBound(inner, key);
+        node* child = erase(inner->child_[idx], key, erased);
+        if( !erased )
+            return n;
+        inner = writable(inner);
+        inner->child_[idx] = child;
+        if( child->isLeafNode() ) {
+            if( child->size_ < static_cast<unsigned int>(LEAF_MIN_) )
+                fixLeaf(inner, idx);
+        } else if( child->size_ < static_cast<unsigned int>(INNER_MIN_) ) {
+            fixInner(inner, idx);
+        }
+        return inner;
+    }
+
+    // child idx of the private parent is an underflowing private leaf
+    // borrow one pair from a sibling with spare pairs, otherwise merge
+    void fixLeaf(innerNode* parent, unsigned int idx) {
+        leafNode* n = static_cast<leafNode*>(parent->child_[idx]);
+
+        if( idx > 0 ) {
+            leafNode* left = static_cast<leafNode*>(parent->child_[idx-1]);
+            if( left->size_ > static_cast<unsigned int>(LEAF_MIN_) ) {
+                left = writable(left);
+                parent->child_[idx-1] = left;
+                std::copy_backward(n->key_, n->key_ + n->size_, n->key_ + n->size_ + 1);
+                std::copy_backward(n->data_, n->data_ + n->size_, n->data_ + n->size_ + 1);
+                n->key_[0] = left->key_[left->size_-1];
+                n->data_[0] = left->data_[left->size_-1];
+                ++n->size_;
+                --left->size_;
+                parent->key_[idx-1] = left->key_[left->size_-1];
+                return;
+            }
+        }
+        if( idx < parent->size_ ) {
+            leafNode* right = static_cast<leafNode*>(parent->child_[idx+1]);
+            if( right->size_ > static_cast<unsigned int>(LEAF_MIN_) ) {
+                right = writable(right);
+                parent->child_[idx+1] = right;
+                n->key_[n->size_] = right->key_[0];
+                n->data_[n->size_] = right->data_[0];
+                ++n->size_;
+                std::copy(right->key_ + 1, right->key_ + right->size_, right->key_);
+                std::copy(right->data_ + 1, right->data_ + right->size_, right->data_);
+                --right->size_;
+                parent->key_[idx] = n->key_[n->size_-1];
+                return;
+            }
+            // merge the right sibling into this leaf
+            std::copy(right->key_, right->key_ + right->size_, n->key_ + n->size_);
+            std::copy(right->data_, right->data_ + right->size_, n->data_ + n->size_);
+            n->size_ += right->size_;
+            discard(right);
+            std::copy(parent->key_ + idx + 1, parent->key_ + parent->size_, parent->key_ + idx);
+            std::copy(parent->child_ + idx + 2, parent->child_ + parent->size_ + 1, parent->child_ + idx + 1);
+            --parent->size_;
+            return;
+        }
+        // last child, merge this leaf into the left sibling
+        leafNode* left = writable(static_cast<leafNode*>(parent->child_[idx-1]));
+        parent->child_[idx-1] = left;
+        std::copy(n->key_, n->key_ + n->size_, left->key_ + left->size_);
+        std::copy(n->data_, n->data_ + n->size_, left->data_ + left->size_);
+        left->size_ += n->size_;
+        discard(n);
+        --parent->size_;
+    }
+
+    // child idx of the private parent is an underflowing private inner
+    // node, borrow one child through the parent key, otherwise merge
+    void fixInner(innerNode* parent, unsigned int idx) {
+        innerNode* n = static_cast<innerNode*>(parent->child_[idx]);
+
+        if( idx > 0 ) {
+            innerNode* left = static_cast<innerNode*>(parent->child_[idx-1]);
+            if( left->size_ > static_cast<unsigned int>(INNER_MIN_) ) {
+                left = writable(left);
+                parent->child_[idx-1] = left;
+                std::copy_backward(n->key_, n->key_ + n->size_, n->key_ + n->size_ + 1);
+                std::copy_backward(n->child_, n->child_ + n->size_ + 1, n->child_ + n->size_ + 2);
+                n->key_[0] = parent->key_[idx-1];
+                n->child_[0] = left->child_[left->size_];
+                ++n->size_;
+                parent->key_[idx-1] = left->key_[left->size_-1];
+                --left->size_;
+                return;
+            }
+        }
+        if( idx < parent->size_ ) {
+            innerNode* right = static_cast<innerNode*>(parent->child_[idx+1]);
+            if( right->size_ > static_cast<unsigned int>(INNER_MIN_) ) {
+                right = writable(right);
+                parent->child_[idx+1] = right;
+                n->key_[n->size_] = parent->key_[idx];
+                n->child_[n->size_+1] = right->child_[0];
+                ++n->size_;
+                parent->key_[idx] = right->key_[0];
+                std::copy(right->key_ + 1, right->key_ + right->size_, right->key_);
+                std::copy(right->child_ + 1, right->child_ + right->size_ + 1, right->child_);
+                --right->size_;
+                return;
+            }
+            // merge the right sibling into this node
+            n->key_[n->size_] = parent->key_[idx];
+            std::copy(right->key_, right->key_ + right->size_, n->key_ + n->size_ + 1);
+            std::copy(right->child_, right->child_ + right->size_ + 1, n->child_ + n->size_ + 1);
+            n->size_ += right->size_ + 1;
+            discard(right);
+            std::copy(parent->key_ + idx + 1, parent->key_ + parent->size_, parent->key_ + idx);
+            std::copy(parent->child_ + idx + 2, parent->child_ + parent->size_ + 1, parent->child_ + idx + 1);
+            --parent->size_;
+            return;
+        }
+        // last child, merge this node into the left sibling
+        innerNode* left = writable(static_cast<innerNode*>(parent->child_[idx-1]));
+        parent->child_[idx-1] = left;
+        left->key_[left->size_] = parent->key_[idx-1];
+        std::copy(n->key_, n->key_ + n->size_, left->key_ + left->size_ + 1);
+        std::copy(n->child_, n->child_ + n->size_ + 1, left->child_ + left->size_ + 1);
+        left->size_ += n->size_ + 1;
+        discard(n);
+        --parent->size_;
+    }
+
+    // published state, changed by writers under both mutexes
+    node* root_;
+    std::size_t size_;
+    uint64_t version_;
+
+    // serializes writers
+    std::mutex writeMutex_;
+    // the update under construction, only valid while writeMutex_ is held
+    update* update_;
+
+    // guards the published state, the snapshot counts and retired nodes
+    mutable std::mutex epochMutex_;
+    // version -> number of live snapshots
+    mutable std::map<uint64_t, std::size_t> active_;
+    mutable std::deque<retiredList> retired_;
+    mutable std::size_t pending_;
+};
+
+#endif
@@ -0,0 +1,988 @@
+#ifndef _BPlusTree_PAGED_HPP_
+#define _BPlusTree_PAGED_HPP_
+
+#include "btree.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// page id inside the tree file, page 0 is the meta page so 0 also
+// serves as the null page id
+typedef uint32_t page_id;
+
+// page access counters of a page store
+struct page_stats {
+    std::size_t hits_;      // pin of a page already in memory
+    std::size_t misses_;    // pin which had to read the page
+    std::size_t evictions_; // pages dropped to make room
+    std::size_t writes_;    // dirty pages written back
+
+    page_stats() : hits_(0), misses_(0), evictions_(0), writes_(0) {}
+};
+
+// page store which maps the whole file into memory
+// a large range of address space is reserved up front so pages never
+// move when the file grows, pin() is only an address computation and
+// the OS pages data in and out as needed
+template<std::size_t _PageSize = 4096>
+class mmap_page_store {
+public:
+    static const std::size_t PAGE_SIZE = _PageSize;
+
+    // open or create the file, reserve is the maximum file size in bytes
+    explicit mmap_page_store(const std::string& path, std::size_t reserve = std::size_t(1) << 36)
+        : fd_(-1), base_(nullptr), reserve_(reserve / PAGE_SIZE * PAGE_SIZE), pages_(0) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        struct stat st;
+        if( ::fstat(fd_, &st) != 0 ) {
+            int err = errno;
+            ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+        if( st.st_size % PAGE_SIZE != 0 ) {
+            ::close(fd_);
+            throw std::runtime_error("mmap_page_store: size of " + path + " is not a multiple of the page size");
+        }
+        pages_ = st.st_size / PAGE_SIZE;
+        void* p = ::mmap(nullptr, reserve_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd_, 0);
+        if( p == MAP_FAILED ) {
+            int err = errno;
+            ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "mmap " + path);
+        }
+        base_ = static_cast<char*>(p);
+    }
+
+    // non-copyable
+    mmap_page_store(const mmap_page_store&) = delete;
+    mmap_page_store& operator=(const mmap_page_store&) = delete;
+
+    // the destructor only reports errors, close() throws them
+    ~mmap_page_store() {
+        try {
+            close();
+        } catch(const std::exception& e) {
+            std::fprintf(stderr, "mmap_page_store: %s\n", e.what());
+        }
+        if( base_ ) {
+            ::munmap(base_, reserve_);
+            ::close(fd_);
+        }
+    }
+
+    // number of pages in the file
+    std::size_t pageCount() const {
+        return pages_;
+    }
+
+    // extend the file to hold at least n pages
+    void grow(std::size_t n) {
+        if( n <= pages_ )
+            return;
+        if( n * PAGE_SIZE > reserve_ )
+            throw std::length_error("mmap_page_store: file exceeds the reserved mapping");
+        if( ::ftruncate(fd_, n * PAGE_SIZE) != 0 )
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        pages_ = n;
+    }
+
+    // the mapping is permanent, so pinning is an address computation
+    inline char* pin(page_id pid) {
+        assert( pid < pages_ );
+        return base_ + static_cast<std::size_t>(pid) * PAGE_SIZE;
+    }
+    inline void unpin(page_id, bool) {
+    }
+
+    // write all modified pages back to the file
+    void sync() {
+        if( ::msync(base_, pages_ * PAGE_SIZE, MS_SYNC) != 0 )
+            throw std::system_error(errno, std::generic_category(), "msync");
+    }
+
+    // sync and release the file, nothing may be pinned afterwards
+    void close() {
+        if( !base_ )
+            return;
+        sync();
+        ::munmap(base_, reserve_);
+        ::close(fd_);
+        base_ = nullptr;
+        fd_ = -1;
+    }
+
+    // paging is done by the OS, so there is nothing to count
+    const page_stats& stats() const {
+        return stats_;
+    }
+
+private:
+    int fd_;
+    char* base_;
+    std::size_t reserve_;
+    std::size_t pages_;
+    page_stats stats_;
+};
+
+// page store which caches pages in a fixed number of frames
+// memory use is bounded by the frame budget, pinned pages stay in their
+// frame until unpinned, and the CLOCK algorithm picks an unpinned frame
+// whose reference bit is clear when a page has to be read in. Dirty
+// pages are written back when evicted or on sync().
+template<std::size_t _PageSize = 4096>
+class buffer_pool_page_store {
+public:
+    static const std::size_t PAGE_SIZE = _PageSize;
+
+    // open or create the file and allocate the frames
+    explicit buffer_pool_page_store(const std::string& path, std::size_t frames = 1024)
+        : fd_(-1), pages_(0), buffer_(nullptr), frames_(frames), hand_(0) {
+        assert( frames > 0 );
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        struct stat st;
+        if( ::fstat(fd_, &st) != 0 ) {
+            int err = errno;
+            ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+        if( st.st_size % PAGE_SIZE != 0 ) {
+            ::close(fd_);
+            throw std::runtime_error("buffer_pool_page_store: size of " + path + " is not a multiple of the page size");
+        }
+        pages_ = st.st_size / PAGE_SIZE;
+        if( ::posix_memalign(reinterpret_cast<void**>(&buffer_), PAGE_SIZE, frames * PAGE_SIZE) != 0 ) {
+            ::close(fd_);
+            throw std::bad_alloc();
+        }
+        table_.reserve(frames);
+    }
+
+    // non-copyable
+    buffer_pool_page_store(const buffer_pool_page_store&) = delete;
+    buffer_pool_page_store& operator=(const buffer_pool_page_store&) = delete;
+
+    // the destructor only reports errors, close() throws them
+    ~buffer_pool_page_store() {
+        try {
+            close();
+        } catch(const std::exception& e) {
+            std::fprintf(stderr, "buffer_pool_page_store: %s\n", e.what());
+        }
+        if( fd_ >= 0 )
+            ::close(fd_);
+        std::free(buffer_);
+    }
+
+    // number of pages in the file
+    std::size_t pageCount() const {
+        return pages_;
+    }
+
+    // extend the file to hold at least n pages
+    void grow(std::size_t n) {
+        if( n <= pages_ )
+            return;
+        if( ::ftruncate(fd_, n * PAGE_SIZE) != 0 )
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        pages_ = n;
+    }
+
+    // return the frame holding the page, read it in if needed
+    char* pin(page_id pid) {
+        assert( pid < pages_ );
+        typename std::unordered_map<page_id, std::size_t>::iterator itr = table_.find(pid);
+        if( itr != table_.end() ) {
+            frame& f = frames_[itr->second];
+            ++f.pins_;
+            f.referenced_ = true;
+            ++stats_.hits_;
+            return data(itr->second);
+        }
+
+        ++stats_.misses_;
+        std::size_t i = victim();
+        frame& f = frames_[i];
+        if( f.used_ ) {
+            writeBack(i);
+            table_.erase(f.pid_);
+            ++stats_.evictions_;
+            f.used_ = false;
+            f.pins_ = 0;
+            f.dirty_ = false;
+        }
+        if( ::pread(fd_, data(i), PAGE_SIZE, static_cast<off_t>(pid) * PAGE_SIZE) != static_cast<ssize_t>(PAGE_SIZE) )
+            throw std::system_error(errno, std::generic_category(), "pread");
+        f.pid_ = pid;
+        f.used_ = true;
+        f.pins_ = 1;
+        f.dirty_ = false;
+        f.referenced_ = true;
+        table_[pid] = i;
+        return data(i);
+    }
+
+    void unpin(page_id pid, bool dirty) {
+        typename std::unordered_map<page_id, std::size_t>::iterator itr = table_.find(pid);
+        assert( itr != table_.end() );
+        frame& f = frames_[itr->second];
+        assert( f.pins_ > 0 );
+        --f.pins_;
+        f.dirty_ = f.dirty_ || dirty;
+    }
+
+    // write all dirty pages back to the file
+    void sync() {
+        flush();
+        if( ::fsync(fd_) != 0 )
+            throw std::system_error(errno, std::generic_category(), "fsync");
+    }
+
+    // write all dirty pages back without waiting for the disk
+    void flush() {
+        for(std::size_t i = 0; i < frames_.size(); ++i)
+            writeBack(i);
+    }
+
+    // sync and release the file, nothing may be pinned afterwards
+    void close() {
+        if( fd_ < 0 )
+            return;
+        sync();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    const page_stats& stats() const {
+        return stats_;
+    }
+
+private:
+    struct frame {
+        page_id pid_;
+        unsigned int pins_;
+        bool used_;
+        bool dirty_;
+        // set on every access, cleared when the clock hand passes
+        bool referenced_;
+
+        frame() : pid_(0), pins_(0), used_(false), dirty_(false), referenced_(false) {}
+    };
+
+    inline char* data(std::size_t i) {
+        return buffer_ + i * PAGE_SIZE;
+    }
+
+    // sweep the clock hand until an unpinned frame with a clear
+    // reference bit is found, two full sweeps clear every bit
+    std::size_t victim() {
+        for(std::size_t n = 0; n < 2 * frames_.size() + 1; ++n) {
+            std::size_t i = hand_;
+            hand_ = (hand_ + 1) % frames_.size();
+            frame& f = frames_[i];
+            if( !f.used_ )
+                return i;
+            if( f.pins_ )
+                continue;
+            if( f.referenced_ )
+                f.referenced_ = false;
+            else
+                return i;
+        }
+        throw std::runtime_error("buffer_pool_page_store: all frames are pinned");
+    }
+
+    void writeBack(std::size_t i) {
+        frame& f = frames_[i];
+        if( !f.used_ || !f.dirty_ )
+            return;
+        if( ::pwrite(fd_, data(i), PAGE_SIZE, static_cast<off_t>(f.pid_) * PAGE_SIZE) != static_cast<ssize_t>(PAGE_SIZE) )
+            throw std::system_error(errno, std::generic_category(), "pwrite");
+        f.dirty_ = false;
+        ++stats_.writes_;
+    }
+
+    int fd_;
+    std::size_t pages_;
+    char* buffer_;
+    std::vector<frame> frames_;
+    // page id to frame index
+    std::unordered_map<page_id, std::size_t> table_;
+    std::size_t hand_;
+    page_stats stats_;
+};
+
+// BPlusTree stored in fixed-size pages of a file
+// children and leaf links are page ids instead of pointers, so the file
+// can be reopened and used directly without any deserialization
+// keys and data are stored as raw bytes, both must be trivially copyable
+// @param :
+// _Store : page store providing pin/unpin access to the pages, either
+//          mmap_page_store or buffer_pool_page_store
+template<typename _key,
+         typename _data,
+         typename _Store = mmap_page_store<>,
+         typename _Search = btree_default_search>
+class BPlusTree_paged {
+    static_assert(std::is_trivially_copyable<_key>::value, "BPlusTree_paged needs trivially copyable keys");
+    static_assert(std::is_trivially_copyable<_data>::value, "BPlusTree_paged needs trivially copyable data");
+public:
+    // open the tree stored in path, create it if the file is empty
+    // extra arguments are passed to the page store
+    template<typename... Args>
+    explicit BPlusTree_paged(const std::string& path, Args&&... args);
+    // non-copyable
+    BPlusTree_paged(const BPlusTree_paged&) = delete;
+    BPlusTree_paged& operator=(const BPlusTree_paged&) = delete;
+    // destructor closes the tree and reports errors instead of throwing
+    ~BPlusTree_paged();
+
+    // insert an element, identical key is ignored
+    void insert(const _key& key, const _data& data);
+
+    // find an element, if true return key/data pair
+    // else return false pair
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key);
+
+    // remove one element
+    void erase(const _key& key);
+
+    // call f(key, data) on every element in [lo, hi) in order
+    // return the number of visited elements
+    template<typename Function>
+    std::size_t scan(const _key& lo, const _key& hi, Function f);
+
+    // return the size of tree
+    std::size_t size() const {
+        return meta_->itemCount_;
+    }
+
+    // check whether the tree is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // write all pages back to the file
+    void sync() {
+        store_.sync();
+    }
+
+    // write all pages back and close the file, errors are thrown
+    // the tree is unusable afterwards
+    void close() {
+        metaRef_ = pageRef();
+        store_.close();
+    }
+
+    struct tree_stats {
+        std::size_t itemCount_; // number of items in btree
+        std::size_t leaves_;    // number of leaf nodes
+        std::size_t inners_;    // number of inner nodes
+        page_stats pages_;      // page store counters
+    };
+
+    // return the statistical information of tree
+    tree_stats stats() const {
+        tree_stats st;
+        st.itemCount_ = meta_->itemCount_;
+        st.leaves_ = meta_->leaves_;
+        st.inners_ = meta_->inners_;
+        st.pages_ = store_.stats();
+        return st;
+    }
+
+private:
+    static const std::size_t PAGE_SIZE = _Store::PAGE_SIZE;
+    static const uint64_t MAGIC = 0x42504c5553545245ull; // "BPLUSTRE"
+    static const uint32_t FORMAT_VERSION = 2;
+
+    // first page of the file
+    struct metaPage {
+        uint64_t magic_;
+        uint32_t version_;
+        uint32_t pageSize_;
+        uint32_t keySize_;
+        uint32_t dataSize_;
+        page_id root_;
+        page_id head_;      // first leaf
+        page_id tail_;      // last leaf
+        page_id freeList_;  // chain of released pages
+        uint32_t pageCount_; // pages in use, including the free ones
+        uint32_t leaves_;
+        uint32_t inners_;
+        uint64_t itemCount_;
+    };
+
+    // common header of every node page
+    struct pageHeader {
+        // 0 for leaf node
+        uint32_t level_;
+        uint32_t size_;
+        // neighbour leaves, unused by inner nodes
+        page_id prev_;
+        page_id next_;
+    };
+
+    // the node sizes of the in-memory layout with the page header, page
+    // ids and the leaf links in the header take less than the pointers
+    // it leaves room for
+    typedef btree_layout<_key, _data, PAGE_SIZE, btree_default_traits, sizeof(pageHeader)> layout;
+    static const int LEAF_MAX_ = layout::LEAF_MAX;
+    static const int LEAF_MIN_ = LEAF_MAX_ / 2;
+    static const int INNER_MAX_ = layout::INNER_MAX;
+    static const int INNER_MIN_ = INNER_MAX_ / 2;
+
+    struct leafPage : public pageHeader {
+        _key key_[LEAF_MAX_];
+        _data data_[LEAF_MAX_];
+    };
+
+    struct innerPage : public pageHeader {
+        _key key_[INNER_MAX_];
+        page_id child_[INNER_MAX_+1];
+    };
+
+    typedef btree_node_bytes<_key, _data, btree_default_traits, sizeof(pageHeader)> node_bytes;
+    static_assert(sizeof(metaPage) <= PAGE_SIZE, "page size too small");
+    static_assert(sizeof(innerPage) <= node_bytes::inner(INNER_MAX_) && sizeof(leafPage) <= node_bytes::leaf(LEAF_MAX_),
+                  "BPlusTree_paged: page layout exceeds btree_node_bytes");
+
+    // pinned page, unpinned when it goes out of scope
+    class pageRef {
+    public:
+        pageRef() : store_(nullptr), pid_(0), data_(nullptr), dirty_(false) {}
+        pageRef(_Store* store, page_id pid) : store_(store), pid_(pid), data_(store->pin(pid)), dirty_(false) {}
+        pageRef(pageRef&& other) : store_(other.store_), pid_(other.pid_), data_(other.data_), dirty_(other.dirty_) {
+            other.store_ = nullptr;
+        }
+        pageRef& operator=(pageRef&& other) {
+            release();
+            store_ = other.store_;
+            pid_ = other.pid_;
+            data_ = other.data_;
+            dirty_ = other.dirty_;
+            other.store_ = nullptr;
+            return *this;
+        }
+        pageRef(const pageRef&) = delete;
+        pageRef& operator=(const pageRef&) = delete;
+        ~pageRef() {
+            release();
+        }
+
+        page_id id() const {
+            return pid_;
+        }
+        pageHeader* header() const {
+            return reinterpret_cast<pageHeader*>(data_);
+        }
+        leafPage* leaf() const {
+            return reinterpret_cast<leafPage*>(data_);
+        }
+        innerPage* inner() const {
+            return reinterpret_cast<innerPage*>(data_);
+        }
+        // the page is written back when unpinned
+        void markDirty() {
+            dirty_ = true;
+        }
+    private:
+        void release() {
+            if( store_ )
+                store_->unpin(pid_, dirty_);
+            store_ = nullptr;
+        }
+        _Store* store_;
+        page_id pid_;
+        char* data_;
+        bool dirty_;
+    };
+
+    inline pageRef pin(page_id pid) {
+        return pageRef(&store_, pid);
+    }
+
+    template<typename page>
+    static inline unsigned int find(const page* p, const _key& key) {
+        return _Search::lower_bound(p->key_, p->size_, key);
+    }
+
+    // allocate one page, reuse released pages first
+    pageRef allocPage(uint32_t level);
+    // release one page to the free list
+    void freePage(pageRef& ref);
+
+    bool insert(page_id pid, const _key& key, const _data& data, page_id& splitPage, _key& splitKey);
+    void split_leafnode(pageRef& ref, pageRef& right, _key& splitKey);
+    void split_innernode(pageRef& ref, pageRef& right, _key& splitKey);
+
+    bool erase(page_id pid, const _key& key);
+    // fix child idx of parent after it underflows
+    void fix_leaf(pageRef& parent, unsigned int idx);
+    void fix_inner(pageRef& parent, unsigned int idx);
+
+    _Store store_;
+    // the meta page stays pinned while the tree is open
+    pageRef metaRef_;
+    metaPage* meta_;
+};
+
+// open the tree file, initialize the meta page of a new file
+template<typename _key, typename _data, typename _Store, typename _Search>
+template<typename... Args>
+BPlusTree_paged<_key,_data,_Store,_Search>::BPlusTree_paged(const std::string& path, Args&&... args)
+    : store_(path, std::forward<Args>(args)...) {
+    bool created = store_.pageCount() == 0;
+    if( created )
+        store_.grow(16);
+    metaRef_ = pin(0);
+    metaRef_.markDirty();
+    meta_ = reinterpret_cast<metaPage*>(metaRef_.header());
+    if( created ) {
+        std::memset(meta_, 0, sizeof(metaPage));
+        meta_->magic_ = MAGIC;
+        meta_->version_ = FORMAT_VERSION;
+        meta_->pageSize_ = PAGE_SIZE;
+        meta_->keySize_ = sizeof(_key);
+        meta_->dataSize_ = sizeof(_data);
+        meta_->pageCount_ = 1;
+    } else if( meta_->magic_ != MAGIC || meta_->version_ != FORMAT_VERSION ) {
+        throw std::runtime_error("BPlusTree_paged: " + path + " is not a tree file");
+    } else if( meta_->pageSize_ != PAGE_SIZE || meta_->keySize_ != sizeof(_key) || meta_->dataSize_ != sizeof(_data) ) {
+        throw std::runtime_error("BPlusTree_paged: " + path + " has a different page or key/data layout");
+    }
+}
+
+template<typename _key, typename _data, typename _Store, typename _Search>
+BPlusTree_paged<_key,_data,_Store,_Search>::~BPlusTree_paged() {
+    try {
+        close();
+    } catch(const std::exception& e) {
+        std::fprintf(stderr, "BPlusTree_paged: %s\n", e.what());
+    }
+}
+
+template<typename _key, typename _data, typename _Store, typename _Search>
+typename BPlusTree_paged<_key,_data,_Store,_Search>::pageRef BPlusTree_paged<_key,_data,_Store,_Search>::allocPage(uint32_t level) {
+    page_id pid = meta_->freeList_;
+    if( pid ) {
+        pageRef ref = pin(pid);
+        meta_->freeList_ = ref.header()->next_;
+    } else {
+        pid = meta_->pageCount_++;
+        if( pid >= store_.pageCount() )
+            store_.grow(store_.pageCount() * 2);
+    }
+    pageRef ref = pin(pid);
+    ref.markDirty();
+    pageHeader* h = ref.header();
+    h->level_ = level;
+    h->size_ = 0;
+    h->prev_ = h->next_ = 0;
+    if( level == 0 )
+        ++meta_->leaves_;
+    else
+        ++meta_->inners_;
+    return ref;
+}
+
+// the next_ field links the free pages
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::freePage(pageRef& ref) {
+    pageHeader* h = ref.header();
+    if( h->level_ == 0 )
+        --meta_->leaves_;
+    else
+        --meta_->inners_;
+    h->size_ = 0;
+    h->next_ = meta_->freeList_;
+    ref.markDirty();
+    meta_->freeList_ = ref.id();
+    ref = pageRef();
+}
+
+// find an element, if true return key/data pair
+// else return false pair
+template<typename _key, typename _data, typename _Store, typename _Search>
+std::pair<bool, std::pair<_key, _data> >
+BPlusTree_paged<_key,_data,_Store,_Search>::find(const _key& key) {
+    page_id pid = meta_->root_;
+    if( !pid )
+        return std::make_pair(false, std::make_pair(_key(), _data()) );
+    pageRef ref = pin(pid);
+    while( ref.header()->level_ ) {
+        innerPage* inner = ref.inner();
+        ref = pin(inner->child_[find(inner, key)]);
+    }
+    leafPage* leaf = ref.leaf();
+    unsigned int idx = find(leaf, key);
+    if( idx < leaf->size_ && leaf->key_[idx] == key )
+        return std::make_pair(true, std::make_pair(leaf->key_[idx], leaf->data_[idx]) );
+    return std::make_pair(false, std::make_pair(_key(), _data()) );
+}
+
+// visit every element in [lo, hi) following the leaf links
+template<typename _key, typename _data, typename _Store, typename _Search>
+template<typename Function>
+std::size_t BPlusTree_paged<_key,_data,_Store,_Search>::scan(const _key& lo, const _key& hi, Function f) {
+    std::size_t cnt = 0;
+    page_id pid = meta_->root_;
+    if( !pid || !(lo < hi) )
+        return cnt;
+    pageRef ref = pin(pid);
+    while( ref.header()->level_ ) {
+        innerPage* inner = ref.inner();
+        ref = pin(inner->child_[find(inner, lo)]);
+    }
+    unsigned int idx = find(ref.leaf(), lo);
+    while( true ) {
+        leafPage* leaf = ref.leaf();
+        for(; idx < leaf->size_; ++idx) {
+            if( !(leaf->key_[idx] < hi) )
+                return cnt;
+            f(leaf->key_[idx], leaf->data_[idx]);
+            ++cnt;
+        }
+        if( !leaf->next_ )
+            return cnt;
+        ref = pin(leaf->next_);
+        idx = 0;
+    }
+}
+
+// insert an element into the tree
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::insert(const _key& key, const _data& data) {
+    if( !meta_->root_ ) {
+        pageRef ref = allocPage(0);
+        meta_->root_ = meta_->head_ = meta_->tail_ = ref.id();
+    }
+
+    page_id splitPage = 0;
+    _key splitKey;
+    bool res = insert(meta_->root_, key, data, splitPage, splitKey);
+
+    // the root has been split, grow the tree by one level
+    if( splitPage ) {
+        uint32_t level = pin(meta_->root_).header()->level_;
+        pageRef ref = allocPage(level + 1);
+        innerPage* root = ref.inner();
+        root->key_[0] = splitKey;
+        root->child_[0] = meta_->root_;
+        root->child_[1] = splitPage;
+        root->size_ = 1;
+        meta_->root_ = ref.id();
+    }
+
+    if( res )
+        ++meta_->itemCount_;
+}
+
+// descend down to leaf and insert key/data, split full nodes on the way
+// back up and hand the new right node to the parent
+template<typename _key, typename _data, typename _Store, typename _Search>
+bool BPlusTree_paged<_key,_data,_Store,_Search>::insert(page_id pid, const _key& key, const _data& data, page_id& splitPage, _key& splitKey) {
+    pageRef ref = pin(pid);
+    if( ref.header()->level_ == 0 ) {
+        leafPage* n = ref.leaf();
+        unsigned int idx = find(n, key);
+        if( idx < n->size_ && n->key_[idx] == key )
+            return false;
+        ref.markDirty();
+        pageRef right;
+        if( n->size_ == static_cast<uint32_t>(LEAF_MAX_) ) {
+            split_leafnode(ref, right, splitKey);
+            splitPage = right.id();
+            // the key goes to the right leaf if it is after the left's last key
+            if( idx >= n->size_ ) {
+                idx -= n->size_;
+                n = right.leaf();
+            }
+        }
+        std::copy_backward(n->key_ + idx, n->key_ + n->size_, n->key_ + n->size_ + 1);
+        std::copy_backward(n->data_ + idx, n->data_ + n->size_, n->data_ + n->size_ + 1);
+        n->key_[idx] = key;
+        n->data_[idx] = data;
+        ++n->size_;
+        return true;
+    }
+
+    innerPage* n = ref.inner();
+    unsigned int idx = find(n, key);
+    page_id newChild = 0;
+    _key newKey;
+    bool res = insert(n->child_[idx], key, data, newChild, newKey);
+    if( !newChild )
+        return res;
+
+    ref.markDirty();
+    pageRef right;
+    if( n->size_ == static_cast<uint32_t>(INNER_MAX_) ) {
+        split_innernode(ref, right, splitKey);
+        splitPage = right.id();
+        // the split child is kept on the left if it is at most the
+        // left's last child, otherwise it moved to the right node
+        if( idx > n->size_ ) {
+            idx -= n->size_ + 1;
+            n = right.inner();
+        }
+    }
+    std::copy_backward(n->key_ + idx, n->key_ + n->size_, n->key_ + n->size_ + 1);
+    std::copy_backward(n->child_ + idx + 1, n->child_ + n->size_ + 1, n->child_ + n->size_ + 2);
+    n->key_[idx] = newKey;
+    n->child_[idx+1] = newChild;
+    ++n->size_;
+    return res;
+}
+
+// move the upper half of a full leaf into a new right leaf
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::split_leafnode(pageRef& ref, pageRef& right, _key& splitKey) {
+    right = allocPage(0);
+    leafPage* n = ref.leaf();
+    leafPage* leaf = right.leaf();
+    unsigned int m = n->size_ / 2;
+    leaf->size_ = n->size_ - m;
+    std::copy(n->key_ + m, n->key_ + n->size_, leaf->key_);
+    std::copy(n->data_ + m, n->data_ + n->size_, leaf->data_);
+    n->size_ = m;
+
+    leaf->next_ = n->next_;
+    leaf->prev_ = ref.id();
+    if( leaf->next_ ) {
+        pageRef next = pin(leaf->next_);
+        next.leaf()->prev_ = right.id();
+        next.markDirty();
+    } else {
+        meta_->tail_ = right.id();
+    }
+    n->next_ = right.id();
+    splitKey = n->key_[m-1];
+}
+
+// move the upper half of a full inner node into a new right node
+// the middle key moves up to the parent
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::split_innernode(pageRef& ref, pageRef& right, _key& splitKey) {
+    innerPage* n = ref.inner();
+    right = allocPage(n->level_);
+    innerPage* inner = right.inner();
+    unsigned int m = n->size_ / 2;
+    inner->size_ = n->size_ - m - 1;
+    std::copy(n->key_ + m + 1, n->key_ + n->size_, inner->key_);
+    std::copy(n->child_ + m + 1, n->child_ + n->size_ + 1, inner->child_);
+    n->size_ = m;
+    splitKey = n->key_[m];
+}
+
+// remove one element
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::erase(const _key& key) {
+    if( !meta_->root_ )
+        return;
+    if( !erase(meta_->root_, key) )
+        return;
+    --meta_->itemCount_;
+
+    pageRef root = pin(meta_->root_);
+    if( root.header()->level_ == 0 ) {
+        // the last element is gone
+        if( root.header()->size_ == 0 ) {
+            freePage(root);
+            meta_->root_ = meta_->head_ = meta_->tail_ = 0;
+        }
+    } else if( root.header()->size_ == 0 ) {
+        // the root has one child left, the child becomes the root
+        meta_->root_ = root.inner()->child_[0];
+        freePage(root);
+    }
+}
+
+// descend down to the leaf and remove the key, on the way back up every
+// underflowing child borrows from or is merged with a sibling
+template<typename _key, typename _data, typename _Store, typename _Search>
+bool BPlusTree_paged<_key,_data,_Store,_Search>::erase(page_id pid, const _key& key) {
+    pageRef ref = pin(pid);
+    if( ref.header()->level_ == 0 ) {
+        leafPage* leaf = ref.leaf();
+        unsigned int idx = find(leaf, key);
+        if( idx >= leaf->size_ || leaf->key_[idx] != key )
+            return false;
+        std::copy(leaf->key_ + idx + 1, leaf->key_ + leaf->size_, leaf->key_ + idx);
+        std::copy(leaf->data_ + idx + 1, leaf->data_ + leaf->size_, leaf->data_ + idx);
+        --leaf->size_;
+        ref.markDirty();
+        return true;
+    }
+
+    innerPage* inner = ref.inner();
+    unsigned int idx = find(inner, key);
+    if( !erase(inner->child_[idx], key) )
+        return false;
+
+    pageRef child = pin(inner->child_[idx]);
+    if( child.header()->level_ == 0 ) {
+        if( child.header()->size_ < static_cast<uint32_t>(LEAF_MIN_) ) {
+            child = pageRef();
+            fix_leaf(ref, idx);
+        }
+    } else if( child.header()->size_ < static_cast<uint32_t>(INNER_MIN_) ) {
+        child = pageRef();
+        fix_inner(ref, idx);
+    }
+    return true;
+}
+
+// child idx of parent is an underflowing leaf
+// borrow one pair from a sibling with spare pairs, otherwise merge
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::fix_leaf(pageRef& parentRef, unsigned int idx) {
+    innerPage* parent = parentRef.inner();
+    parentRef.markDirty();
+    pageRef ref = pin(parent->child_[idx]);
+    ref.markDirty();
+    leafPage* n = ref.leaf();
+
+    if( idx > 0 ) {
+        pageRef leftRef = pin(parent->child_[idx-1]);
+        leafPage* left = leftRef.leaf();
+        if( left->size_ > static_cast<uint32_t>(LEAF_MIN_) ) {
+            leftRef.markDirty();
+            std::copy_backward(n->key_, n->key_ + n->size_, n->key_ + n->size_ + 1);
+            std::copy_backward(n->data_, n->data_ + n->size_, n->data_ + n->size_ + 1);
+            n->key_[0] = left->key_[left->size_-1];
+            n->data_[0] = left->data_[left->size_-1];
+            ++n->size_;
+            --left->size_;
+            parent->key_[idx-1] = left->key_[left->size_-1];
+            return;
+        }
+    }
+    if( idx < parent->size_ ) {
+        pageRef rightRef = pin(parent->child_[idx+1]);
+        leafPage* right = rightRef.leaf();
+        rightRef.markDirty();
+        if( right->size_ > static_cast<uint32_t>(LEAF_MIN_) ) {
+            n->key_[n->size_] = right->key_[0];
+            n->data_[n->size_] = right->data_[0];
+            ++n->size_;
+            std::copy(right->key_ + 1, right->key_ + right->size_, right->key_);
+            std::copy(right->data_ + 1, right->data_ + right->size_, right->data_);
+            --right->size_;
+            parent->key_[idx] = n->key_[n->size_-1];
+            return;
+        }
+        // merge the right sibling into this leaf
+        std::copy(right->key_, right->key_ + right->size_, n->key_ + n->size_);
+        std::copy(right->data_, right->data_ + right->size_, n->data_ + n->size_);
+        n->size_ += right->size_;
+        n->next_ = right->next_;
+        if( n->next_ ) {
+            pageRef next = pin(n->next_);
+            next.leaf()->prev_ = ref.id();
+            next.markDirty();
+        } else {
+            meta_->tail_ = ref.id();
+        }
+        freePage(rightRef);
+        std::copy(parent->key_ + idx + 1, parent->key_ + parent->size_, parent->key_ + idx);
+        std::copy(parent->child_ + idx + 2, parent->child_ + parent->size_ + 1, parent->child_ + idx + 1);
+        --parent->size_;
+        return;
+    }
+    // last child, merge this leaf into the left sibling
+    pageRef leftRef = pin(parent->child_[idx-1]);
+    leafPage* left = leftRef.leaf();
+    leftRef.markDirty();
+    std::copy(n->key_, n->key_ + n->size_, left->key_ + left->size_);
+    std::copy(n->data_, n->data_ + n->size_, left->data_ + left->size_);
+    left->size_ += n->size_;
+    left->next_ = n->next_;
+    if( left->next_ ) {
+        pageRef next = pin(left->next_);
+        next.leaf()->prev_ = leftRef.id();
+        next.markDirty();
+    } else {
+        meta_->tail_ = leftRef.id();
+    }
+    freePage(ref);
+    --parent->size_;
+}
+
+// child idx of parent is an underflowing inner node
+// borrow one child through the parent key, otherwise merge
+template<typename _key, typename _data, typename _Store, typename _Search>
+void BPlusTree_paged<_key,_data,_Store,_Search>::fix_inner(pageRef& parentRef, unsigned int idx) {
+    innerPage* parent = parentRef.inner();
+    parentRef.markDirty();
+    pageRef ref = pin(parent->child_[idx]);
+    ref.markDirty();
+    innerPage* n = ref.inner();
+
+    if( idx > 0 ) {
+        pageRef leftRef = pin(parent->child_[idx-1]);
+        innerPage* left = leftRef.inner();
+        if( left->size_ > static_cast<uint32_t>(INNER_MIN_) ) {
+            leftRef.markDirty();
+            std::copy_backward(n->key_, n->key_ + n->size_, n->key_ + n->size_ + 1);
+            std::copy_backward(n->child_, n->child_ + n->size_ + 1, n->child_ + n->size_ + 2);
+            n->key_[0] = parent->key_[idx-1];
+            n->child_[0] = left->child_[left->size_];
+            ++n->size_;
+            parent->key_[idx-1] = left->key_[left->size_-1];
+            --left->size_;
+            return;
+        }
+    }
+    if( idx < parent->size_ ) {
+        pageRef rightRef = pin(parent->child_[idx+1]);
+        innerPage* right = rightRef.inner();
+        rightRef.markDirty();
+        if( right->size_ > static_cast<uint32_t>(INNER_MIN_) ) {
+            n->key_[n->size_] = parent->key_[idx];
+            n->child_[n->size_+1] = right->child_[0];
+            ++n->size_;
+            parent->key_[idx] = right->key_[0];
+            std::copy(right->key_ + 1, right->key_ + right->size_, right->key_);
+            std::copy(right->child_ + 1, right->child_ + right->size_ + 1, right->child_);
+            --right->size_;
+            return;
+        }
+        // merge the right sibling into this node
+        n->key_[n->size_] = parent->key_[idx];
+        std::copy(right->key_, right->key_ + right->size_, n->key_ + n->size_ + 1);
+        std::copy(right->child_, right->child_ + right->size_ + 1, n->child_ + n->size_ + 1);
+        n->size_ += right->size_ + 1;
+        freePage(rightRef);
+        std::copy(parent->key_ + idx + 1, parent->key_ + parent->size_, parent->key_ + idx);
+        std::copy(parent->child_ + idx + 2, parent->child_ + parent->size_ + 1, parent->child_ + idx + 1);
+        --parent->size_;
+        return;
+    }
+    // last child, merge this node into the left sibling
+    pageRef leftRef = pin(parent->child_[idx-1]);
+    innerPage* left = leftRef.inner();
+    leftRef.markDirty();
+    left->key_[left->size_] = parent->key_[idx-1];
+    std::copy(n->key_, n->key_ + n->size_, left->key_ + left->size_ + 1);
+    std::copy(n->child_, n->child_ + n->size_ + 1, left->child_ + left->size_ + 1);
+    left->size_ += n->size_ + 1;
+    freePage(ref);
+    --parent->size_;
+}
+
+#endif
@@ -0,0 +1,643 @@
+#ifndef _BPlusTree_STRING_HPP_
+#define _BPlusTree_STRING_HPP_
+
+#include "btree.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// BPlusTree for variable length string keys
+// a node is one fixed-size block : the slot array grows from the front,
+// key bytes and values grow from the back into the same block. Every node
+// keeps the two separators bounding its key range (fences), all keys in
+// the range share the common prefix of the fences, so a node stores only
+// the suffixes behind that prefix. Every slot caches the first 4 bytes of
+// its suffix, most comparisons are decided without touching the key bytes.
+// A leaf split pushes up the shortest separator between the two halves
+// instead of a whole key.
+// Unlike BPlusTree, child i of an inner node holds the keys less than
+// separator i and the last child the keys not less than the last one.
+// data is copied bytewise, so it must be trivially copyable
+// @param :
+// _NodeSize : bytes per node
+// _Alloc : allocator rebound to the node type
+template<typename _data,
+         std::size_t _NodeSize = 4096,
+         typename _Alloc = btree_slab_allocator<char> >
+class BPlusTree_string {
+    static_assert(std::is_trivially_copyable<_data>::value, "BPlusTree_string needs trivially copyable data");
+    static_assert(_NodeSize >= 512 && _NodeSize <= 32768, "BPlusTree_string node size must be in [512, 32768]");
+    static_assert(sizeof(_data) <= _NodeSize / 32, "BPlusTree_string node size too small for data");
+public:
+    // longest key accepted, a node always has room for its two fences
+    // and a few records of this size
+    static const std::size_t MAX_KEY_SIZE = (_NodeSize - 64) / 8 - 16 - (sizeof(_data) > sizeof(void*) ? sizeof(_data) : sizeof(void*));
+
+    // default constructor
+    explicit BPlusTree_string() : root_(nullptr), stats_() {}
+    // non-copyable
+    BPlusTree_string(const BPlusTree_string&) = delete;
+    BPlusTree_string& operator=(const BPlusTree_string&) = delete;
+    ~BPlusTree_string() {
+        if( root_ )
+            clear(root_);
+    }
+
+    // insert an element, identical key is ignored
+    // keys longer than MAX_KEY_SIZE throw std::length_error
+    void insert(const std::string& key, const _data& data);
+
+    // find an element, if true return key/data pair
+    // else return false pair
+    std::pair<bool, std::pair<std::string, _data> > find(const std::string& key) const;
+
+    // remove one element
+    void erase(const std::string& key);
+
+    // call f(key, data) on every element in [lo, hi) in order
+    // return the number of visited elements
+    template<typename Function>
+    std::size_t scan(const std::string& lo, const std::string& hi, Function f) const;
+
+    // return the size of tree
+    std::size_t size() const {
+        return stats_.itemCount_;
+    }
+
+    // check whether the tree is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // remove all elements
+    void clear() {
+        if( root_ )
+            clear(root_);
+        root_ = nullptr;
+        stats_ = tree_stats();
+    }
+
+    struct tree_stats {
+        std::size_t itemCount_; // number of items in btree
+        std::size_t leaves_;    // number of leaf nodes
+        std::size_t inners_;    // number of inner nodes
+
+        tree_stats() : itemCount_(0), leaves_(0), inners_(0) {}
+    };
+
+    // return the statistical information of tree
+    tree_stats stats() const {
+        return stats_;
+    }
+
+private:
+    // deeper than any tree the node size allows
+    static const unsigned int MAX_HEIGHT = 32;
+
+    // lexicographic byte comparison, the same order as std::string
+    static inline int compare(const unsigned char* a, unsigned int alen, const unsigned char* b, unsigned int blen) {
+        int c = std::memcmp(a, b, std::min(alen, blen));
+        if( c )
+            return c;
+        return alen < blen ? -1 : (alen > blen ? 1 : 0);
+    }
+
+    static inline unsigned int commonPrefix(const unsigned char* a, unsigned int alen, const unsigned char* b, unsigned int blen) {
+        unsigned int i = 0;
+        unsigned int n = std::min(alen, blen);
+        while( i < n && a[i] == b[i] )
+            ++i;
+        return i;
+    }
+
+    // first 4 bytes as a big endian integer padded with zeros, comparing
+    // heads orders keys like comparing their first 4 bytes
+    static inline uint32_t head(const unsigned char* s, unsigned int len) {
+        uint32_t h = 0;
+        for(unsigned int i = 0; i < 4; ++i)
+            h = (h << 8) | (i < len ? s[i] : 0);
+        return h;
+    }
+
+    struct slot {
+        uint16_t offset_; // record position in the heap
+        uint16_t len_;    // suffix length, the value follows the suffix
+        uint32_t head_;   // first bytes of the suffix
+    };
+
+    struct nodeHeader {
+        // inner node : child holding the keys not less than the last separator
+        nodeHeader* upper_;
+        // neighbour leaves
+        nodeHeader* prev_;
+        nodeHeader* next_;
+        // 0 for leaf node
+        uint16_t level_;
+        uint16_t size_;
+        // start of the used part of the heap
+        uint16_t heapTop_;
+        // heap bytes of removed records, reclaimed by compact()
+        uint16_t garbage_;
+        // the prefix is the start of the lower fence
+        uint16_t prefixLen_;
+        uint16_t lowFence_;
+        uint16_t lowLen_;
+        uint16_t highFence_;
+        uint16_t highLen_;
+    };
+
+    class node : public nodeHeader {
+    public:
+        static const unsigned int CAPACITY = _NodeSize - sizeof(nodeHeader);
+
+        // empty node for the keys in [low, high), an empty high fence is
+        // the end of the key space
+        void init(unsigned int level, const unsigned char* low, unsigned int lowLen, const unsigned char* high, unsigned int highLen) {
+            this->upper_ = this->prev_ = this->next_ = nullptr;
+            this->level_ = level;
+            this->size_ = 0;
+            this->heapTop_ = CAPACITY;
+            this->garbage_ = 0;
+            this->heapTop_ -= lowLen;
+            this->lowFence_ = this->heapTop_;
+            this->lowLen_ = lowLen;
+            if( lowLen )
+                std::memcpy(data_ + this->lowFence_, low, lowLen);
+            this->heapTop_ -= highLen;
+            this->highFence_ = this->heapTop_;
+            this->highLen_ = highLen;
+            if( highLen )
+                std::memcpy(data_ + this->highFence_, high, highLen);
+            this->prefixLen_ = commonPrefix(low, lowLen, high, highLen);
+        }
+
+        inline bool isLeafNode() const {
+            return this->level_ == 0;
+        }
+        inline slot* slots() {
+            return reinterpret_cast<slot*>(data_);
+        }
+        inline const slot* slots() const {
+            return reinterpret_cast<const slot*>(data_);
+        }
+        inline const unsigned char* lowFence() const {
+            return data_ + this->lowFence_;
+        }
+        inline const unsigned char* highFence() const {
+            return data_ + this->highFence_;
+        }
+        inline unsigned int payloadSize() const {
+            return isLeafNode() ? sizeof(_data) : sizeof(node*);
+        }
+        inline unsigned int freeSpace() const {
+            return this->heapTop_ - this->size_ * sizeof(slot);
+        }
+        inline unsigned int freeSpaceAfterCompaction() const {
+            return freeSpace() + this->garbage_;
+        }
+        // bytes used by the records, fences not included
+        inline unsigned int usedSpace() const {
+            return CAPACITY - freeSpaceAfterCompaction() - this->lowLen_ - this->highLen_;
+        }
+        inline unsigned int spaceNeeded(unsigned int keyLen) const {
+            return sizeof(slot) + keyLen - this->prefixLen_ + payloadSize();
+        }
+        inline bool hasSpaceFor(unsigned int keyLen) const {
+            return spaceNeeded(keyLen) <= freeSpaceAfterCompaction();
+        }
+
+        // first slot whose key is not less than key, the key has to
+        // be inside the fences of the node
+        unsigned int lowerBound(const unsigned char* key, unsigned int len, bool& found) const {
+            assert( len >= this->prefixLen_ && std::memcmp(key, lowFence(), this->prefixLen_) == 0 );
+            const unsigned char* s = key + this->prefixLen_;
+            unsigned int sLen = len - this->prefixLen_;
+            uint32_t h = head(s, sLen);
+            unsigned int lo = 0, hi = this->size_;
+            while( lo < hi ) {
+                unsigned int mid = (lo + hi) / 2;
+                const slot& sl = slots()[mid];
+                int c;
+                if( h != sl.head_ )
+                    c = h < sl.head_ ? -1 : 1;
+                else
+                    c = compare(s, sLen, data_ + sl.offset_, sl.len_);
+                if( c < 0 ) {
+                    hi = mid;
+                } else if( c > 0 ) {
+                    lo = mid + 1;
+                } else {
+                    found = true;
+                    return mid;
+                }
+            }
+            found = false;
+            return lo;
+        }
+
+        // index of the child whose range holds key
+        inline unsigned int upperBound(const unsigned char* key, unsigned int len) const {
+            bool found;
+            unsigned int idx = lowerBound(key, len, found);
+            return found ? idx + 1 : idx;
+        }
+
+        // copy the whole key of slot i into buf, return its length
+        inline unsigned int keyAt(unsigned int i, unsigned char* buf) const {
+            const slot& sl = slots()[i];
+            std::memcpy(buf, lowFence(), this->prefixLen_);
+            std::memcpy(buf + this->prefixLen_, data_ + sl.offset_, sl.len_);
+            return this->prefixLen_ + sl.len_;
+        }
+        inline const unsigned char* payload(unsigned int i) const {
+            const slot& sl = slots()[i];
+            return data_ + sl.offset_ + sl.len_;
+        }
+        inline unsigned char* payload(unsigned int i) {
+            const slot& sl = slots()[i];
+            return data_ + sl.offset_ + sl.len_;
+        }
+        inline node* child(unsigned int i) const {
+            if( i == this->size_ )
+                return static_cast<node*>(this->upper_);
+            node* n;
+            std::memcpy(&n, payload(i), sizeof(n));
+            return n;
+        }
+
+        // insert the record at slot pos, the space must be available
+        void insertAt(unsigned int pos, const unsigned char* key, unsigned int len, const void* value) {
+            assert( hasSpaceFor(len) );
+            if( freeSpace() < spaceNeeded(len) )
+                compact();
+            const unsigned char* s = key + this->prefixLen_;
+            unsigned int sLen = len - this->prefixLen_;
+            this->heapTop_ -= sLen + payloadSize();
+            std::memcpy(data_ + this->heapTop_, s, sLen);
+            std::memcpy(data_ + this->heapTop_ + sLen, value, payloadSize());
+            std::memmove(slots() + pos + 1, slots() + pos, (this->size_ - pos) * sizeof(slot));
+            slot& sl = slots()[pos];
+            sl.offset_ = this->heapTop_;
+            sl.len_ = sLen;
+            sl.head_ = head(s, sLen);
+            ++this->size_;
+        }
+
+        inline void append(const unsigned char* key, unsigned int len, const void* value) {
+            insertAt(this->size_, key, len, value);
+        }
+
+        // append slot i of another node, the key is re-encoded for
+        // the prefix of this node
+        inline void appendFrom(const node& src, unsigned int i) {
+            unsigned char buf[MAX_KEY_SIZE];
+            unsigned int len = src.keyAt(i, buf);
+            append(buf, len, src.payload(i));
+        }
+
+        void removeAt(unsigned int pos) {
+            const slot& sl = slots()[pos];
+            this->garbage_ += sl.len_ + payloadSize();
+            std::memmove(slots() + pos, slots() + pos + 1, (this->size_ - pos - 1) * sizeof(slot));
+            --this->size_;
+        }
+
+        // rewrite the records to reclaim the space of removed records
+        void compact() {
+            node tmp;
+            tmp.init(this->level_, lowFence(), this->lowLen_, highFence(), this->highLen_);
+            tmp.upper_ = this->upper_;
+            tmp.prev_ = this->prev_;
+            tmp.next_ = this->next_;
+            for(unsigned int i = 0; i < this->size_; ++i)
+                tmp.appendFrom(*this, i);
+            std::memcpy(static_cast<void*>(this), &tmp, sizeof(node));
+        }
+
+    private:
+        unsigned char data_[CAPACITY];
+    };
+
+    static_assert(sizeof(node) == _NodeSize, "BPlusTree_string node layout");
+
+    typedef typename std::allocator_traits<_Alloc>::template rebind_alloc<node> node_allocator;
+
+    node* newNode(unsigned int level, const unsigned char* low, unsigned int lowLen, const unsigned char* high, unsigned int highLen) {
+        node* n = node_.allocate(1);
+        n->init(level, low, lowLen, high, highLen);
+        if( level == 0 )
+            ++stats_.leaves_;
+        else
+            ++stats_.inners_;
+        return n;
+    }
+
+    void freeNode(node* n) {
+        if( n->isLeafNode() )
+            --stats_.leaves_;
+        else
+            --stats_.inners_;
+        node_.deallocate(n, 1);
+    }
+
+    // release the whole subtree rooted at n
+    void clear(node* n) {
+        if( !n->isLeafNode() ) {
+            for(unsigned int i = 0; i <= n->size_; ++i)
+                clear(n->child(i));
+        }
+        freeNode(n);
+    }
+
+    static inline const unsigned char* bytes(const std::string& s) {
+        return reinterpret_cast<const unsigned char*>(s.data());
+    }
+
+    // descend down to the leaf which may contain key
+    inline node* findLeaf(const unsigned char* key, unsigned int len) const {
+        node* n = root_;
+        while( !n->isLeafNode() )
+            n = n->child(n->upperBound(key, len));
+        return n;
+    }
+
+    // node is underflowing if its records fill less than a quarter
+    static inline bool isUnderflow(const node* n) {
+        return n->usedSpace() < node::CAPACITY / 4;
+    }
+
+    // split path[depth], or its parent first if the parent has no
+    // room for the separator, the caller retries after every split
+    void split(node** path, unsigned int depth);
+    // merge child idx of parent with a sibling if both fit into one node
+    bool merge(node* parent, unsigned int idx);
+
+    node* root_;
+    tree_stats stats_;
+    node_allocator node_;
+};
+
+// find an element, if true return key/data pair
+// else return false pair
+template<typename _data, std::size_t _NodeSize, typename _Alloc>
+std::pair<bool, std::pair<std::string, _data> >
+BPlusTree_string<_data,_NodeSize,_Alloc>::find(const std::string& key) const {
+    if( !root_ || key.size() > MAX_KEY_SIZE )
+        return std::make_pair(false, std::make_pair(std::string(), _data()) );
+    node* leaf = findLeaf(bytes(key), key.size());
+    bool found;
+    unsigned int idx = leaf->lowerBound(bytes(key), key.size(), found);
+    if( !found )
+        return std::make_pair(false, std::make_pair(std::string(), _data()) );
+    _data data;
+    std::memcpy(&data, leaf->payload(idx), sizeof(_data));
+    return std::make_pair(true, std::make_pair(key, data) );
+}
+
+// visit every element in [lo, hi) following the leaf links
+template<typename _data, std::size_t _NodeSize, typename _Alloc>
+template<typename Function>
+std::size_t BPlusTree_string<_data,_NodeSize,_Alloc>::scan(const std::string& lo, const std::string& hi, Function f) const {
+    std::size_t cnt = 0;
+    if( !root_ || !(lo < hi) )
+        return cnt;
+    unsigned int idx;
+    node* leaf;
+    bool found;
+    bool skip = lo.size() > MAX_KEY_SIZE;
+    if( skip ) {
+        // no such key is stored, start at its truncation and skip
+        // the keys in front of lo
+        std::string tmp = lo.substr(0, MAX_KEY_SIZE);
+        leaf = findLeaf(bytes(tmp), tmp.size());
+        idx = leaf->lowerBound(bytes(tmp), tmp.size(), found);
+    } else {
+        leaf = findLeaf(bytes(lo), lo.size());
+        idx = leaf->lowerBound(bytes(lo), lo.size(), found);
+    }
+
+    unsigned char buf[MAX_KEY_SIZE];
+    std::string key;
+    _data data;
+    while( leaf ) {
+        for(; idx < leaf->size_; ++idx) {
+            key.assign(reinterpret_cast<const char*>(buf), leaf->keyAt(idx, buf));
+            if( skip && key < lo )
+                continue;
+            if( !(key < hi) )
+                return cnt;
+            std::memcpy(&data, leaf->payload(idx), sizeof(_data));
+            f(static_cast<const std::string&>(key), static_cast<const _data&>(data));
+            ++cnt;
+        }
+        leaf = static_cast<node*>(leaf->next_);
+        idx = 0;
+    }
+    return cnt;
+}
+
+// insert an element into the tree
+// a full leaf is split and the insert restarts from the root
+template<typename _data, std::size_t _NodeSize, typename _Alloc>
+void BPlusTree_string<_data,_NodeSize,_Alloc>::insert(const std::string& key, const _data& data) {
+    if( key.size() > MAX_KEY_SIZE )
+        throw std::length_error("BPlusTree_string: key longer than MAX_KEY_SIZE");
+    const unsigned char* k = bytes(key);
+    unsigned int len = key.size();
+    if( !root_ )
+        root_ = newNode(0, nullptr, 0, nullptr, 0);
+
+    while( true ) {
+        node* path[MAX_HEIGHT];
+        unsigned int depth = 0;
+        node* n = root_;
+        while( !n->isLeafNode() ) {
+            path[depth++] = n;
+            n = n->child(n->upperBound(k, len));
+        }
+        path[depth] = n;
+
+        bool found;
+        unsigned int idx = n->lowerBound(k, len, found);
+        if( found )
+            return;
+        if( n->hasSpaceFor(len) ) {
+            n->insertAt(idx, k, len, &data);
+            ++stats_.itemCount_;
+            return;
+        }
+        split(path, depth);
+    }
+}
+
+// move the lower half of path[depth] into a new left node
+// the node keeps its address, so only the parent gains one slot
+template<typename _data, std::size_t _NodeSize, typename _Alloc>
+void BPlusTree_string<_data,_NodeSize,_Alloc>::split(node** path, unsigned int depth) {
+    node* n = path[depth];
+    node* parent;
+    if( depth == 0 ) {
+        // the root is split, grow the tree by one level
+        assert( root_->level_ + 1u < MAX_HEIGHT );
+        parent = newNode(n->level_ + 1, nullptr, 0, nullptr, 0);
+        parent->upper_ = n;
+        root_ = parent;
+    } else {
+        parent = path[depth-1];
+    }
+
+    // split where the records reach half of the used space
+    unsigned int total = 0, acc = 0, m = 0;
+    for(unsigned int i = 0; i < n->size_; ++i)
+        total += n->spaceNeeded(n->prefixLen_ + n->slots()[i].len_);
+    while( m < n->size_ && 2 * acc < total )
+        acc += n->spaceNeeded(n->prefixLen_ + n->slots()[m++].len_);
+
+    unsigned char sep[MAX_KEY_SIZE];
+    unsigned int sepLen;
+    if( n->isLeafNode() ) {
+        assert( n->size_ >= 2 );
+        m = std::max(1u, std::min(m, n->size_ - 1u));
+        // shortest separator s with left keys < s <= right keys, the
+        // last left key and the first right key differ at byte p
+        unsigned char last[MAX_KEY_SIZE];
+        unsigned int lastLen = n->keyAt(m - 1, last);
+        unsigned int firstLen = n->keyAt(m, sep);
+        sepLen = commonPrefix(last, lastLen, sep, firstLen) + 1;
+        assert( sepLen <= firstLen );
+    } else {
+        // the separator in the middle moves up to the parent
+        assert( n->size_ >= 1 );
+        m = std::min(m, n->size_ - 1u);
+        sepLen = n->keyAt(m, sep);
+    }
+
+    if( !parent->hasSpaceFor(sepLen) ) {
+        split(path, depth - 1);
+        return;
+    }
+
+    node* left = newNode(n->level_, n->lowFence(), n->lowLen_, sep, sepLen);
+    node right;
+    right.init(n->level_, sep, sepLen, n->highFence(), n->highLen_);
+    for(unsigned int i = 0; i < m; ++i)
+        left->appendFrom(*n, i);
+    if( n->isLeafNode() ) {
+        for(unsigned int i = m; i < n->size_; ++i)
+            right.appendFrom(*n, i);
+        left->prev_ = n->prev_;
+        left->next_ = n;
+        if( left->prev_ )
+            left->prev_->next_ = left;
+        right.prev_ = left;
+        right.next_ = n->next_;
+    } else {
+        left->upper_ = n->child(m);
+        for(unsigned int i = m + 1; i < n->size_; ++i)
+            right.appendFrom(*n, i);
+        right.upper_ = n->upper_;
+    }
+    std::memcpy(static_cast<void*>(n), &right, sizeof(node));
+
+    // n is the child at the separator's position, the new slot in
+    // front of it takes the left half
+    parent->insertAt(parent->upperBound(sep, sepLen), sep, sepLen, &left);
+}
+
+// remove one element
+// underflowing nodes on the path are merged with a sibling bottom-up
+template<typename _data, std::size_t _NodeSize, typename _Alloc>
+void BPlusTree_string<_data,_NodeSize,_Alloc>::erase(const std::string& key) {
+    if( !root_ || key.size() > MAX_KEY_SIZE )
+        return;
+    const unsigned char* k = bytes(key);
+    unsigned int len = key.size();
+
+    node* path[MAX_HEIGHT];
+    unsigned int pos[MAX_HEIGHT];
+    unsigned int depth = 0;
+    node* n = root_;
+    while( !n->isLeafNode() ) {
+        path[depth] = n;
+        pos[depth] = n->upperBound(k, len);
+        n = n->child(pos[depth++]);
+    }
+    path[depth] = n;
+
+    bool found;
+    unsigned int idx = n->lowerBound(k, len, found);
+    if( !found )
+        return;
+    n->removeAt(idx);
+    --stats_.itemCount_;
+
+    // a node without siblings can't merge, but its parent underflows as
+    // well and merges one level up
+    for(unsigned int d = depth; d > 0 && isUnderflow(path[d]); --d)
+        merge(path[d-1], pos[d-1]);
+
+    // the root has one child left, the child becomes the root
+    while( !root_->isLeafNode() && root_->size_ == 0 ) {
+        node* r = root_;
+        root_ = r->child(0);
+        freeNode(r);
+    }
+    // the last element is gone, drop any empty node left behind
+    if( stats_.itemCount_ == 0 ) {
+        clear(root_);
+        root_ = nullptr;
+    }
+}
+
+// merge child idx of parent with its right sibling, or its left one for
+// the last child. The merged node is built aside and only replaces the
+// right node if it fits
+template<typename _data, std::size_t _NodeSize, typename _Alloc>
+bool BPlusTree_string<_data,_NodeSize,_Alloc>::merge(node* parent, unsigned int idx) {
+    if( parent->size_ == 0 )
+        return false;
+    if( idx == parent->size_ )
+        --idx;
+    node* left = parent->child(idx);
+    node* right = parent->child(idx + 1);
+
+    unsigned char sep[MAX_KEY_SIZE];
+    unsigned int sepLen = parent->keyAt(idx, sep);
+
+    node tmp;
+    tmp.init(left->level_, left->lowFence(), left->lowLen_, right->highFence(), right->highLen_);
+    unsigned int need = 0;
+    for(unsigned int i = 0; i < left->size_; ++i)
+        need += tmp.spaceNeeded(left->prefixLen_ + left->slots()[i].len_);
+    for(unsigned int i = 0; i < right->size_; ++i)
+        need += tmp.spaceNeeded(right->prefixLen_ + right->slots()[i].len_);
+    if( !left->isLeafNode() )
+        need += tmp.spaceNeeded(sepLen);
+    if( need > tmp.freeSpace() )
+        return false;
+
+    for(unsigned int i = 0; i < left->size_; ++i)
+        tmp.appendFrom(*left, i);
+    if( left->isLeafNode() ) {
+        tmp.prev_ = left->prev_;
+        tmp.next_ = right->next_;
+        if( tmp.prev_ )
+            tmp.prev_->next_ = right;
+    } else {
+        // the parent's separator comes down in front of the right keys
+        node* c = left->child(left->size_);
+        tmp.append(sep, sepLen, &c);
+        tmp.upper_ = right->upper_;
+    }
+    for(unsigned int i = 0; i < right->size_; ++i)
+        tmp.appendFrom(*right, i);
+    std::memcpy(static_cast<void*>(right), &tmp, sizeof(node));
+
+    parent->removeAt(idx);
+    freeNode(left);
+    return true;
+}
+
+#endif
@@ -0,0 +1,640 @@
+#ifndef _BPlusTree_WAL_HPP_
+#define _BPlusTree_WAL_HPP_
+
+#include "btree.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// crc32 (IEEE) of a byte range, used to detect torn log records
+inline uint32_t btree_crc32(const void* data, std::size_t len, uint32_t crc = 0) {
+    struct table {
+        uint32_t t_[256];
+        table() {
+            for(uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for(int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t_[i] = c;
+            }
+        }
+    };
+    static const table tab;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for(std::size_t i = 0; i < len; ++i)
+        crc = tab.t_[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+struct wal_options {
+    // a write returns only after its log record is on disk
+    bool syncCommit_;
+    // without syncCommit_, the log is written and synced once this
+    // many bytes are buffered
+    std::size_t syncBytes_;
+    // a committing writer waits this long for more writers to join its
+    // group before it syncs the log for all of them
+    std::chrono::microseconds groupDelay_;
+    // checkpoint once the log grows beyond this size, 0 disables
+    std::size_t checkpointBytes_;
+
+    wal_options() : syncCommit_(true), syncBytes_(1 << 20), groupDelay_(0), checkpointBytes_(64 << 20) {}
+};
+
+// counters of the log
+struct wal_stats {
+    std::size_t records_;     // records appended
+    std::size_t syncs_;       // fdatasync calls, each commits a group
+    std::size_t checkpoints_; // checkpoints taken
+    std::size_t replayed_;    // records applied on open
+
+    wal_stats() : records_(0), syncs_(0), checkpoints_(0), replayed_(0) {}
+};
+
+// append-only log file with group commit
+// records are buffered in memory and get a log sequence number (lsn).
+// A committing writer which finds no sync in progress becomes the leader:
+// it takes the whole buffer, writes and syncs it, and wakes every writer
+// whose record was in it. Writers arriving meanwhile queue up for the
+// next group, so under load one fdatasync covers many writes.
+class write_ahead_log {
+public:
+    // record types
+    enum record_type {
+        wal_insert = 1,
+        wal_erase = 2
+    };
+
+    struct recordHeader {
+        uint32_t crc_;  // crc of the rest of the header and the payload
+        uint32_t size_; // payload bytes
+        uint64_t lsn_;
+        uint32_t type_;
+        uint32_t pad_;
+    };
+
+    write_ahead_log(const std::string& path, const wal_options& opts)
+        : opts_(opts), fd_(-1), nextLsn_(1), bufferedLsn_(0), durableLsn_(0), size_(0), flushing_(false), failed_(0) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+
+    // non-copyable
+    write_ahead_log(const write_ahead_log&) = delete;
+    write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+    ~write_ahead_log() {
+        try {
+            flush();
+        } catch(...) {
+        }
+        ::close(fd_);
+    }
+
+    // call f(type, payload, size) on every complete record in the file
+    // whose lsn is greater than after, a torn record at the tail ends the
+    // log and is cut off. New records continue behind both.
+    // return the number of records passed to f
+    template<typename Function>
+    std::size_t replay(uint64_t after, Function f) {
+        std::string data;
+        char buf[1 << 16];
+        ssize_t n;
+        if( ::lseek(fd_, 0, SEEK_SET) < 0 )
+            throw std::system_error(errno, std::generic_category(), "lseek");
+        while( (n = ::read(fd_, buf, sizeof(buf))) > 0 )
+            data.append(buf, n);
+        if( n < 0 )
+            throw std::system_error(errno, std::generic_category(), "read");
+
+        std::size_t pos = 0, cnt = 0;
+        while( pos + sizeof(recordHeader) <= data.size() ) {
+            recordHeader h;
+            std::memcpy(&h, data.data() + pos, sizeof(h));
+            if( pos + sizeof(h) + h.size_ > data.size() )
+                break;
+            uint32_t crc = btree_crc32(data.data() + pos + sizeof(h.crc_), sizeof(h) - sizeof(h.crc_) + h.size_);
+            if( crc != h.crc_ )
+                break;
+            if( h.lsn_ > after ) {
+                f(static_cast<record_type>(h.type_), data.data() + pos + sizeof(h), h.size_);
+                ++cnt;
+            }
+            nextLsn_ = std::max(nextLsn_, h.lsn_ + 1);
+            pos += sizeof(h) + h.size_;
+        }
+        nextLsn_ = std::max(nextLsn_, after + 1);
+        if( pos != data.size() && ::ftruncate(fd_, pos) != 0 )
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        if( ::lseek(fd_, pos, SEEK_SET) < 0 )
+            throw std::system_error(errno, std::generic_category(), "lseek");
+        size_ = pos;
+        durableLsn_ = bufferedLsn_ = nextLsn_ - 1;
+        return cnt;
+    }
+
+    // buffer one record, return its lsn
+    // the caller serializes appends in the order it applied them
+    uint64_t append(record_type type, const void* a, std::size_t alen, const void* b = nullptr, std::size_t blen = 0) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        checkFailed();
+        recordHeader h;
+        h.size_ = alen + blen;
+        h.lsn_ = nextLsn_++;
+        h.type_ = type;
+        h.pad_ = 0;
+        uint32_t crc = btree_crc32(reinterpret_cast<const char*>(&h) + sizeof(h.crc_), sizeof(h) - sizeof(h.crc_));
+        crc = btree_crc32(a, alen, crc);
+        h.crc_ = btree_crc32(b, blen, crc);
+        buffer_.append(reinterpret_cast<const char*>(&h), sizeof(h));
+        buffer_.append(static_cast<const char*>(a), alen);
+        if( blen )
+            buffer_.append(static_cast<const char*>(b), blen);
+        bufferedLsn_ = h.lsn_;
+        ++stats_.records_;
+        return h.lsn_;
+    }
+
+    // make the record lsn durable according to the options
+    void commit(uint64_t lsn) {
+        std::unique_lock<std::mutex> lk(mutex_);
+        if( !opts_.syncCommit_ ) {
+            if( buffer_.size() >= opts_.syncBytes_ )
+                sync(lk, bufferedLsn_);
+            return;
+        }
+        sync(lk, lsn);
+    }
+
+    // write and sync every buffered record
+    void flush() {
+        std::unique_lock<std::mutex> lk(mutex_);
+        sync(lk, bufferedLsn_);
+    }
+
+    // drop the whole log once a checkpoint holds its records
+    // the caller makes sure no record is appended meanwhile
+    void reset() {
+        std::unique_lock<std::mutex> lk(mutex_);
+        sync(lk, bufferedLsn_);
+        if( ::ftruncate(fd_, 0) != 0 )
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        if( ::lseek(fd_, 0, SEEK_SET) < 0 )
+            throw std::system_error(errno, std::generic_category(), "lseek");
+        if( ::fdatasync(fd_) != 0 )
+            throw std::system_error(errno, std::generic_category(), "fdatasync");
+        size_ = 0;
+    }
+
+    // last lsn handed out
+    uint64_t lastLsn() const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return nextLsn_ - 1;
+    }
+
+    // bytes in the log file and the buffer
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return size_ + buffer_.size();
+    }
+
+    wal_stats stats() const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return stats_;
+    }
+
+private:
+    // wait until lsn is durable, lead a group if nobody else does
+    void sync(std::unique_lock<std::mutex>& lk, uint64_t lsn) {
+        while( durableLsn_ < lsn ) {
+            checkFailed();
+            if( flushing_ ) {
+                cond_.wait(lk);
+                continue;
+            }
+            flushing_ = true;
+            if( opts_.groupDelay_.count() > 0 ) {
+                lk.unlock();
+                std::this_thread::sleep_for(opts_.groupDelay_);
+                lk.lock();
+            }
+            std::string group;
+            group.swap(buffer_);
+            uint64_t upto = bufferedLsn_;
+            const std::size_t offset = size_;
+            lk.unlock();
+            int err = writeAll(group, offset);
+            int syncErr = 0;
+            if( !err && ::fdatasync(fd_) != 0 )
+                syncErr = errno;
+            lk.lock();
+            flushing_ = false;
+            if( err ) {
+                // cut off what made it to the file and put the records back,
+                // a later sync writes the whole group at the same offset
+                if( ::ftruncate(fd_, offset) != 0 )
+                    failed_ = errno;
+                else
+                    buffer_.insert(0, group);
+                cond_.notify_all();
+                throw std::system_error(err, std::generic_category(), "write-ahead log");
+            }
+            if( syncErr ) {
+                // which pages reached the disk is unknown after a failed
+                // sync, retrying could report lost records as durable
+                failed_ = syncErr;
+                cond_.notify_all();
+                throw std::system_error(syncErr, std::generic_category(), "write-ahead log fdatasync");
+            }
+            size_ += group.size();
+            durableLsn_ = upto;
+            ++stats_.syncs_;
+            cond_.notify_all();
+        }
+    }
+
+    // a failed sync leaves the log unusable, every later write throws
+    void checkFailed() const {
+        if( failed_ )
+            throw std::system_error(failed_, std::generic_category(), "write-ahead log failed earlier");
+    }
+
+    // write the group at offset, return 0 or the errno of the failure
+    int writeAll(const std::string& group, std::size_t offset) {
+        std::size_t done = 0;
+        while( done < group.size() ) {
+            ssize_t n = ::pwrite(fd_, group.data() + done, group.size() - done, static_cast<off_t>(offset + done));
+            if( n < 0 ) {
+                if( errno == EINTR )
+                    continue;
+                return errno;
+            }
+            done += n;
+        }
+        return 0;
+    }
+
+    const wal_options opts_;
+    int fd_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    // records not written yet
+    std::string buffer_;
+    uint64_t nextLsn_;
+    uint64_t bufferedLsn_;
+    uint64_t durableLsn_;
+    // bytes in the file
+    std::size_t size_;
+    // a leader is writing a group
+    bool flushing_;
+    // errno of a failed sync or truncate, 0 while the log is usable
+    int failed_;
+    wal_stats stats_;
+};
+
+// BPlusTree made durable by a write-ahead log
+// every insert and erase is logged as a logical record before it returns,
+// the tree itself stays in memory. A checkpoint writes all pairs to
+// path.ckpt and empties the log path.wal, opening the tree loads the last
+// checkpoint and replays the log behind it.
+// The tree is guarded by one mutex, the log sync happens outside of it so
+// concurrent writers share their syncs. Readers may see a write before
+// it is durable.
+// keys and data are logged as raw bytes, both must be trivially copyable
+// @param :
+// _Tree : in-memory tree providing insert/erase/find, cursors and bulk_load
+template<typename _key,
+         typename _data,
+         typename _Tree = BPlusTree<_key, _data> >
+class BPlusTree_durable {
+    static_assert(std::is_trivially_copyable<_key>::value, "BPlusTree_durable needs trivially copyable keys");
+    static_assert(std::is_trivially_copyable<_data>::value, "BPlusTree_durable needs trivially copyable data");
+public:
+    // recover the tree stored under path, start empty if there is none
+    explicit BPlusTree_durable(const std::string& path, const wal_options& opts = wal_options());
+    // non-copyable
+    BPlusTree_durable(const BPlusTree_durable&) = delete;
+    BPlusTree_durable& operator=(const BPlusTree_durable&) = delete;
+
+    // insert an element, identical key is ignored
+    void insert(const _key& key, const _data& data);
+
+    // find an element, if true return key/data pair
+    // else return false pair
+    std::pair<bool, std::pair<_key, _data> > find(const _key& key) const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return tree_.find(key);
+    }
+
+    // remove one element
+    void erase(const _key& key);
+
+    // return the size of tree
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return tree_.size();
+    }
+
+    // check whether the tree is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // write every buffered log record to disk
+    void sync() {
+        log_.flush();
+    }
+
+    // write all pairs to the checkpoint file and empty the log
+    void checkpoint();
+
+    wal_stats stats() const {
+        wal_stats st = log_.stats();
+        st.checkpoints_ = checkpoints_;
+        st.replayed_ = replayed_;
+        return st;
+    }
+
+private:
+    static const uint64_t MAGIC = 0x42505457414c434bull; // "BPTWALCK"
+    static const uint32_t FORMAT_VERSION = 1;
+
+    struct checkpointHeader {
+        uint64_t magic_;
+        uint32_t version_;
+        uint32_t keySize_;
+        uint32_t dataSize_;
+        uint32_t pad_;
+        // last lsn contained in the checkpoint
+        uint64_t lsn_;
+        uint64_t count_;
+        // crc of the pairs
+        uint32_t crc_;
+        uint32_t pad2_;
+    };
+
+    struct pair_t {
+        _key key_;
+        _data data_;
+    };
+
+    // pairs are read and written in chunks of this many bytes
+    static const std::size_t CHUNK_BYTES = std::size_t(1) << 20;
+
+    // load path.ckpt, return its lsn
+    uint64_t load();
+    void checkpointLocked();
+    // write n bytes at offset or close fd and throw
+    static void writeAt(int fd, const char* p, std::size_t n, uint64_t offset, const std::string& file);
+    // checkpoint if the log outgrew the limit
+    void maybeCheckpoint();
+
+    const std::string path_;
+    const wal_options opts_;
+    mutable std::mutex mutex_;
+    _Tree tree_;
+    // syncs the remaining records when the tree is destroyed
+    write_ahead_log log_;
+    std::size_t checkpoints_;
+    std::size_t replayed_;
+};
+
+template<typename _key, typename _data, typename _Tree>
+BPlusTree_durable<_key,_data,_Tree>::BPlusTree_durable(const std::string& path, const wal_options& opts)
+    : path_(path), opts_(opts), log_(path + ".wal", opts), checkpoints_(0), replayed_(0) {
+    // records up to the checkpoint's lsn are already in the tree
+    replayed_ = log_.replay(load(), [&](write_ahead_log::record_type type, const char* payload, std::size_t size) {
+        // the length is checked before anything is copied out of the record
+        _key key;
+        if( type == write_ahead_log::wal_insert && size == sizeof(_key) + sizeof(_data) ) {
+            _data data;
+            std::memcpy(&key, payload, sizeof(_key));
+            std::memcpy(&data, payload + sizeof(_key), sizeof(_data));
+            tree_.insert(key, data);
+        } else if( type == write_ahead_log::wal_erase && size == sizeof(_key) ) {
+            std::memcpy(&key, payload, sizeof(_key));
+            tree_.erase(key);
+        } else {
+            throw std::runtime_error("BPlusTree_durable: bad record in " + path_ + ".wal");
+        }
+    });
+}
+
+template<typename _key, typename _data, typename _Tree>
+uint64_t BPlusTree_durable<_key,_data,_Tree>::load() {
+    const std::string file = path_ + ".ckpt";
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if( fd < 0 ) {
+        if( errno == ENOENT )
+            return 0;
+        throw std::system_error(errno, std::generic_category(), "open " + file);
+    }
+    // read up to n bytes at offset, fewer only at the end of the file
+    auto readAt = [&](char* p, std::size_t n, uint64_t offset) {
+        std::size_t done = 0;
+        while( done < n ) {
+            ssize_t r = ::pread(fd, p + done, n - done, static_cast<off_t>(offset + done));
+            if( r < 0 && errno == EINTR )
+                continue;
+            if( r < 0 ) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "read " + file);
+            }
+            if( r == 0 )
+                break;
+            done += r;
+        }
+        return done;
+    };
+    struct stat st;
+    if( ::fstat(fd, &st) != 0 ) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "fstat " + file);
+    }
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    checkpointHeader h;
+    const char* bad = nullptr;
+    if( readAt(reinterpret_cast<char*>(&h), sizeof(h), 0) < sizeof(h) )
+        bad = " is truncated";
+    else if( h.magic_ != MAGIC || h.version_ != FORMAT_VERSION )
+        bad = " is not a checkpoint file";
+    else if( h.keySize_ != sizeof(_key) || h.dataSize_ != sizeof(_data) )
+        bad = " has a different key/data layout";
+    else if( h.count_ > size / sizeof(pair_t) || size != sizeof(h) + h.count_ * sizeof(pair_t) )
+        bad = " is corrupted";
+    if( bad ) {
+        ::close(fd);
+        throw std::runtime_error("BPlusTree_durable: " + file + bad);
+    }
+
+    std::vector<std::pair<_key, _data> > pairs;
+    pairs.reserve(h.count_);
+    std::vector<char> buf(CHUNK_BYTES / sizeof(pair_t) * sizeof(pair_t) + sizeof(pair_t));
+    uint32_t crc = 0;
+    for(uint64_t offset = sizeof(h); offset < size; ) {
+        std::size_t n = readAt(buf.data(), std::min<uint64_t>(buf.size(), size - offset), offset);
+        if( n == 0 || n % sizeof(pair_t) != 0 ) {
+            ::close(fd);
+            throw std::runtime_error("BPlusTree_durable: " + file + " is truncated");
+        }
+        crc = btree_crc32(buf.data(), n, crc);
+        for(std::size_t i = 0; i < n; i += sizeof(pair_t)) {
+            pair_t p;
+            std::memcpy(&p, buf.data() + i, sizeof(pair_t));
+            pairs.push_back(std::make_pair(p.key_, p.data_));
+        }
+        offset += n;
+    }
+    ::close(fd);
+    if( crc != h.crc_ )
+        throw std::runtime_error("BPlusTree_durable: " + file + " is corrupted");
+    tree_.bulk_load(pairs.begin(), pairs.end());
+    return h.lsn_;
+}
+
+template<typename _key, typename _data, typename _Tree>
+void BPlusTree_durable<_key,_data,_Tree>::insert(const _key& key, const _data& data) {
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        std::size_t before = tree_.size();
+        tree_.insert(key, data);
+        if( tree_.size() == before )
+            return;
+        lsn = log_.append(write_ahead_log::wal_insert, &key, sizeof(_key), &data, sizeof(_data));
+    }
+    log_.commit(lsn);
+    maybeCheckpoint();
+}
+
+template<typename _key, typename _data, typename _Tree>
+void BPlusTree_durable<_key,_data,_Tree>::erase(const _key& key) {
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        std::size_t before = tree_.size();
+        tree_.erase(key);
+        if( tree_.size() == before )
+            return;
+        lsn = log_.append(write_ahead_log::wal_erase, &key, sizeof(_key));
+    }
+    log_.commit(lsn);
+    maybeCheckpoint();
+}
+
+template<typename _key, typename _data, typename _Tree>
+void BPlusTree_durable<_key,_data,_Tree>::checkpoint() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    checkpointLocked();
+}
+
+template<typename _key, typename _data, typename _Tree>
+void BPlusTree_durable<_key,_data,_Tree>::maybeCheckpoint() {
+    if( opts_.checkpointBytes_ == 0 || log_.size() < opts_.checkpointBytes_ )
+        return;
+    std::lock_guard<std::mutex> lk(mutex_);
+    // another writer may have taken it meanwhile
+    if( log_.size() >= opts_.checkpointBytes_ )
+        checkpointLocked();
+}
+
+template<typename _key, typename _data, typename _Tree>
+void BPlusTree_durable<_key,_data,_Tree>::writeAt(int fd, const char* p, std::size_t n, uint64_t offset,
+                                                  const std::string& file) {
+    while( n > 0 ) {
+        ssize_t w = ::pwrite(fd, p, n, static_cast<off_t>(offset));
+        if( w < 0 && errno == EINTR )
+            continue;
+        if( w < 0 ) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "write " + file);
+        }
+        p += w;
+        n -= w;
+        offset += w;
+    }
+}
+
+// the new checkpoint is written aside and renamed over the old one, the
+// log is emptied only after the rename is durable. A crash in between
+// replays the old log, its records are skipped by lsn.
+// The pairs are streamed out in chunks, the header goes in last once the
+// count and the crc are known
+template<typename _key, typename _data, typename _Tree>
+void BPlusTree_durable<_key,_data,_Tree>::checkpointLocked() {
+    const std::string file = path_ + ".ckpt";
+    const std::string tmp = file + ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if( fd < 0 )
+        throw std::system_error(errno, std::generic_category(), "open " + tmp);
+
+    checkpointHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::vector<char> buf;
+    buf.reserve(CHUNK_BYTES + sizeof(pair_t));
+    uint64_t offset = sizeof(h);
+    uint32_t crc = 0;
+    for(typename _Tree::cursor c = tree_.begin(); c != tree_.end(); ++c, ++h.count_) {
+        pair_t p;
+        std::memset(&p, 0, sizeof(p));
+        p.key_ = c.key();
+        p.data_ = c.data();
+        buf.insert(buf.end(), reinterpret_cast<const char*>(&p), reinterpret_cast<const char*>(&p) + sizeof(p));
+        if( buf.size() >= CHUNK_BYTES ) {
+            crc = btree_crc32(buf.data(), buf.size(), crc);
+            writeAt(fd, buf.data(), buf.size(), offset, tmp);
+            offset += buf.size();
+            buf.clear();
+        }
+    }
+    crc = btree_crc32(buf.data(), buf.size(), crc);
+    writeAt(fd, buf.data(), buf.size(), offset, tmp);
+
+    h.magic_ = MAGIC;
+    h.version_ = FORMAT_VERSION;
+    h.keySize_ = sizeof(_key);
+    h.dataSize_ = sizeof(_data);
+    h.lsn_ = log_.lastLsn();
+    h.crc_ = crc;
+    writeAt(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0, tmp);
+
+    if( ::fsync(fd) != 0 ) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "fsync " + tmp);
+    }
+    ::close(fd);
+    if( ::rename(tmp.c_str(), file.c_str()) != 0 )
+        throw std::system_error(errno, std::generic_category(), "rename " + tmp);
+
+    // make the rename durable
+    std::string::size_type slash = file.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : file.substr(0, slash + 1);
+    fd = ::open(dir.c_str(), O_RDONLY);
+    if( fd >= 0 ) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    log_.reset();
+    ++checkpoints_;
+}
+
+#endif
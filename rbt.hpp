@@ -1,12 +1,351 @@
 #ifndef _RBT_HPP_
 #define _RBT_HPP_
 
-//#include <iterator>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
 #include <queue>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+/*
+ * node allocation
+ * per-tree node pool following the std allocator interface, the tree
+ * rebinds it to its node type. Nodes are handed out back to back from
+ * chunks which double in size up to CHUNK_MAX, released nodes are kept
+ * on a free list for reuse. All chunks go back to the heap at once when
+ * the pool is destroyed, so the tree skips the node by node release
+ * when its values need no destructor.
+ * Copies and rebound copies share the pool and compare equal, every
+ * tree default constructs a pool of its own. A tree which takes over all
+ * nodes of another (join and the set operations) adopts the chunks of
+ * its pool, after split both trees share the chunks. A chunk is released
+ * with the last pool holding it.
+ */
+
+// the chunks and free lists shared by a pool and its copies, one free
+// list per node stride
+struct rbt_pool_state {
+    static const std::size_t CHUNK_MIN = 1 << 10;
+    static const std::size_t CHUNK_MAX = 1 << 20;
+
+    // a released node is reused as the link of the free list
+    struct freeItem {
+        freeItem* next_;
+    };
+
+    struct pool {
+        // distance between two nodes, no padding beyond the alignment
+        const std::size_t stride_;
+        // released nodes
+        freeItem* free_;
+        // unused part of the last chunk
+        char* cur_;
+        char* end_;
+        std::size_t chunkBytes_;
+
+        explicit pool(std::size_t stride) : stride_(stride), free_(nullptr), cur_(nullptr), end_(nullptr), chunkBytes_(CHUNK_MIN) {}
+    };
+
+    rbt_pool_state() = default;
+    // non-copyable, shared through shared_ptr
+    rbt_pool_state(const rbt_pool_state&) = delete;
+    rbt_pool_state& operator=(const rbt_pool_state&) = delete;
+
+    // the pool of a stride, the pools stay where they are
+    pool* find(std::size_t stride) {
+        for(auto &p : pools_)
+            if( p->stride_ == stride )
+                return p.get();
+        pools_.push_back(std::unique_ptr<pool>(new pool(stride)));
+        return pools_.back().get();
+    }
+
+    // operator new returns memory aligned for any node type
+    void grow(pool* p) {
+        std::size_t bytes = p->chunkBytes_ > 8 * p->stride_ ? p->chunkBytes_ : 8 * p->stride_;
+        // the shared_ptr releases the chunk if it cannot be stored
+        std::shared_ptr<char> held(static_cast<char*>(::operator new(bytes)), chunkDeleter());
+        chunks_.insert(std::lower_bound(chunks_.begin(), chunks_.end(), held, chunkLess()), held);
+        char* chunk = held.get();
+        p->cur_ = chunk;
+        p->end_ = chunk + bytes / p->stride_ * p->stride_;
+        if( p->chunkBytes_ < CHUNK_MAX )
+            p->chunkBytes_ *= 2;
+    }
+
+    // keep the chunks of other alive as long as this state. The chunks
+    // are kept sorted, a chunk both hold already is kept once
+    void share(const rbt_pool_state& other) {
+        std::vector<std::shared_ptr<char> > merged;
+        merged.reserve(chunks_.size() + other.chunks_.size());
+        std::set_union(chunks_.begin(), chunks_.end(), other.chunks_.begin(), other.chunks_.end(),
+                       std::back_inserter(merged), chunkLess());
+        chunks_.swap(merged);
+    }
+
+    // take over the chunks and the free nodes of other, which holds no
+    // nodes any more. other starts over empty
+    void adopt(rbt_pool_state& other) {
+        share(other);
+        for(auto &o : other.pools_) {
+            pool* p = find(o->stride_);
+            if( o->free_ ) {
+                freeItem* last = o->free_;
+                while( last->next_ )
+                    last = last->next_;
+                last->next_ = p->free_;
+                p->free_ = o->free_;
+            }
+            if( p->cur_ == p->end_ ) {
+                p->cur_ = o->cur_;
+                p->end_ = o->end_;
+            }
+            o->free_ = nullptr;
+            o->cur_ = nullptr;
+            o->end_ = nullptr;
+        }
+        other.chunks_.clear();
+    }
+
+    struct chunkDeleter {
+        void operator()(char* chunk) const {
+            ::operator delete(chunk);
+        }
+    };
+
+    struct chunkLess {
+        bool operator()(const std::shared_ptr<char>& a, const std::shared_ptr<char>& b) const {
+            return std::less<char*>()(a.get(), b.get());
+        }
+    };
+
+    std::vector<std::unique_ptr<pool> > pools_;
+    std::vector<std::shared_ptr<char> > chunks_;
+};
+
+template<typename T>
+class rbt_pool_allocator {
+    template<typename U>
+    friend class rbt_pool_allocator;
+    typedef rbt_pool_state::freeItem freeItem;
+
+public:
+    typedef T value_type;
+    template<typename U>
+    struct rebind {
+        typedef rbt_pool_allocator<U> other;
+    };
+
+    static const std::size_t CHUNK_MIN = rbt_pool_state::CHUNK_MIN;
+    static const std::size_t CHUNK_MAX = rbt_pool_state::CHUNK_MAX;
+
+    rbt_pool_allocator() : state_(std::make_shared<rbt_pool_state>()), pool_(state_->find(stride())) {}
+    rbt_pool_allocator(const rbt_pool_allocator&) = default;
+    template<typename U>
+    rbt_pool_allocator(const rbt_pool_allocator<U>& other) : state_(other.state_), pool_(state_->find(stride())) {}
+    rbt_pool_allocator& operator=(const rbt_pool_allocator&) = delete;
+
+    // keep the chunks of other alive as long as this pool, so nodes of
+    // other can be released into this pool
+    void share(const rbt_pool_allocator& other) {
+        if( state_ != other.state_ )
+            state_->share(*other.state_);
+    }
+
+    // take over the chunks and the free nodes of other, which holds no
+    // nodes any more. other starts over empty
+    void adopt(rbt_pool_allocator& other) {
+        if( state_ != other.state_ )
+            state_->adopt(*other.state_);
+    }
+
+    T* allocate(std::size_t n) {
+        // only single nodes come from the pool
+        if( n != 1 )
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        rbt_pool_state::pool* p = pool_;
+        if( p->free_ ) {
+            freeItem* f = p->free_;
+            p->free_ = f->next_;
+            return reinterpret_cast<T*>(f);
+        }
+        if( p->cur_ == p->end_ )
+            state_->grow(p);
+        T* r = reinterpret_cast<T*>(p->cur_);
+        p->cur_ += p->stride_;
+        return r;
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        if( n != 1 ) {
+            ::operator delete(p);
+            return;
+        }
+        freeItem* f = reinterpret_cast<freeItem*>(p);
+        f->next_ = pool_->free_;
+        pool_->free_ = f;
+    }
+
+    // copies share the state, so they release each other's nodes
+    template<typename U>
+    bool operator==(const rbt_pool_allocator<U>& other) const {
+        return state_ == other.state_;
+    }
+    template<typename U>
+    bool operator!=(const rbt_pool_allocator<U>& other) const {
+        return !(*this == other);
+    }
+
+private:
+    // distance between two nodes, no padding beyond the alignment
+    static inline std::size_t stride() {
+        std::size_t size = sizeof(T) > sizeof(freeItem) ? sizeof(T) : sizeof(freeItem);
+        std::size_t align = alignof(T) > alignof(freeItem) ? alignof(T) : alignof(freeItem);
+        return (size + align - 1) / align * align;
+    }
+
+    std::shared_ptr<rbt_pool_state> state_;
+    // the pool of this node stride inside state_
+    rbt_pool_state::pool* pool_;
+};
+
+// let the allocator to release the nodes which came from the allocator
+// from, stateless allocators like std::allocator need nothing
+template<typename Alloc>
+inline void rbt_share_nodes(Alloc &to, const Alloc &from) {
+    assert( to == from );
+}
+
+template<typename T>
+inline void rbt_share_nodes(rbt_pool_allocator<T> &to, const rbt_pool_allocator<T> &from) {
+    to.share(from);
+}
+
+// like rbt_share_nodes, when from gives away all of its nodes
+template<typename Alloc>
+inline void rbt_adopt_nodes(Alloc &to, Alloc &from) {
+    assert( to == from );
+}
 
-// Binary search Tree declaration
 template<typename T>
+inline void rbt_adopt_nodes(rbt_pool_allocator<T> &to, rbt_pool_allocator<T> &from) {
+    to.adopt(from);
+}
+
+// whether destroying the allocator releases every node it handed out
+template<typename Alloc>
+struct rbt_bulk_release : std::false_type {};
+
+template<typename T>
+struct rbt_bulk_release<rbt_pool_allocator<T> > : std::true_type {};
+
+/*
+ * optional node layout
+ * PACK_COLOR : keep the color in the lowest bit of the parent pointer
+ *              instead of a field of its own, an RBT<int> node shrinks
+ *              from 40 to 32 bytes
+ * COUNTED : every node keeps the size of its subtree, which gives rank,
+ *           select and count_range in O(log n)
+ */
+struct rbt_default_traits {
+    static const bool PACK_COLOR = false;
+    static const bool COUNTED = false;
+};
+
+struct rbt_packed_traits : rbt_default_traits {
+    static const bool PACK_COLOR = true;
+};
+
+struct rbt_counted_traits : rbt_default_traits {
+    static const bool COUNTED = true;
+};
+
+// subtree size of a node, empty unless counted. 32 bits like the
+// element count of the tree, so a packed RBT<int> node stays at 32 bytes
+template<bool _Counted>
+struct rbt_subtree_size {
+    rbt_subtree_size() : size_(1) {}
+    unsigned int size_;
+
+    inline std::size_t subtree_size() const {
+        return size_;
+    }
+    inline void set_subtree_size(std::size_t s) {
+        size_ = static_cast<unsigned int>(s);
+    }
+    inline void add_subtree_size(int d) {
+        size_ += d;
+    }
+};
+
+template<>
+struct rbt_subtree_size<false> {
+    inline std::size_t subtree_size() const {
+        return 0;
+    }
+    inline void set_subtree_size(std::size_t) {}
+    inline void add_subtree_size(int) {}
+};
+
+// parent pointer and color of a node
+template<typename Node, bool _Packed>
+class rbt_node_links {
+public:
+    rbt_node_links(Node* p, unsigned int c) : parent_(p), color_(static_cast<unsigned char>(c)) {}
+    inline Node* parent() const {
+        return parent_;
+    }
+    inline void set_parent(Node* p) {
+        parent_ = p;
+    }
+    inline unsigned int color() const {
+        return color_;
+    }
+    inline void set_color(unsigned int c) {
+        color_ = static_cast<unsigned char>(c);
+    }
+private:
+    Node* parent_;
+    unsigned char color_;
+};
+
+// nodes are pointer aligned, so the lowest bit of the parent is free
+template<typename Node>
+class rbt_node_links<Node, true> {
+public:
+    rbt_node_links(Node* p, unsigned int c) : link_(reinterpret_cast<std::uintptr_t>(p) | c) {}
+    inline Node* parent() const {
+        return reinterpret_cast<Node*>(link_ & ~COLOR_MASK);
+    }
+    inline void set_parent(Node* p) {
+        link_ = reinterpret_cast<std::uintptr_t>(p) | (link_ & COLOR_MASK);
+    }
+    inline unsigned int color() const {
+        return static_cast<unsigned int>(link_ & COLOR_MASK);
+    }
+    inline void set_color(unsigned int c) {
+        link_ = (link_ & ~COLOR_MASK) | c;
+    }
+private:
+    static const std::uintptr_t COLOR_MASK = 1;
+    std::uintptr_t link_;
+};
+
+// Binary search Tree declaration
+// @param :
+// Alloc : allocator rebound to the node type, std::allocator<T> for
+//         plain new and delete
+// Traits : rbt_default_traits or rbt_packed_traits
+template<typename T,
+         typename Alloc = rbt_pool_allocator<T>,
+         typename Traits = rbt_default_traits>
 class RBT {
 public:
     // default constructor
@@ -14,26 +353,39 @@ public:
     // copy constructor
     RBT(const RBT &other);
     // assignment constructor
-    const RBT<T>& operator=(const RBT &other);
+    const RBT& operator=(const RBT &other);
     // destructor
     ~RBT();
 
     enum Color { RED, BLACK };
     // TreeNode definition
-    class TreeNode {
+    class TreeNode : public rbt_subtree_size<Traits::COUNTED> {
     public:
         friend class RBT;
         T val;
         TreeNode *left;
         TreeNode *right;
-        TreeNode *parent;
-        // indicate this node's color
-        Color color;
         // constructor
-        TreeNode() : left(nullptr), right(nullptr), parent(nullptr), color(BLACK){};
-        TreeNode(T v) : val(v), left(nullptr), right(nullptr), parent(nullptr), color(RED){};
-        TreeNode(T v, TreeNode *l, TreeNode *r, TreeNode *p = nullptr, Color c = RED) : val(v), left(l), right(r),parent(p), color(c){};
+        TreeNode() : left(nullptr), right(nullptr), links_(nullptr, BLACK){};
+        TreeNode(T v) : val(v), left(nullptr), right(nullptr), links_(nullptr, RED){};
+        TreeNode(T v, TreeNode *l, TreeNode *r, TreeNode *p = nullptr, Color c = RED) : val(v), left(l), right(r), links_(p, c){};
+        TreeNode* parent() const {
+            return links_.parent();
+        }
+        void set_parent(TreeNode *p) {
+            links_.set_parent(p);
+        }
+        // indicate this node's color
+        Color color() const {
+            return static_cast<Color>(links_.color());
+        }
+        void set_color(Color c) {
+            links_.set_color(c);
+        }
+    private:
+        rbt_node_links<TreeNode, Traits::PACK_COLOR> links_;
     };
+    static_assert(alignof(TreeNode) >= 2, "no free bit for the packed color");
 
 
     // STL-style iterator
@@ -45,8 +397,8 @@ public:
         iterator& operator++(); // prefix increment
         iterator operator++(int); // postfix increment
         T& operator*() const; // derefence the pointer
-        bool operator!=(const RBT<T>::iterator &other) const;
-        bool operator==(const RBT<T>::iterator &other) const;
+        bool operator!=(const iterator &other) const;
+        bool operator==(const iterator &other) const;
         // for iterator_traits to refer
         typedef std::output_iterator_tag iterator_category;
         typedef T value_type;
@@ -79,10 +431,44 @@ public:
     // check whether the RBT is nullptr
     const bool empty() const;
 
+    // order statistics, only with rbt_counted_traits
+    // number of elements which are less than v
+    std::size_t rank(const T& v) const;
+    // iterator to the element with rank k, end() if k >= size()
+    iterator select(std::size_t k) const;
+    // number of elements in [lo, hi)
+    std::size_t count_range(const T& lo, const T& hi) const;
+
+    // join based operations after Blelloch, Ferizovic and Sun. The nodes
+    // move from one tree to the other, nothing is copied or allocated
+    // append other, whose values must not be less than those of this tree
+    void join(RBT &other);
+    // move the values which are not less than key into right, the old
+    // content of right is released. Counting the moved values takes
+    // O(log n) with rbt_counted_traits and O(k) otherwise
+    void split(const T& key, RBT &right);
+    // set operations in O(m log(n/m + 1)) work for sizes m <= n, the
+    // recursion forks onto up to threads threads, 0 for one per core.
+    // The result is left in this tree and other is left empty. Meant for
+    // trees of distinct values: every value of other which equals a
+    // value of this tree counts as present
+    void set_union(RBT &other, unsigned int threads = 0);
+    void set_intersection(RBT &other, unsigned int threads = 0);
+    void set_difference(RBT &other, unsigned int threads = 0);
+
 private:
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<TreeNode> node_allocator;
 
     int cnt;
     TreeNode *root;
+    node_allocator alloc;
+
+    // private : node allocation
+    TreeNode* newTreeNode(const T &v, TreeNode *p, Color c);
+    void freeTreeNode(TreeNode *node);
+    // private : deep copy the nodes of other, release all nodes
+    void copy(const RBT &other);
+    void destroy();
 
     // private insert helper function
     void insert(T v, TreeNode *&r, TreeNode * const &p = nullptr);
@@ -98,6 +484,7 @@ private:
     void replace_node_in_parent(TreeNode *node, TreeNode *newNode = nullptr);
 
     // delete helper functions
+    void erase(TreeNode *node);
     void delete_case1(TreeNode *node);
     void delete_case2(TreeNode *node);
     void delete_case3(TreeNode *node);
@@ -108,54 +495,114 @@ private:
     // rotate the node
     void rotate_right(TreeNode *r);
     void rotate_left(TreeNode *r);
-    // private : find the max value node
-    TreeNode *findMax(TreeNode *node);
+    static void rotate_right(TreeNode *r, TreeNode *&top);
+    static void rotate_left(TreeNode *r, TreeNode *&top);
+    // private : recount a node from its children
+    static std::size_t subtree_size(TreeNode *node);
+    static void update_size(TreeNode *node);
+    // private : find the max and min value node
+    static TreeNode *findMax(TreeNode *node);
+    static TreeNode *findMin(TreeNode *node);
+
+    // a detached subtree with a black root, and its black height
+    struct subtree {
+        TreeNode *root;
+        int height;
+    };
+    // nodes dropped by a set operation, chained through their left link
+    // and released once the recursion has finished
+    struct node_chain {
+        TreeNode *head;
+        TreeNode *tail;
+        std::size_t size;
+        node_chain() : head(nullptr), tail(nullptr), size(0) {}
+        void push(TreeNode *node) {
+            node->left = head;
+            if( head == nullptr )
+                tail = node;
+            head = node;
+            ++size;
+        }
+        void append(node_chain &other) {
+            if( other.head == nullptr )
+                return;
+            if( head == nullptr )
+                head = other.head;
+            else
+                tail->left = other.head;
+            tail = other.tail;
+            size += other.size;
+        }
+    };
+    enum set_op { UNION, INTERSECTION, DIFFERENCE };
+    // subtrees below this black height on either side are combined
+    // without forking, they hold too few nodes to pay for a thread
+    static const int PARALLEL_HEIGHT = 10;
+
+    // private : join based helpers, all work on detached subtrees only
+    // and never touch root, so disjoint subtrees can be worked on by
+    // different threads
+    subtree whole();
+    void set_operation(RBT &other, set_op op, unsigned int threads);
+    void release(node_chain &chain);
+    static subtree detach(TreeNode *node, int height);
+    static void expose(const subtree &t, subtree &l, subtree &r);
+    static void link(TreeNode *k, TreeNode *l, TreeNode *r);
+    static bool fix_red(TreeNode *x, TreeNode *&top);
+    static subtree join(const subtree &l, TreeNode *k, const subtree &r);
+    static subtree join_right(const subtree &l, TreeNode *k, const subtree &r);
+    static subtree join_left(const subtree &l, TreeNode *k, const subtree &r);
+    static subtree join2(const subtree &l, const subtree &r);
+    static TreeNode *split_last(const subtree &t, subtree &rest);
+    static bool split(const subtree &t, const T& k, subtree &lo, subtree &hi, node_chain *drop);
+    static subtree combine(set_op op, const subtree &a, const subtree &b, node_chain &drop, unsigned int threads);
+    static void drop_all(TreeNode *node, node_chain &drop);
 };
 
 // RBT<T>::iterator
 // default constructor
-template<typename T>
-RBT<T>::iterator::iterator() {
+template<typename T, typename Alloc, typename Traits>
+RBT<T,Alloc,Traits>::iterator::iterator() {
     node = nullptr;
     lastNode = nullptr;
 }
 
 // one argument constructor
-template<typename T>
-RBT<T>::iterator::iterator(TreeNode* n) {
+template<typename T, typename Alloc, typename Traits>
+RBT<T,Alloc,Traits>::iterator::iterator(TreeNode* n) {
     node = n;
     lastNode = nullptr;
 }
 
 // assignment constructor
-template<typename T>
-const typename RBT<T>::iterator& RBT<T>::iterator::operator=(const iterator &other) {
+template<typename T, typename Alloc, typename Traits>
+const typename RBT<T,Alloc,Traits>::iterator& RBT<T,Alloc,Traits>::iterator::operator=(const iterator &other) {
     this->node = other.node;
     return *this;
 }
 
-template<typename T>
-T& RBT<T>::iterator::operator*() const {
+template<typename T, typename Alloc, typename Traits>
+T& RBT<T,Alloc,Traits>::iterator::operator*() const {
     return this->node->val;
 }
 
 // overload operator ==
-template<typename T>
-bool RBT<T>::iterator::operator==(const RBT<T>::iterator &other) const {
+template<typename T, typename Alloc, typename Traits>
+bool RBT<T,Alloc,Traits>::iterator::operator==(const iterator &other) const {
     return this->node == other.node;
 }
 
 // overload operator !=
-template<typename T>
-bool RBT<T>::iterator::operator!=(const RBT<T>::iterator &other ) const {
+template<typename T, typename Alloc, typename Traits>
+bool RBT<T,Alloc,Traits>::iterator::operator!=(const iterator &other ) const {
     return this->node != other.node;
 }
 
 // overload prefix ++
-template<typename T>
-typename RBT<T>::iterator& RBT<T>::iterator::operator++() {
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::iterator& RBT<T,Alloc,Traits>::iterator::operator++() {
     // if current node is root , we could get the lastNode
-    if( node->parent == nullptr ) {
+    if( node->parent() == nullptr ) {
         lastNode = node;
         while( lastNode->right )
             lastNode = lastNode->right;
@@ -166,21 +613,23 @@ typename RBT<T>::iterator& RBT<T>::iterator::operator++() {
             node = node->left;
     } else if( node == lastNode ){
         node = nullptr;
-    } else if( node == node->parent->left ) {
-        node = node->parent;
-    } else if( node == node->parent->right ) {
-        while( node->parent->val <= node->val )
-            node = node->parent;
-        node = node->parent;
+    } else if( node == node->parent()->left ) {
+        node = node->parent();
+    } else if( node == node->parent()->right ) {
+        // climb to the first ancestor reached from its left subtree, an
+        // iterator from find or select may not have passed the root
+        while( node->parent() && node == node->parent()->right )
+            node = node->parent();
+        node = node->parent();
     }
     return *this;
 }
 
 // overload postfix ++
-template<typename T>
-typename RBT<T>::iterator RBT<T>::iterator::operator++(int) {
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::iterator RBT<T,Alloc,Traits>::iterator::operator++(int) {
     // if current node is root , we could get the lastNode
-    if( node->parent == nullptr ) {
+    if( node->parent() == nullptr ) {
         lastNode = node;
         while( lastNode->right )
             lastNode = lastNode->right;
@@ -192,77 +641,103 @@ typename RBT<T>::iterator RBT<T>::iterator::operator++(int) {
             node = node->left;
     } else if( node == lastNode ){
         node = nullptr;
-    } else if( node == node->parent->left ) {
-        node = node->parent;
-    } else if( node == node->parent->right ) {
-        while( node->parent->val <= node->val )
-            node = node->parent;
-        node = node->parent;
+    } else if( node == node->parent()->left ) {
+        node = node->parent();
+    } else if( node == node->parent()->right ) {
+        // climb to the first ancestor reached from its left subtree, an
+        // iterator from find or select may not have passed the root
+        while( node->parent() && node == node->parent()->right )
+            node = node->parent();
+        node = node->parent();
     }
     return iterator(p);
 }
 
 // default constructor -- only initialize the private variable
-template<typename T>
-RBT<T>::RBT() {
+template<typename T, typename Alloc, typename Traits>
+RBT<T,Alloc,Traits>::RBT() {
     cnt = 0;
     root = nullptr;
 }
 
 // copy constructor -- deep copy every element of the other RBT
-template<typename T>
-RBT<T>::RBT(const RBT &other) {
-    cnt = other.cnt;
-    if( cnt == 0 )
+// the copy gets a pool of its own
+template<typename T, typename Alloc, typename Traits>
+RBT<T,Alloc,Traits>::RBT(const RBT &other) {
+    cnt = 0;
+    root = nullptr;
+    copy(other);
+}
+
+// assignment constructor
+template<typename T, typename Alloc, typename Traits>
+const RBT<T,Alloc,Traits>& RBT<T,Alloc,Traits>::operator=(const RBT &other) {
+    if( this != &other ) {
+        destroy();
+        copy(other);
+    }
+    return *this;
+}
+
+// destructor
+// the pool releases all nodes with its chunks, so the walk is only
+// needed if the values have destructors
+template<typename T, typename Alloc, typename Traits>
+RBT<T,Alloc,Traits>::~RBT() {
+    if( std::is_trivially_destructible<T>::value && rbt_bulk_release<node_allocator>::value )
         return;
-    std::queue<std::pair<TreeNode*, TreeNode*> > q;
-    q.push(std::make_pair(root(other.root->val),other.root));
-    while( !q.empty() ) {
-        TreeNode *node1 = q.front().first;
-        TreeNode *node2 = q.front().second;
-        q.pop();
-        if( node2->left ) {
-            node1->left = new TreeNode(node2->left->val);
-            node1->left->parent = node1;
-            q.push(make_pair(node1->left, node2->left));
-        }
-        if( node2->right ) {
-            node1->right = new TreeNode(node2->right->val);
-            node1->irght->parent = node1;
-            q.push(make_pair(node1->right, node2->right));
-        }
+    destroy();
+}
+
+// private : allocate and construct a node
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode* RBT<T,Alloc,Traits>::newTreeNode(const T &v, TreeNode *p, Color c) {
+    TreeNode *node = alloc.allocate(1);
+    try {
+        new (node) TreeNode(v, nullptr, nullptr, p, c);
+    } catch(...) {
+        alloc.deallocate(node, 1);
+        throw;
     }
+    return node;
 }
 
-// assignment constructor
-template<typename T>
-const RBT<T>& RBT<T>::operator=(const RBT &other) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::freeTreeNode(TreeNode *node) {
+    node->~TreeNode();
+    alloc.deallocate(node, 1);
+}
+
+// private : deep copy every node of other, colors included
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::copy(const RBT &other) {
+    if( other.cnt == 0 )
+        return;
+    root = newTreeNode(other.root->val, nullptr, other.root->color());
+    root->set_subtree_size(other.root->subtree_size());
     cnt = other.cnt;
-    if( cnt == 0 )
-        return *this;
     std::queue<std::pair<TreeNode*, TreeNode*> > q;
-    q.push(std::make_pair(root(other.root->val),other.root));
+    q.push(std::make_pair(root, other.root));
     while( !q.empty() ) {
         TreeNode *node1 = q.front().first;
         TreeNode *node2 = q.front().second;
         q.pop();
         if( node2->left ) {
-            node1->left = new TreeNode(node2->left->val);
-            node1->left->parent = node1;
-            q.push(make_pair(node1->left, node2->left));
+            node1->left = newTreeNode(node2->left->val, node1, node2->left->color());
+            node1->left->set_subtree_size(node2->left->subtree_size());
+            q.push(std::make_pair(node1->left, node2->left));
         }
         if( node2->right ) {
-            node1->right = new TreeNode(node2->right->val);
-            node1->right->parent = node1;
-            q.push(make_pair(node1->right, node2->right));
+            node1->right = newTreeNode(node2->right->val, node1, node2->right->color());
+            node1->right->set_subtree_size(node2->right->subtree_size());
+            q.push(std::make_pair(node1->right, node2->right));
         }
     }
-    return *this;
 }
 
-// destructor
-template<typename T>
-RBT<T>::~RBT() {
+// private : release every node
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::destroy() {
     if( cnt == 0 )
         return ;
     cnt = 0;
@@ -277,47 +752,48 @@ RBT<T>::~RBT() {
         if( root->right ) {
             q.push(root->right);
         }
-        delete root;
+        freeTreeNode(root);
     }
+    root = nullptr;
 }
 
 // insert an element into RBT
-template<typename T>
-void RBT<T>::insert(T v) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert(T v) {
     insert(v,root);
     // increase cnt
     ++cnt;
 }
 
 // return the size of RBT
-template<typename T>
-const std::size_t RBT<T>::size() const {
+template<typename T, typename Alloc, typename Traits>
+const std::size_t RBT<T,Alloc,Traits>::size() const {
     return cnt;
 }
 
 // check whether the RBT is nullptr
-template<typename T>
-const bool RBT<T>::empty() const {
+template<typename T, typename Alloc, typename Traits>
+const bool RBT<T,Alloc,Traits>::empty() const {
     return cnt == 0;
 }
 
 // iterator begin() and end()
-template<typename T>
-typename RBT<T>::iterator RBT<T>::begin() const {
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::iterator RBT<T,Alloc,Traits>::begin() const {
     TreeNode* node = root;
     while( node && node->left )
         node = node->left;
     return iterator(node);
 }
 
-template<typename T>
-typename RBT<T>::iterator RBT<T>::end() const {
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::iterator RBT<T,Alloc,Traits>::end() const {
     return iterator();
 }
 
 // find an element
-template<typename T>
-typename RBT<T>::iterator RBT<T>::find(const T& v) const {
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::iterator RBT<T,Alloc,Traits>::find(const T& v) const {
     TreeNode *p = root;
     while( p ) {
         if( p->val == v )
@@ -330,306 +806,760 @@ typename RBT<T>::iterator RBT<T>::find(const T& v) const {
     return end();
 }
 
-//template<typename T>
+//template<typename T, typename Alloc, typename Traits>
 //const_iterator find(const T& v) const {
 //}
 
+// add up the left subtrees and nodes passed on the way to v
+template<typename T, typename Alloc, typename Traits>
+std::size_t RBT<T,Alloc,Traits>::rank(const T& v) const {
+    static_assert(Traits::COUNTED, "rank needs rbt_counted_traits");
+    std::size_t r = 0;
+    TreeNode *p = root;
+    while( p ) {
+        if( p->val < v ) {
+            r += subtree_size(p->left) + 1;
+            p = p->right;
+        } else {
+            p = p->left;
+        }
+    }
+    return r;
+}
+
+// descend towards rank k, skipping the left subtrees which are too small
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::iterator RBT<T,Alloc,Traits>::select(std::size_t k) const {
+    static_assert(Traits::COUNTED, "select needs rbt_counted_traits");
+    if( k >= size() )
+        return end();
+    TreeNode *p = root;
+    while( true ) {
+        std::size_t l = subtree_size(p->left);
+        if( k == l )
+            return iterator(p);
+        if( k < l ) {
+            p = p->left;
+        } else {
+            k -= l + 1;
+            p = p->right;
+        }
+    }
+}
+
+template<typename T, typename Alloc, typename Traits>
+std::size_t RBT<T,Alloc,Traits>::count_range(const T& lo, const T& hi) const {
+    if( !(lo < hi) )
+        return 0;
+    return rank(hi) - rank(lo);
+}
+
 // remove one element
-template<typename T>
-void RBT<T>::erase(iterator itr) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::erase(iterator itr) {
     --cnt;
     if( cnt == 0 ) {
-        delete root;
+        freeTreeNode(root);
         root = nullptr;
         return;
     }
+    erase(itr.node);
+}
+
+// private : unlink one node and rebalance
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::erase(TreeNode *node) {
     // if left & right child both exist
-    if( (itr.node)->left && (itr.node)->right ) {
-        TreeNode *predecessor = findMax((itr.node)->left);
-        (itr.node)->val = predecessor->val;
-        erase(iterator(predecessor));
+    if( node->left && node->right ) {
+        TreeNode *predecessor = findMax(node->left);
+        node->val = predecessor->val;
+        erase(predecessor);
     } else {
-        TreeNode *child = (itr.node)->left ? (itr.node)->left : (itr.node)->right;
+        TreeNode *child = node->left ? node->left : node->right;
         // here difference with bst, we need rebalance rbt to satisfy rbt rules
-        if( (itr.node)->color == BLACK ) {
+        if( node->color() == BLACK ) {
             // when current node is black and its child is RED, we can
             // simply repaint child to black
-            if( child && child->color == RED )
-                child->color = BLACK;
+            if( child && child->color() == RED )
+                child->set_color(BLACK);
             // or the deleted node is the leaf cell, we should rebalance it
             else
-                delete_case1(itr.node);
+                delete_case1(node);
         }
-        replace_node_in_parent(itr.node, child);
-        delete itr.node;
+        // every ancestor loses the node, after the rebalance rotations
+        for(TreeNode *p = node->parent(); p; p = p->parent())
+            p->add_subtree_size(-1);
+        replace_node_in_parent(node, child);
+        freeTreeNode(node);
     }
 }
 
-template<typename T>
-void RBT<T>::delete_case1(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::delete_case1(TreeNode *node) {
     // when current node is the new root , it's okay
-    if( node->parent != nullptr )
+    if( node->parent() != nullptr )
         delete_case2(node);
 }
 
-template<typename T>
-void RBT<T>::delete_case2(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::delete_case2(TreeNode *node) {
     // in this case when current node's sibling is RED, we should replace its
     // parent's color with its sibling, and rotate the parent
     TreeNode *s = sibling(node);
-    if( s->color == RED ) {
-        node->parent->color = RED;
-        s->color = BLACK;
-        if( node == node->parent->left )
-            rotate_left(node->parent);
+    if( s->color() == RED ) {
+        node->parent()->set_color(RED);
+        s->set_color(BLACK);
+        if( node == node->parent()->left )
+            rotate_left(node->parent());
         else
-            rotate_right(node->parent);
+            rotate_right(node->parent());
     }
     delete_case3(node);
 }
 
-template<typename T>
-void RBT<T>::delete_case3(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::delete_case3(TreeNode *node) {
     // in this case current node and its parent, its sibling and its sibling's
     // two children are both black. we just repaint its sibling to red and
     // rebalance the tree for its parent
     TreeNode *s = sibling(node);
-    if( node->parent->color == BLACK && s->color == BLACK &&
-        (s->left == nullptr || s->left->color == BLACK) && (s->right == nullptr || s->right->color == BLACK) ) {
-        s->color = RED;
-        delete_case1(node->parent);
+    if( node->parent()->color() == BLACK && s->color() == BLACK &&
+        (s->left == nullptr || s->left->color() == BLACK) && (s->right == nullptr || s->right->color() == BLACK) ) {
+        s->set_color(RED);
+        delete_case1(node->parent());
     } else {
         delete_case4(node);
     }
 }
 
-template<typename T>
-void RBT<T>::delete_case4(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::delete_case4(TreeNode *node) {
     // in this case current node and its sibling and its sibling's two children
     // are all black but the parent is red, we can just exchange the parent and
     // its sibling's color
 
     TreeNode *s = sibling(node);
-    if( node->parent->color == RED && s->color == BLACK &&
-        (s->left == nullptr || s->left->color == BLACK) && (s->right == nullptr || s->right->color == BLACK) ) {
-        s->color = RED;
-        node->parent->color = BLACK;
+    if( node->parent()->color() == RED && s->color() == BLACK &&
+        (s->left == nullptr || s->left->color() == BLACK) && (s->right == nullptr || s->right->color() == BLACK) ) {
+        s->set_color(RED);
+        node->parent()->set_color(BLACK);
     } else {
         delete_case5(node);
     }
 }
 
-template<typename T>
-void RBT<T>::delete_case5(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::delete_case5(TreeNode *node) {
     // in this case current node's sibling has a left red child and right black
     // child, we can perform a right rotation on the sibling and exchange the
     // color with its red child
     TreeNode *s = sibling(node);
-    if( s->color == BLACK ) {
-        if( node == node->parent->left && (s->left && s->left->color == RED) &&
-            (s->right == nullptr || s->right->color == BLACK) ) {
-            s->color = RED;
-            s->left->color = BLACK;
+    if( s->color() == BLACK ) {
+        if( node == node->parent()->left && (s->left && s->left->color() == RED) &&
+            (s->right == nullptr || s->right->color() == BLACK) ) {
+            s->set_color(RED);
+            s->left->set_color(BLACK);
             rotate_right(s);
-        } else if( node == node->parent->right && (s->right && s->right->color == RED) &&
-                    (s->left == nullptr || s->left->color == BLACK) ) {
-            s->color = RED;
-            s->right->color = BLACK;
+        } else if( node == node->parent()->right && (s->right && s->right->color() == RED) &&
+                    (s->left == nullptr || s->left->color() == BLACK) ) {
+            s->set_color(RED);
+            s->right->set_color(BLACK);
             rotate_left(s);
         }
     }
     delete_case6(node);
 }
 
-template<typename T>
-void RBT<T>::delete_case6(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::delete_case6(TreeNode *node) {
     // in this case current node's sibling has a right red child
     // we can perform rotate on current node's parent and exchange the color
     // with sibling, and repaint the sibling's right red child to black
     TreeNode *s = sibling(node);
-    s->color = node->parent->color;
-    node->parent->color = BLACK;
-    if( node == node->parent->left ) {
-        s->right->color = BLACK;
-        rotate_left(node->parent);
+    s->set_color(node->parent()->color());
+    node->parent()->set_color(BLACK);
+    if( node == node->parent()->left ) {
+        s->right->set_color(BLACK);
+        rotate_left(node->parent());
     } else {
-        s->left->color = BLACK;
-        rotate_right(node->parent);
+        s->left->set_color(BLACK);
+        rotate_right(node->parent());
     }
 }
 
-template<typename T>
-void RBT<T>::replace_node_in_parent(TreeNode *node, TreeNode *newNode) {
-    if( node->parent ) {
-        if( node->parent->left == node )
-            node->parent->left = newNode;
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::replace_node_in_parent(TreeNode *node, TreeNode *newNode) {
+    if( node->parent() ) {
+        if( node->parent()->left == node )
+            node->parent()->left = newNode;
         else
-            node->parent->right = newNode;
+            node->parent()->right = newNode;
     } else {
         root = newNode;
     }
     if( newNode )
-        newNode->parent = node->parent;
+        newNode->set_parent(node->parent());
 }
 
-template<typename T>
-typename RBT<T>::TreeNode *RBT<T>::findMax(TreeNode *node) {
+template<typename T, typename Alloc, typename Traits>
+std::size_t RBT<T,Alloc,Traits>::subtree_size(TreeNode *node) {
+    return node ? node->subtree_size() : 0;
+}
+
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::update_size(TreeNode *node) {
+    node->set_subtree_size(subtree_size(node->left) + subtree_size(node->right) + 1);
+}
+
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode *RBT<T,Alloc,Traits>::findMax(TreeNode *node) {
     while( node && node->right )
         node = node->right;
     return node;
 }
 
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode *RBT<T,Alloc,Traits>::findMin(TreeNode *node) {
+    while( node && node->left )
+        node = node->left;
+    return node;
+}
+
 // private : insert an element into RBT
-template<typename T>
-void RBT<T>::insert(T v, TreeNode *&r, TreeNode * const &p) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert(T v, TreeNode *&r, TreeNode * const &p) {
     if( r == nullptr ) {
-        r = new TreeNode(v, nullptr, nullptr, p);
+        r = newTreeNode(v, p, RED);
         // here we need to remove the violation of RBT if exists
         insert_case1(r);
-    } else if( v < r->val )
+        return;
+    }
+    // every node on the path gains the new element
+    r->add_subtree_size(1);
+    if( v < r->val )
         insert(v, r->left, r);
     else
         insert(v, r->right,r);
 }
 
 // this function handle case that the current node is the root
-template<typename T>
-void RBT<T>::insert_case1(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert_case1(TreeNode *r) {
     // in this case we just paint the node to black
-    if( r->parent == nullptr )
-        r->color = BLACK;
+    if( r->parent() == nullptr )
+        r->set_color(BLACK);
     else
         insert_case2(r);
 }
 
 // this handles when the node's parent is black
-template<typename T>
-void RBT<T>::insert_case2(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert_case2(TreeNode *r) {
     // in this case we just return
-    if( r->parent->color == BLACK )
+    if( r->parent()->color() == BLACK )
         return;
     else
         insert_case3(r);
 }
 
 // get current node's grandparent
-template<typename T>
-typename RBT<T>::TreeNode* RBT<T>::grandParent(TreeNode * const &r) const {
-    if( r && r->parent )
-        return r->parent->parent;
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode* RBT<T,Alloc,Traits>::grandParent(TreeNode * const &r) const {
+    if( r && r->parent() )
+        return r->parent()->parent();
     else
         return nullptr;
 }
 
 // get current node's uncle
-template<typename T>
-typename RBT<T>::TreeNode* RBT<T>::uncle(TreeNode * const &r) const {
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode* RBT<T,Alloc,Traits>::uncle(TreeNode * const &r) const {
     TreeNode *g = grandParent(r);
     // if no grandParent then no uncle
     if( g == nullptr )
         return nullptr;
-    if( r->parent == g->left )
+    if( r->parent() == g->left )
         return g->right;
     else
         return g->left;
 }
 
 // get current node's silbing
-template<typename T>
-typename RBT<T>::TreeNode* RBT<T>::sibling(TreeNode * const &r) const {
-    if( r == nullptr || r->parent == nullptr )
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode* RBT<T,Alloc,Traits>::sibling(TreeNode * const &r) const {
+    if( r == nullptr || r->parent() == nullptr )
         return nullptr;
-    if( r->parent->left == r )
-        return r->parent->right;
+    if( r->parent()->left == r )
+        return r->parent()->right;
     else
-        return r->parent->left;
+        return r->parent()->left;
 }
 
 // this handles when both the parent and the uncle are red
-template<typename T>
-void RBT<T>::insert_case3(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert_case3(TreeNode *r) {
     // when both the parent and the uncle are red, we can paint the parent and
     // uncle to black and the grandParent to red
     // this will remain all RBT rules but the grandParent may violate rule
     TreeNode* u = uncle(r);
-    if( u && u->color == RED ) {
-        r->parent->color = BLACK;
-        u->color = BLACK;
-        u->parent->color = RED;
-        insert_case1(u->parent);
+    if( u && u->color() == RED ) {
+        r->parent()->set_color(BLACK);
+        u->set_color(BLACK);
+        u->parent()->set_color(RED);
+        insert_case1(u->parent());
     } else
         insert_case4(r);
 }
 
 // this handles when current node's parent is red but the uncle is black
-template<typename T>
-void RBT<T>::insert_case4(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert_case4(TreeNode *r) {
     TreeNode *g = grandParent(r);
     // when current node is the right child and parent is the left child of
     // grandParent , we rotate left
-    if( r == r->parent->right && r->parent == g->left ) {
-        rotate_left(r->parent);
+    if( r == r->parent()->right && r->parent() == g->left ) {
+        rotate_left(r->parent());
         r = r->left;
     // in this case we rotate right
-    } else if( r == r->parent->left && r->parent == g->right ) {
-        rotate_right(r->parent);
+    } else if( r == r->parent()->left && r->parent() == g->right ) {
+        rotate_right(r->parent());
         r = r->right;
     }
     insert_case5(r);
 }
 
 // this handles that the parent is red but uncle is black
-template<typename T>
-void RBT<T>::insert_case5(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::insert_case5(TreeNode *r) {
     TreeNode *g = grandParent(r);
     // in this case we just paint the parent to BLACK and grandParent to RED
     // then rotate left or right
-    g->color = RED;
-    r->parent->color = BLACK;
-    if( r == r->parent->left )
+    g->set_color(RED);
+    r->parent()->set_color(BLACK);
+    if( r == r->parent()->left )
         rotate_right(g);
     else
         rotate_left(g);
 }
 
 // this rotate the current node to the left
-template<typename T>
-void RBT<T>::rotate_left(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::rotate_left(TreeNode *r) {
+    rotate_left(r, root);
+}
+
+// top is the root of the (sub)tree r belongs to
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::rotate_left(TreeNode *r, TreeNode *&top) {
     TreeNode *saved_right_left = r->right->left, *child = r->right;
-    if( r->parent ) {
-        if( r == r->parent->left )
-            r->parent->left = child;
+    if( r->parent() ) {
+        if( r == r->parent()->left )
+            r->parent()->left = child;
         else
-            r->parent->right = child;
+            r->parent()->right = child;
     // if current node is the root we need update the root node also
     } else {
-        root = child;
+        top = child;
     }
     child->left = r;
-    child->parent = r->parent;
-    r->parent = child;
+    child->set_parent(r->parent());
+    r->set_parent(child);
     r->right = saved_right_left;
     if( saved_right_left )
-        saved_right_left->parent = r;
+        saved_right_left->set_parent(r);
+    // the child takes over the subtree of r
+    child->set_subtree_size(r->subtree_size());
+    update_size(r);
 }
 // thi rotate the current node to the right
-template<typename T>
-void RBT<T>::rotate_right(TreeNode *r) {
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::rotate_right(TreeNode *r) {
+    rotate_right(r, root);
+}
+
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::rotate_right(TreeNode *r, TreeNode *&top) {
     TreeNode *saved_left_right = r->left->right, *child = r->left;
-    if( r->parent ) {
-        if( r == r->parent->left )
-            r->parent->left = child;
+    if( r->parent() ) {
+        if( r == r->parent()->left )
+            r->parent()->left = child;
         else
-            r->parent->right = child;
+            r->parent()->right = child;
     // if current node is the root we need update the root node also
     } else {
-        root = child;
+        top = child;
     }
     child->right = r;
-    child->parent = r->parent;
-    r->parent = child;
+    child->set_parent(r->parent());
+    r->set_parent(child);
     r->left = saved_left_right;
     if( saved_left_right )
-        saved_left_right->parent = r;
+        saved_left_right->set_parent(r);
+    child->set_subtree_size(r->subtree_size());
+    update_size(r);
+}
+
+// append other, whose values must not be less than those of this tree
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::join(RBT &other) {
+    if( this == &other || other.cnt == 0 )
+        return;
+    assert( cnt == 0 || !(findMin(other.root)->val < findMax(root)->val) );
+    rbt_adopt_nodes(alloc, other.alloc);
+    root = join2(whole(), other.whole()).root;
+    cnt += other.cnt;
+    other.root = nullptr;
+    other.cnt = 0;
+}
+
+// move the values which are not less than key into right
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::split(const T& key, RBT &right) {
+    if( this == &right )
+        return;
+    right.destroy();
+    if( cnt == 0 )
+        return;
+    rbt_share_nodes(right.alloc, alloc);
+    subtree lo, hi;
+    split(whole(), key, lo, hi, nullptr);
+    root = lo.root;
+    right.root = hi.root;
+    std::size_t moved = 0;
+    if( Traits::COUNTED ) {
+        moved = subtree_size(hi.root);
+    } else {
+        for(iterator itr = right.begin(); itr != right.end(); ++itr)
+            ++moved;
+    }
+    right.cnt = static_cast<int>(moved);
+    cnt -= right.cnt;
+}
+
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::set_union(RBT &other, unsigned int threads) {
+    set_operation(other, UNION, threads);
+}
+
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::set_intersection(RBT &other, unsigned int threads) {
+    set_operation(other, INTERSECTION, threads);
+}
+
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::set_difference(RBT &other, unsigned int threads) {
+    set_operation(other, DIFFERENCE, threads);
+}
+
+// private : the whole tree as a subtree, its black height is counted
+// along the leftmost path
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::whole() {
+    subtree t = { root, 0 };
+    if( root && root->color() == RED )
+        root->set_color(BLACK);
+    for(TreeNode *node = root; node; node = node->left)
+        if( node->color() == BLACK )
+            ++t.height;
+    return t;
+}
+
+// private : combine both trees into this one, the dropped nodes are
+// released after all threads have finished
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::set_operation(RBT &other, set_op op, unsigned int threads) {
+    if( this == &other ) {
+        if( op == DIFFERENCE )
+            destroy();
+        return;
+    }
+    if( threads == 0 )
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    rbt_adopt_nodes(alloc, other.alloc);
+    node_chain drop;
+    const std::size_t total = static_cast<std::size_t>(cnt) + other.cnt;
+    root = combine(op, whole(), other.whole(), drop, threads).root;
+    cnt = static_cast<int>(total - drop.size);
+    other.root = nullptr;
+    other.cnt = 0;
+    release(drop);
+}
+
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::release(node_chain &chain) {
+    while( chain.head ) {
+        TreeNode *node = chain.head;
+        chain.head = node->left;
+        freeTreeNode(node);
+    }
+    chain = node_chain();
+}
+
+// private : a child of an exposed node as a tree of its own, a red root
+// is painted black, which adds one to the black height
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::detach(TreeNode *node, int height) {
+    subtree t = { node, height };
+    if( node ) {
+        node->set_parent(nullptr);
+        if( node->color() == RED ) {
+            node->set_color(BLACK);
+            ++t.height;
+        }
+    }
+    return t;
+}
+
+// private : take the root of t apart from its two subtrees
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::expose(const subtree &t, subtree &l, subtree &r) {
+    TreeNode *m = t.root;
+    // the root of t is black
+    l = detach(m->left, t.height - 1);
+    r = detach(m->right, t.height - 1);
+    m->left = nullptr;
+    m->right = nullptr;
+}
+
+// private : make l and r the children of k
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::link(TreeNode *k, TreeNode *l, TreeNode *r) {
+    k->left = l;
+    k->right = r;
+    if( l )
+        l->set_parent(k);
+    if( r )
+        r->set_parent(k);
+    update_size(k);
+}
+
+// private : repair the red node x below a red parent, the same cases as
+// insert_case1 to insert_case5 inside the subtree with root top.
+// return whether the black height of the subtree has grown
+template<typename T, typename Alloc, typename Traits>
+bool RBT<T,Alloc,Traits>::fix_red(TreeNode *x, TreeNode *&top) {
+    while( true ) {
+        TreeNode *p = x->parent();
+        // x reached the root, painting it black adds a black level
+        if( p == nullptr ) {
+            x->set_color(BLACK);
+            return true;
+        }
+        if( p->color() == BLACK )
+            return false;
+        TreeNode *g = p->parent();
+        if( g == nullptr ) {
+            p->set_color(BLACK);
+            return true;
+        }
+        TreeNode *u = p == g->left ? g->right : g->left;
+        if( u && u->color() == RED ) {
+            p->set_color(BLACK);
+            u->set_color(BLACK);
+            g->set_color(RED);
+            x = g;
+            continue;
+        }
+        if( p == g->left ) {
+            if( x == p->right ) {
+                rotate_left(p, top);
+                p = x;
+            }
+            rotate_right(g, top);
+        } else {
+            if( x == p->left ) {
+                rotate_right(p, top);
+                p = x;
+            }
+            rotate_left(g, top);
+        }
+        p->set_color(BLACK);
+        g->set_color(RED);
+        return false;
+    }
+}
+
+// private : the subtree of l, k and r, where l < k <= r. The work is
+// the difference of the black heights
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::join(const subtree &l, TreeNode *k, const subtree &r) {
+    if( l.height > r.height )
+        return join_right(l, k, r);
+    if( l.height < r.height )
+        return join_left(l, k, r);
+    link(k, l.root, r.root);
+    k->set_parent(nullptr);
+    k->set_color(BLACK);
+    subtree t = { k, l.height + 1 };
+    return t;
+}
+
+// private : l is higher, k takes the place of the black node with the
+// black height of r on the right spine of l, with r as right child
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::join_right(const subtree &l, TreeNode *k, const subtree &r) {
+    TreeNode *p = nullptr, *c = l.root;
+    int h = l.height;
+    while( c && !(c->color() == BLACK && h == r.height) ) {
+        if( c->color() == BLACK )
+            --h;
+        p = c;
+        c = c->right;
+    }
+    link(k, c, r.root);
+    k->set_color(RED);
+    k->set_parent(p);
+    p->right = k;
+    // every node above k gains r and k
+    for(TreeNode *a = p; a; a = a->parent())
+        a->add_subtree_size(static_cast<int>(subtree_size(r.root)) + 1);
+    subtree t = { l.root, l.height };
+    if( fix_red(k, t.root) )
+        ++t.height;
+    return t;
+}
+
+// private : the mirror of join_right, r is higher
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::join_left(const subtree &l, TreeNode *k, const subtree &r) {
+    TreeNode *p = nullptr, *c = r.root;
+    int h = r.height;
+    while( c && !(c->color() == BLACK && h == l.height) ) {
+        if( c->color() == BLACK )
+            --h;
+        p = c;
+        c = c->left;
+    }
+    link(k, l.root, c);
+    k->set_color(RED);
+    k->set_parent(p);
+    p->left = k;
+    for(TreeNode *a = p; a; a = a->parent())
+        a->add_subtree_size(static_cast<int>(subtree_size(l.root)) + 1);
+    subtree t = { r.root, r.height };
+    if( fix_red(k, t.root) )
+        ++t.height;
+    return t;
+}
+
+// private : join without a middle node, the last node of l takes its place
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::join2(const subtree &l, const subtree &r) {
+    if( l.root == nullptr )
+        return r;
+    subtree rest;
+    TreeNode *k = split_last(l, rest);
+    return join(rest, k, r);
+}
+
+// private : detach the last node of t, rest gets the other nodes
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::TreeNode *RBT<T,Alloc,Traits>::split_last(const subtree &t, subtree &rest) {
+    TreeNode *m = t.root;
+    subtree l, r;
+    expose(t, l, r);
+    if( r.root == nullptr ) {
+        rest = l;
+        return m;
+    }
+    subtree rr;
+    TreeNode *last = split_last(r, rr);
+    rest = join(l, m, rr);
+    return last;
+}
+
+// private : split t into the values less than k and the others. With
+// drop, the values equal to k go to drop instead of hi.
+// return whether a value equal to k has been dropped
+template<typename T, typename Alloc, typename Traits>
+bool RBT<T,Alloc,Traits>::split(const subtree &t, const T& k, subtree &lo, subtree &hi, node_chain *drop) {
+    if( t.root == nullptr ) {
+        lo = hi = t;
+        return false;
+    }
+    TreeNode *m = t.root;
+    subtree l, r;
+    expose(t, l, r);
+    if( m->val < k ) {
+        subtree rl;
+        bool found = split(r, k, rl, hi, drop);
+        lo = join(l, m, rl);
+        return found;
+    }
+    if( drop && !(k < m->val) ) {
+        // equal values may continue at the inner ends of l and r
+        drop->push(m);
+        subtree none;
+        if( l.root && !(findMax(l.root)->val < k) )
+            split(l, k, lo, none, drop);
+        else
+            lo = l;
+        if( r.root && !(k < findMin(r.root)->val) )
+            split(r, k, none, hi, drop);
+        else
+            hi = r;
+        return true;
+    }
+    subtree lr;
+    bool found = split(l, k, lo, lr, drop);
+    hi = join(lr, m, r);
+    return found;
+}
+
+// private : the set operation on a and b. The root of a splits b, both
+// halves recurse, the left one on a new thread while threads allow it
+template<typename T, typename Alloc, typename Traits>
+typename RBT<T,Alloc,Traits>::subtree RBT<T,Alloc,Traits>::combine(set_op op, const subtree &a, const subtree &b, node_chain &drop, unsigned int threads) {
+    if( a.root == nullptr || b.root == nullptr ) {
+        if( op == UNION )
+            return a.root ? a : b;
+        drop_all(b.root, drop);
+        if( op == DIFFERENCE )
+            return a;
+        drop_all(a.root, drop);
+        subtree none = { nullptr, 0 };
+        return none;
+    }
+    TreeNode *m = a.root;
+    subtree l1, r1, l2, r2;
+    expose(a, l1, r1);
+    const bool found = split(b, m->val, l2, r2, &drop);
+
+    subtree l, r;
+    node_chain rdrop;
+    bool forked = false;
+    if( threads > 1 && std::min(a.height, b.height) >= PARALLEL_HEIGHT ) {
+        const unsigned int half = threads / 2;
+        try {
+            std::thread left([&]() {
+                l = combine(op, l1, l2, drop, threads - half);
+            });
+            r = combine(op, r1, r2, rdrop, half);
+            left.join();
+            forked = true;
+        } catch(const std::system_error &) {
+            // no thread available, stay on this one
+        }
+    }
+    if( !forked ) {
+        l = combine(op, l1, l2, drop, 1);
+        r = combine(op, r1, r2, rdrop, 1);
+    }
+    drop.append(rdrop);
+
+    if( op == UNION || (op == INTERSECTION) == found )
+        return join(l, m, r);
+    drop.push(m);
+    return join2(l, r);
+}
+
+// private : drop every node of a subtree
+template<typename T, typename Alloc, typename Traits>
+void RBT<T,Alloc,Traits>::drop_all(TreeNode *node, node_chain &drop) {
+    if( node == nullptr )
+        return;
+    drop_all(node->left, drop);
+    drop_all(node->right, drop);
+    drop.push(node);
 }
 #endif
\ No newline at end of file
@@ -3,10 +3,999 @@
 #include<cstddef>
 #include <cstdlib>
 #include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <limits>
+#include <atomic>
+#include <functional>
+#include <cstdio>
+#include <stdexcept>
+#include <system_error>
+#include <memory>
 
 using namespace std;
 
+// rank, select and count_range agree with the sorted keys of m
+template<typename T>
+void checkOrder(const T &b, const map<int, int> &m, int range) {
+    vector<int> keys;
+    for(auto &p : m)
+        keys.push_back(p.first);
+    for(size_t i = 0; i < keys.size(); ++i) {
+        auto c = b.select(i);
+        assert( c.valid() && c.key() == keys[i] && c.data() == m.at(keys[i]) );
+        assert( b.rank(keys[i]) == i );
+    }
+    assert( !b.select(keys.size()).valid() );
+    for(int k = -1; k <= range; k += 7) {
+        size_t r = lower_bound(keys.begin(), keys.end(), k) - keys.begin();
+        assert( b.rank(k) == r );
+        int hi = k + range / 5;
+        assert( b.count_range(k, hi) == static_cast<size_t>(lower_bound(keys.begin(), keys.end(), hi) - keys.begin()) - r );
+        assert( b.count_range(hi, k) == 0 );
+    }
+}
+
+// the subtree counts follow single inserts and erases, batches and bulk loads
+template<int M, int L>
+void testOrderStatistics(int n) {
+    BPlusTree<int, int, M, L, btree_default_search, btree_slab_allocator<char>, btree_counted_traits> b;
+    map<int, int> m;
+    mt19937 rng(n + L);
+    checkOrder(b, m, n);
+    for(int round = 0; round < 6; ++round) {
+        for(int i = 0; i < n; ++i) {
+            int k = rng() % n;
+            if( rng() % 3 ) {
+                b.insert(k, i);
+                m.insert(make_pair(k, i));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        }
+        checkOrder(b, m, n);
+
+        vector<pair<int, int> > batch;
+        for(int i = 0; i < n / 2; ++i) {
+            int k = rng() % n;
+            batch.push_back(make_pair(k, -k));
+        }
+        b.insert_many(batch.begin(), batch.end());
+        m.insert(batch.begin(), batch.end());
+        checkOrder(b, m, n);
+
+        vector<int> keys;
+        for(int i = 0; i < n / 2; ++i)
+            keys.push_back(rng() % n);
+        b.erase_many(keys.begin(), keys.end());
+        for(auto k : keys)
+            m.erase(k);
+        checkOrder(b, m, n);
+    }
+
+    vector<pair<int, int> > input(m.begin(), m.end());
+    b.bulk_load(input.begin(), input.end(), 0.6);
+    checkOrder(b, m, n);
+    for(auto &p : input) {
+        b.erase(p.first);
+        m.erase(p.first);
+        if( m.size() % 97 == 0 )
+            checkOrder(b, m, n);
+    }
+    assert( b.empty() && b.rank(5) == 0 && !b.select(0).valid() );
+}
+
+// every search strategy must agree with std::lower_bound
+template<typename Search, typename T>
+void testSearch(const vector<T>& keys, const vector<T>& probes) {
+    for(unsigned int n = 0; n <= keys.size(); ++n) {
+        for(auto &p : probes) {
+            unsigned int expect = lower_bound(keys.begin(), keys.begin() + n, p) - keys.begin();
+            assert( Search::lower_bound(keys.data(), n, p) == expect );
+        }
+    }
+}
+
+template<typename Search>
+void testSearchStrategy() {
+    vector<int> ik, ip;
+    vector<unsigned int> uk, up;
+    vector<long> lk, lp;
+    vector<double> dk, dp;
+    vector<string> sk, sp;
+    for(int i = 0; i < 40; ++i) {
+        ik.push_back(i * 3 - 50);
+        uk.push_back(i * 3 + 0x7ffffff0u);
+        lk.push_back((long)i * 3 - 50);
+        dk.push_back(i * 3 - 50.5);
+        sk.push_back(to_string(1000 + i * 3));
+    }
+    for(int i = -2; i < 125; ++i) {
+        ip.push_back(i - 50);
+        up.push_back(i + 0x7ffffff0u);
+        lp.push_back((long)i - 50);
+        dp.push_back(i - 50.5);
+        sp.push_back(to_string(1000 + i));
+    }
+    testSearch<Search>(ik, ip);
+    testSearch<Search>(uk, up);
+    testSearch<Search>(lk, lp);
+    testSearch<Search>(dk, dp);
+    testSearch<Search>(sk, sp);
+
+    // the tree must behave the same with every strategy
+    BPlusTree<int, int, 64, 64, Search> b;
+    vector<int> keys;
+    for(int i = 0; i < 5000; ++i)
+        keys.push_back(i * 2);
+    shuffle(keys.begin(), keys.end(), mt19937(1));
+    for(auto k : keys)
+        b.insert(k, k + 1);
+    assert( b.size() == keys.size() );
+    for(int i = 0; i < 10000; ++i) {
+        auto r = b.find(i);
+        assert( r.first == (i % 2 == 0) );
+        if( r.first )
+            assert( r.second == make_pair(i, i + 1) );
+    }
+    for(int i = 0; i < 10000; i += 4)
+        b.erase(i);
+    assert( b.size() == keys.size() / 2 );
+    for(int i = 0; i < 10000; ++i)
+        assert( b.find(i).first == (i % 4 == 2) );
+}
+
+void testCursor() {
+    BPlusTree<int, int, 8, 8> b;
+    assert( b.begin() == b.end() );
+    assert( !b.lower_bound(10).valid() );
+    for(int i = 0; i < 1000; ++i)
+        b.insert(i * 2, i);
+
+    // forward walk visits every element in order
+    int i = 0;
+    for(auto c = b.begin(); c != b.end(); ++c, ++i) {
+        assert( c.key() == i * 2 );
+        assert( c.data() == i );
+    }
+    assert( i == 1000 );
+
+    // backward walk from end()
+    auto c = b.end();
+    for(i = 999; i >= 0; --i) {
+        --c;
+        assert( c.valid() && c.key() == i * 2 );
+    }
+    --c;
+    assert( !c.valid() );
+
+    assert( b.lower_bound(10).key() == 10 );
+    assert( b.lower_bound(11).key() == 12 );
+    assert( b.upper_bound(10).key() == 12 );
+    assert( b.upper_bound(11).key() == 12 );
+    assert( b.lower_bound(-5).key() == 0 );
+    assert( !b.lower_bound(1999).valid() );
+    assert( !b.upper_bound(1998).valid() );
+
+    // erase leaves stale separators behind, bounds must still be right
+    for(i = 100; i < 300; ++i)
+        b.erase(i * 2);
+    assert( b.lower_bound(201).key() == 600 );
+    assert( b.upper_bound(198).key() == 600 );
+
+    vector<int> seen;
+    size_t n = b.scan(190, 610, [&](const int &k, const int &d) {
+        assert( d == k / 2 );
+        seen.push_back(k);
+    });
+    assert( n == seen.size() );
+    assert( seen.size() == 5 + 5 );
+    assert( seen.front() == 190 && seen.back() == 608 );
+    assert( b.scan(10, 10, [](const int&, const int&) {}) == 0 );
+    assert( b.scan(0, 5000, [](const int&, const int&) {}) == b.size() );
+}
+
+template<int M, int L>
+void testBulkLoad(int n, double fill) {
+    vector<pair<int, int> > input;
+    for(int i = 0; i < n; ++i)
+        input.push_back(make_pair(i * 3, i));
+    BPlusTree<int, int, M, L> b;
+    b.insert(1, 1);
+    b.bulk_load(input.begin(), input.end(), fill);
+    assert( b.size() == input.size() );
+    assert( b.dumpTree() == input );
+    for(int i = 0; i < n * 3; ++i) {
+        auto r = b.find(i);
+        assert( r.first == (i % 3 == 0) );
+        if( r.first )
+            assert( r.second.second == i / 3 );
+    }
+
+    // the loaded tree must keep working under updates
+    mt19937 rng(n);
+    map<int, int> m(input.begin(), input.end());
+    for(int i = 0; i < 4 * n; ++i) {
+        int k = rng() % (n * 3 + 10);
+        if( rng() % 2 ) {
+            b.insert(k, i);
+            m.insert(make_pair(k, i));
+        } else {
+            b.erase(k);
+            m.erase(k);
+        }
+    }
+    assert( b.size() == m.size() );
+    vector<pair<int, int> > expect(m.begin(), m.end());
+    assert( b.dumpTree() == expect );
+}
+
+// random updates against std::map, the freed nodes are reused by
+// the next round and released again by clear()
+template<typename Alloc>
+void testAllocator() {
+    // copies and rebound copies compare equal and free each other's memory
+    typedef typename allocator_traits<Alloc>::template rebind_alloc<long> long_alloc;
+    Alloc a;
+    Alloc c(a);
+    long_alloc la(a), lc(c);
+    assert( a == c && la == a && la == lc );
+    long* p = la.allocate(1);
+    *p = 42;
+    lc.deallocate(p, 1);
+
+    BPlusTree<int, int, 8, 8, btree_default_search, Alloc> b;
+    mt19937 rng(7);
+    map<int, int> m;
+    for(int round = 0; round < 3; ++round) {
+        for(int i = 0; i < 20000; ++i) {
+            int k = rng() % 5000;
+            if( rng() % 3 ) {
+                b.insert(k, i);
+                m.insert(make_pair(k, i));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        }
+        assert( b.size() == m.size() );
+        vector<pair<int, int> > expect(m.begin(), m.end());
+        assert( b.dumpTree() == expect );
+        if( round == 1 ) {
+            b.clear();
+            m.clear();
+        }
+    }
+}
+
+// batches with local and random keys against std::map, mixed with
+// single inserts and erases
+template<int M, int L>
+void testBatch(int n) {
+    BPlusTree<int, int, M, L> b;
+    mt19937 rng(n + M);
+    map<int, int> m;
+    for(int round = 0; round < 40; ++round) {
+        vector<pair<int, int> > batch;
+        int base = rng() % (n * 4);
+        int cnt = rng() % n;
+        for(int i = 0; i < cnt; ++i) {
+            int k = round % 2 ? base + rng() % (n / 4 + 1) : rng() % (n * 4);
+            batch.push_back(make_pair(k, round * n + i));
+        }
+        map<int, int> expect = m;
+        for(auto &p : batch)
+            expect.insert(p);
+        assert( b.insert_many(batch.begin(), batch.end()) == expect.size() - m.size() );
+        m.swap(expect);
+
+        for(int i = 0; i < 10; ++i) {
+            int k = rng() % (n * 4);
+            b.insert(k, -k);
+            m.insert(make_pair(k, -k));
+            k = rng() % (n * 4);
+            b.erase(k);
+            m.erase(k);
+        }
+
+        vector<int> keys;
+        base = rng() % (n * 4);
+        cnt = rng() % (round % 4 == 3 ? n * 4 : n);
+        for(int i = 0; i < cnt; ++i)
+            keys.push_back(round % 3 ? base + rng() % (n / 2 + 1) : rng() % (n * 4));
+        size_t erased = 0;
+        for(auto k : keys)
+            erased += m.erase(k);
+        assert( b.erase_many(keys.begin(), keys.end()) == erased );
+
+        assert( b.size() == m.size() );
+        vector<pair<int, int> > expectDump(m.begin(), m.end());
+        assert( b.dumpTree() == expectDump );
+        for(int i = 0; i < 200; ++i) {
+            int k = rng() % (n * 4);
+            auto r = b.find(k);
+            assert( r.first == (m.count(k) > 0) );
+            if( r.first )
+                assert( r.second.second == m[k] );
+        }
+    }
+
+    // erase everything in one batch
+    vector<int> all;
+    for(auto &p : m)
+        all.push_back(p.first);
+    assert( b.erase_many(all.begin(), all.end()) == all.size() );
+    assert( b.empty() && b.begin() == b.end() );
+    b.insert(1, 1);
+    assert( b.find(1).first );
+}
+
+// ranges of every width are removed, from a few keys inside one leaf up to
+// most of the tree, the leaf chain is walked both ways afterwards
+template<int M, int L>
+void testEraseRange(int n) {
+    BPlusTree<int, int, M, L, btree_default_search, btree_slab_allocator<char>, btree_counted_traits> b;
+    mt19937 rng(n + M + L);
+    map<int, int> m;
+    for(int round = 0; round < 60; ++round) {
+        for(int i = 0; i < n / 2; ++i) {
+            int k = rng() % (n * 4);
+            b.insert(k, i);
+            m.insert(make_pair(k, i));
+        }
+        int lo = static_cast<int>(rng() % (n * 4)) - n / 8;
+        int width = round % 3 == 0 ? rng() % 16 : rng() % (round % 3 == 1 ? n : n * 4);
+        int hi = lo + width;
+        size_t erased = 0;
+        for(auto itr = m.lower_bound(lo); itr != m.end() && itr->first < hi; )
+            itr = m.erase(itr), ++erased;
+        assert( b.erase_range(lo, hi) == erased );
+        assert( b.erase_range(hi, lo) == 0 );
+
+        assert( b.size() == m.size() );
+        vector<pair<int, int> > expectDump(m.begin(), m.end());
+        assert( b.dumpTree() == expectDump );
+        auto itr = m.rbegin();
+        for(auto c = b.end(); c != b.begin(); ++itr) {
+            --c;
+            assert( itr != m.rend() && c.key() == itr->first );
+        }
+        assert( itr == m.rend() );
+        checkOrder(b, m, n * 4);
+    }
+
+    // the whole key space at once
+    assert( b.erase_range(numeric_limits<int>::min(), numeric_limits<int>::max()) == m.size() );
+    assert( b.empty() && b.begin() == b.end() );
+    b.insert(1, 1);
+    assert( b.find(1).first && b.size() == 1 );
+}
+
+// relaxed erase leaves underfull nodes behind, compact() in small steps
+// between the updates brings the tree back to half full nodes
+template<int M, int L>
+void testRelaxed(int n) {
+    BPlusTree<int, int, M, L, btree_default_search, btree_slab_allocator<char>, btree_counted_traits> b;
+    b.set_min_fill(0);
+    mt19937 rng(n + M * L);
+    map<int, int> m;
+    for(int k = 0; k < n; ++k) {
+        b.insert(k, k);
+        m.insert(make_pair(k, k));
+    }
+    for(int round = 0; round < 20; ++round) {
+        // erase most keys of a random stretch, insert some elsewhere
+        int base = rng() % n;
+        for(int i = 0; i < n / 4; ++i) {
+            int k = (base + i) % n;
+            if( rng() % 8 ) {
+                b.erase(k);
+                m.erase(k);
+            }
+            k = rng() % n;
+            if( rng() % 4 == 0 ) {
+                b.insert(k, -k);
+                m.insert(make_pair(k, -k));
+            }
+            if( i % 64 == 0 )
+                b.compact(round % 3 + 1);
+        }
+        if( round % 4 == 3 ) {
+            // finish the running pass, the next one sees every node
+            b.compact();
+            assert( b.compact() );
+            assert( b.leaf_count() <= max<size_t>(1, b.size() / (L / 2)) );
+        }
+        vector<pair<int, int> > expectDump(m.begin(), m.end());
+        assert( b.dumpTree() == expectDump );
+        checkOrder(b, m, n);
+    }
+
+    // erase everything without rebalancing, then compact the empty tree
+    for(int k = 0; k < n; ++k)
+        b.erase(k);
+    assert( b.empty() && b.compact() );
+    b.set_min_fill(0.5);
+    b.insert(3, 3);
+    assert( b.find(3).first && b.size() == 1 );
+}
+
+// payload which counts its copies
+struct counted_payload {
+    static size_t copies;
+    long value;
+    char pad[192];
+    counted_payload() : value(0) {}
+    explicit counted_payload(long v) : value(v) {}
+    counted_payload(const counted_payload &other) : value(other.value) {
+        ++copies;
+    }
+    counted_payload(counted_payload &&other) noexcept : value(other.value) {}
+    counted_payload& operator=(const counted_payload &other) {
+        value = other.value;
+        ++copies;
+        return *this;
+    }
+    counted_payload& operator=(counted_payload &&other) noexcept {
+        value = other.value;
+        return *this;
+    }
+};
+size_t counted_payload::copies = 0;
+
+// emplace, move insert, upsert and find_ptr never copy the data, not
+// even when leaves split, merge or shift. Move-only data works as well
+template<int M, int L>
+void testMoveAware(int n) {
+    BPlusTree<string, counted_payload, M, L> b;
+    map<string, long> m;
+    mt19937 rng(n + L);
+    counted_payload::copies = 0;
+    for(int i = 0; i < n; ++i) {
+        int k = rng() % n;
+        string key = to_string(k);
+        switch( rng() % 4 ) {
+        case 0:
+            assert( b.emplace(key, k) == m.insert(make_pair(key, k)).second );
+            break;
+        case 1:
+            b.insert(to_string(k), counted_payload(k));
+            m.insert(make_pair(key, k));
+            break;
+        case 2:
+            assert( b.upsert(key, [](counted_payload &p) { p.value += 1000; }) == (m.find(key) == m.end()) );
+            m[key] += 1000;
+            break;
+        default:
+            b.erase(key);
+            m.erase(key);
+        }
+    }
+    assert( counted_payload::copies == 0 );
+    assert( b.size() == m.size() );
+    for(int k = 0; k < n; ++k) {
+        counted_payload* p = b.find_ptr(to_string(k));
+        auto itr = m.find(to_string(k));
+        assert( (p != nullptr) == (itr != m.end()) );
+        if( p ) {
+            assert( p->value == itr->second );
+            // write through the pointer
+            p->value = -k;
+        }
+    }
+    const BPlusTree<string, counted_payload, M, L>& cb = b;
+    for(auto &e : m)
+        assert( cb.find_ptr(e.first)->value == -atol(e.first.c_str()) );
+    assert( counted_payload::copies == 0 );
+
+    BPlusTree<int, unique_ptr<long>, M, L> u;
+    for(int k = 0; k < n; ++k)
+        u.emplace(k, new long(k));
+    for(int k = 0; k < n; k += 3)
+        u.erase(k);
+    for(int k = 0; k < n; ++k) {
+        unique_ptr<long>* p = u.find_ptr(k);
+        assert( (p != nullptr) == (k % 3 != 0) );
+        if( p )
+            assert( **p == k );
+    }
+    assert( !u.emplace(1, unique_ptr<long>(new long(-1))) );
+}
+
+// save and load give back the same tree with any fill factor, bad files
+// are rejected and leave an empty tree
+template<int M, int L>
+void testSaveLoad(int n) {
+    const char* file = "test_btree_save.db";
+    typedef BPlusTree<long, double, M, L, btree_default_search, btree_slab_allocator<char>, btree_counted_traits> tree;
+    mt19937 rng(n + M);
+    for(int size : { 0, 1, n }) {
+        tree b;
+        map<long, double> m;
+        while( m.size() < static_cast<size_t>(size) ) {
+            long k = static_cast<long>(rng() % (4 * n + 1)) - n;
+            b.insert(k, k * 0.5);
+            m.insert(make_pair(k, k * 0.5));
+        }
+        b.save(file);
+        for(double fill : { 1.0, 0.6 }) {
+            tree c;
+            c.insert(12345678, 1.0);
+            c.load(file, fill);
+            vector<pair<long, double> > expectDump(m.begin(), m.end());
+            assert( c.dumpTree() == expectDump && c.size() == m.size() );
+            for(auto &e : m)
+                assert( c.find(e.first).second.second == e.second );
+            if( size > 2 )
+                assert( c.rank(m.rbegin()->first) == m.size() - 1 );
+            // the loaded tree takes writes like any other
+            c.insert(-10 * n, 1.0);
+            c.erase(m.begin()->first);
+            assert( c.size() == m.size() + (size > 0 ? 0 : 1) );
+        }
+    }
+
+    bool thrown = false;
+    BPlusTree<int, int, M, L> wrongLayout;
+    try {
+        wrongLayout.load(file);
+    } catch(const runtime_error &) {
+        thrown = true;
+    }
+    assert( thrown && wrongLayout.empty() );
+
+    // swap two keys, the order check catches it
+    tree b;
+    for(long k = 0; k < n; ++k)
+        b.insert(k, k);
+    b.save(file);
+    FILE* f = fopen(file, "r+b");
+    long k0 = 0, k1 = 0;
+    fseek(f, 64, SEEK_SET);
+    assert( fread(&k0, sizeof(long), 1, f) == 1 && fread(&k1, sizeof(long), 1, f) == 1 );
+    fseek(f, 64, SEEK_SET);
+    fwrite(&k1, sizeof(long), 1, f);
+    fwrite(&k0, sizeof(long), 1, f);
+    fclose(f);
+    thrown = false;
+    try {
+        b.load(file);
+    } catch(const runtime_error &) {
+        thrown = true;
+    }
+    assert( thrown && b.empty() && b.dumpTree().empty() );
+
+    remove(file);
+    thrown = false;
+    try {
+        b.load(file);
+    } catch(const system_error &) {
+        thrown = true;
+    }
+    assert( thrown );
+}
+
+// an allocator which fails once the budget is used up, -1 never fails
+static long allocBudget = -1;
+
+template<typename T>
+struct failing_allocator {
+    typedef T value_type;
+    failing_allocator() {}
+    template<typename U>
+    failing_allocator(const failing_allocator<U>&) {}
+    T* allocate(size_t n) {
+        if( allocBudget == 0 )
+            throw bad_alloc();
+        if( allocBudget > 0 )
+            --allocBudget;
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p);
+    }
+    template<typename U>
+    bool operator==(const failing_allocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const failing_allocator<U>&) const { return false; }
+};
+
+// a load which runs out of memory anywhere leaves a usable empty tree
+void testLoadFailure() {
+    const char* file = "test_btree_save.db";
+    typedef BPlusTree<long, long, 4, 4, btree_default_search, failing_allocator<char> > tree;
+    {
+        tree b;
+        for(long k = 0; k < 1000; ++k)
+            b.insert(k, k);
+        b.save(file);
+    }
+    for(long budget = 0; budget < 600; budget += 7) {
+        tree c;
+        c.insert(-1, -1);
+        allocBudget = budget;
+        bool thrown = false;
+        try {
+            c.load(file);
+        } catch(const bad_alloc &) {
+            thrown = true;
+        }
+        allocBudget = -1;
+        assert( c.size() == (thrown ? 0 : 1000) );
+        c.insert(2000, 1);
+        assert( c.find(2000).first );
+    }
+    remove(file);
+}
+
+// the parts of a parallel scan cover the range exactly once and come
+// back in key order, also with the stale separators relaxed erase leaves
+template<int M, int L>
+void testParallelScan(int n) {
+    BPlusTree<int, int, M, L> b;
+    map<int, int> m;
+    mt19937 rng(n + L);
+    for(int i = 0; i < n; ++i) {
+        int k = rng() % (4 * n);
+        b.insert(k, k % 97);
+        m.insert(make_pair(k, k % 97));
+    }
+    b.set_min_fill(0);
+    for(int i = 0; i < n / 2; ++i) {
+        int k = rng() % (4 * n);
+        b.erase(k);
+        m.erase(k);
+    }
+    auto concat = [](vector<int> a, const vector<int> &part) {
+        a.insert(a.end(), part.begin(), part.end());
+        return a;
+    };
+    auto collect = [](vector<int> &acc, const int &k, const int &) {
+        acc.push_back(k);
+    };
+    for(unsigned int threads : { 1u, 2u, 4u, 7u, 0u }) {
+        vector<int> all;
+        for(auto &e : m)
+            all.push_back(e.first);
+        assert( b.parallel_reduce(vector<int>(), collect, concat, threads) == all );
+        atomic<long> sum(0);
+        assert( b.parallel_scan([&](const int &, const int &d) { sum += d; }, threads) == m.size() );
+        long expect = 0;
+        for(auto &e : m)
+            expect += e.second;
+        assert( sum.load() == expect );
+
+        for(int round = 0; round < 20; ++round) {
+            int lo = static_cast<int>(rng() % (5 * n)) - n / 2, hi = lo + rng() % (2 * n);
+            vector<int> part;
+            for(auto itr = m.lower_bound(lo); itr != m.end() && itr->first < hi; ++itr)
+                part.push_back(itr->first);
+            assert( b.parallel_reduce(lo, hi, vector<int>(), collect, concat, threads) == part );
+            assert( b.parallel_scan(lo, hi, [](const int &, const int &) {}, threads) == part.size() );
+            assert( b.parallel_scan(hi, lo, [](const int &, const int &) {}, threads) == 0 );
+        }
+    }
+
+    // the first exception stops the scan and reaches the caller
+    bool thrown = false;
+    try {
+        b.parallel_scan([&](const int &k, const int &) {
+            if( k == m.rbegin()->first )
+                throw runtime_error("stop");
+        }, 4);
+    } catch(const runtime_error &) {
+        thrown = true;
+    }
+    assert( thrown );
+
+    BPlusTree<int, int, M, L> empty;
+    assert( empty.parallel_scan([](const int &, const int &) {}, 4) == 0 );
+}
+
+// keys for the fingerprinted trees, many share long prefixes
+template<typename T> T fingerprintKey(int k);
+template<> int fingerprintKey<int>(int k) {
+    return k;
+}
+template<> string fingerprintKey<string>(int k) {
+    return "user/" + to_string(k % 7) + "/" + to_string(k);
+}
+template<> pair<int, string> fingerprintKey<pair<int, string> >(int k) {
+    return make_pair(k % 13, to_string(k));
+}
+
+// find through the fingerprints agrees with the map after every kind of
+// write which moves keys between or inside leaves
+template<typename T, int M, int L>
+void testFingerprint(int n) {
+    BPlusTree<T, int, M, L, btree_default_search, btree_slab_allocator<char>, btree_fingerprint_traits> b;
+    map<T, int> m;
+    mt19937 rng(n + M * L);
+    auto check = [&]() {
+        for(int k = -5; k < n + 5; ++k) {
+            auto r = b.find(fingerprintKey<T>(k));
+            auto itr = m.find(fingerprintKey<T>(k));
+            assert( r.first == (itr != m.end()) );
+            if( r.first )
+                assert( r.second.first == itr->first && r.second.second == itr->second );
+        }
+        vector<pair<T, int> > expectDump(m.begin(), m.end());
+        assert( b.dumpTree() == expectDump );
+    };
+
+    vector<pair<T, int> > input;
+    for(int k = 0; k < n; k += 2)
+        input.push_back(make_pair(fingerprintKey<T>(k), k));
+    sort(input.begin(), input.end());
+    b.bulk_load(input.begin(), input.end(), 0.7);
+    m.insert(input.begin(), input.end());
+    check();
+
+    // single inserts split leaves, erases shift and merge them
+    for(int i = 0; i < n; ++i) {
+        int k = rng() % n;
+        if( rng() % 3 ) {
+            b.insert(fingerprintKey<T>(k), k);
+            m.insert(make_pair(fingerprintKey<T>(k), k));
+        } else {
+            b.erase(fingerprintKey<T>(k));
+            m.erase(fingerprintKey<T>(k));
+        }
+    }
+    check();
+
+    vector<pair<T, int> > batch;
+    vector<T> keys;
+    for(int i = 0; i < n / 4; ++i) {
+        int k = rng() % n;
+        batch.push_back(make_pair(fingerprintKey<T>(k), -k));
+        keys.push_back(fingerprintKey<T>(rng() % n));
+    }
+    b.insert_many(batch.begin(), batch.end());
+    m.insert(batch.begin(), batch.end());
+    check();
+    b.erase_many(keys.begin(), keys.end());
+    for(auto &k : keys)
+        m.erase(k);
+    check();
+
+    T lo = fingerprintKey<T>(n / 3), hi = fingerprintKey<T>(n / 2);
+    if( hi < lo )
+        swap(lo, hi);
+    b.erase_range(lo, hi);
+    m.erase(m.lower_bound(lo), m.lower_bound(hi));
+    check();
+
+    // relaxed erase leaves sparse leaves, compact merges and evens them
+    b.set_min_fill(0);
+    for(int k = 0; k < n; ++k)
+        if( rng() % 4 ) {
+            b.erase(fingerprintKey<T>(k));
+            m.erase(fingerprintKey<T>(k));
+        }
+    b.compact();
+    b.compact();
+    check();
+}
+
+// find with the learned index agrees with the map before and after
+// writes, with stale models and after the rebuilds
+template<int M, int L>
+void testLearned(int n, size_t epsilon) {
+    BPlusTree<long, long, M, L> b;
+    map<long, long> m;
+    mt19937 rng(n + L);
+    // ids in runs with gaps between them
+    long id = -1000;
+    for(int i = 0; i < n; ++i) {
+        id += rng() % 16 ? 1 + rng() % 3 : 1000 + rng() % 100000;
+        m.insert(make_pair(id, i));
+    }
+    vector<pair<long, long> > input(m.begin(), m.end());
+    b.bulk_load(input.begin(), input.end(), 0.8);
+    b.learn(epsilon, n / 8);
+    assert( b.learned_models() > 0 && b.learned_models() < m.size() );
+
+    auto check = [&](int probes) {
+        for(int i = 0; i < probes; ++i) {
+            long k = i % 2 ? input[rng() % input.size()].first : input[0].first - 50 + static_cast<long>(rng() % (id - input[0].first + 100));
+            auto r = b.find(k);
+            auto itr = m.find(k);
+            assert( r.first == (itr != m.end()) );
+            if( r.first )
+                assert( r.second.second == itr->second );
+        }
+    };
+    check(n * 2);
+    for(int round = 0; round < 10; ++round) {
+        for(int i = 0; i < n / 20; ++i) {
+            long k = input[rng() % input.size()].first + static_cast<long>(rng() % 5) - 2;
+            if( rng() % 2 ) {
+                b.insert(k, -k);
+                m.insert(make_pair(k, -k));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+            if( i % 16 == 0 )
+                check(8);
+        }
+        check(n / 4);
+    }
+    b.insert_many(input.begin(), input.begin() + input.size() / 2);
+    m.insert(input.begin(), input.begin() + input.size() / 2);
+    check(n / 2);
+    b.erase_range(input[input.size() / 4].first, input[input.size() / 2].first);
+    m.erase(m.lower_bound(input[input.size() / 4].first), m.lower_bound(input[input.size() / 2].first));
+    check(n / 2);
+    b.learn(epsilon, n / 8);
+    check(n / 2);
+
+    b.unlearn();
+    assert( b.learned_models() == 0 );
+    check(n / 4);
+}
+
+// keys spread over the whole range of a signed type, their differences
+// do not fit the key type
+template<typename T>
+void testLearnedRange(int n) {
+    BPlusTree<T, int, 16, 32> b;
+    map<T, int> m;
+    mt19937_64 rng(n);
+    m.insert(make_pair(numeric_limits<T>::min(), 0));
+    m.insert(make_pair(numeric_limits<T>::max(), 1));
+    for(int i = 0; i < n; ++i)
+        m.insert(make_pair(static_cast<T>(rng()), i));
+    vector<pair<T, int> > input(m.begin(), m.end());
+    b.bulk_load(input.begin(), input.end());
+    b.learn(8, n / 8);
+    assert( b.learned_models() > 0 );
+    for(auto &p : m) {
+        auto r = b.find(p.first);
+        assert( r.first && r.second.second == p.second );
+        if( p.first != numeric_limits<T>::max() )
+            assert( b.find(p.first + 1).first == (m.count(p.first + 1) > 0) );
+    }
+}
+
+template<typename tree>
+void tree_insert(tree &b, atomic<bool> &f, int start, int end) {
+    while( !f.load() )
+        btree_cpu_relax();
+    for(int i = start; i < end; ++i)
+        assert( b.insert(i, i + 1) );
+}
+
+template<typename tree>
+void tree_erase(tree &b, atomic<bool> &f, int start, int end) {
+    while( !f.load() )
+        btree_cpu_relax();
+    for(int i = start; i < end; ++i)
+        assert( b.erase(i) );
+}
+
+template<typename tree>
+void tree_find(tree &b, atomic<bool> &f, atomic<bool> &stop, int start, int end) {
+    while( !f.load() )
+        btree_cpu_relax();
+    while( !stop.load() ) {
+        for(int i = start; i < end; ++i) {
+            auto r = b.find(i);
+            // keys which are never erased must always be found
+            assert( r.first );
+            assert( r.second == make_pair(i, i + 1) );
+        }
+    }
+}
+
+template<typename tree>
+void multiple_threaded_test() {
+    const int NUM_ELEMENTS_PER_THREAD = 5000;
+    const int NUM_THREADS = 4;
+    tree b;
+
+    // concurrent inserts of disjoint ranges, no value lost
+    {
+        vector<thread> threads;
+        atomic<bool> start_flag(false);
+        for(int i = 0; i < NUM_THREADS; ++i)
+            threads.push_back(thread(tree_insert<tree>, ref(b), ref(start_flag),
+                i * NUM_ELEMENTS_PER_THREAD, (i + 1) * NUM_ELEMENTS_PER_THREAD));
+        start_flag.store(true);
+        for(auto &t : threads)
+            t.join();
+        assert( b.size() == NUM_THREADS * NUM_ELEMENTS_PER_THREAD );
+        for(int i = 0; i < NUM_THREADS * NUM_ELEMENTS_PER_THREAD; ++i)
+            assert( b.find(i).second == make_pair(i, i + 1) );
+    }
+
+    // erase half of the keys while readers look up the other half
+    {
+        vector<thread> threads;
+        atomic<bool> start_flag(false);
+        atomic<bool> stop(false);
+        const int half = NUM_THREADS * NUM_ELEMENTS_PER_THREAD / 2;
+        for(int i = 0; i < NUM_THREADS; ++i)
+            threads.push_back(thread(tree_erase<tree>, ref(b), ref(start_flag),
+                half + i * NUM_ELEMENTS_PER_THREAD / 2, half + (i + 1) * NUM_ELEMENTS_PER_THREAD / 2));
+        thread reader(tree_find<tree>, ref(b), ref(start_flag), ref(stop), 0, half);
+        start_flag.store(true);
+        for(auto &t : threads)
+            t.join();
+        stop.store(true);
+        reader.join();
+        assert( b.size() == half );
+        for(int i = 0; i < 2 * half; ++i)
+            assert( b.find(i).first == (i < half) );
+    }
+
+    // with no other operation running a merge releases all but its own node
+    for(int i = 0; i < NUM_THREADS * NUM_ELEMENTS_PER_THREAD / 2; ++i)
+        b.erase(i);
+    assert( b.empty() );
+    assert( b.pending() <= 1 );
+}
+
 int main() {
+    multiple_threaded_test<BPlusTree_olc<int, int, 8, 8> >();
+    multiple_threaded_test<BPlusTree_olc<int, int> >();
+
+    testBulkLoad<4, 4>(0, 1.0);
+    testBulkLoad<4, 4>(1, 1.0);
+    testBulkLoad<4, 4>(5, 1.0);
+    testBulkLoad<4, 4>(1000, 1.0);
+    testBulkLoad<4, 4>(1000, 0.5);
+    testBulkLoad<5, 3>(777, 0.7);
+    testBulkLoad<16, 16>(10000, 1.0);
+    testBulkLoad<16, 16>(10000, 0.1);
+
+    testBatch<4, 4>(2000);
+    testBatch<8, 8>(5000);
+    testBatch<16, 32>(20000);
+    testBatch<64, 64>(50000);
+    testEraseRange<4, 4>(2000);
+    testEraseRange<5, 3>(2000);
+    testEraseRange<16, 32>(20000);
+    testEraseRange<0, 0>(20000);
+    testRelaxed<4, 4>(2000);
+    testRelaxed<5, 3>(2000);
+    testRelaxed<16, 32>(20000);
+    testLearned<4, 4>(3000, 2);
+    testLearned<8, 16>(20000, 8);
+    testLearned<64, 128>(100000, 32);
+    testLearnedRange<int>(20000);
+    testLearnedRange<long long>(20000);
+    testFingerprint<int, 4, 4>(2000);
+    testFingerprint<int, 16, 64>(20000);
+    testFingerprint<string, 4, 4>(2000);
+    testFingerprint<string, 8, 40>(20000);
+    testFingerprint<string, 0, 0>(20000);
+    testFingerprint<pair<int, string>, 5, 3>(2000);
+    testFingerprint<pair<int, string>, 16, 32>(10000);
+    testMoveAware<4, 4>(3000);
+    testMoveAware<16, 32>(20000);
+    testSaveLoad<4, 4>(3000);
+    testSaveLoad<16, 32>(50000);
+    testLoadFailure();
+    testParallelScan<4, 4>(3000);
+    testParallelScan<16, 32>(50000);
+    testAllocator<btree_slab_allocator<char> >();
+    testAllocator<btree_slab_allocator<char, true> >();
+    testAllocator<allocator<char> >();
+    testOrderStatistics<4, 4>(600);
+    testOrderStatistics<5, 3>(600);
+    testOrderStatistics<16, 32>(5000);
+    testCursor();
+    testSearchStrategy<btree_linear_search>();
+    testSearchStrategy<btree_binary_search>();
+    testSearchStrategy<btree_simd_search>();
+    testSearchStrategy<btree_default_search>();
+
     BPlusTree<int, int, 2, 2> b;
     assert( b.empty() );
     b.insert(10,20);
@@ -0,0 +1,179 @@
+#include "btree_blink.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// the tree holds exactly the pairs of m
+template<typename T>
+void compare(const T &b, const map<int, int> &m, int range) {
+    for(int k = -1; k <= range; ++k) {
+        auto r = b.find(k);
+        auto itr = m.find(k);
+        assert( r.first == (itr != m.end()) );
+        if( r.first )
+            assert( r.second.first == k && r.second.second == itr->second );
+    }
+    auto itr = m.begin();
+    size_t cnt = b.scan(-1, range + 1, [&](const int &k, const int &d) {
+        assert( itr != m.end() && itr->first == k && itr->second == d );
+        ++itr;
+    });
+    assert( cnt == m.size() && itr == m.end() );
+    assert( b.size() == m.size() );
+}
+
+// single threaded random inserts and erases against std::map
+template<typename T>
+void testSequential(int range, int ops) {
+    T b;
+    map<int, int> m;
+    mt19937 rng(range);
+    for(int i = 0; i < ops; ++i) {
+        int k = rng() % range;
+        if( rng() % 3 ) {
+            bool res = b.insert(k, i);
+            assert( res == m.insert(make_pair(k, i)).second );
+        } else {
+            bool res = b.erase(k);
+            assert( res == (m.erase(k) == 1) );
+        }
+    }
+    compare(b, m, range);
+
+    // bounded scans start and stop inside leaves
+    for(int i = 0; i < 100; ++i) {
+        int lo = rng() % range, hi = lo + rng() % 200;
+        auto itr = m.lower_bound(lo);
+        size_t cnt = b.scan(lo, hi, [&](const int &k, const int &d) {
+            assert( itr != m.end() && itr->first == k && itr->second == d );
+            ++itr;
+        });
+        assert( itr == m.lower_bound(hi) );
+        assert( cnt == static_cast<size_t>(distance(m.lower_bound(lo), itr)) );
+    }
+    assert( b.scan(10, 10, [](const int &, const int &) { assert( false ); }) == 0 );
+
+    // erase everything, the emptied nodes stay linked
+    for(int k = 0; k < range; ++k)
+        b.erase(k);
+    m.clear();
+    compare(b, m, range);
+    assert( b.empty() );
+    for(int k = range - 1; k >= 0; k -= 2) {
+        b.insert(k, -k);
+        m.insert(make_pair(k, -k));
+    }
+    compare(b, m, range);
+}
+
+// writers split leaves while readers look up and scan, with small nodes
+// most operations meet a split on their way
+template<typename T>
+void testConcurrent(int threads, int perThread) {
+    T b;
+    const int range = threads * perThread;
+    atomic<bool> stop(false);
+
+    // keys are interleaved between the writers so they share leaves
+    vector<thread> writers;
+    for(int t = 0; t < threads; ++t)
+        writers.push_back(thread([&b, t, threads, perThread]() {
+            mt19937 rng(t);
+            vector<int> keys;
+            for(int i = 0; i < perThread; ++i)
+                keys.push_back(i * threads + t);
+            shuffle(keys.begin(), keys.end(), rng);
+            for(int k : keys)
+                assert( b.insert(k, k + 1) );
+            // erase and reinsert a quarter of them
+            for(int i = 0; i < perThread / 4; ++i)
+                assert( b.erase(keys[i]) );
+            for(int i = 0; i < perThread / 4; ++i)
+                assert( b.insert(keys[i], keys[i] + 1) );
+        }));
+    thread reader([&]() {
+        mt19937 rng(42);
+        while( !stop.load() ) {
+            int k = rng() % range;
+            auto r = b.find(k);
+            if( r.first )
+                assert( r.second.first == k && r.second.second == k + 1 );
+            int last = -1;
+            b.scan(k, k + 100, [&](const int &key, const int &d) {
+                assert( key > last && key >= k && key < k + 100 && d == key + 1 );
+                last = key;
+            });
+        }
+    });
+    for(auto &t : writers)
+        t.join();
+    stop.store(true);
+    reader.join();
+
+    map<int, int> m;
+    for(int k = 0; k < range; ++k)
+        m.insert(make_pair(k, k + 1));
+    compare(b, m, range);
+}
+
+// concurrent inserts and erases of the same keys, then every thread
+// inserts one residue class and erases another, so the end state is known
+template<typename T>
+void testContended(int threads, int range) {
+    T b;
+    vector<thread> workers;
+    for(int t = 0; t < threads; ++t)
+        workers.push_back(thread([&b, t, range]() {
+            mt19937 rng(t + 100);
+            for(int i = 0; i < range * 4; ++i) {
+                int k = rng() % range;
+                if( rng() % 2 )
+                    b.insert(k, k);
+                else
+                    b.erase(k);
+            }
+        }));
+    for(auto &t : workers)
+        t.join();
+    workers.clear();
+    for(int t = 0; t < threads; ++t)
+        workers.push_back(thread([&b, t, threads, range]() {
+            for(int k = t; k < range; k += 2 * threads) {
+                b.insert(k, k);
+                b.erase(k + threads);
+            }
+        }));
+    for(auto &t : workers)
+        t.join();
+
+    size_t cnt = 0;
+    int last = -1;
+    b.scan(0, range, [&](const int &k, const int &d) {
+        assert( k > last && d == k && k % (2 * threads) < threads );
+        last = k;
+        ++cnt;
+    });
+    assert( cnt == b.size() );
+    for(int k = 0; k < range; ++k)
+        assert( b.find(k).first == (k % (2 * threads) < threads) );
+}
+
+int main() {
+    testSequential<BPlusTree_blink<int, int, 3, 2> >(500, 5000);
+    testSequential<BPlusTree_blink<int, int, 4, 4> >(2000, 20000);
+    testSequential<BPlusTree_blink<int, int> >(100000, 300000);
+
+    testConcurrent<BPlusTree_blink<int, int, 3, 2> >(4, 3000);
+    testConcurrent<BPlusTree_blink<int, int, 8, 8> >(4, 10000);
+    testConcurrent<BPlusTree_blink<int, int> >(4, 50000);
+
+    testContended<BPlusTree_blink<int, int, 3, 2> >(4, 2000);
+    testContended<BPlusTree_blink<int, int> >(4, 20000);
+
+    cout << "-- Test Pass --" << endl;
+    return 0;
+}
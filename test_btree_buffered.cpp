@@ -0,0 +1,109 @@
+#include "btree_buffered.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// the tree holds exactly the pairs of m, buffered or not
+template<typename T>
+void compare(const T &b, const map<int, long> &m, int range) {
+    for(int k = 0; k < range; ++k) {
+        auto r = b.find(k);
+        auto itr = m.find(k);
+        assert( r.first == (itr != m.end()) );
+        if( r.first )
+            assert( r.second.second == itr->second );
+    }
+}
+
+template<typename T>
+void compareFlushed(T &b, const map<int, long> &m) {
+    auto itr = m.begin();
+    size_t cnt = b.scan(-1, numeric_limits<int>::max(), [&](const int &k, const long &d) {
+        assert( itr != m.end() && itr->first == k && itr->second == d );
+        ++itr;
+    });
+    assert( cnt == m.size() );
+    assert( b.size() == m.size() );
+    assert( b.pending() == 0 );
+}
+
+// random inserts and erases of a small key range, so messages for one
+// key meet in the buffers and at the leaves
+template<typename T>
+void testRandom(int range, int ops) {
+    T b;
+    map<int, long> m;
+    mt19937 rng(range);
+    for(int round = 0; round < 4; ++round) {
+        for(int i = 0; i < ops; ++i) {
+            int k = rng() % range;
+            int op = rng() % 8;
+            if( op < 5 ) {
+                long d = static_cast<long>(rng() % 1000);
+                b.insert(k, d);
+                m.insert(make_pair(k, d));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        }
+        compare(b, m, range);
+        if( round % 2 )
+            compareFlushed(b, m);
+    }
+
+    // erase everything, the leaves merge and the root shrinks
+    for(int k = 0; k < range; ++k)
+        b.erase(k);
+    m.clear();
+    compare(b, m, range);
+    compareFlushed(b, m);
+    assert( b.empty() );
+
+    // refill in descending order, then clear
+    for(int k = range - 1; k >= 0; --k) {
+        b.insert(k, k * 2L);
+        m.insert(make_pair(k, k * 2L));
+    }
+    compare(b, m, range);
+    compareFlushed(b, m);
+    b.clear();
+    assert( b.empty() && b.pending() == 0 );
+    compare(b, map<int, long>(), range);
+}
+
+// an erase followed by an insert replaces the data, an insert of a
+// present key is ignored wherever the key is
+void testMessageOrder() {
+    BPlusTree_buffered<int, long, 4, 4, 8> b;
+    for(int k = 0; k < 200; ++k)
+        b.insert(k, k);
+    b.flush();
+    for(int k = 0; k < 200; ++k) {
+        b.insert(k, -1);
+        b.erase(k);
+        b.insert(k, k + 1000);
+        b.insert(k, -2);
+    }
+    assert( b.pending() > 0 );
+    for(int k = 0; k < 200; ++k)
+        assert( b.find(k).second.second == k + 1000 );
+    b.flush();
+    for(int k = 0; k < 200; ++k)
+        assert( b.find(k).second.second == k + 1000 );
+    assert( b.size() == 200 );
+}
+
+int main() {
+    testMessageOrder();
+    testRandom<BPlusTree_buffered<int, long, 4, 4, 8> >(300, 2000);
+    testRandom<BPlusTree_buffered<int, long, 4, 4, 3> >(300, 2000);
+    testRandom<BPlusTree_buffered<int, long, 8, 16, 64> >(5000, 20000);
+    testRandom<BPlusTree_buffered<int, long> >(100000, 200000);
+
+    cout << "-- Test Pass --" << endl;
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "btree_cow.hpp"
+#include <iostream>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef BPlusTree_cow<int, long, 4, 4> small_tree;
+
+// the snapshot holds exactly the pairs of m
+template<typename S>
+void compare(const S &s, const map<int, long> &m, int range) {
+    assert( s.size() == m.size() );
+    for(int k = 0; k < range; ++k) {
+        auto r = s.find(k);
+        auto itr = m.find(k);
+        assert( r.first == (itr != m.end()) );
+        if( r.first )
+            assert( r.second.second == itr->second );
+    }
+    auto itr = m.begin();
+    size_t cnt = s.scan(-1, range, [&](const int &k, const long &d) {
+        assert( itr != m.end() && itr->first == k && itr->second == d );
+        ++itr;
+    });
+    assert( cnt == m.size() );
+}
+
+// old snapshots keep their version while the tree changes underneath
+template<typename T>
+void testSnapshots(int range) {
+    T b;
+    map<int, long> m;
+    mt19937 rng(5);
+    vector<map<int, long> > states;
+    vector<typename T::snapshot> snaps;
+    for(int round = 0; round < 8; ++round) {
+        for(int i = 0; i < range; ++i) {
+            int k = rng() % range;
+            if( rng() % 3 ) {
+                assert( b.insert(k, k * 7L + round) == (m.find(k) == m.end()) );
+                m.insert(make_pair(k, k * 7L + round));
+            } else {
+                assert( b.erase(k) == (m.erase(k) == 1) );
+            }
+        }
+        states.push_back(m);
+        snaps.push_back(b.take_snapshot());
+        assert( snaps.back().version() == b.version() );
+    }
+    for(size_t i = 0; i < snaps.size(); ++i)
+        compare(snaps[i], states[i], range);
+
+    // releasing the newest snapshots frees nothing older ones can reach
+    while( snaps.size() > 1 ) {
+        snaps.pop_back();
+        states.pop_back();
+        compare(snaps.front(), states.front(), range);
+    }
+    snaps.clear();
+    assert( b.pending() == 0 );
+
+    // erase everything
+    auto s = b.take_snapshot();
+    for(int k = 0; k < range; ++k)
+        b.erase(k);
+    assert( b.empty() );
+    compare(s, m, range);
+    assert( b.pending() > 0 );
+    s.release();
+    assert( b.pending() == 0 );
+    compare(b.take_snapshot(), map<int, long>(), range);
+}
+
+// readers scan snapshots taken while the writer runs, a snapshot
+// gives the same result every time it is read
+void testConcurrent() {
+    const int range = 4000;
+    BPlusTree_cow<int, long, 8, 8> b;
+    for(int k = 0; k < range; k += 2)
+        b.insert(k, k * 3L);
+
+    atomic<bool> done(false);
+    atomic<size_t> checks(0);
+    vector<thread> readers;
+    for(int t = 0; t < 3; ++t) {
+        readers.push_back(thread([&]() {
+            while( !done.load() ) {
+                auto s = b.take_snapshot();
+                vector<int> first;
+                int prev = -1;
+                size_t cnt = s.scan(0, range, [&](const int &k, const long &d) {
+                    assert( k > prev && d == k * 3L );
+                    prev = k;
+                    first.push_back(k);
+                });
+                assert( cnt == s.size() );
+                this_thread::yield();
+                size_t idx = 0;
+                s.scan(0, range, [&](const int &k, const long &) {
+                    assert( idx < first.size() && first[idx] == k );
+                    ++idx;
+                });
+                assert( idx == first.size() );
+                ++checks;
+            }
+        }));
+    }
+
+    mt19937 rng(9);
+    for(int i = 0; i < 50000; ++i) {
+        int k = rng() % range;
+        if( rng() % 2 )
+            b.insert(k, k * 3L);
+        else
+            b.erase(k);
+    }
+    done.store(true);
+    for(auto &t : readers)
+        t.join();
+    assert( checks.load() > 0 );
+    assert( b.pending() == 0 );
+}
+
+// data whose assignment fails after a set number of copies
+struct flaky {
+    static int budget;
+    long v_;
+    flaky() : v_(0) {}
+    flaky(long v) : v_(v) {}
+    flaky& operator=(const flaky &other) {
+        if( budget >= 0 && budget-- == 0 )
+            throw runtime_error("flaky");
+        v_ = other.v_;
+        return *this;
+    }
+};
+int flaky::budget = -1;
+
+// an update which throws in the middle of its path copy leaves the
+// published tree as it was and retires none of its nodes
+void testFailedUpdate() {
+    BPlusTree_cow<int, flaky, 4, 4> b;
+    map<int, long> m;
+    for(int k = 0; k < 1000; k += 2) {
+        b.insert(k, flaky(k));
+        m.insert(make_pair(k, static_cast<long>(k)));
+    }
+    mt19937 rng(9);
+    int failed = 0;
+    for(int i = 0; i < 2000; ++i) {
+        int k = rng() % 1000;
+        bool insert = rng() % 2;
+        flaky::budget = rng() % 40;
+        try {
+            if( insert ) {
+                b.insert(k, flaky(k));
+                m.insert(make_pair(k, static_cast<long>(k)));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        } catch(const runtime_error &) {
+            ++failed;
+        }
+        flaky::budget = -1;
+        // a reader after the next update must still find every pair
+        assert( b.pending() == 0 );
+        auto s = b.take_snapshot();
+        assert( s.size() == m.size() );
+        for(auto &p : m) {
+            auto r = s.find(p.first);
+            assert( r.first && r.second.second.v_ == p.second );
+        }
+    }
+    assert( failed > 0 );
+}
+
+int main() {
+    testSnapshots<small_tree>(500);
+    testSnapshots<BPlusTree_cow<int, long> >(5000);
+    testConcurrent();
+    testFailedUpdate();
+
+    cout << "-- Test Pass --" << endl;
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "btree_paged.hpp"
+#include <iostream>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <system_error>
+#include <unistd.h>
+
+using namespace std;
+
+// small pages give a deep tree with few keys
+typedef BPlusTree_paged<int, long, mmap_page_store<128> > small_tree;
+typedef BPlusTree_paged<int, long> tree;
+typedef BPlusTree_paged<int, long, buffer_pool_page_store<128> > pooled_tree;
+
+template<typename T, typename... Args>
+void testPagedTree(const char* path, Args... storeArgs) {
+    std::remove(path);
+    map<int, long> m;
+    mt19937 rng(5);
+
+    // every round reopens the file and checks what the last round left
+    for(int round = 0; round < 4; ++round) {
+        T b(path, storeArgs...);
+        assert( b.size() == m.size() );
+        for(auto &p : m) {
+            auto r = b.find(p.first);
+            assert( r.first && r.second.second == p.second );
+        }
+
+        for(int i = 0; i < 50000; ++i) {
+            int k = rng() % 20000;
+            if( rng() % 3 ) {
+                b.insert(k, k * 7L + round);
+                m.insert(make_pair(k, k * 7L + round));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        }
+        assert( b.size() == m.size() );
+        for(int k = 0; k < 20000; ++k)
+            assert( b.find(k).first == (m.count(k) > 0) );
+
+        auto itr = m.lower_bound(100);
+        size_t n = b.scan(100, 5000, [&](const int &k, const long &d) {
+            assert( itr->first == k && itr->second == d );
+            ++itr;
+        });
+        assert( n == static_cast<size_t>(distance(m.lower_bound(100), m.lower_bound(5000))) );
+    }
+
+    {
+        T b(path, storeArgs...);
+        for(int k = 0; k < 20000; ++k)
+            b.erase(k);
+        assert( b.empty() );
+        assert( !b.find(1).first );
+    }
+    {
+        T b(path, storeArgs...);
+        assert( b.empty() );
+    }
+    std::remove(path);
+}
+
+int main() {
+    testPagedTree<small_tree>("test_btree_paged.db");
+    testPagedTree<tree>("test_btree_paged.db");
+    // a frame budget far below the number of pages forces evictions
+    testPagedTree<pooled_tree>("test_btree_paged.db", 32);
+
+    {
+        pooled_tree b("test_btree_paged.db", 16);
+        for(int k = 0; k < 5000; ++k)
+            b.insert(k, k);
+        for(int k = 0; k < 5000; ++k)
+            assert( b.find(k).first );
+        pooled_tree::tree_stats st = b.stats();
+        assert( st.itemCount_ == 5000 );
+        assert( st.leaves_ + st.inners_ > 16 );
+        assert( st.pages_.misses_ > 0 && st.pages_.hits_ > 0 );
+        assert( st.pages_.evictions_ > 0 && st.pages_.writes_ > 0 );
+        // an explicit close reports errors by throwing, a second one and
+        // the destructor have nothing left to do
+        b.close();
+        b.close();
+    }
+    {
+        // evicted pages must have been written back
+        pooled_tree b("test_btree_paged.db", 16);
+        assert( b.size() == 5000 );
+        for(int k = 0; k < 5000; ++k)
+            assert( b.find(k).second.second == k );
+    }
+    {
+        tree b("test_btree_paged.db.mmap");
+        b.insert(1, 1);
+        assert( b.stats().pages_.misses_ == 0 );
+        b.close();
+    }
+    {
+        tree b("test_btree_paged.db.mmap");
+        assert( b.find(1).first );
+    }
+    std::remove("test_btree_paged.db");
+    std::remove("test_btree_paged.db.mmap");
+
+    // a file of another layout must be rejected
+    {
+        small_tree b("test_btree_paged.db");
+        b.insert(1, 1);
+    }
+    bool rejected = false;
+    try {
+        tree b("test_btree_paged.db");
+    } catch(const runtime_error &e) {
+        rejected = true;
+    }
+    assert( rejected );
+    std::remove("test_btree_paged.db");
+
+    // a failed read leaves the evicted frame free for the next pin
+    {
+        buffer_pool_page_store<128> s("test_btree_paged.db", 1);
+        s.grow(2);
+        s.pin(0);
+        s.unpin(0, false);
+        int rc = ::truncate("test_btree_paged.db", 128);
+        assert( rc == 0 );
+        (void)rc;
+        bool failed = false;
+        try {
+            s.pin(1);
+        } catch(const system_error &e) {
+            failed = true;
+        }
+        assert( failed );
+        assert( s.stats().evictions_ == 1 );
+        s.pin(0);
+        s.unpin(0, false);
+        assert( s.stats().evictions_ == 1 );
+    }
+    std::remove("test_btree_paged.db");
+
+    cout << "-- Test Pass --" << endl;
+    return 0;
+}
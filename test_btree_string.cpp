@@ -0,0 +1,102 @@
+#include "btree_string.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// url like keys : long shared prefixes with a random tail
+string randomKey(mt19937 &rng) {
+    static const char* hosts[] = { "http://www.example.com/", "http://www.example.org/", "https://a.b/", "" };
+    string k = hosts[rng() % 4];
+    unsigned int n = rng() % 24;
+    for(unsigned int i = 0; i < n; ++i)
+        k += static_cast<char>(rng() % 3 ? 'a' + rng() % 4 : rng() % 256);
+    return k;
+}
+
+template<size_t N>
+void testStringTree() {
+    BPlusTree_string<long, N> b;
+    map<string, long> m;
+    mt19937 rng(N);
+    assert( b.empty() );
+    assert( !b.find("").first );
+
+    for(int round = 0; round < 3; ++round) {
+        for(int i = 0; i < 60000; ++i) {
+            string k = randomKey(rng);
+            if( rng() % 4 ) {
+                b.insert(k, i);
+                m.insert(make_pair(k, static_cast<long>(i)));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        }
+        assert( b.size() == m.size() );
+        for(auto &p : m) {
+            auto r = b.find(p.first);
+            assert( r.first && r.second.first == p.first && r.second.second == p.second );
+        }
+
+        string end(2, '\xff');
+        auto itr = m.begin();
+        size_t n = b.scan("", end, [&](const string &k, const long &d) {
+            assert( itr->first == k && itr->second == d );
+            ++itr;
+        });
+        assert( n == static_cast<size_t>(distance(m.begin(), m.lower_bound(end))) );
+
+        string lo = "http://www.example.com/b", hi = "https://a.b/c";
+        itr = m.lower_bound(lo);
+        n = b.scan(lo, hi, [&](const string &k, const long &d) {
+            assert( itr->first == k && itr->second == d );
+            ++itr;
+        });
+        assert( n == static_cast<size_t>(distance(m.lower_bound(lo), m.lower_bound(hi))) );
+    }
+
+    // keys at the size limit
+    string big(BPlusTree_string<long, N>::MAX_KEY_SIZE, 'x');
+    for(int i = 0; i < 200; ++i) {
+        big[big.size() - 1 - i % 8] = 'a' + i % 26;
+        b.insert(big, i);
+        m.insert(make_pair(big, static_cast<long>(i)));
+    }
+    bool thrown = false;
+    try {
+        b.insert(big + "x", 1);
+    } catch(const length_error &e) {
+        thrown = true;
+    }
+    assert( thrown );
+    assert( b.size() == m.size() );
+
+    for(auto &p : m)
+        b.erase(p.first);
+    assert( b.empty() );
+    assert( b.stats().leaves_ == 0 && b.stats().inners_ == 0 );
+}
+
+int main() {
+    testStringTree<1024>();
+    testStringTree<4096>();
+
+    // the fences let nodes drop the shared host prefix
+    {
+        BPlusTree_string<int> b;
+        for(int i = 0; i < 100000; ++i)
+            b.insert("http://www.example.com/items/" + to_string(i), i);
+        auto st = b.stats();
+        assert( st.itemCount_ == 100000 );
+        assert( st.itemCount_ / st.leaves_ > 100 );
+        b.clear();
+        assert( b.empty() && !b.find("http://www.example.com/items/1").first );
+    }
+
+    cout << "-- Test Pass --" << endl;
+    return 0;
+}
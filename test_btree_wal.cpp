@@ -0,0 +1,271 @@
+#include "btree_wal.hpp"
+#include <iostream>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+typedef BPlusTree_durable<int, long> tree;
+
+static const char* PATH = "test_btree_wal.db";
+
+void removeFiles() {
+    std::remove("test_btree_wal.db.wal");
+    std::remove("test_btree_wal.db.ckpt");
+    std::remove("test_btree_wal.db.ckpt.tmp");
+}
+
+template<typename T>
+void compare(T &b, const map<int, long> &m, int range) {
+    assert( b.size() == m.size() );
+    for(int k = 0; k < range; ++k) {
+        auto r = b.find(k);
+        auto itr = m.find(k);
+        assert( r.first == (itr != m.end()) );
+        if( r.first )
+            assert( r.second.second == itr->second );
+    }
+}
+
+// random updates over several reopens, with and without checkpoints
+void testReopen(const wal_options &opts) {
+    removeFiles();
+    map<int, long> m;
+    mt19937 rng(11);
+    for(int round = 0; round < 4; ++round) {
+        tree b(PATH, opts);
+        compare(b, m, 3000);
+        for(int i = 0; i < 5000; ++i) {
+            int k = rng() % 3000;
+            if( rng() % 3 ) {
+                b.insert(k, k * 3L + round);
+                m.insert(make_pair(k, k * 3L + round));
+            } else {
+                b.erase(k);
+                m.erase(k);
+            }
+        }
+        if( round == 1 )
+            b.checkpoint();
+    }
+    tree b(PATH, opts);
+    compare(b, m, 3000);
+    removeFiles();
+}
+
+// a child process dies without any cleanup after every write it
+// acknowledged, the parent must find all of them
+void testCrash() {
+    removeFiles();
+    wal_options opts;
+    opts.checkpointBytes_ = 16 << 10;
+    int fds[2];
+    assert( pipe(fds) == 0 );
+    pid_t pid = fork();
+    if( pid == 0 ) {
+        close(fds[0]);
+        tree b(PATH, opts);
+        mt19937 rng(5);
+        for(int i = 0; i < 3000; ++i) {
+            int k = rng() % 1000;
+            if( rng() % 4 )
+                b.insert(k, i);
+            else
+                b.erase(k);
+            int acked = i + 1;
+            if( write(fds[1], &acked, sizeof(acked)) != sizeof(acked) )
+                _exit(1);
+        }
+        // no destructor, no flush
+        _exit(0);
+    }
+    close(fds[1]);
+    int acked = 0, n;
+    while( read(fds[0], &n, sizeof(n)) == sizeof(n) )
+        acked = n;
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    assert( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+    assert( acked == 3000 );
+
+    // redo the same writes in memory
+    map<int, long> m;
+    mt19937 rng(5);
+    for(int i = 0; i < acked; ++i) {
+        int k = rng() % 1000;
+        if( rng() % 4 )
+            m.insert(make_pair(k, static_cast<long>(i)));
+        else
+            m.erase(k);
+    }
+    tree b(PATH, opts);
+    compare(b, m, 1000);
+    assert( b.stats().replayed_ > 0 );
+
+    // a torn record at the end of the log is dropped
+    b.sync();
+    FILE* f = fopen("test_btree_wal.db.wal", "ab");
+    assert( f );
+    fwrite("torn record", 1, 11, f);
+    fclose(f);
+    {
+        tree c(PATH, opts);
+        compare(c, m, 1000);
+        c.insert(5000, 1);
+        m.insert(make_pair(5000, 1L));
+    }
+    tree c(PATH, opts);
+    compare(c, m, 5001);
+    removeFiles();
+}
+
+// concurrent writers share their syncs
+void testGroupCommit() {
+    removeFiles();
+    wal_options opts;
+    opts.groupDelay_ = chrono::microseconds(200);
+    const int NUM_THREADS = 8;
+    const int NUM_PER_THREAD = 200;
+    {
+        tree b(PATH, opts);
+        vector<thread> threads;
+        for(int t = 0; t < NUM_THREADS; ++t) {
+            threads.push_back(thread([&b, t]() {
+                for(int i = 0; i < NUM_PER_THREAD; ++i)
+                    b.insert(t * NUM_PER_THREAD + i, i);
+            }));
+        }
+        for(auto &t : threads)
+            t.join();
+        wal_stats st = b.stats();
+        assert( st.records_ == NUM_THREADS * NUM_PER_THREAD );
+        assert( st.syncs_ < st.records_ / 2 );
+    }
+    tree b(PATH, opts);
+    assert( b.size() == NUM_THREADS * NUM_PER_THREAD );
+    removeFiles();
+}
+
+// a checkpoint of several chunks loads back, a damaged one is refused
+void testLargeCheckpoint() {
+    removeFiles();
+    wal_options opts;
+    opts.syncCommit_ = false;
+    opts.checkpointBytes_ = 0;
+    const int N = 300000;
+    map<int, long> m;
+    {
+        tree b(PATH, opts);
+        for(int k = 0; k < N; ++k) {
+            b.insert(k, k * 7L);
+            m.insert(make_pair(k, k * 7L));
+        }
+        b.checkpoint();
+    }
+    {
+        tree b(PATH, opts);
+        assert( b.stats().replayed_ == 0 );
+        compare(b, m, N);
+    }
+
+    // flip one byte in the middle of the pairs
+    FILE* f = fopen("test_btree_wal.db.ckpt", "r+b");
+    assert( f );
+    fseek(f, N * 8L, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, N * 8L, SEEK_SET);
+    fputc(c ^ 1, f);
+    fclose(f);
+    bool thrown = false;
+    try {
+        tree b(PATH, opts);
+    } catch(const runtime_error &) {
+        thrown = true;
+    }
+    assert( thrown );
+
+    // cut off the end of the file
+    assert( truncate("test_btree_wal.db.ckpt", N * 16L) == 0 );
+    thrown = false;
+    try {
+        tree b(PATH, opts);
+    } catch(const runtime_error &) {
+        thrown = true;
+    }
+    assert( thrown );
+    removeFiles();
+}
+
+// a group cut short by a write error is rewritten in place, not behind
+// the torn bytes, so no record after it is lost on reopen
+void testPartialWrite() {
+    removeFiles();
+    wal_options opts;
+    opts.syncCommit_ = false;
+    opts.checkpointBytes_ = 0;
+    map<int, long> m;
+    {
+        tree b(PATH, opts);
+        for(int k = 0; k < 100; ++k) {
+            b.insert(k, k);
+            m.insert(make_pair(k, static_cast<long>(k)));
+        }
+        b.sync();
+        struct stat st;
+        assert( stat("test_btree_wal.db.wal", &st) == 0 );
+        for(int k = 100; k < 300; ++k) {
+            b.insert(k, k);
+            m.insert(make_pair(k, static_cast<long>(k)));
+        }
+
+        // the file may grow by half a group only
+        signal(SIGXFSZ, SIG_IGN);
+        struct rlimit old, lim;
+        assert( getrlimit(RLIMIT_FSIZE, &old) == 0 );
+        lim = old;
+        lim.rlim_cur = st.st_size + 1001;
+        assert( setrlimit(RLIMIT_FSIZE, &lim) == 0 );
+        bool thrown = false;
+        try {
+            b.sync();
+        } catch(const system_error &) {
+            thrown = true;
+        }
+        assert( setrlimit(RLIMIT_FSIZE, &old) == 0 );
+        assert( thrown );
+        b.sync();
+        for(int k = 300; k < 400; ++k) {
+            b.insert(k, k);
+            m.insert(make_pair(k, static_cast<long>(k)));
+        }
+    }
+    tree b(PATH, opts);
+    compare(b, m, 400);
+    removeFiles();
+}
+
+int main() {
+    wal_options opts;
+    testReopen(opts);
+    // batched syncs and frequent checkpoints
+    opts.syncCommit_ = false;
+    opts.syncBytes_ = 4096;
+    opts.checkpointBytes_ = 32 << 10;
+    testReopen(opts);
+    testCrash();
+    testGroupCommit();
+    testLargeCheckpoint();
+    testPartialWrite();
+
+    cout << "-- Test Pass --" << endl;
+    return 0;
+}
@@ -1,8 +1,13 @@
 #include "bst.hpp"
 #include "rbt.hpp"
 #include<cstddef>
+#include <cassert>
 #include <iostream>
 #include<cstdlib>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
 
 using namespace std;
 
@@ -61,7 +66,223 @@ void testTree() {
     }
 }
 
+// the tree iterates exactly the values of s in order
+template<typename T>
+void compare(const T &t, const set<int> &s) {
+    assert( t.size() == s.size() );
+    typename T::iterator itr = t.begin();
+    for(int v : s) {
+        assert( itr != t.end() && *itr == v );
+        itr++;
+    }
+    assert( itr == t.end() );
+}
+
+// random inserts and erases of distinct values against std::set, for
+// every allocator and node layout
+template<typename T>
+void testRBT(int range, int ops) {
+    T t;
+    set<int> s;
+    mt19937 rng(range);
+    for(int i = 0; i < ops; ++i) {
+        int v = rng() % range;
+        typename T::iterator itr = t.find(v);
+        if( itr == t.end() ) {
+            assert( s.count(v) == 0 );
+            t.insert(v);
+            s.insert(v);
+        } else {
+            assert( *itr == v && s.count(v) == 1 );
+            t.erase(itr);
+            s.erase(v);
+        }
+    }
+    compare(t, s);
+
+    // copies own their nodes
+    T c(t);
+    compare(c, s);
+    T a;
+    a.insert(-1);
+    a = t;
+    compare(a, s);
+    while( !t.empty() )
+        t.erase(t.begin());
+    compare(t, set<int>());
+    compare(c, s);
+    compare(a, s);
+    // released nodes are reused
+    for(int v = 0; v < range; v += 3)
+        t.insert(v);
+    assert( t.size() == static_cast<size_t>((range + 2) / 3) );
+}
+
+// rank, select and count_range against a sorted copy while duplicates
+// are inserted and values erased, the counts must survive every rotation
+template<typename T>
+void testOrderStatistics(int range, int ops) {
+    T t;
+    multiset<int> s;
+    mt19937 rng(range + 1);
+    for(int i = 0; i < ops; ++i) {
+        int v = rng() % range;
+        typename T::iterator itr = t.find(v);
+        if( itr == t.end() || rng() % 2 ) {
+            t.insert(v);
+            s.insert(v);
+        } else {
+            t.erase(itr);
+            s.erase(s.find(v));
+        }
+        if( i % (ops / 10) )
+            continue;
+        vector<int> sorted(s.begin(), s.end());
+        for(int x = -1; x <= range; ++x)
+            assert( t.rank(x) == static_cast<size_t>(lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin()) );
+        for(size_t k = 0; k < sorted.size(); ++k)
+            assert( *t.select(k) == sorted[k] );
+        assert( t.select(sorted.size()) == t.end() );
+        for(int j = 0; j < 100; ++j) {
+            int lo = rng() % range, hi = lo + rng() % 50;
+            assert( t.count_range(lo, hi) == static_cast<size_t>(distance(s.lower_bound(lo), s.lower_bound(hi))) );
+            assert( t.count_range(hi, lo) == 0 || lo == hi );
+        }
+    }
+
+    // iterate from a selected element to the end, copies keep the counts
+    T c(t);
+    vector<int> sorted(s.begin(), s.end());
+    size_t k = sorted.size() / 2;
+    for(typename T::iterator itr = c.select(k); itr != c.end(); ++itr)
+        assert( *itr == sorted[k++] );
+    assert( k == sorted.size() );
+    assert( c.count_range(-1, range) == sorted.size() );
+}
+
+// join, split and the set operations against std::set, the large runs
+// fork onto several threads
+template<typename T>
+void testSetOperations(int n, int range, unsigned int threads) {
+    mt19937 rng(n + threads);
+    for(int op = 0; op < 3; ++op) {
+        T a, b;
+        set<int> sa, sb, r;
+        for(int i = 0; i < n; ++i) {
+            int v = rng() % range;
+            if( sa.insert(v).second )
+                a.insert(v);
+            v = rng() % range;
+            if( sb.insert(v).second )
+                b.insert(v);
+        }
+        if( op == 0 ) {
+            a.set_union(b, threads);
+            r = sa;
+            r.insert(sb.begin(), sb.end());
+        } else if( op == 1 ) {
+            a.set_intersection(b, threads);
+            for(int v : sa)
+                if( sb.count(v) )
+                    r.insert(v);
+        } else {
+            a.set_difference(b, threads);
+            for(int v : sa)
+                if( !sb.count(v) )
+                    r.insert(v);
+        }
+        compare(a, r);
+        compare(b, set<int>());
+        // the emptied tree is still usable
+        b.insert(1);
+        assert( b.size() == 1 );
+
+        // split in the middle and join back
+        int key = range / 2;
+        T hi;
+        hi.insert(-1);
+        a.split(key, hi);
+        compare(a, set<int>(r.begin(), r.lower_bound(key)));
+        compare(hi, set<int>(r.lower_bound(key), r.end()));
+        a.join(hi);
+        compare(a, r);
+        assert( hi.empty() );
+    }
+
+    // the tree of a set operation is as good as an inserted one
+    T a, b;
+    for(int v = 0; v < n; ++v)
+        (v % 2 ? a : b).insert(v);
+    a.set_union(b, threads);
+    for(int v = 0; v < n; v += 7)
+        assert( a.find(v) != a.end() );
+    while( a.size() > static_cast<size_t>(n / 2) )
+        a.erase(a.begin());
+    assert( *a.begin() == n - n / 2 );
+}
+
+// merge two trees back and forth, with splits in between. The pools pass
+// their chunks on instead of piling up references to them, so every
+// step stays as cheap as the first
+template<typename T>
+void testMergeBackAndForth(int n, int steps) {
+    T a, b;
+    set<int> s;
+    for(int v = 0; v < n; ++v) {
+        a.insert(v * 2);
+        s.insert(v * 2);
+    }
+    for(int i = 0; i < steps; ++i) {
+        b.insert(i * 2 + 1);
+        s.insert(i * 2 + 1);
+        b.set_union(a, 1);
+        a.set_union(b, 1);
+        a.split(n, b);
+        a.join(b);
+        assert( b.empty() );
+    }
+    compare(a, s);
+}
+
+// copies and rebound copies of a pool compare equal and release each
+// other's nodes, separately constructed pools do not compare equal
+void testPoolAllocator() {
+    rbt_pool_allocator<int> a;
+    rbt_pool_allocator<int> c(a);
+    rbt_pool_allocator<long> la(a), lc(c);
+    rbt_pool_allocator<int> other;
+    assert( a == c && la == a && la == lc );
+    assert( a != other );
+    rbt_share_nodes(c, a);
+    rbt_adopt_nodes(c, a);
+    long* p = la.allocate(1);
+    *p = 42;
+    lc.deallocate(p, 1);
+    assert( lc.allocate(1) == p );
+    int* q = other.allocate(1);
+    rbt_adopt_nodes(a, other);
+    c.deallocate(q, 1);
+    assert( a.allocate(1) == q );
+}
+
 int main() {
+    testPoolAllocator();
+    testRBT<RBT<int> >(1000, 20000);
+    testRBT<RBT<int, rbt_pool_allocator<int>, rbt_packed_traits> >(1000, 20000);
+    testRBT<RBT<int, std::allocator<int> > >(1000, 20000);
+    testRBT<RBT<int, std::allocator<int>, rbt_packed_traits> >(100000, 200000);
+    testRBT<RBT<int, rbt_pool_allocator<int>, rbt_packed_traits> >(100000, 200000);
+    assert( sizeof(RBT<int, rbt_pool_allocator<int>, rbt_packed_traits>::TreeNode) < sizeof(RBT<int>::TreeNode) );
+    testRBT<RBT<int, rbt_pool_allocator<int>, rbt_counted_traits> >(1000, 20000);
+    testOrderStatistics<RBT<int, rbt_pool_allocator<int>, rbt_counted_traits> >(100, 5000);
+    testOrderStatistics<RBT<int, std::allocator<int>, rbt_counted_traits> >(2000, 20000);
+    testSetOperations<RBT<int> >(100, 300, 1);
+    testSetOperations<RBT<int, rbt_pool_allocator<int>, rbt_packed_traits> >(5000, 8000, 2);
+    testSetOperations<RBT<int, std::allocator<int> > >(5000, 8000, 4);
+    testSetOperations<RBT<int, rbt_pool_allocator<int>, rbt_counted_traits> >(100000, 150000, 4);
+    testMergeBackAndForth<RBT<int> >(1000, 200);
+    testMergeBackAndForth<RBT<int, std::allocator<int> > >(1000, 50);
+
     srand((unsigned int)time(NULL));
     cout << "Test BST<int>\n";
     testTree<BST<int> >();